@@ -389,6 +389,12 @@
 #define __NR_inotify_init1		(__NR_SYSCALL_BASE+360)
 #define __NR_preadv			(__NR_SYSCALL_BASE+361)
 #define __NR_pwritev			(__NR_SYSCALL_BASE+362)
+#define __NR_epoll_wait_ring		(__NR_SYSCALL_BASE+363)
+#define __NR_io_ring_setup		(__NR_SYSCALL_BASE+364)
+#define __NR_io_ring_enter		(__NR_SYSCALL_BASE+365)
+#define __NR_io_ring_register		(__NR_SYSCALL_BASE+366)
+#define __NR_fanotify_init		(__NR_SYSCALL_BASE+367)
+#define __NR_fanotify_mark		(__NR_SYSCALL_BASE+368)
 
 /*
  * The following SWIs are ARM private.
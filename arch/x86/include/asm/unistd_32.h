@@ -340,6 +340,12 @@
 #define __NR_inotify_init1	332
 #define __NR_preadv		333
 #define __NR_pwritev		334
+#define __NR_epoll_wait_ring	335
+#define __NR_io_ring_setup	336
+#define __NR_io_ring_enter	337
+#define __NR_io_ring_register	338
+#define __NR_fanotify_init	339
+#define __NR_fanotify_mark	340
 
 #ifdef __KERNEL__
 
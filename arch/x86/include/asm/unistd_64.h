@@ -657,6 +657,18 @@ __SYSCALL(__NR_inotify_init1, sys_inotify_init1)
 __SYSCALL(__NR_preadv, sys_preadv)
 #define __NR_pwritev				296
 __SYSCALL(__NR_pwritev, sys_pwritev)
+#define __NR_epoll_wait_ring			297
+__SYSCALL(__NR_epoll_wait_ring, sys_epoll_wait_ring)
+#define __NR_io_ring_setup			298
+__SYSCALL(__NR_io_ring_setup, sys_io_ring_setup)
+#define __NR_io_ring_enter			299
+__SYSCALL(__NR_io_ring_enter, sys_io_ring_enter)
+#define __NR_io_ring_register			300
+__SYSCALL(__NR_io_ring_register, sys_io_ring_register)
+#define __NR_fanotify_init			301
+__SYSCALL(__NR_fanotify_init, sys_fanotify_init)
+#define __NR_fanotify_mark			302
+__SYSCALL(__NR_fanotify_mark, sys_fanotify_mark)
 
 
 #ifndef __NO_STUBS
@@ -54,6 +54,12 @@
 //#define DPRINTK PRINTK /* set this NULL to avoid verbose debug output */
 #define DPRINTK(x...) do { } while(0)
 
+/*
+ * Most sectors bitmap_start_sync reports as clean in one go.  Resync
+ * code converts the count to bytes in an int, so keep well below that.
+ */
+#define BITMAP_SKIP_MAX (1 << 21)
+
 #ifndef PRINTK
 #  if DEBUG > 0
 #    define PRINTK(x...) printk(KERN_DEBUG x)
@@ -1216,9 +1222,16 @@ static bitmap_counter_t *bitmap_get_counter(struct bitmap *bitmap,
 	unsigned long page = chunk >> PAGE_COUNTER_SHIFT;
 	unsigned long pageoff = (chunk & PAGE_COUNTER_MASK) << COUNTER_BYTE_SHIFT;
 	sector_t csize;
+	int err;
 
-	if (bitmap_checkpage(bitmap, page, create) < 0) {
+	err = bitmap_checkpage(bitmap, page, create);
+	if (err < 0) {
 		csize = ((sector_t)1) << (CHUNK_BLOCK_SHIFT(bitmap));
+		/* nothing is set on a page that was never allocated,
+		 * so report the rest of it if that isn't too much */
+		if (err == -ENOENT &&
+		    (csize << PAGE_COUNTER_SHIFT) <= BITMAP_SKIP_MAX)
+			csize <<= PAGE_COUNTER_SHIFT;
 		*blocks = csize - (offset & (csize- 1));
 		return NULL;
 	}
@@ -1380,6 +1393,20 @@ static int __bitmap_start_sync(struct bitmap *bitmap, sector_t offset, int *bloc
 	return rv;
 }
 
+/* Does the chunk at 'offset' need nothing from resync?  Changes nothing. */
+static int bitmap_chunk_clean(struct bitmap *bitmap, sector_t offset,
+			      int *blocks)
+{
+	bitmap_counter_t *bmc;
+	int clean;
+
+	spin_lock_irq(&bitmap->lock);
+	bmc = bitmap_get_counter(bitmap, offset, blocks, 0);
+	clean = !bmc || (!RESYNC(*bmc) && !NEEDED(*bmc));
+	spin_unlock_irq(&bitmap->lock);
+	return clean;
+}
+
 int bitmap_start_sync(struct bitmap *bitmap, sector_t offset, int *blocks,
 		      int degraded)
 {
@@ -1400,6 +1427,16 @@ int bitmap_start_sync(struct bitmap *bitmap, sector_t offset, int *blocks,
 		offset += blocks1;
 		*blocks += blocks1;
 	}
+	/* Nothing to do here, so take in the clean chunks that follow
+	 * as well and let resync skip all of them in one step rather
+	 * than calling back for every chunk.
+	 */
+	while (!rv && bitmap && *blocks < BITMAP_SKIP_MAX &&
+	       offset < bitmap->mddev->resync_max_sectors &&
+	       bitmap_chunk_clean(bitmap, offset, &blocks1)) {
+		offset += blocks1;
+		*blocks += blocks1;
+	}
 	return rv;
 }
 
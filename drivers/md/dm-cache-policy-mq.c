@@ -0,0 +1,440 @@
+/*
+ * This file is released under the GPL.
+ *
+ * mq cache policy - keeps track of how often origin blocks are hit in
+ * a set of multilevel queues and promotes the blocks that are hit
+ * most often.
+ */
+
+#include <linux/device-mapper.h>
+
+#include "dm-cache-policy.h"
+
+#include <linux/bitops.h>
+#include <linux/hash.h>
+#include <linux/list.h>
+#include <linux/log2.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+
+#define DM_MSG_PREFIX	"cache-policy-mq"
+#define MQ_VERSION	"0.1.0"
+
+/*
+ * A queue is split into NR_LEVELS lists, an entry with hit count h
+ * lives on level fls(h) - 1.  Within a level the least recently hit
+ * entries are at the head.
+ */
+#define NR_LEVELS 16
+#define DEFAULT_PROMOTE_THRESHOLD 4
+
+struct queue {
+	struct list_head levels[NR_LEVELS];
+};
+
+/*
+ * The policy tracks twice as many origin blocks as fit in the cache.
+ * Those that are not cached sit on the pre_cache queue and compete for
+ * promotion, the least hit of them are forgotten to make room for new
+ * ones.
+ */
+struct entry {
+	struct hlist_node hlist;
+	struct list_head list;
+	dm_oblock_t oblock;
+	dm_cblock_t cblock;
+	unsigned hit_count;
+	unsigned in_cache:1;
+};
+
+struct mq_policy {
+	dm_cblock_t cache_size;
+	dm_cblock_t nr_cblocks_allocated;
+	unsigned long *allocated;
+
+	unsigned nr_entries;
+	struct entry *entries;
+	struct list_head free;
+
+	unsigned hash_bits;
+	struct hlist_head *table;
+
+	struct queue pre_cache;
+	struct queue cache;
+
+	unsigned tick;
+	unsigned promote_threshold;
+};
+
+static void queue_init(struct queue *q)
+{
+	unsigned i;
+
+	for (i = 0; i < NR_LEVELS; i++)
+		INIT_LIST_HEAD(q->levels + i);
+}
+
+static unsigned queue_level(struct entry *e)
+{
+	unsigned level = fls(e->hit_count);
+
+	if (level)
+		level--;
+
+	return min(level, (unsigned) NR_LEVELS - 1);
+}
+
+static void queue_push(struct queue *q, struct entry *e)
+{
+	list_add_tail(&e->list, q->levels + queue_level(e));
+}
+
+/* Returns the least recently hit entry on the lowest level */
+static struct entry *queue_coldest(struct queue *q)
+{
+	unsigned i;
+
+	for (i = 0; i < NR_LEVELS; i++)
+		if (!list_empty(q->levels + i))
+			return list_first_entry(q->levels + i, struct entry,
+						list);
+
+	return NULL;
+}
+
+static void requeue(struct mq_policy *mq, struct entry *e)
+{
+	list_del(&e->list);
+	queue_push(e->in_cache ? &mq->cache : &mq->pre_cache, e);
+}
+
+/*
+ * Halve every hit count so that blocks which were hot a long time ago
+ * don't hold on to the cache forever.
+ */
+static void age_queue(struct queue *q)
+{
+	struct list_head all;
+	struct entry *e, *tmp;
+	unsigned i;
+
+	INIT_LIST_HEAD(&all);
+	for (i = 0; i < NR_LEVELS; i++)
+		list_splice_tail_init(q->levels + i, &all);
+
+	list_for_each_entry_safe(e, tmp, &all, list) {
+		e->hit_count >>= 1;
+		queue_push(q, e);
+	}
+}
+
+static void tick(struct mq_policy *mq)
+{
+	if (++mq->tick < mq->nr_entries)
+		return;
+
+	mq->tick = 0;
+	age_queue(&mq->pre_cache);
+	age_queue(&mq->cache);
+}
+
+/*-----------------------------------------------------------------
+ * Hash table of tracked origin blocks
+ *---------------------------------------------------------------*/
+static struct hlist_head *hash_bucket(struct mq_policy *mq, dm_oblock_t oblock)
+{
+	return mq->table + hash_long((unsigned long) oblock, mq->hash_bits);
+}
+
+static struct entry *hash_lookup(struct mq_policy *mq, dm_oblock_t oblock)
+{
+	struct hlist_node *n;
+	struct entry *e;
+
+	hlist_for_each_entry(e, n, hash_bucket(mq, oblock), hlist)
+		if (e->oblock == oblock)
+			return e;
+
+	return NULL;
+}
+
+/*
+ * At most cache_size entries are cached, so there is always a free or
+ * pre_cache entry to hand out.
+ */
+static struct entry *alloc_entry(struct mq_policy *mq, dm_oblock_t oblock)
+{
+	struct entry *e;
+
+	if (!list_empty(&mq->free)) {
+		e = list_first_entry(&mq->free, struct entry, list);
+		list_del(&e->list);
+	} else {
+		e = queue_coldest(&mq->pre_cache);
+		BUG_ON(!e);
+		list_del(&e->list);
+		hlist_del(&e->hlist);
+	}
+
+	e->oblock = oblock;
+	e->hit_count = 0;
+	e->in_cache = 0;
+	hlist_add_head(&e->hlist, hash_bucket(mq, oblock));
+
+	return e;
+}
+
+static int alloc_cblock(struct mq_policy *mq, dm_cblock_t *result)
+{
+	unsigned long b;
+
+	if (mq->nr_cblocks_allocated == mq->cache_size)
+		return -ENOSPC;
+
+	b = find_first_zero_bit(mq->allocated, mq->cache_size);
+	BUG_ON(b >= mq->cache_size);
+	set_bit(b, mq->allocated);
+	mq->nr_cblocks_allocated++;
+	*result = b;
+
+	return 0;
+}
+
+static void free_cblock(struct mq_policy *mq, dm_cblock_t cblock)
+{
+	BUG_ON(!test_bit(cblock, mq->allocated));
+	clear_bit(cblock, mq->allocated);
+	mq->nr_cblocks_allocated--;
+}
+
+static void move_to_cache(struct mq_policy *mq, struct entry *e,
+			  dm_cblock_t cblock)
+{
+	e->cblock = cblock;
+	e->in_cache = 1;
+	requeue(mq, e);
+}
+
+static void move_to_pre_cache(struct mq_policy *mq, struct entry *e)
+{
+	e->in_cache = 0;
+	requeue(mq, e);
+}
+
+/*-----------------------------------------------------------------
+ * Policy interface
+ *---------------------------------------------------------------*/
+static void free_mq(struct mq_policy *mq)
+{
+	vfree(mq->table);
+	vfree(mq->entries);
+	vfree(mq->allocated);
+	kfree(mq);
+}
+
+static int mq_create(struct dm_cache_policy *p, dm_cblock_t cache_size,
+		     unsigned argc, char **argv)
+{
+	struct mq_policy *mq;
+	unsigned i, nr_buckets;
+	size_t len;
+
+	/*
+	 * Arguments: [promote_threshold <n>]
+	 *	<n>: How many more hits than the coldest cached block an
+	 *	     uncached block needs before it replaces it.
+	 */
+	if (argc != 0 && argc != 2)
+		return -EINVAL;
+
+	mq = kzalloc(sizeof(*mq), GFP_KERNEL);
+	if (!mq)
+		return -ENOMEM;
+
+	mq->cache_size = cache_size;
+	mq->promote_threshold = DEFAULT_PROMOTE_THRESHOLD;
+
+	if (argc &&
+	    (strcmp(argv[0], "promote_threshold") ||
+	     sscanf(argv[1], "%u", &mq->promote_threshold) != 1)) {
+		kfree(mq);
+		return -EINVAL;
+	}
+
+	len = BITS_TO_LONGS(cache_size) * sizeof(unsigned long);
+	mq->allocated = vmalloc(len);
+	if (!mq->allocated)
+		goto bad;
+	memset(mq->allocated, 0, len);
+
+	mq->nr_entries = max(2 * cache_size, 16U);
+	mq->entries = vmalloc(sizeof(*mq->entries) * mq->nr_entries);
+	if (!mq->entries)
+		goto bad;
+
+	INIT_LIST_HEAD(&mq->free);
+	for (i = 0; i < mq->nr_entries; i++)
+		list_add_tail(&mq->entries[i].list, &mq->free);
+
+	nr_buckets = roundup_pow_of_two(max(mq->nr_entries / 4, 16U));
+	mq->hash_bits = ilog2(nr_buckets);
+	mq->table = vmalloc(sizeof(*mq->table) * nr_buckets);
+	if (!mq->table)
+		goto bad;
+
+	for (i = 0; i < nr_buckets; i++)
+		INIT_HLIST_HEAD(mq->table + i);
+
+	queue_init(&mq->pre_cache);
+	queue_init(&mq->cache);
+
+	p->context = mq;
+	return 0;
+
+bad:
+	free_mq(mq);
+	return -ENOMEM;
+}
+
+static void mq_destroy(struct dm_cache_policy *p)
+{
+	free_mq(p->context);
+	p->context = NULL;
+}
+
+static void mq_map(struct dm_cache_policy *p, dm_oblock_t oblock,
+		   int may_migrate, struct policy_result *result)
+{
+	struct mq_policy *mq = p->context;
+	struct entry *e, *victim;
+	dm_cblock_t cblock;
+
+	tick(mq);
+
+	e = hash_lookup(mq, oblock);
+	if (!e) {
+		e = alloc_entry(mq, oblock);
+		e->hit_count = 1;
+		queue_push(&mq->pre_cache, e);
+	} else {
+		e->hit_count++;
+		requeue(mq, e);
+	}
+
+	if (e->in_cache) {
+		result->op = POLICY_HIT;
+		result->cblock = e->cblock;
+		return;
+	}
+
+	result->op = POLICY_MISS;
+	if (!may_migrate)
+		return;
+
+	if (!alloc_cblock(mq, &cblock)) {
+		move_to_cache(mq, e, cblock);
+		result->op = POLICY_NEW;
+		result->cblock = cblock;
+		return;
+	}
+
+	victim = queue_coldest(&mq->cache);
+	if (!victim ||
+	    e->hit_count < victim->hit_count + mq->promote_threshold)
+		return;
+
+	result->op = POLICY_REPLACE;
+	result->cblock = victim->cblock;
+	result->old_oblock = victim->oblock;
+
+	move_to_pre_cache(mq, victim);
+	move_to_cache(mq, e, result->cblock);
+}
+
+static int mq_load_mapping(struct dm_cache_policy *p, dm_oblock_t oblock,
+			   dm_cblock_t cblock)
+{
+	struct mq_policy *mq = p->context;
+	struct entry *e;
+
+	if (cblock >= mq->cache_size || test_bit(cblock, mq->allocated))
+		return -EINVAL;
+
+	e = hash_lookup(mq, oblock);
+	if (e && e->in_cache)
+		return -EINVAL;
+
+	if (!e) {
+		e = alloc_entry(mq, oblock);
+		e->hit_count = 1;
+		queue_push(&mq->pre_cache, e);
+	}
+
+	set_bit(cblock, mq->allocated);
+	mq->nr_cblocks_allocated++;
+	move_to_cache(mq, e, cblock);
+
+	return 0;
+}
+
+static void mq_remove_mapping(struct dm_cache_policy *p, dm_oblock_t oblock)
+{
+	struct mq_policy *mq = p->context;
+	struct entry *e = hash_lookup(mq, oblock);
+
+	if (!e || !e->in_cache)
+		return;
+
+	free_cblock(mq, e->cblock);
+	move_to_pre_cache(mq, e);
+}
+
+static int mq_status(struct dm_cache_policy *p, status_type_t type,
+		     char *result, unsigned maxlen)
+{
+	struct mq_policy *mq = p->context;
+	unsigned sz = 0;
+
+	if (type == STATUSTYPE_TABLE)
+		DMEMIT("2 promote_threshold %u", mq->promote_threshold);
+
+	return sz;
+}
+
+static struct dm_cache_policy_type mq_policy_type = {
+	.name		= "mq",
+	.module		= THIS_MODULE,
+	.create		= mq_create,
+	.destroy	= mq_destroy,
+	.map		= mq_map,
+	.load_mapping	= mq_load_mapping,
+	.remove_mapping	= mq_remove_mapping,
+	.status		= mq_status,
+};
+
+static int __init dm_mq_init(void)
+{
+	int r = dm_register_cache_policy(&mq_policy_type);
+
+	if (r < 0)
+		DMERR("register failed %d", r);
+
+	DMINFO("version " MQ_VERSION " loaded");
+
+	return r;
+}
+
+static void __exit dm_mq_exit(void)
+{
+	int r = dm_unregister_cache_policy(&mq_policy_type);
+
+	if (r < 0)
+		DMERR("unregister failed %d", r);
+}
+
+module_init(dm_mq_init);
+module_exit(dm_mq_exit);
+
+MODULE_DESCRIPTION(DM_NAME " mq cache policy");
+MODULE_LICENSE("GPL");
@@ -0,0 +1,122 @@
+/*
+ * This file is released under the GPL.
+ *
+ * Cache policy registration.
+ */
+
+#include <linux/device-mapper.h>
+
+#include "dm-cache-policy.h"
+
+#include <linux/module.h>
+#include <linux/slab.h>
+
+struct policy_internal {
+	struct dm_cache_policy_type type;
+	struct list_head list;
+};
+
+static LIST_HEAD(_policies);
+static DECLARE_RWSEM(_policy_lock);
+
+static struct policy_internal *__find_policy(const char *name)
+{
+	struct policy_internal *pi;
+
+	list_for_each_entry(pi, &_policies, list) {
+		if (!strcmp(name, pi->type.name))
+			return pi;
+	}
+
+	return NULL;
+}
+
+static struct policy_internal *get_policy(const char *name)
+{
+	struct policy_internal *pi;
+
+	down_read(&_policy_lock);
+	pi = __find_policy(name);
+	if (pi && !try_module_get(pi->type.module))
+		pi = NULL;
+	up_read(&_policy_lock);
+
+	return pi;
+}
+
+struct dm_cache_policy_type *dm_get_cache_policy(const char *name)
+{
+	struct policy_internal *pi;
+
+	if (!name)
+		return NULL;
+
+	pi = get_policy(name);
+	if (!pi) {
+		request_module("dm-cache-%s", name);
+		pi = get_policy(name);
+	}
+
+	return pi ? &pi->type : NULL;
+}
+
+void dm_put_cache_policy(struct dm_cache_policy_type *type)
+{
+	struct policy_internal *pi;
+
+	if (!type)
+		return;
+
+	down_read(&_policy_lock);
+	pi = __find_policy(type->name);
+	if (pi)
+		module_put(pi->type.module);
+	up_read(&_policy_lock);
+}
+
+int dm_register_cache_policy(struct dm_cache_policy_type *type)
+{
+	int r = 0;
+	struct policy_internal *pi = kzalloc(sizeof(*pi), GFP_KERNEL);
+
+	if (!pi)
+		return -ENOMEM;
+
+	pi->type = *type;
+
+	down_write(&_policy_lock);
+
+	if (__find_policy(type->name)) {
+		kfree(pi);
+		r = -EEXIST;
+	} else
+		list_add(&pi->list, &_policies);
+
+	up_write(&_policy_lock);
+
+	return r;
+}
+
+int dm_unregister_cache_policy(struct dm_cache_policy_type *type)
+{
+	struct policy_internal *pi;
+
+	down_write(&_policy_lock);
+
+	pi = __find_policy(type->name);
+	if (!pi) {
+		up_write(&_policy_lock);
+		return -EINVAL;
+	}
+
+	list_del(&pi->list);
+
+	up_write(&_policy_lock);
+
+	kfree(pi);
+
+	return 0;
+}
+
+EXPORT_SYMBOL_GPL(dm_register_cache_policy);
+EXPORT_SYMBOL_GPL(dm_unregister_cache_policy);
@@ -0,0 +1,101 @@
+/*
+ * This file is released under the GPL.
+ *
+ * Cache policy registration.
+ */
+
+#ifndef	DM_CACHE_POLICY_H
+#define	DM_CACHE_POLICY_H
+
+#include <linux/device-mapper.h>
+
+typedef sector_t dm_oblock_t;	/* A block on the origin device */
+typedef uint32_t dm_cblock_t;	/* A block on the cache device */
+
+/*
+ * The policy decides which origin blocks are kept on the cache device.
+ * The cache target asks it where each bio should go and it answers
+ * with one of these operations.
+ */
+enum policy_operation {
+	POLICY_HIT,	/* oblock is cached in cblock */
+	POLICY_MISS,	/* oblock isn't cached, use the origin */
+	POLICY_NEW,	/* Promote oblock into the free cblock */
+	POLICY_REPLACE,	/* Demote old_oblock from cblock, promote oblock */
+};
+
+struct policy_result {
+	enum policy_operation op;
+	dm_cblock_t cblock;
+	dm_oblock_t old_oblock;
+};
+
+struct dm_cache_policy_type;
+struct dm_cache_policy {
+	struct dm_cache_policy_type *type;
+	void *context;
+};
+
+/*
+ * Information about a cache policy type.  The target serialises all
+ * calls into a policy and makes them with a spinlock held, so none of
+ * them may block except create and destroy.
+ */
+struct dm_cache_policy_type {
+	char *name;
+	struct module *module;
+
+	/*
+	 * Constructs a policy for a cache of cache_size blocks, takes
+	 * custom arguments.
+	 */
+	int (*create) (struct dm_cache_policy *p, dm_cblock_t cache_size,
+		       unsigned argc, char **argv);
+	void (*destroy) (struct dm_cache_policy *p);
+
+	/*
+	 * Called for every bio.  When may_migrate is clear the target
+	 * can't start a migration and only POLICY_HIT or POLICY_MISS
+	 * may be returned.  The policy's view of the cache changes as
+	 * soon as it returns POLICY_NEW or POLICY_REPLACE; the target
+	 * holds back I/O to the blocks involved until the data is
+	 * copied.
+	 */
+	void (*map) (struct dm_cache_policy *p, dm_oblock_t oblock,
+		     int may_migrate, struct policy_result *result);
+
+	/*
+	 * Tells the policy about a mapping found in the metadata, or
+	 * restores one after a failed demotion.
+	 */
+	int (*load_mapping) (struct dm_cache_policy *p, dm_oblock_t oblock,
+			     dm_cblock_t cblock);
+
+	/*
+	 * Forgets the mapping of oblock and frees its cblock, used when
+	 * a promotion fails.
+	 */
+	void (*remove_mapping) (struct dm_cache_policy *p,
+				dm_oblock_t oblock);
+
+	/*
+	 * Policy arguments, preceded by their count, for STATUSTYPE_TABLE.
+	 * Nothing is reported for STATUSTYPE_INFO.
+	 */
+	int (*status) (struct dm_cache_policy *p, status_type_t type,
+		       char *result, unsigned int maxlen);
+};
+
+/* Register a cache policy */
+int dm_register_cache_policy(struct dm_cache_policy_type *type);
+
+/* Unregister a cache policy */
+int dm_unregister_cache_policy(struct dm_cache_policy_type *type);
+
+/* Returns a registered cache policy type */
+struct dm_cache_policy_type *dm_get_cache_policy(const char *name);
+
+/* Releases a cache policy type */
+void dm_put_cache_policy(struct dm_cache_policy_type *type);
+
+#endif
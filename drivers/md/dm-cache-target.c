@@ -0,0 +1,1571 @@
+/*
+ * This file is released under the GPL.
+ *
+ * Cache target.  Keeps copies of the most used blocks of a slow origin
+ * device on a fast cache device, such as an SSD.  A pluggable policy
+ * decides which blocks are worth caching.
+ */
+
+#include <linux/device-mapper.h>
+#include <linux/dm-io.h>
+#include <linux/dm-kcopyd.h>
+
+#include "dm-bio-record.h"
+#include "dm-cache-policy.h"
+
+#include <linux/bio.h>
+#include <linux/bitmap.h>
+#include <linux/blkdev.h>
+#include <linux/crc32c.h>
+#include <linux/hash.h>
+#include <linux/init.h>
+#include <linux/list.h>
+#include <linux/mempool.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+
+#define DM_MSG_PREFIX "cache"
+
+/*-----------------------------------------------------------------
+ * On disk format
+ *---------------------------------------------------------------*/
+
+/*
+ * The metadata device is divided into 4k blocks.  Block 0 is the
+ * superblock, the following blocks hold an array with one entry per
+ * cache block giving the origin block it holds.  Entries are updated
+ * in place.
+ *
+ * A cache block is only reused for another origin block after its old
+ * entry has been invalidated on disk, so an entry never points at the
+ * wrong data.  Whether a block is dirty is only written out when the
+ * cache is suspended, at which point the superblock is flagged as
+ * cleanly shut down.  If that flag is missing when the cache is
+ * resumed every cached block is treated as dirty.
+ *
+ * A blank metadata device is formatted.
+ */
+#define CACHE_MAGIC 0x68636143		/* "Cach" */
+#define CACHE_DISK_VERSION 1
+
+#define METADATA_BLOCK_SHIFT 12
+#define METADATA_BLOCK_SIZE (1 << METADATA_BLOCK_SHIFT)
+#define METADATA_BLOCK_SECTORS (METADATA_BLOCK_SIZE >> SECTOR_SHIFT)
+
+#define SB_CLEAN_SHUTDOWN 1
+
+#define M_VALID 1
+#define M_DIRTY 2
+
+struct disk_superblock {
+	__le32 csum;		/* crc32c of the rest of the block */
+	__le32 magic;
+	__le32 version;
+	__le32 flags;
+
+	__le64 block_size;	/* In sectors */
+	__le64 nr_cblocks;
+} __attribute__ ((packed));
+
+struct disk_mapping {
+	__le64 oblock;
+	__le64 flags;
+} __attribute__ ((packed));
+
+#define MAPPINGS_PER_BLOCK (METADATA_BLOCK_SIZE / sizeof(struct disk_mapping))
+
+/*-----------------------------------------------------------------
+ * In core structures
+ *---------------------------------------------------------------*/
+#define MIN_BLOCK_SIZE 64		/* 32KB */
+#define MAX_BLOCK_SIZE (1 << 21)	/* 1GB */
+#define COMMIT_PERIOD HZ
+#define MIN_HOOKS 256
+#define MIN_DETAILS 16
+#define MAX_MIGRATIONS 64
+#define CLEAN_BATCH 16
+#define NR_BUCKET_BITS 10
+#define CACHE_IO_PAGES 64
+#define CACHE_COPY_PAGES (((1UL << 20) >> PAGE_SHIFT) ? : 1)
+
+static struct kmem_cache *_hook_cache;
+static struct kmem_cache *_migration_cache;
+
+/*
+ * Every bio gets a hook, kept in map_context->ptr, that records what
+ * has to be undone when it completes.
+ */
+#define HOOK_CACHE 1		/* Counted in in_flight[cblock] */
+#define HOOK_ORIGIN_WRITE 2	/* Counted in the oblock's bucket */
+#define HOOK_WRITETHROUGH 4	/* Write the cache once the origin is done */
+#define HOOK_CACHE_LEG 8	/* ... and now writing the cache */
+
+struct bio_hook {
+	unsigned flags;
+	dm_cblock_t cblock;
+	dm_oblock_t oblock;	/* Only for HOOK_CACHE_LEG */
+	unsigned bucket;
+	struct dm_bio_details *details;
+};
+
+/*
+ * A migration moves data between the devices for the policy.  Bios for
+ * either origin block involved wait on it until it has finished.
+ */
+enum migration_type {
+	MG_PROMOTE,	/* Copy oblock into a free cblock */
+	MG_REPLACE,	/* Demote old_oblock from cblock, then promote */
+	MG_CLEAN,	/* Write a dirty cblock back to its origin block */
+};
+
+enum migration_stage {
+	MG_QUIESCE,
+	MG_WRITEBACK,
+	MG_INVALIDATE,
+	MG_COPY,
+};
+
+struct cache;
+struct migration {
+	struct list_head list;		/* cache->migrations */
+	struct list_head stage_list;	/* Work queued for the worker */
+	struct cache *cache;
+
+	enum migration_type type;
+	enum migration_stage stage;
+	dm_oblock_t oblock;
+	dm_oblock_t old_oblock;
+	dm_cblock_t cblock;
+	int err;
+
+	struct bio_list bios;
+};
+
+struct cache {
+	struct dm_target *ti;
+	struct dm_dev *metadata_dev;
+	struct dm_dev *cache_dev;
+	struct dm_dev *origin_dev;
+
+	sector_t block_size;
+	unsigned block_shift;
+	dm_oblock_t nr_oblocks;
+	dm_cblock_t nr_cblocks;
+	int writethrough;
+
+	struct dm_cache_policy policy;
+
+	spinlock_t lock;
+	struct bio_list deferred_barriers;
+	struct bio_list writethrough_bios;
+	struct bio_list failed_writethrough_bios;
+	struct list_head migrations;
+	struct list_head quiescing;
+	struct list_head completed;
+	struct list_head need_commit;	/* Only touched by the worker */
+	struct bio_list need_commit_bios;	/* ... as is this */
+	unsigned nr_migrations;
+	unsigned nr_quiescing;
+	struct migration *spare_migration;
+	wait_queue_head_t migration_wait;
+
+	atomic_t *in_flight;
+	atomic_t buckets[1 << NR_BUCKET_BITS];
+	unsigned long *dirty;
+	dm_cblock_t nr_dirty;
+	dm_cblock_t nr_valid;
+	dm_cblock_t clean_cursor;
+
+	/*
+	 * The metadata is only touched by the worker and waker, which
+	 * share a single threaded workqueue, and while suspended.
+	 */
+	int loaded;
+	int clean_shutdown;
+	struct disk_superblock *sb_buf;
+	struct disk_mapping *mappings;
+	unsigned nr_map_blocks;
+	unsigned long *dirty_meta;
+
+	struct dm_io_client *io_client;
+	struct dm_kcopyd_client *copier;
+	mempool_t *hook_pool;
+	mempool_t *details_pool;
+	mempool_t *migration_pool;
+
+	struct workqueue_struct *wq;
+	struct work_struct worker;
+	struct delayed_work waker;
+
+	/* Statistics, protected by lock */
+	unsigned long read_hit;
+	unsigned long read_miss;
+	unsigned long write_hit;
+	unsigned long write_miss;
+	unsigned long demotion;
+	unsigned long promotion;
+	unsigned long writeback;
+};
+
+/*-----------------------------------------------------------------
+ * Metadata
+ *---------------------------------------------------------------*/
+static int superblock_io(struct cache *cache, int rw)
+{
+	struct dm_io_region region = {
+		.bdev = cache->metadata_dev->bdev,
+		.sector = 0,
+		.count = METADATA_BLOCK_SECTORS,
+	};
+	struct dm_io_request io_req = {
+		.bi_rw = rw,
+		.mem.type = DM_IO_KMEM,
+		.mem.ptr.addr = cache->sb_buf,
+		.notify.fn = NULL,
+		.client = cache->io_client,
+	};
+
+	return dm_io(&io_req, 1, &region, NULL);
+}
+
+static int mappings_io(struct cache *cache, unsigned block, unsigned count,
+		       int rw)
+{
+	struct dm_io_region region = {
+		.bdev = cache->metadata_dev->bdev,
+		.sector = (sector_t) (block + 1) * METADATA_BLOCK_SECTORS,
+		.count = (sector_t) count * METADATA_BLOCK_SECTORS,
+	};
+	struct dm_io_request io_req = {
+		.bi_rw = rw,
+		.mem.type = DM_IO_VMA,
+		.mem.ptr.vma = (char *) cache->mappings +
+			       ((size_t) block << METADATA_BLOCK_SHIFT),
+		.notify.fn = NULL,
+		.client = cache->io_client,
+	};
+
+	return dm_io(&io_req, 1, &region, NULL);
+}
+
+static int flush_device(struct block_device *bdev)
+{
+	int r = blkdev_issue_flush(bdev, NULL);
+
+	return r == -EOPNOTSUPP ? 0 : r;
+}
+
+static u32 superblock_csum(struct disk_superblock *sb)
+{
+	return crc32c(~(u32) 0, &sb->magic,
+		      METADATA_BLOCK_SIZE - sizeof(sb->csum));
+}
+
+static int superblock_valid(struct disk_superblock *sb)
+{
+	return le32_to_cpu(sb->magic) == CACHE_MAGIC &&
+		le32_to_cpu(sb->version) == CACHE_DISK_VERSION &&
+		le32_to_cpu(sb->csum) == superblock_csum(sb);
+}
+
+static int block_is_zero(void *data)
+{
+	unsigned long *p = data;
+	unsigned i;
+
+	for (i = 0; i < METADATA_BLOCK_SIZE / sizeof(*p); i++)
+		if (p[i])
+			return 0;
+
+	return 1;
+}
+
+static void set_mapping(struct cache *cache, dm_cblock_t cblock,
+			dm_oblock_t oblock, unsigned flags)
+{
+	struct disk_mapping *m = cache->mappings + cblock;
+
+	m->oblock = cpu_to_le64(oblock);
+	m->flags = cpu_to_le64(flags);
+	set_bit(cblock / MAPPINGS_PER_BLOCK, cache->dirty_meta);
+}
+
+static dm_oblock_t get_mapping(struct cache *cache, dm_cblock_t cblock)
+{
+	return le64_to_cpu(cache->mappings[cblock].oblock);
+}
+
+/*
+ * Dirty bits change with every write, they are only brought up to
+ * date when the cache shuts down cleanly.
+ */
+static void sync_dirty_flags(struct cache *cache)
+{
+	struct disk_mapping *m;
+	dm_cblock_t cblock;
+	unsigned flags;
+
+	for (cblock = 0; cblock < cache->nr_cblocks; cblock++) {
+		m = cache->mappings + cblock;
+		if (!(le64_to_cpu(m->flags) & M_VALID))
+			continue;
+
+		flags = M_VALID;
+		if (test_bit(cblock, cache->dirty))
+			flags |= M_DIRTY;
+
+		if (le64_to_cpu(m->flags) != flags)
+			set_mapping(cache, cblock, le64_to_cpu(m->oblock),
+				    flags);
+	}
+}
+
+static int write_superblock(struct cache *cache, int clean)
+{
+	struct disk_superblock *sb = cache->sb_buf;
+	int r;
+
+	memset(sb, 0, METADATA_BLOCK_SIZE);
+	sb->magic = cpu_to_le32(CACHE_MAGIC);
+	sb->version = cpu_to_le32(CACHE_DISK_VERSION);
+	sb->flags = cpu_to_le32(clean ? SB_CLEAN_SHUTDOWN : 0);
+	sb->block_size = cpu_to_le64(cache->block_size);
+	sb->nr_cblocks = cpu_to_le64(cache->nr_cblocks);
+	sb->csum = cpu_to_le32(superblock_csum(sb));
+
+	r = superblock_io(cache, WRITE);
+	if (!r)
+		r = flush_device(cache->metadata_dev->bdev);
+
+	return r;
+}
+
+/*
+ * Write out the changed parts of the mapping array.  With clean set
+ * the dirty bits are included and the superblock is marked as cleanly
+ * shut down.
+ */
+static int commit_metadata(struct cache *cache, int clean)
+{
+	unsigned b, e, nr = cache->nr_map_blocks;
+	int r;
+
+	if (clean)
+		sync_dirty_flags(cache);
+
+	b = find_first_bit(cache->dirty_meta, nr);
+	if (b < nr) {
+		/*
+		 * Freshly promoted data must reach the cache device
+		 * before the entries pointing at it.
+		 */
+		r = flush_device(cache->cache_dev->bdev);
+		if (r)
+			return r;
+
+		while (b < nr) {
+			e = find_next_zero_bit(cache->dirty_meta, nr, b);
+			r = mappings_io(cache, b, e - b, WRITE);
+			if (r)
+				return r;
+			b = find_next_bit(cache->dirty_meta, nr, e);
+		}
+
+		r = flush_device(cache->metadata_dev->bdev);
+		if (r)
+			return r;
+
+		bitmap_zero(cache->dirty_meta, nr);
+	}
+
+	if (clean != cache->clean_shutdown) {
+		r = write_superblock(cache, clean);
+		if (r)
+			return r;
+		cache->clean_shutdown = clean;
+	}
+
+	return 0;
+}
+
+static int cache_commit(struct cache *cache, int clean)
+{
+	int r = commit_metadata(cache, clean);
+
+	if (r)
+		DMERR("metadata commit failed: error = %d", r);
+
+	return r;
+}
+
+static int load_metadata(struct cache *cache)
+{
+	struct disk_superblock *sb = cache->sb_buf;
+	struct disk_mapping *m;
+	dm_cblock_t cblock;
+	dm_oblock_t oblock;
+	unsigned long flags;
+	int r, clean;
+
+	r = superblock_io(cache, READ);
+	if (r)
+		return r;
+
+	if (block_is_zero(sb)) {
+		/* The mapping array starts out zeroed, write all of it */
+		bitmap_fill(cache->dirty_meta, cache->nr_map_blocks);
+		cache->clean_shutdown = 1;
+		return 0;
+	}
+
+	if (!superblock_valid(sb)) {
+		DMERR("superblock is invalid");
+		return -EINVAL;
+	}
+
+	if (le64_to_cpu(sb->block_size) != cache->block_size ||
+	    le64_to_cpu(sb->nr_cblocks) != cache->nr_cblocks) {
+		DMERR("superblock doesn't match the cache geometry");
+		return -EINVAL;
+	}
+
+	clean = le32_to_cpu(sb->flags) & SB_CLEAN_SHUTDOWN;
+
+	r = mappings_io(cache, 0, cache->nr_map_blocks, READ);
+	if (r)
+		return r;
+
+	for (cblock = 0; cblock < cache->nr_cblocks; cblock++) {
+		m = cache->mappings + cblock;
+		if (!(le64_to_cpu(m->flags) & M_VALID))
+			continue;
+
+		oblock = le64_to_cpu(m->oblock);
+		if (oblock >= cache->nr_oblocks) {
+			DMERR("cache block %u maps beyond the origin",
+			      (unsigned) cblock);
+			return -EINVAL;
+		}
+
+		spin_lock_irqsave(&cache->lock, flags);
+		r = cache->policy.type->load_mapping(&cache->policy, oblock,
+						     cblock);
+		spin_unlock_irqrestore(&cache->lock, flags);
+		if (r)
+			return r;
+
+		cache->nr_valid++;
+		if (!clean || (le64_to_cpu(m->flags) & M_DIRTY)) {
+			set_bit(cblock, cache->dirty);
+			cache->nr_dirty++;
+		}
+	}
+
+	cache->clean_shutdown = clean;
+
+	return 0;
+}
+
+/*-----------------------------------------------------------------
+ * Bio mapping
+ *---------------------------------------------------------------*/
+static void wake_worker(struct cache *cache)
+{
+	queue_work(cache->wq, &cache->worker);
+}
+
+static dm_oblock_t get_bio_block(struct cache *cache, struct bio *bio)
+{
+	return (bio->bi_sector - cache->ti->begin) >> cache->block_shift;
+}
+
+static unsigned oblock_bucket(dm_oblock_t oblock)
+{
+	return hash_long((unsigned long) oblock, NR_BUCKET_BITS);
+}
+
+static void remap_to_origin(struct cache *cache, struct bio *bio)
+{
+	bio->bi_bdev = cache->origin_dev->bdev;
+	bio->bi_sector = bio->bi_sector - cache->ti->begin;
+}
+
+static void remap_to_cache(struct cache *cache, struct bio *bio,
+			   dm_cblock_t cblock)
+{
+	sector_t offset = bio->bi_sector - cache->ti->begin;
+
+	bio->bi_bdev = cache->cache_dev->bdev;
+	bio->bi_sector = ((sector_t) cblock << cache->block_shift) +
+			 (offset & (cache->block_size - 1));
+}
+
+static struct migration *find_migration(struct cache *cache,
+					dm_oblock_t oblock)
+{
+	struct migration *mg;
+
+	list_for_each_entry(mg, &cache->migrations, list)
+		if (mg->oblock == oblock ||
+		    (mg->type != MG_PROMOTE && mg->old_oblock == oblock))
+			return mg;
+
+	return NULL;
+}
+
+static int cblock_migrating(struct cache *cache, dm_cblock_t cblock)
+{
+	struct migration *mg;
+
+	list_for_each_entry(mg, &cache->migrations, list)
+		if (mg->cblock == cblock)
+			return 1;
+
+	return 0;
+}
+
+/*
+ * Called with the lock held.  The migration waits until no bio is in
+ * flight to the blocks it touches.
+ */
+static void __queue_migration(struct cache *cache, struct migration *mg)
+{
+	mg->cache = cache;
+	mg->stage = MG_QUIESCE;
+	mg->err = 0;
+
+	list_add(&mg->list, &cache->migrations);
+	list_add_tail(&mg->stage_list, &cache->quiescing);
+	cache->nr_migrations++;
+	cache->nr_quiescing++;
+}
+
+/*
+ * Decides where a bio goes.  Returns DM_MAPIO_SUBMITTED if it was
+ * queued on a migration, may_migrate is cleared for bios coming back
+ * from one.
+ */
+static int map_bio(struct cache *cache, struct bio *bio,
+		   struct bio_hook *hook, int may_migrate)
+{
+	dm_oblock_t oblock = get_bio_block(cache, bio);
+	int write = bio_data_dir(bio) == WRITE;
+	struct policy_result result;
+	struct migration *mg;
+	unsigned long flags;
+
+	hook->flags = 0;
+
+	spin_lock_irqsave(&cache->lock, flags);
+
+	mg = find_migration(cache, oblock);
+	if (mg) {
+		bio_list_add(&mg->bios, bio);
+		spin_unlock_irqrestore(&cache->lock, flags);
+		return DM_MAPIO_SUBMITTED;
+	}
+
+	/*
+	 * The policy commits to a migration as soon as it suggests one,
+	 * so make sure there is one to hand beforehand.
+	 */
+	if (cache->nr_migrations >= MAX_MIGRATIONS)
+		may_migrate = 0;
+	if (may_migrate && !cache->spare_migration)
+		cache->spare_migration = mempool_alloc(cache->migration_pool,
+						       GFP_ATOMIC);
+	if (!cache->spare_migration)
+		may_migrate = 0;
+
+	cache->policy.type->map(&cache->policy, oblock, may_migrate, &result);
+
+	switch (result.op) {
+	case POLICY_HIT:
+		if (write)
+			cache->write_hit++;
+		else
+			cache->read_hit++;
+
+		hook->flags = HOOK_CACHE;
+		hook->cblock = result.cblock;
+		atomic_inc(cache->in_flight + result.cblock);
+
+		if (write && !cache->writethrough &&
+		    !test_and_set_bit(result.cblock, cache->dirty))
+			cache->nr_dirty++;
+		break;
+
+	case POLICY_MISS:
+		if (write) {
+			cache->write_miss++;
+			hook->flags = HOOK_ORIGIN_WRITE;
+			hook->bucket = oblock_bucket(oblock);
+			atomic_inc(cache->buckets + hook->bucket);
+		} else
+			cache->read_miss++;
+		break;
+
+	case POLICY_NEW:
+	case POLICY_REPLACE:
+		if (write)
+			cache->write_miss++;
+		else
+			cache->read_miss++;
+
+		mg = cache->spare_migration;
+		cache->spare_migration = NULL;
+
+		mg->type = result.op == POLICY_NEW ? MG_PROMOTE : MG_REPLACE;
+		mg->oblock = oblock;
+		mg->old_oblock = result.old_oblock;
+		mg->cblock = result.cblock;
+		bio_list_init(&mg->bios);
+		bio_list_add(&mg->bios, bio);
+		__queue_migration(cache, mg);
+
+		spin_unlock_irqrestore(&cache->lock, flags);
+		wake_worker(cache);
+		return DM_MAPIO_SUBMITTED;
+	}
+
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	if (!(hook->flags & HOOK_CACHE))
+		remap_to_origin(cache, bio);
+	else if (write && cache->writethrough) {
+		/* Recorded before remapping so end_io can find the cblock */
+		hook->details = mempool_alloc(cache->details_pool, GFP_NOIO);
+		dm_bio_record(hook->details, bio);
+		hook->flags |= HOOK_WRITETHROUGH;
+		remap_to_origin(cache, bio);
+	} else
+		remap_to_cache(cache, bio, hook->cblock);
+
+	return DM_MAPIO_REMAPPED;
+}
+
+static void process_bio(struct cache *cache, struct bio *bio)
+{
+	if (map_bio(cache, bio, dm_get_mapinfo(bio)->ptr, 0) ==
+	    DM_MAPIO_REMAPPED)
+		generic_make_request(bio);
+}
+
+/*-----------------------------------------------------------------
+ * Migrations
+ *---------------------------------------------------------------*/
+static int migration_quiesced(struct cache *cache, struct migration *mg)
+{
+	if (mg->type != MG_CLEAN &&
+	    atomic_read(cache->buckets + oblock_bucket(mg->oblock)))
+		return 0;
+
+	/*
+	 * A promotion can be given a cblock whose invalidation isn't
+	 * committed yet, after a failed writethrough; the bio holds the
+	 * cblock in in_flight until it is.
+	 */
+	if (atomic_read(cache->in_flight + mg->cblock))
+		return 0;
+
+	return 1;
+}
+
+static void copy_complete(int read_err, unsigned long write_err, void *context)
+{
+	struct migration *mg = context;
+	struct cache *cache = mg->cache;
+	unsigned long flags;
+
+	mg->err = (read_err || write_err) ? -EIO : 0;
+
+	spin_lock_irqsave(&cache->lock, flags);
+	list_add_tail(&mg->stage_list, &cache->completed);
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	wake_worker(cache);
+}
+
+static void copy_block(struct cache *cache, struct migration *mg,
+		       int to_origin)
+{
+	struct dm_io_region o, c;
+
+	o.bdev = cache->origin_dev->bdev;
+	o.sector = (to_origin ? mg->old_oblock : mg->oblock) <<
+		   cache->block_shift;
+	o.count = cache->block_size;
+
+	c.bdev = cache->cache_dev->bdev;
+	c.sector = (sector_t) mg->cblock << cache->block_shift;
+	c.count = cache->block_size;
+
+	if (to_origin)
+		dm_kcopyd_copy(cache->copier, &c, 1, &o, 0, copy_complete, mg);
+	else
+		dm_kcopyd_copy(cache->copier, &o, 1, &c, 0, copy_complete, mg);
+}
+
+static void finish_migration(struct cache *cache, struct migration *mg)
+{
+	struct bio_list bios;
+	struct bio *bio;
+	unsigned long flags;
+
+	bio_list_init(&bios);
+
+	spin_lock_irqsave(&cache->lock, flags);
+	list_del(&mg->list);
+	bio_list_merge(&bios, &mg->bios);
+	if (!--cache->nr_migrations)
+		wake_up(&cache->migration_wait);
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	mempool_free(mg, cache->migration_pool);
+
+	while ((bio = bio_list_pop(&bios)))
+		process_bio(cache, bio);
+}
+
+static void promote(struct cache *cache, struct migration *mg)
+{
+	mg->stage = MG_COPY;
+	copy_block(cache, mg, 0);
+}
+
+/*
+ * The cblock no longer holds anything that isn't on the origin.
+ */
+static void writeback_done(struct cache *cache, struct migration *mg)
+{
+	unsigned long flags;
+
+	if (mg->err) {
+		DMERR_LIMIT("writeback of cache block %u failed",
+			    (unsigned) mg->cblock);
+		if (mg->type == MG_REPLACE) {
+			spin_lock_irqsave(&cache->lock, flags);
+			cache->policy.type->remove_mapping(&cache->policy,
+							   mg->oblock);
+			cache->policy.type->load_mapping(&cache->policy,
+							 mg->old_oblock,
+							 mg->cblock);
+			spin_unlock_irqrestore(&cache->lock, flags);
+		}
+		finish_migration(cache, mg);
+		return;
+	}
+
+	if (mg->stage == MG_WRITEBACK) {
+		spin_lock_irqsave(&cache->lock, flags);
+		clear_bit(mg->cblock, cache->dirty);
+		cache->nr_dirty--;
+		cache->writeback++;
+		spin_unlock_irqrestore(&cache->lock, flags);
+	}
+
+	switch (mg->type) {
+	case MG_CLEAN:
+		finish_migration(cache, mg);
+		break;
+
+	case MG_PROMOTE:
+		promote(cache, mg);
+		break;
+
+	case MG_REPLACE:
+		/* The invalidation is committed before the cblock is reused */
+		set_mapping(cache, mg->cblock, 0, 0);
+		cache->nr_valid--;
+		mg->stage = MG_INVALIDATE;
+		list_add_tail(&mg->stage_list, &cache->need_commit);
+		break;
+	}
+}
+
+static void promotion_done(struct cache *cache, struct migration *mg)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&cache->lock, flags);
+	if (mg->err)
+		cache->policy.type->remove_mapping(&cache->policy, mg->oblock);
+	else
+		cache->promotion++;
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	if (mg->err)
+		DMERR_LIMIT("promotion to cache block %u failed",
+			    (unsigned) mg->cblock);
+	else {
+		set_mapping(cache, mg->cblock, mg->oblock, M_VALID);
+		cache->nr_valid++;
+	}
+
+	finish_migration(cache, mg);
+}
+
+static void start_migration(struct cache *cache, struct migration *mg)
+{
+	if (mg->type != MG_PROMOTE && test_bit(mg->cblock, cache->dirty)) {
+		mg->stage = MG_WRITEBACK;
+		copy_block(cache, mg, 1);
+	} else
+		writeback_done(cache, mg);
+}
+
+static void start_quiesced_migrations(struct cache *cache)
+{
+	struct migration *mg, *tmp;
+	struct list_head ready;
+	unsigned long flags;
+
+	INIT_LIST_HEAD(&ready);
+
+	spin_lock_irqsave(&cache->lock, flags);
+	list_for_each_entry_safe(mg, tmp, &cache->quiescing, stage_list)
+		if (migration_quiesced(cache, mg)) {
+			list_move_tail(&mg->stage_list, &ready);
+			cache->nr_quiescing--;
+		}
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	list_for_each_entry_safe(mg, tmp, &ready, stage_list) {
+		list_del(&mg->stage_list);
+		start_migration(cache, mg);
+	}
+}
+
+static void process_completed_migrations(struct cache *cache)
+{
+	struct migration *mg, *tmp;
+	struct list_head completed;
+	unsigned long flags;
+
+	INIT_LIST_HEAD(&completed);
+
+	spin_lock_irqsave(&cache->lock, flags);
+	list_splice_init(&cache->completed, &completed);
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	list_for_each_entry_safe(mg, tmp, &completed, stage_list) {
+		list_del(&mg->stage_list);
+		if (mg->stage == MG_WRITEBACK)
+			writeback_done(cache, mg);
+		else
+			promotion_done(cache, mg);
+	}
+}
+
+/*
+ * Demotions are batched so that a single commit covers all of them.
+ */
+static void commit_invalidations(struct cache *cache)
+{
+	struct migration *mg, *tmp;
+	struct bio *bio;
+	unsigned long flags;
+	int r;
+
+	if (list_empty(&cache->need_commit) &&
+	    bio_list_empty(&cache->need_commit_bios))
+		return;
+
+	r = cache_commit(cache, 0);
+
+	list_for_each_entry_safe(mg, tmp, &cache->need_commit, stage_list) {
+		list_del(&mg->stage_list);
+
+		spin_lock_irqsave(&cache->lock, flags);
+		if (r)
+			cache->policy.type->remove_mapping(&cache->policy,
+							   mg->oblock);
+		else
+			cache->demotion++;
+		spin_unlock_irqrestore(&cache->lock, flags);
+
+		if (r)
+			finish_migration(cache, mg);
+		else
+			promote(cache, mg);
+	}
+
+	/* Failed writethroughs: the origin holds the data */
+	while ((bio = bio_list_pop(&cache->need_commit_bios))) {
+		if (!r)
+			set_bit(BIO_UPTODATE, &bio->bi_flags);
+		bio_endio(bio, r);
+	}
+}
+
+/*
+ * Queue a few dirty blocks to be written back, so that the cache
+ * doesn't fill up with blocks that can't be demoted cheaply.
+ */
+static void queue_cleaning(struct cache *cache)
+{
+	struct migration *mg;
+	dm_cblock_t cblock;
+	unsigned long flags;
+	unsigned i, queued = 0;
+
+	spin_lock_irqsave(&cache->lock, flags);
+	for (i = 0; i < CLEAN_BATCH && cache->nr_dirty; i++) {
+		if (cache->nr_migrations >= MAX_MIGRATIONS)
+			break;
+
+		cblock = find_next_bit(cache->dirty, cache->nr_cblocks,
+				       cache->clean_cursor);
+		if (cblock >= cache->nr_cblocks) {
+			cache->clean_cursor = 0;
+			break;
+		}
+		cache->clean_cursor = cblock + 1;
+
+		if (cblock_migrating(cache, cblock))
+			continue;
+
+		mg = mempool_alloc(cache->migration_pool, GFP_ATOMIC);
+		if (!mg)
+			break;
+
+		mg->type = MG_CLEAN;
+		mg->oblock = mg->old_oblock = get_mapping(cache, cblock);
+		mg->cblock = cblock;
+		bio_list_init(&mg->bios);
+		__queue_migration(cache, mg);
+		queued++;
+	}
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	if (queued)
+		wake_worker(cache);
+}
+
+/*-----------------------------------------------------------------
+ * Worker
+ *---------------------------------------------------------------*/
+
+/*
+ * Everything written before a barrier may sit on either device, and
+ * the mappings to it may not be committed yet.
+ */
+static void process_deferred_barriers(struct cache *cache)
+{
+	struct bio_list bios;
+	struct bio *bio;
+	unsigned long flags;
+	int r;
+
+	bio_list_init(&bios);
+
+	spin_lock_irqsave(&cache->lock, flags);
+	bio_list_merge(&bios, &cache->deferred_barriers);
+	bio_list_init(&cache->deferred_barriers);
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	if (bio_list_empty(&bios))
+		return;
+
+	r = flush_device(cache->origin_dev->bdev);
+	if (!r)
+		r = cache_commit(cache, 0);
+	if (!r)
+		r = flush_device(cache->cache_dev->bdev);
+
+	while ((bio = bio_list_pop(&bios))) {
+		if (r)
+			bio_endio(bio, r);
+		else
+			process_bio(cache, bio);
+	}
+}
+
+static void process_writethrough_bios(struct cache *cache)
+{
+	struct bio_list bios;
+	struct bio *bio;
+	unsigned long flags;
+
+	bio_list_init(&bios);
+
+	spin_lock_irqsave(&cache->lock, flags);
+	bio_list_merge(&bios, &cache->writethrough_bios);
+	bio_list_init(&cache->writethrough_bios);
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	while ((bio = bio_list_pop(&bios)))
+		generic_make_request(bio);
+}
+
+/*
+ * The cache half of a writethrough write failed, so the cblock no
+ * longer matches the origin.  The policy has already dropped it; the
+ * invalidation is committed like a demotion's before the bio completes
+ * and lets go of the cblock.  This must run before anything else can
+ * commit, so the worker does it first.
+ */
+static void process_failed_writethrough_bios(struct cache *cache)
+{
+	struct bio_list bios;
+	struct bio_hook *hook;
+	struct bio *bio;
+	unsigned long flags;
+
+	bio_list_init(&bios);
+
+	spin_lock_irqsave(&cache->lock, flags);
+	bio_list_merge(&bios, &cache->failed_writethrough_bios);
+	bio_list_init(&cache->failed_writethrough_bios);
+	spin_unlock_irqrestore(&cache->lock, flags);
+
+	while ((bio = bio_list_pop(&bios))) {
+		hook = dm_get_mapinfo(bio)->ptr;
+		DMERR_LIMIT("writethrough to cache block %u failed",
+			    (unsigned) hook->cblock);
+
+		spin_lock_irqsave(&cache->lock, flags);
+		if (test_and_clear_bit(hook->cblock, cache->dirty))
+			cache->nr_dirty--;
+		spin_unlock_irqrestore(&cache->lock, flags);
+
+		set_mapping(cache, hook->cblock, 0, 0);
+		cache->nr_valid--;
+
+		bio_list_add(&cache->need_commit_bios, bio);
+	}
+}
+
+static void do_worker(struct work_struct *ws)
+{
+	struct cache *cache = container_of(ws, struct cache, worker);
+
+	process_failed_writethrough_bios(cache);
+	process_deferred_barriers(cache);
+	process_writethrough_bios(cache);
+	start_quiesced_migrations(cache);
+	process_completed_migrations(cache);
+	commit_invalidations(cache);
+}
+
+/*
+ * Commit periodically so that little is lost in a crash, and keep the
+ * number of dirty blocks down.
+ */
+static void do_waker(struct work_struct *ws)
+{
+	struct cache *cache = container_of(to_delayed_work(ws), struct cache,
+					   waker);
+
+	cache_commit(cache, 0);
+	queue_cleaning(cache);
+
+	queue_delayed_work(cache->wq, &cache->waker, COMMIT_PERIOD);
+}
+
+/*-----------------------------------------------------------------
+ * Target methods
+ *---------------------------------------------------------------*/
+static void cache_free(struct cache *cache)
+{
+	if (cache->wq)
+		destroy_workqueue(cache->wq);
+	if (cache->spare_migration)
+		mempool_free(cache->spare_migration, cache->migration_pool);
+	if (cache->migration_pool)
+		mempool_destroy(cache->migration_pool);
+	if (cache->details_pool)
+		mempool_destroy(cache->details_pool);
+	if (cache->hook_pool)
+		mempool_destroy(cache->hook_pool);
+	if (cache->copier)
+		dm_kcopyd_client_destroy(cache->copier);
+	if (cache->io_client && !IS_ERR(cache->io_client))
+		dm_io_client_destroy(cache->io_client);
+
+	vfree(cache->dirty_meta);
+	vfree(cache->mappings);
+	vfree(cache->dirty);
+	vfree(cache->in_flight);
+	kfree(cache->sb_buf);
+	kfree(cache);
+}
+
+static unsigned long *alloc_bitset(unsigned nr_bits)
+{
+	size_t len = BITS_TO_LONGS(nr_bits) * sizeof(unsigned long);
+	unsigned long *bits = vmalloc(len);
+
+	if (bits)
+		memset(bits, 0, len);
+
+	return bits;
+}
+
+static int cache_alloc_core(struct cache *cache, char **error)
+{
+	dm_cblock_t i;
+	size_t len;
+
+	cache->sb_buf = kmalloc(METADATA_BLOCK_SIZE, GFP_KERNEL);
+	if (!cache->sb_buf) {
+		*error = "Error allocating superblock buffer";
+		return -ENOMEM;
+	}
+
+	cache->in_flight = vmalloc(sizeof(*cache->in_flight) *
+				   cache->nr_cblocks);
+	if (!cache->in_flight) {
+		*error = "Error allocating in flight counters";
+		return -ENOMEM;
+	}
+	for (i = 0; i < cache->nr_cblocks; i++)
+		atomic_set(cache->in_flight + i, 0);
+
+	for (i = 0; i < ARRAY_SIZE(cache->buckets); i++)
+		atomic_set(cache->buckets + i, 0);
+
+	cache->dirty = alloc_bitset(cache->nr_cblocks);
+	cache->dirty_meta = alloc_bitset(cache->nr_map_blocks);
+	if (!cache->dirty || !cache->dirty_meta) {
+		*error = "Error allocating dirty bitsets";
+		return -ENOMEM;
+	}
+
+	len = (size_t) cache->nr_map_blocks << METADATA_BLOCK_SHIFT;
+	cache->mappings = vmalloc(len);
+	if (!cache->mappings) {
+		*error = "Error allocating mapping array";
+		return -ENOMEM;
+	}
+	memset(cache->mappings, 0, len);
+
+	cache->io_client = dm_io_client_create(CACHE_IO_PAGES);
+	if (IS_ERR(cache->io_client)) {
+		*error = "Error creating io client";
+		return PTR_ERR(cache->io_client);
+	}
+
+	if (dm_kcopyd_client_create(CACHE_COPY_PAGES, &cache->copier)) {
+		cache->copier = NULL;
+		*error = "Error creating kcopyd client";
+		return -ENOMEM;
+	}
+
+	cache->hook_pool = mempool_create_slab_pool(MIN_HOOKS, _hook_cache);
+	cache->details_pool = mempool_create_kmalloc_pool(MIN_DETAILS,
+					sizeof(struct dm_bio_details));
+	cache->migration_pool = mempool_create_slab_pool(MAX_MIGRATIONS,
+							 _migration_cache);
+	if (!cache->hook_pool || !cache->details_pool ||
+	    !cache->migration_pool) {
+		*error = "Error creating mempools";
+		return -ENOMEM;
+	}
+
+	cache->wq = create_singlethread_workqueue("kcached");
+	if (!cache->wq) {
+		*error = "Error creating workqueue";
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+/*
+ * cache <metadata dev> <cache dev> <origin dev> <block size (sectors)>
+ *       <#features> [writeback|writethrough]
+ *       <policy> <#policy args> [<policy args>]*
+ */
+static int cache_ctr(struct dm_target *ti, unsigned argc, char **argv)
+{
+	struct cache *cache;
+	struct dm_cache_policy_type *type;
+	unsigned long block_size;
+	unsigned nr_features, nr_policy_args;
+	char **policy_argv;
+	sector_t cache_sectors, meta_sectors;
+	int writethrough = 0;
+	int r;
+
+	if (argc < 7) {
+		ti->error = "Invalid argument count";
+		return -EINVAL;
+	}
+
+	if (sscanf(argv[3], "%lu", &block_size) != 1 ||
+	    block_size < MIN_BLOCK_SIZE || block_size > MAX_BLOCK_SIZE ||
+	    (block_size & (block_size - 1))) {
+		ti->error = "Invalid block size";
+		return -EINVAL;
+	}
+
+	if (ti->len & (block_size - 1)) {
+		ti->error = "Target length is not a multiple of the block size";
+		return -EINVAL;
+	}
+
+	if (sscanf(argv[4], "%u", &nr_features) != 1 || nr_features > 1 ||
+	    argc < 7 + nr_features) {
+		ti->error = "Invalid number of features";
+		return -EINVAL;
+	}
+
+	if (nr_features) {
+		if (!strcmp(argv[5], "writethrough"))
+			writethrough = 1;
+		else if (strcmp(argv[5], "writeback")) {
+			ti->error = "Unrecognised cache feature";
+			return -EINVAL;
+		}
+	}
+
+	policy_argv = argv + 5 + nr_features;
+	if (sscanf(policy_argv[1], "%u", &nr_policy_args) != 1 ||
+	    argc != 7 + nr_features + nr_policy_args) {
+		ti->error = "Invalid number of policy arguments";
+		return -EINVAL;
+	}
+
+	cache = kzalloc(sizeof(*cache), GFP_KERNEL);
+	if (!cache) {
+		ti->error = "Error allocating cache context";
+		return -ENOMEM;
+	}
+
+	cache->ti = ti;
+	cache->writethrough = writethrough;
+	cache->block_size = block_size;
+	cache->block_shift = __ffs(block_size);
+	cache->nr_oblocks = ti->len >> cache->block_shift;
+
+	spin_lock_init(&cache->lock);
+	bio_list_init(&cache->deferred_barriers);
+	bio_list_init(&cache->writethrough_bios);
+	bio_list_init(&cache->failed_writethrough_bios);
+	INIT_LIST_HEAD(&cache->migrations);
+	INIT_LIST_HEAD(&cache->quiescing);
+	INIT_LIST_HEAD(&cache->completed);
+	INIT_LIST_HEAD(&cache->need_commit);
+	bio_list_init(&cache->need_commit_bios);
+	init_waitqueue_head(&cache->migration_wait);
+	INIT_WORK(&cache->worker, do_worker);
+	INIT_DELAYED_WORK(&cache->waker, do_waker);
+
+	r = dm_get_device(ti, argv[0], 0, 0, FMODE_READ | FMODE_WRITE,
+			  &cache->metadata_dev);
+	if (r) {
+		ti->error = "Error opening metadata device";
+		goto bad_metadata_dev;
+	}
+
+	r = dm_get_device(ti, argv[1], 0, 0, FMODE_READ | FMODE_WRITE,
+			  &cache->cache_dev);
+	if (r) {
+		ti->error = "Error opening cache device";
+		goto bad_cache_dev;
+	}
+
+	r = dm_get_device(ti, argv[2], 0, ti->len, FMODE_READ | FMODE_WRITE,
+			  &cache->origin_dev);
+	if (r) {
+		ti->error = "Error opening origin device";
+		goto bad_origin_dev;
+	}
+
+	r = -EINVAL;
+	cache_sectors = i_size_read(cache->cache_dev->bdev->bd_inode) >>
+			SECTOR_SHIFT;
+	if (!(cache_sectors >> cache->block_shift) ||
+	    (cache_sectors >> cache->block_shift) > (dm_cblock_t) -1) {
+		ti->error = "Invalid cache device size";
+		goto bad_size;
+	}
+	cache->nr_cblocks = cache_sectors >> cache->block_shift;
+	cache->nr_map_blocks = DIV_ROUND_UP(cache->nr_cblocks,
+					    MAPPINGS_PER_BLOCK);
+
+	meta_sectors = i_size_read(cache->metadata_dev->bdev->bd_inode) >>
+		       SECTOR_SHIFT;
+	if (meta_sectors < (sector_t) (cache->nr_map_blocks + 1) *
+			   METADATA_BLOCK_SECTORS) {
+		ti->error = "Metadata device too small";
+		goto bad_size;
+	}
+
+	type = dm_get_cache_policy(policy_argv[0]);
+	if (!type) {
+		ti->error = "Unknown cache policy";
+		goto bad_size;
+	}
+	cache->policy.type = type;
+
+	r = type->create(&cache->policy, cache->nr_cblocks, nr_policy_args,
+			 policy_argv + 2);
+	if (r) {
+		ti->error = "Error creating cache policy";
+		goto bad_policy;
+	}
+
+	r = cache_alloc_core(cache, &ti->error);
+	if (r)
+		goto bad_core;
+
+	ti->split_io = block_size;
+	ti->private = cache;
+
+	return 0;
+
+bad_core:
+	type->destroy(&cache->policy);
+bad_policy:
+	dm_put_cache_policy(type);
+bad_size:
+	dm_put_device(ti, cache->origin_dev);
+bad_origin_dev:
+	dm_put_device(ti, cache->cache_dev);
+bad_cache_dev:
+	dm_put_device(ti, cache->metadata_dev);
+bad_metadata_dev:
+	cache_free(cache);
+	return r;
+}
+
+static void cache_dtr(struct dm_target *ti)
+{
+	struct cache *cache = ti->private;
+
+	/* A live table is always suspended first, which committed */
+	cache->policy.type->destroy(&cache->policy);
+	dm_put_cache_policy(cache->policy.type);
+
+	dm_put_device(ti, cache->origin_dev);
+	dm_put_device(ti, cache->cache_dev);
+	dm_put_device(ti, cache->metadata_dev);
+	cache_free(cache);
+}
+
+static int cache_map(struct dm_target *ti, struct bio *bio,
+		     union map_info *map_context)
+{
+	struct cache *cache = ti->private;
+	struct bio_hook *hook = mempool_alloc(cache->hook_pool, GFP_NOIO);
+	unsigned long flags;
+
+	hook->flags = 0;
+	hook->details = NULL;
+	map_context->ptr = hook;
+
+	if (bio_barrier(bio)) {
+		spin_lock_irqsave(&cache->lock, flags);
+		bio_list_add(&cache->deferred_barriers, bio);
+		spin_unlock_irqrestore(&cache->lock, flags);
+
+		wake_worker(cache);
+		return DM_MAPIO_SUBMITTED;
+	}
+
+	return map_bio(cache, bio, hook, 1);
+}
+
+static int cache_end_io(struct dm_target *ti, struct bio *bio,
+			int error, union map_info *map_context)
+{
+	struct cache *cache = ti->private;
+	struct bio_hook *hook = map_context->ptr;
+	unsigned long flags;
+	int wake = 0;
+
+	/*
+	 * A writethrough write has reached the origin, send it on to the
+	 * cache device from the worker.
+	 */
+	if ((hook->flags & HOOK_WRITETHROUGH) && !error) {
+		hook->flags &= ~HOOK_WRITETHROUGH;
+		hook->flags |= HOOK_CACHE_LEG;
+		dm_bio_restore(hook->details, bio);
+		hook->oblock = get_bio_block(cache, bio);
+		remap_to_cache(cache, bio, hook->cblock);
+
+		spin_lock_irqsave(&cache->lock, flags);
+		bio_list_add(&cache->writethrough_bios, bio);
+		spin_unlock_irqrestore(&cache->lock, flags);
+
+		wake_worker(cache);
+		return DM_ENDIO_INCOMPLETE;
+	}
+
+	/*
+	 * ... and failed to reach the cache.  Reads must not hit the stale
+	 * cblock, so the policy forgets it here; the worker invalidates
+	 * the mapping and completes the bio once that is committed.  The
+	 * bio keeps the cblock in in_flight till then.
+	 */
+	if ((hook->flags & HOOK_CACHE_LEG) && error) {
+		hook->flags &= ~HOOK_CACHE_LEG;
+
+		spin_lock_irqsave(&cache->lock, flags);
+		cache->policy.type->remove_mapping(&cache->policy,
+						   hook->oblock);
+		bio_list_add(&cache->failed_writethrough_bios, bio);
+		spin_unlock_irqrestore(&cache->lock, flags);
+
+		wake_worker(cache);
+		return DM_ENDIO_INCOMPLETE;
+	}
+
+	if ((hook->flags & HOOK_CACHE) &&
+	    atomic_dec_and_test(cache->in_flight + hook->cblock))
+		wake = 1;
+
+	if ((hook->flags & HOOK_ORIGIN_WRITE) &&
+	    atomic_dec_and_test(cache->buckets + hook->bucket))
+		wake = 1;
+
+	if (hook->details)
+		mempool_free(hook->details, cache->details_pool);
+	mempool_free(hook, cache->hook_pool);
+
+	/* A migration may have been waiting for this */
+	if (wake && cache->nr_quiescing)
+		wake_worker(cache);
+
+	return error;
+}
+
+static void cache_postsuspend(struct dm_target *ti)
+{
+	struct cache *cache = ti->private;
+
+	cancel_delayed_work_sync(&cache->waker);
+	wait_event(cache->migration_wait, !cache->nr_migrations);
+	flush_workqueue(cache->wq);
+
+	if (cache->loaded)
+		cache_commit(cache, 1);
+}
+
+/*
+ * The metadata is read here rather than in the constructor, by now
+ * any table this one replaces has been suspended and has committed.
+ */
+static int cache_preresume(struct dm_target *ti)
+{
+	struct cache *cache = ti->private;
+	int r;
+
+	if (!cache->loaded) {
+		r = load_metadata(cache);
+		if (r) {
+			DMERR("error loading metadata: %d", r);
+			return r;
+		}
+		cache->loaded = 1;
+	}
+
+	/* Until the next suspend, the dirty bits on disk can't be trusted */
+	return cache_commit(cache, 0);
+}
+
+static void cache_resume(struct dm_target *ti)
+{
+	struct cache *cache = ti->private;
+
+	queue_delayed_work(cache->wq, &cache->waker, COMMIT_PERIOD);
+}
+
+static int cache_status(struct dm_target *ti, status_type_t type,
+			char *result, unsigned maxlen)
+{
+	struct cache *cache = ti->private;
+	unsigned long flags;
+	unsigned sz = 0;
+
+	switch (type) {
+	case STATUSTYPE_INFO:
+		spin_lock_irqsave(&cache->lock, flags);
+		DMEMIT("%lu %lu %lu %lu %lu %lu %lu %u/%u %u",
+		       cache->read_hit, cache->read_miss,
+		       cache->write_hit, cache->write_miss,
+		       cache->demotion, cache->promotion, cache->writeback,
+		       (unsigned) cache->nr_valid, (unsigned) cache->nr_cblocks,
+		       (unsigned) cache->nr_dirty);
+		spin_unlock_irqrestore(&cache->lock, flags);
+		break;
+
+	case STATUSTYPE_TABLE:
+		DMEMIT("%s %s %s %lu 1 %s %s ", cache->metadata_dev->name,
+		       cache->cache_dev->name, cache->origin_dev->name,
+		       (unsigned long) cache->block_size,
+		       cache->writethrough ? "writethrough" : "writeback",
+		       cache->policy.type->name);
+		spin_lock_irqsave(&cache->lock, flags);
+		cache->policy.type->status(&cache->policy, type, result + sz,
+					   maxlen - sz);
+		spin_unlock_irqrestore(&cache->lock, flags);
+		break;
+	}
+
+	return 0;
+}
+
+static struct target_type cache_target = {
+	.name = "cache",
+	.module = THIS_MODULE,
+	.version = {1, 0, 0},
+	.ctr = cache_ctr,
+	.dtr = cache_dtr,
+	.map = cache_map,
+	.end_io = cache_end_io,
+	.postsuspend = cache_postsuspend,
+	.preresume = cache_preresume,
+	.resume = cache_resume,
+	.status = cache_status,
+};
+
+static int __init dm_cache_init(void)
+{
+	int r;
+
+	BUILD_BUG_ON(sizeof(struct disk_superblock) > METADATA_BLOCK_SIZE);
+
+	_hook_cache = KMEM_CACHE(bio_hook, 0);
+	if (!_hook_cache)
+		return -ENOMEM;
+
+	_migration_cache = KMEM_CACHE(migration, 0);
+	if (!_migration_cache) {
+		r = -ENOMEM;
+		goto bad_migration_cache;
+	}
+
+	r = dm_register_target(&cache_target);
+	if (r) {
+		DMERR("cache target register failed %d", r);
+		goto bad_target;
+	}
+
+	return 0;
+
+bad_target:
+	kmem_cache_destroy(_migration_cache);
+bad_migration_cache:
+	kmem_cache_destroy(_hook_cache);
+	return r;
+}
+
+static void __exit dm_cache_exit(void)
+{
+	dm_unregister_target(&cache_target);
+	kmem_cache_destroy(_migration_cache);
+	kmem_cache_destroy(_hook_cache);
+}
+
+module_init(dm_cache_init);
+module_exit(dm_cache_exit);
+
+MODULE_DESCRIPTION(DM_NAME " cache target");
+MODULE_LICENSE("GPL");
@@ -17,7 +17,10 @@
 #include <linux/slab.h>
 #include <linux/crypto.h>
 #include <linux/workqueue.h>
+#include <linux/kthread.h>
 #include <linux/backing-dev.h>
+#include <linux/percpu.h>
+#include <linux/rbtree.h>
 #include <asm/atomic.h>
 #include <linux/scatterlist.h>
 #include <asm/page.h>
@@ -50,6 +53,7 @@ struct dm_crypt_io {
 	struct dm_target *target;
 	struct bio *base_bio;
 	struct work_struct work;
+	struct rb_node rb_node;		/* in crypt_config.write_tree */
 
 	struct convert_context ctx;
 
@@ -75,6 +79,14 @@ struct crypt_iv_operations {
 	int (*generator)(struct crypt_config *cc, u8 *iv, sector_t sector);
 };
 
+/*
+ * Per cpu state.  Conversions run on the bound kcryptd worker of the cpu
+ * which queued them, so this is only ever used by one thread at a time.
+ */
+struct crypt_cpu {
+	struct ablkcipher_request *req;	/* cached request for crypt_convert */
+};
+
 /*
  * Crypt: maps a linear range of a block device
  * and encrypts / decrypts at the same time.
@@ -96,6 +108,17 @@ struct crypt_config {
 	struct workqueue_struct *io_queue;
 	struct workqueue_struct *crypt_queue;
 
+	/*
+	 * Encrypted writes, sorted by sector, waiting for the write thread
+	 * to submit them.
+	 */
+	struct task_struct *write_thread;
+	wait_queue_head_t write_wait;
+	spinlock_t write_lock;
+	struct rb_root write_tree;
+
+	struct crypt_cpu *cpu;
+
 	/*
 	 * crypto related data
 	 */
@@ -122,7 +145,6 @@ struct crypt_config {
 	 * correctly aligned.
 	 */
 	unsigned int dmreq_start;
-	struct ablkcipher_request *req;
 
 	char cipher[CRYPTO_MAX_ALG_NAME];
 	char chainmode[CRYPTO_MAX_ALG_NAME];
@@ -141,6 +163,11 @@ static struct kmem_cache *_crypt_io_pool;
 static void clone_init(struct dm_crypt_io *, struct bio *);
 static void kcryptd_queue_crypt(struct dm_crypt_io *io);
 
+static struct crypt_cpu *this_crypt_cpu(struct crypt_config *cc)
+{
+	return per_cpu_ptr(cc->cpu, smp_processor_id());
+}
+
 /*
  * Different IV generation algorithms:
  *
@@ -405,13 +432,16 @@ static void kcryptd_async_done(struct crypto_async_request *async_req,
 static void crypt_alloc_req(struct crypt_config *cc,
 			    struct convert_context *ctx)
 {
-	if (!cc->req)
-		cc->req = mempool_alloc(cc->req_pool, GFP_NOIO);
-	ablkcipher_request_set_tfm(cc->req, cc->tfm);
-	ablkcipher_request_set_callback(cc->req, CRYPTO_TFM_REQ_MAY_BACKLOG |
+	struct crypt_cpu *this_cc = this_crypt_cpu(cc);
+
+	if (!this_cc->req)
+		this_cc->req = mempool_alloc(cc->req_pool, GFP_NOIO);
+	ablkcipher_request_set_tfm(this_cc->req, cc->tfm);
+	ablkcipher_request_set_callback(this_cc->req,
+					CRYPTO_TFM_REQ_MAY_BACKLOG |
 					CRYPTO_TFM_REQ_MAY_SLEEP,
 					kcryptd_async_done,
-					dmreq_of_req(cc, cc->req));
+					dmreq_of_req(cc, this_cc->req));
 }
 
 /*
@@ -420,6 +450,7 @@ static void crypt_alloc_req(struct crypt_config *cc,
 static int crypt_convert(struct crypt_config *cc,
 			 struct convert_context *ctx)
 {
+	struct crypt_cpu *this_cc = this_crypt_cpu(cc);
 	int r;
 
 	atomic_set(&ctx->pending, 1);
@@ -431,7 +462,7 @@ static int crypt_convert(struct crypt_config *cc,
 
 		atomic_inc(&ctx->pending);
 
-		r = crypt_convert_block(cc, ctx, cc->req);
+		r = crypt_convert_block(cc, ctx, this_cc->req);
 
 		switch (r) {
 		/* async */
@@ -440,7 +471,7 @@ static int crypt_convert(struct crypt_config *cc,
 			INIT_COMPLETION(ctx->restart);
 			/* fall through*/
 		case -EINPROGRESS:
-			cc->req = NULL;
+			this_cc->req = NULL;
 			ctx->sector++;
 			continue;
 
@@ -587,14 +618,21 @@ static void crypt_dec_pending(struct dm_crypt_io *io)
 }
 
 /*
- * kcryptd/kcryptd_io:
+ * kcryptd/kcryptd_io/dmcrypt_write:
  *
  * Needed because it would be very unwise to do decryption in an
  * interrupt context.
  *
- * kcryptd performs the actual encryption or decryption.
+ * kcryptd performs the actual encryption or decryption.  It has a
+ * worker per cpu, and work is queued on the cpu which submitted the
+ * write or completed the read, so a device isn't limited to the
+ * crypto throughput of a single cpu.
+ *
+ * kcryptd_io performs the IO submission of reads.
  *
- * kcryptd_io performs the IO submission.
+ * dmcrypt_write submits encrypted writes.  Writes converted in
+ * parallel finish in any order, so they are collected in a tree and
+ * submitted sorted by sector.
  *
  * They must be separated as otherwise the final stages could be
  * starved by new requests which can block in the first stages due
@@ -680,10 +718,7 @@ static void kcryptd_io(struct work_struct *work)
 {
 	struct dm_crypt_io *io = container_of(work, struct dm_crypt_io, work);
 
-	if (bio_data_dir(io->base_bio) == READ)
-		kcryptd_io_read(io);
-	else
-		kcryptd_io_write(io);
+	kcryptd_io_read(io);
 }
 
 static void kcryptd_queue_io(struct dm_crypt_io *io)
@@ -694,11 +729,45 @@ static void kcryptd_queue_io(struct dm_crypt_io *io)
 	queue_work(cc->io_queue, &io->work);
 }
 
-static void kcryptd_crypt_write_io_submit(struct dm_crypt_io *io,
-					  int error, int async)
+static int dmcrypt_write(void *data)
+{
+	struct crypt_config *cc = data;
+	struct dm_crypt_io *io;
+	struct rb_root write_tree;
+
+	while (1) {
+		wait_event_interruptible(cc->write_wait,
+					 !RB_EMPTY_ROOT(&cc->write_tree) ||
+					 kthread_should_stop());
+
+		spin_lock_irq(&cc->write_lock);
+		write_tree = cc->write_tree;
+		cc->write_tree = RB_ROOT;
+		spin_unlock_irq(&cc->write_lock);
+
+		if (RB_EMPTY_ROOT(&write_tree)) {
+			if (kthread_should_stop())
+				break;
+			continue;
+		}
+
+		do {
+			io = rb_entry(rb_first(&write_tree),
+				      struct dm_crypt_io, rb_node);
+			rb_erase(&io->rb_node, &write_tree);
+			kcryptd_io_write(io);
+		} while (!RB_EMPTY_ROOT(&write_tree));
+	}
+
+	return 0;
+}
+
+static void kcryptd_crypt_write_io_submit(struct dm_crypt_io *io, int error)
 {
 	struct bio *clone = io->ctx.bio_out;
 	struct crypt_config *cc = io->target->private;
+	struct rb_node **rbp, *parent;
+	unsigned long flags;
 
 	if (unlikely(error < 0)) {
 		crypt_free_buffer_pages(cc, clone);
@@ -713,10 +782,22 @@ static void kcryptd_crypt_write_io_submit(struct dm_crypt_io *io,
 
 	clone->bi_sector = cc->start + io->sector;
 
-	if (async)
-		kcryptd_queue_io(io);
-	else
-		generic_make_request(clone);
+	spin_lock_irqsave(&cc->write_lock, flags);
+	rbp = &cc->write_tree.rb_node;
+	parent = NULL;
+	while (*rbp) {
+		parent = *rbp;
+		if (io->sector < rb_entry(parent, struct dm_crypt_io,
+					  rb_node)->sector)
+			rbp = &parent->rb_left;
+		else
+			rbp = &parent->rb_right;
+	}
+	rb_link_node(&io->rb_node, parent, rbp);
+	rb_insert_color(&io->rb_node, &cc->write_tree);
+	spin_unlock_irqrestore(&cc->write_lock, flags);
+
+	wake_up(&cc->write_wait);
 }
 
 static void kcryptd_crypt_write_convert(struct dm_crypt_io *io)
@@ -759,7 +840,7 @@ static void kcryptd_crypt_write_convert(struct dm_crypt_io *io)
 
 		/* Encryption was already finished, submit io now */
 		if (crypt_finished) {
-			kcryptd_crypt_write_io_submit(io, r, 0);
+			kcryptd_crypt_write_io_submit(io, r);
 
 			/*
 			 * If there was an error, do not try next fragments.
@@ -767,8 +848,6 @@ static void kcryptd_crypt_write_convert(struct dm_crypt_io *io)
 			 */
 			if (unlikely(r < 0))
 				break;
-
-			io->sector = sector;
 		}
 
 		/*
@@ -779,10 +858,11 @@ static void kcryptd_crypt_write_convert(struct dm_crypt_io *io)
 			congestion_wait(WRITE, HZ/100);
 
 		/*
-		 * With async crypto it is unsafe to share the crypto context
-		 * between fragments, so switch to a new dm_crypt_io structure.
+		 * The io now waits for the write thread, or with async crypto
+		 * for the conversion to finish, so switch to a new dm_crypt_io
+		 * structure for the next fragment.
 		 */
-		if (unlikely(!crypt_finished && remaining)) {
+		if (unlikely(remaining)) {
 			new_io = crypt_io_alloc(io->target, io->base_bio,
 						sector);
 			crypt_inc_pending(new_io);
@@ -857,7 +937,7 @@ static void kcryptd_async_done(struct crypto_async_request *async_req,
 	if (bio_data_dir(io->base_bio) == READ)
 		kcryptd_crypt_read_done(io, error);
 	else
-		kcryptd_crypt_write_io_submit(io, error, 1);
+		kcryptd_crypt_write_io_submit(io, error);
 }
 
 static void kcryptd_crypt(struct work_struct *work)
@@ -1071,7 +1151,12 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 		ti->error = "Cannot allocate crypt request mempool";
 		goto bad_req_pool;
 	}
-	cc->req = NULL;
+
+	cc->cpu = alloc_percpu(struct crypt_cpu);
+	if (!cc->cpu) {
+		ti->error = "Cannot allocate per cpu state";
+		goto bad_percpu;
+	}
 
 	cc->page_pool = mempool_create_page_pool(MIN_POOL_PAGES, 0);
 	if (!cc->page_pool) {
@@ -1126,15 +1211,27 @@ static int crypt_ctr(struct dm_target *ti, unsigned int argc, char **argv)
 		goto bad_io_queue;
 	}
 
-	cc->crypt_queue = create_singlethread_workqueue("kcryptd");
+	cc->crypt_queue = create_workqueue("kcryptd");
 	if (!cc->crypt_queue) {
 		ti->error = "Couldn't create kcryptd queue";
 		goto bad_crypt_queue;
 	}
 
+	init_waitqueue_head(&cc->write_wait);
+	spin_lock_init(&cc->write_lock);
+	cc->write_tree = RB_ROOT;
+
+	cc->write_thread = kthread_run(dmcrypt_write, cc, "dmcrypt_write");
+	if (IS_ERR(cc->write_thread)) {
+		ti->error = "Couldn't spawn write thread";
+		goto bad_write_thread;
+	}
+
 	ti->private = cc;
 	return 0;
 
+bad_write_thread:
+	destroy_workqueue(cc->crypt_queue);
 bad_crypt_queue:
 	destroy_workqueue(cc->io_queue);
 bad_io_queue:
@@ -1146,6 +1243,8 @@ bad_device:
 bad_bs:
 	mempool_destroy(cc->page_pool);
 bad_page_pool:
+	free_percpu(cc->cpu);
+bad_percpu:
 	mempool_destroy(cc->req_pool);
 bad_req_pool:
 	mempool_destroy(cc->io_pool);
@@ -1163,12 +1262,19 @@ bad_cipher:
 static void crypt_dtr(struct dm_target *ti)
 {
 	struct crypt_config *cc = (struct crypt_config *) ti->private;
+	struct crypt_cpu *cpu_cc;
+	int cpu;
 
 	destroy_workqueue(cc->io_queue);
 	destroy_workqueue(cc->crypt_queue);
+	kthread_stop(cc->write_thread);
 
-	if (cc->req)
-		mempool_free(cc->req, cc->req_pool);
+	for_each_possible_cpu(cpu) {
+		cpu_cc = per_cpu_ptr(cc->cpu, cpu);
+		if (cpu_cc->req)
+			mempool_free(cpu_cc->req, cc->req_pool);
+	}
+	free_percpu(cc->cpu);
 
 	bioset_free(cc->bs);
 	mempool_destroy(cc->page_pool);
@@ -1307,7 +1413,7 @@ static int crypt_merge(struct dm_target *ti, struct bvec_merge_data *bvm,
 
 static struct target_type crypt_target = {
 	.name   = "crypt",
-	.version= {1, 6, 0},
+	.version= {1, 7, 0},
 	.module = THIS_MODULE,
 	.ctr    = crypt_ctr,
 	.dtr    = crypt_dtr,
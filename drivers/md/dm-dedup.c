@@ -0,0 +1,1263 @@
+/*
+ * This file is released under the GPL.
+ *
+ * Deduplication target.  Every 4k block written is hashed, and blocks
+ * with the same contents share a single copy on the data device.
+ */
+
+#include <linux/device-mapper.h>
+#include <linux/dm-io.h>
+
+#include <crypto/hash.h>
+#include <linux/bio.h>
+#include <linux/bitmap.h>
+#include <linux/blkdev.h>
+#include <linux/crc32c.h>
+#include <linux/crypto.h>
+#include <linux/highmem.h>
+#include <linux/init.h>
+#include <linux/jhash.h>
+#include <linux/list.h>
+#include <linux/log2.h>
+#include <linux/mempool.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+
+#define DM_MSG_PREFIX "dedup"
+
+/*-----------------------------------------------------------------
+ * On disk format
+ *---------------------------------------------------------------*/
+
+/*
+ * The metadata device is divided into 4k blocks.  Block 0 is the
+ * superblock.  It is followed by the mapping array, one entry for
+ * every virtual block giving the data block holding its contents plus
+ * one, or zero if the block has never been written or was last
+ * written with zeroes.  After that comes the digest of every data
+ * block.  Both arrays are updated in place.
+ *
+ * Reference counts and the hash index aren't stored, they are rebuilt
+ * from the two arrays when the target is resumed.
+ *
+ * New data never overwrites a data block in use, it is written to a
+ * free block and the mapping switched over afterwards.  A commit
+ * flushes the data device, then writes the changed digests and
+ * finally the changed mappings.  A data block that has lost its last
+ * reference is not reused until the commit that drops the reference
+ * is complete.  So after a crash every mapping on disk points at a
+ * block with the right contents and the right digest.
+ *
+ * A blank metadata device is formatted.
+ */
+#define DEDUP_MAGIC 0x75646544		/* "Dedu" */
+#define DEDUP_DISK_VERSION 1
+
+#define METADATA_BLOCK_SHIFT 12
+#define METADATA_BLOCK_SIZE (1 << METADATA_BLOCK_SHIFT)
+#define METADATA_BLOCK_SECTORS (METADATA_BLOCK_SIZE >> SECTOR_SHIFT)
+
+struct disk_superblock {
+	__le32 csum;		/* crc32c of the rest of the block */
+	__le32 magic;
+	__le32 version;
+	__le32 digest_size;
+
+	__le64 nr_virt_blocks;
+	__le64 nr_data_blocks;
+
+	char hash_name[CRYPTO_MAX_ALG_NAME];
+} __attribute__ ((packed));
+
+#define MAPPINGS_PER_BLOCK (METADATA_BLOCK_SIZE / sizeof(__le64))
+
+/*-----------------------------------------------------------------
+ * In core
+ *---------------------------------------------------------------*/
+#define DEDUP_BLOCK_SHIFT 12
+#define DEDUP_BLOCK_SIZE (1 << DEDUP_BLOCK_SHIFT)
+#define DEDUP_BLOCK_SECTORS (DEDUP_BLOCK_SIZE >> SECTOR_SHIFT)
+
+/*
+ * Digests shorter than this are only used to find candidates, which
+ * are then compared byte for byte.
+ */
+#define STRONG_DIGEST_SIZE 20
+#define MAX_DIGEST_SIZE 64
+
+#define COMMIT_PERIOD HZ
+#define MIN_IOS 64
+#define DEDUP_IO_PAGES 64
+
+typedef sector_t dm_block_t;
+
+static struct kmem_cache *_io_cache;
+
+/*
+ * A write of new contents, in flight to a free data block.
+ */
+struct dedup_io {
+	struct list_head list;		/* On in_flight */
+	struct list_head done;		/* On completed */
+	struct dedup_c *dc;
+	struct bio *bio;
+	struct page *page;
+
+	dm_block_t vblock;
+	dm_block_t pblock;
+	int error;
+
+	u8 digest[MAX_DIGEST_SIZE];
+};
+
+struct dedup_c {
+	struct dm_target *ti;
+	struct dm_dev *metadata_dev;
+	struct dm_dev *data_dev;
+
+	dm_block_t nr_virt_blocks;
+	dm_block_t nr_data_blocks;
+
+	char hash_name[CRYPTO_MAX_ALG_NAME];
+	struct crypto_shash *tfm;
+	struct shash_desc *desc;	/* Only used by the worker */
+	unsigned digest_size;
+	unsigned digests_per_block;
+	int verify;
+
+	spinlock_t lock;
+	struct bio_list deferred_bios;
+	struct list_head completed;
+
+	/* These are only touched by the worker */
+	struct bio_list blocked_bios;
+	struct list_head in_flight;
+
+	/*
+	 * The metadata.  Mappings are read by the map function under the
+	 * lock, everything else belongs to the worker.
+	 */
+	int loaded;
+	unsigned nr_map_blocks;
+	unsigned nr_digest_blocks;
+	__le64 *mappings;
+	u8 *digests;
+	unsigned long *dirty_map;
+	unsigned long *dirty_digests;
+	struct disk_superblock *sb_buf;
+
+	/*
+	 * Space map.  A data block is in use while it is referenced or
+	 * held, held blocks have lost their last reference since the
+	 * last commit.
+	 */
+	uint32_t *refcounts;
+	unsigned long *in_use;
+	unsigned long *held;
+	dm_block_t nr_used;
+	dm_block_t nr_held;
+	dm_block_t alloc_cursor;
+
+	/* Hash index of the referenced data blocks, chained by block */
+	dm_block_t *buckets;
+	dm_block_t *chain;
+	unsigned bucket_mask;
+
+	/* Statistics */
+	dm_block_t nr_mapped;
+	unsigned long writes;
+	unsigned long duplicates;
+	unsigned long zero_writes;
+
+	struct dm_io_client *io_client;
+	mempool_t *io_pool;
+	mempool_t *page_pool;
+	void *verify_buf;
+
+	struct workqueue_struct *wq;
+	struct work_struct worker;
+	struct delayed_work waker;
+};
+
+/*-----------------------------------------------------------------
+ * Metadata
+ *---------------------------------------------------------------*/
+static int superblock_io(struct dedup_c *dc, int rw)
+{
+	struct dm_io_region region = {
+		.bdev = dc->metadata_dev->bdev,
+		.sector = 0,
+		.count = METADATA_BLOCK_SECTORS,
+	};
+	struct dm_io_request io_req = {
+		.bi_rw = rw,
+		.mem.type = DM_IO_KMEM,
+		.mem.ptr.addr = dc->sb_buf,
+		.notify.fn = NULL,
+		.client = dc->io_client,
+	};
+
+	return dm_io(&io_req, 1, &region, NULL);
+}
+
+/*
+ * Transfers metadata blocks [block, block + count) to or from core,
+ * counting from the block after the superblock.
+ */
+static int metadata_io(struct dedup_c *dc, void *core, unsigned block,
+		       unsigned count, int rw)
+{
+	struct dm_io_region region = {
+		.bdev = dc->metadata_dev->bdev,
+		.sector = (sector_t) (block + 1) * METADATA_BLOCK_SECTORS,
+		.count = (sector_t) count * METADATA_BLOCK_SECTORS,
+	};
+	struct dm_io_request io_req = {
+		.bi_rw = rw,
+		.mem.type = DM_IO_VMA,
+		.mem.ptr.vma = core,
+		.notify.fn = NULL,
+		.client = dc->io_client,
+	};
+
+	return dm_io(&io_req, 1, &region, NULL);
+}
+
+static int mappings_io(struct dedup_c *dc, unsigned block, unsigned count,
+		       int rw)
+{
+	return metadata_io(dc, (char *) dc->mappings +
+			   ((size_t) block << METADATA_BLOCK_SHIFT),
+			   block, count, rw);
+}
+
+static int digests_io(struct dedup_c *dc, unsigned block, unsigned count,
+		      int rw)
+{
+	return metadata_io(dc, dc->digests +
+			   ((size_t) block << METADATA_BLOCK_SHIFT),
+			   dc->nr_map_blocks + block, count, rw);
+}
+
+static int flush_device(struct block_device *bdev)
+{
+	int r = blkdev_issue_flush(bdev, NULL);
+
+	return r == -EOPNOTSUPP ? 0 : r;
+}
+
+static u32 superblock_csum(struct disk_superblock *sb)
+{
+	return crc32c(~(u32) 0, &sb->magic,
+		      METADATA_BLOCK_SIZE - sizeof(sb->csum));
+}
+
+static int superblock_valid(struct disk_superblock *sb)
+{
+	return le32_to_cpu(sb->magic) == DEDUP_MAGIC &&
+		le32_to_cpu(sb->version) == DEDUP_DISK_VERSION &&
+		le32_to_cpu(sb->csum) == superblock_csum(sb);
+}
+
+static int block_is_zero(void *data)
+{
+	unsigned long *p = data;
+	unsigned i;
+
+	for (i = 0; i < METADATA_BLOCK_SIZE / sizeof(*p); i++)
+		if (p[i])
+			return 0;
+
+	return 1;
+}
+
+static int write_superblock(struct dedup_c *dc)
+{
+	struct disk_superblock *sb = dc->sb_buf;
+	int r;
+
+	memset(sb, 0, METADATA_BLOCK_SIZE);
+	sb->magic = cpu_to_le32(DEDUP_MAGIC);
+	sb->version = cpu_to_le32(DEDUP_DISK_VERSION);
+	sb->digest_size = cpu_to_le32(dc->digest_size);
+	sb->nr_virt_blocks = cpu_to_le64(dc->nr_virt_blocks);
+	sb->nr_data_blocks = cpu_to_le64(dc->nr_data_blocks);
+	strncpy(sb->hash_name, dc->hash_name, sizeof(sb->hash_name));
+	sb->csum = cpu_to_le32(superblock_csum(sb));
+
+	r = superblock_io(dc, WRITE);
+	if (!r)
+		r = flush_device(dc->metadata_dev->bdev);
+
+	return r;
+}
+
+static u8 *block_digest(struct dedup_c *dc, dm_block_t pblock)
+{
+	unsigned block = pblock / dc->digests_per_block;
+	unsigned slot = pblock % dc->digests_per_block;
+
+	return dc->digests + ((size_t) block << METADATA_BLOCK_SHIFT) +
+	       slot * dc->digest_size;
+}
+
+static void set_digest(struct dedup_c *dc, dm_block_t pblock, u8 *digest)
+{
+	memcpy(block_digest(dc, pblock), digest, dc->digest_size);
+	set_bit(pblock / dc->digests_per_block, dc->dirty_digests);
+}
+
+static int write_dirty(struct dedup_c *dc, unsigned long *dirty,
+		       unsigned nr,
+		       int (*fn)(struct dedup_c *, unsigned, unsigned, int))
+{
+	unsigned b, e;
+	int r;
+
+	b = find_first_bit(dirty, nr);
+	while (b < nr) {
+		e = find_next_zero_bit(dirty, nr, b);
+		r = fn(dc, b, e - b, WRITE);
+		if (r)
+			return r;
+		b = find_next_bit(dirty, nr, e);
+	}
+
+	bitmap_zero(dirty, nr);
+
+	return 0;
+}
+
+static int commit_metadata(struct dedup_c *dc)
+{
+	int r;
+
+	if (find_first_bit(dc->dirty_map, dc->nr_map_blocks) >=
+	    dc->nr_map_blocks)
+		return 0;
+
+	/* New data must be on disk before the mappings pointing at it */
+	r = flush_device(dc->data_dev->bdev);
+	if (r)
+		return r;
+
+	r = write_dirty(dc, dc->dirty_digests, dc->nr_digest_blocks,
+			digests_io);
+	if (r)
+		return r;
+
+	r = flush_device(dc->metadata_dev->bdev);
+	if (r)
+		return r;
+
+	r = write_dirty(dc, dc->dirty_map, dc->nr_map_blocks, mappings_io);
+	if (r)
+		return r;
+
+	r = flush_device(dc->metadata_dev->bdev);
+	if (r)
+		return r;
+
+	/* Nothing on disk refers to the held blocks any more */
+	bitmap_andnot(dc->in_use, dc->in_use, dc->held, dc->nr_data_blocks);
+	bitmap_zero(dc->held, dc->nr_data_blocks);
+	dc->nr_used -= dc->nr_held;
+	dc->nr_held = 0;
+
+	return 0;
+}
+
+static int dedup_commit(struct dedup_c *dc)
+{
+	int r = commit_metadata(dc);
+
+	if (r)
+		DMERR("metadata commit failed: error = %d", r);
+
+	return r;
+}
+
+/*-----------------------------------------------------------------
+ * Hash index and space map
+ *---------------------------------------------------------------*/
+static unsigned digest_bucket(struct dedup_c *dc, u8 *digest)
+{
+	return jhash(digest, dc->digest_size, 0) & dc->bucket_mask;
+}
+
+/* Entries in buckets and chain are block + 1, zero ends a chain */
+static void index_insert(struct dedup_c *dc, dm_block_t pblock)
+{
+	unsigned b = digest_bucket(dc, block_digest(dc, pblock));
+
+	dc->chain[pblock] = dc->buckets[b];
+	dc->buckets[b] = pblock + 1;
+}
+
+static void index_remove(struct dedup_c *dc, dm_block_t pblock)
+{
+	unsigned b = digest_bucket(dc, block_digest(dc, pblock));
+	dm_block_t *p = dc->buckets + b;
+
+	while (*p && *p != pblock + 1)
+		p = dc->chain + *p - 1;
+
+	if (*p)
+		*p = dc->chain[pblock];
+}
+
+static void inc_block(struct dedup_c *dc, dm_block_t pblock)
+{
+	dc->refcounts[pblock]++;
+}
+
+static void dec_block(struct dedup_c *dc, dm_block_t pblock)
+{
+	if (--dc->refcounts[pblock])
+		return;
+
+	index_remove(dc, pblock);
+	set_bit(pblock, dc->held);
+	dc->nr_held++;
+}
+
+static int alloc_block(struct dedup_c *dc, dm_block_t *result)
+{
+	dm_block_t b;
+
+	if (dc->nr_used == dc->nr_data_blocks)
+		return -ENOSPC;
+
+	b = find_next_zero_bit(dc->in_use, dc->nr_data_blocks,
+			       dc->alloc_cursor);
+	if (b >= dc->nr_data_blocks)
+		b = find_first_zero_bit(dc->in_use, dc->nr_data_blocks);
+
+	set_bit(b, dc->in_use);
+	dc->nr_used++;
+	dc->alloc_cursor = b + 1;
+	*result = b;
+
+	return 0;
+}
+
+/* Gives back a block that never got referenced */
+static void free_block(struct dedup_c *dc, dm_block_t pblock)
+{
+	dc->refcounts[pblock] = 0;
+	clear_bit(pblock, dc->in_use);
+	dc->nr_used--;
+}
+
+static int load_metadata(struct dedup_c *dc)
+{
+	struct disk_superblock *sb = dc->sb_buf;
+	dm_block_t vblock, pblock, m;
+	int r;
+
+	r = superblock_io(dc, READ);
+	if (r)
+		return r;
+
+	if (block_is_zero(sb)) {
+		/* Zero the mapping array before the superblock goes down */
+		bitmap_fill(dc->dirty_map, dc->nr_map_blocks);
+		r = commit_metadata(dc);
+		if (!r)
+			r = write_superblock(dc);
+		return r;
+	}
+
+	if (!superblock_valid(sb)) {
+		DMERR("superblock is invalid");
+		return -EINVAL;
+	}
+
+	if (le64_to_cpu(sb->nr_virt_blocks) != dc->nr_virt_blocks ||
+	    le64_to_cpu(sb->nr_data_blocks) != dc->nr_data_blocks) {
+		DMERR("superblock doesn't match the device sizes");
+		return -EINVAL;
+	}
+
+	if (le32_to_cpu(sb->digest_size) != dc->digest_size ||
+	    strncmp(sb->hash_name, dc->hash_name, sizeof(sb->hash_name))) {
+		DMERR("metadata was written with hash %.*s",
+		      (int) sizeof(sb->hash_name), sb->hash_name);
+		return -EINVAL;
+	}
+
+	r = mappings_io(dc, 0, dc->nr_map_blocks, READ);
+	if (!r)
+		r = digests_io(dc, 0, dc->nr_digest_blocks, READ);
+	if (r)
+		return r;
+
+	for (vblock = 0; vblock < dc->nr_virt_blocks; vblock++) {
+		m = le64_to_cpu(dc->mappings[vblock]);
+		if (!m)
+			continue;
+
+		pblock = m - 1;
+		if (pblock >= dc->nr_data_blocks) {
+			DMERR("virtual block %llu maps beyond the data device",
+			      (unsigned long long) vblock);
+			return -EINVAL;
+		}
+
+		if (!dc->refcounts[pblock]++) {
+			set_bit(pblock, dc->in_use);
+			dc->nr_used++;
+		}
+		dc->nr_mapped++;
+	}
+
+	for (pblock = 0; pblock < dc->nr_data_blocks; pblock++)
+		if (dc->refcounts[pblock])
+			index_insert(dc, pblock);
+
+	return 0;
+}
+
+/*-----------------------------------------------------------------
+ * Bio mapping
+ *---------------------------------------------------------------*/
+static void wake_worker(struct dedup_c *dc)
+{
+	queue_work(dc->wq, &dc->worker);
+}
+
+static dm_block_t get_bio_block(struct dedup_c *dc, struct bio *bio)
+{
+	return (bio->bi_sector - dc->ti->begin) >> (DEDUP_BLOCK_SHIFT -
+						    SECTOR_SHIFT);
+}
+
+/* Sector within its block, the target need not start on a block */
+static unsigned get_bio_offset(struct dedup_c *dc, struct bio *bio)
+{
+	return (bio->bi_sector - dc->ti->begin) & (DEDUP_BLOCK_SECTORS - 1);
+}
+
+static void remap_to_data(struct dedup_c *dc, struct bio *bio,
+			  dm_block_t pblock)
+{
+	bio->bi_bdev = dc->data_dev->bdev;
+	bio->bi_sector = (pblock << (DEDUP_BLOCK_SHIFT - SECTOR_SHIFT)) +
+			 get_bio_offset(dc, bio);
+}
+
+static dm_block_t get_mapping(struct dedup_c *dc, dm_block_t vblock)
+{
+	unsigned long flags;
+	dm_block_t m;
+
+	spin_lock_irqsave(&dc->lock, flags);
+	m = le64_to_cpu(dc->mappings[vblock]);
+	spin_unlock_irqrestore(&dc->lock, flags);
+
+	return m;
+}
+
+/*
+ * Points vblock at pblock + 1, or at nothing if m is zero, and drops
+ * the reference to the block it pointed at before.
+ */
+static void set_mapping(struct dedup_c *dc, dm_block_t vblock, dm_block_t m)
+{
+	unsigned long flags;
+	dm_block_t old;
+
+	spin_lock_irqsave(&dc->lock, flags);
+	old = le64_to_cpu(dc->mappings[vblock]);
+	dc->mappings[vblock] = cpu_to_le64(m);
+	dc->nr_mapped += !!m - !!old;
+	spin_unlock_irqrestore(&dc->lock, flags);
+
+	set_bit(vblock / MAPPINGS_PER_BLOCK, dc->dirty_map);
+
+	if (old)
+		dec_block(dc, old - 1);
+}
+
+static void map_read(struct dedup_c *dc, struct bio *bio)
+{
+	dm_block_t m = get_mapping(dc, get_bio_block(dc, bio));
+
+	if (!m) {
+		zero_fill_bio(bio);
+		bio_endio(bio, 0);
+		return;
+	}
+
+	remap_to_data(dc, bio, m - 1);
+	generic_make_request(bio);
+}
+
+/*-----------------------------------------------------------------
+ * Writes
+ *---------------------------------------------------------------*/
+static int data_io(struct dedup_c *dc, void *data, dm_block_t pblock, int rw,
+		   io_notify_fn fn, void *context)
+{
+	struct dm_io_region region = {
+		.bdev = dc->data_dev->bdev,
+		.sector = pblock << (DEDUP_BLOCK_SHIFT - SECTOR_SHIFT),
+		.count = DEDUP_BLOCK_SECTORS,
+	};
+	struct dm_io_request io_req = {
+		.bi_rw = rw,
+		.mem.type = DM_IO_KMEM,
+		.mem.ptr.addr = data,
+		.notify.fn = fn,
+		.notify.context = context,
+		.client = dc->io_client,
+	};
+
+	return dm_io(&io_req, 1, &region, NULL);
+}
+
+/*
+ * Builds the whole of the block a write goes to.  A partial write is
+ * merged with the current contents.
+ */
+static int gather_block(struct dedup_c *dc, struct bio *bio, void *data)
+{
+	unsigned offset = get_bio_offset(dc, bio) << SECTOR_SHIFT;
+	struct bio_vec *bv;
+	dm_block_t m;
+	char *src;
+	int i, r;
+
+	if (offset || bio->bi_size != DEDUP_BLOCK_SIZE) {
+		m = get_mapping(dc, get_bio_block(dc, bio));
+		if (!m)
+			memset(data, 0, DEDUP_BLOCK_SIZE);
+		else {
+			r = data_io(dc, data, m - 1, READ, NULL, NULL);
+			if (r)
+				return r;
+		}
+	}
+
+	bio_for_each_segment(bv, bio, i) {
+		src = kmap_atomic(bv->bv_page, KM_USER0);
+		memcpy(data + offset, src + bv->bv_offset, bv->bv_len);
+		kunmap_atomic(src, KM_USER0);
+		offset += bv->bv_len;
+	}
+
+	return 0;
+}
+
+/*
+ * Looks for a referenced block with the same contents.  Returns the
+ * block plus one, or zero.
+ */
+static dm_block_t find_duplicate(struct dedup_c *dc, u8 *digest, void *data)
+{
+	dm_block_t m = dc->buckets[digest_bucket(dc, digest)];
+
+	for (; m; m = dc->chain[m - 1]) {
+		if (memcmp(block_digest(dc, m - 1), digest, dc->digest_size))
+			continue;
+
+		if (dc->refcounts[m - 1] == (uint32_t) -1)
+			continue;
+
+		if (!dc->verify)
+			return m;
+
+		if (!data_io(dc, dc->verify_buf, m - 1, READ, NULL, NULL) &&
+		    !memcmp(dc->verify_buf, data, DEDUP_BLOCK_SIZE))
+			return m;
+	}
+
+	return 0;
+}
+
+static int block_in_flight(struct dedup_c *dc, dm_block_t vblock)
+{
+	struct dedup_io *io;
+
+	list_for_each_entry(io, &dc->in_flight, list)
+		if (io->vblock == vblock)
+			return 1;
+
+	return 0;
+}
+
+/*
+ * After a barrier write the mapping to it has to be on disk before
+ * the write is complete.
+ */
+static void complete_write(struct dedup_c *dc, struct dedup_io *io, int r)
+{
+	if (!r && bio_barrier(io->bio))
+		r = dedup_commit(dc);
+
+	bio_endio(io->bio, r);
+	mempool_free(io->page, dc->page_pool);
+	mempool_free(io, dc->io_pool);
+}
+
+static void write_complete(unsigned long error, void *context)
+{
+	struct dedup_io *io = context;
+	struct dedup_c *dc = io->dc;
+	unsigned long flags;
+
+	io->error = error ? -EIO : 0;
+
+	spin_lock_irqsave(&dc->lock, flags);
+	list_add_tail(&io->done, &dc->completed);
+	spin_unlock_irqrestore(&dc->lock, flags);
+
+	wake_worker(dc);
+}
+
+static void process_write(struct dedup_c *dc, struct bio *bio)
+{
+	dm_block_t vblock = get_bio_block(dc, bio);
+	struct dedup_io *io;
+	void *data;
+	dm_block_t m;
+	int r;
+
+	/* Writes to one block are applied in order */
+	if (block_in_flight(dc, vblock)) {
+		bio_list_add(&dc->blocked_bios, bio);
+		return;
+	}
+
+	io = mempool_alloc(dc->io_pool, GFP_NOIO);
+	io->dc = dc;
+	io->bio = bio;
+	io->vblock = vblock;
+	io->page = mempool_alloc(dc->page_pool, GFP_NOIO);
+	data = page_address(io->page);
+
+	r = gather_block(dc, bio, data);
+	if (r) {
+		complete_write(dc, io, r);
+		return;
+	}
+
+	dc->writes++;
+
+	/* Zeroes are read back from unmapped blocks */
+	if (block_is_zero(data)) {
+		dc->zero_writes++;
+		set_mapping(dc, vblock, 0);
+		complete_write(dc, io, 0);
+		return;
+	}
+
+	r = crypto_shash_digest(dc->desc, data, DEDUP_BLOCK_SIZE, io->digest);
+	if (r) {
+		DMERR("hashing failed: error = %d", r);
+		complete_write(dc, io, r);
+		return;
+	}
+
+	m = find_duplicate(dc, io->digest, data);
+	if (m) {
+		dc->duplicates++;
+		inc_block(dc, m - 1);
+		set_mapping(dc, vblock, m);
+		complete_write(dc, io, 0);
+		return;
+	}
+
+	r = alloc_block(dc, &io->pblock);
+	if (r && dc->nr_held && !dedup_commit(dc))
+		r = alloc_block(dc, &io->pblock);
+	if (r) {
+		complete_write(dc, io, r);
+		return;
+	}
+
+	list_add_tail(&io->list, &dc->in_flight);
+	data_io(dc, data, io->pblock, WRITE, write_complete, io);
+}
+
+static void process_completed_writes(struct dedup_c *dc)
+{
+	struct list_head list;
+	struct dedup_io *io, *tmp;
+	unsigned long flags;
+
+	INIT_LIST_HEAD(&list);
+
+	spin_lock_irqsave(&dc->lock, flags);
+	list_splice_init(&dc->completed, &list);
+	spin_unlock_irqrestore(&dc->lock, flags);
+
+	list_for_each_entry_safe(io, tmp, &list, done) {
+		list_del(&io->list);
+
+		if (io->error)
+			free_block(dc, io->pblock);
+		else {
+			set_digest(dc, io->pblock, io->digest);
+			inc_block(dc, io->pblock);
+			index_insert(dc, io->pblock);
+			set_mapping(dc, io->vblock, io->pblock + 1);
+		}
+
+		complete_write(dc, io, io->error);
+	}
+}
+
+/*-----------------------------------------------------------------
+ * Worker
+ *---------------------------------------------------------------*/
+static void process_bio(struct dedup_c *dc, struct bio *bio)
+{
+	if (bio_data_dir(bio) == WRITE)
+		process_write(dc, bio);
+	else
+		map_read(dc, bio);
+}
+
+static void process_deferred_bios(struct dedup_c *dc)
+{
+	struct bio_list bios;
+	struct bio *bio;
+	unsigned long flags;
+	int r;
+
+	/* Bios held back for an earlier write to their block go first */
+	bio_list_init(&bios);
+	bio_list_merge(&bios, &dc->blocked_bios);
+	bio_list_init(&dc->blocked_bios);
+
+	spin_lock_irqsave(&dc->lock, flags);
+	bio_list_merge(&bios, &dc->deferred_bios);
+	bio_list_init(&dc->deferred_bios);
+	spin_unlock_irqrestore(&dc->lock, flags);
+
+	while ((bio = bio_list_pop(&bios))) {
+		/*
+		 * Everything before a barrier has completed, but the
+		 * mappings to it may not be committed yet.
+		 */
+		if (bio_barrier(bio)) {
+			r = dedup_commit(dc);
+			if (r) {
+				bio_endio(bio, r);
+				continue;
+			}
+		}
+
+		process_bio(dc, bio);
+	}
+}
+
+static void do_worker(struct work_struct *ws)
+{
+	struct dedup_c *dc = container_of(ws, struct dedup_c, worker);
+
+	process_completed_writes(dc);
+	process_deferred_bios(dc);
+}
+
+static void do_waker(struct work_struct *ws)
+{
+	struct dedup_c *dc = container_of(to_delayed_work(ws), struct dedup_c,
+					  waker);
+
+	dedup_commit(dc);
+
+	queue_delayed_work(dc->wq, &dc->waker, COMMIT_PERIOD);
+}
+
+/*-----------------------------------------------------------------
+ * Target methods
+ *---------------------------------------------------------------*/
+static void dedup_free(struct dedup_c *dc)
+{
+	if (dc->wq)
+		destroy_workqueue(dc->wq);
+	if (dc->page_pool)
+		mempool_destroy(dc->page_pool);
+	if (dc->io_pool)
+		mempool_destroy(dc->io_pool);
+	if (dc->io_client && !IS_ERR(dc->io_client))
+		dm_io_client_destroy(dc->io_client);
+	if (dc->tfm && !IS_ERR(dc->tfm))
+		crypto_free_shash(dc->tfm);
+
+	vfree(dc->chain);
+	vfree(dc->buckets);
+	vfree(dc->held);
+	vfree(dc->in_use);
+	vfree(dc->refcounts);
+	vfree(dc->dirty_digests);
+	vfree(dc->dirty_map);
+	vfree(dc->digests);
+	vfree(dc->mappings);
+	kfree(dc->verify_buf);
+	kfree(dc->desc);
+	kfree(dc->sb_buf);
+	kfree(dc);
+}
+
+static unsigned long *alloc_bitset(dm_block_t nr_bits)
+{
+	size_t len = BITS_TO_LONGS(nr_bits) * sizeof(unsigned long);
+	unsigned long *bits = vmalloc(len);
+
+	if (bits)
+		memset(bits, 0, len);
+
+	return bits;
+}
+
+static void *alloc_array(dm_block_t nr, size_t size)
+{
+	void *p = vmalloc(nr * size);
+
+	if (p)
+		memset(p, 0, nr * size);
+
+	return p;
+}
+
+static int dedup_alloc_core(struct dedup_c *dc, char **error)
+{
+	dm_block_t nr_buckets;
+
+	dc->sb_buf = kmalloc(METADATA_BLOCK_SIZE, GFP_KERNEL);
+	if (!dc->sb_buf) {
+		*error = "Error allocating superblock buffer";
+		return -ENOMEM;
+	}
+
+	dc->mappings = alloc_array(dc->nr_map_blocks, METADATA_BLOCK_SIZE);
+	dc->digests = alloc_array(dc->nr_digest_blocks, METADATA_BLOCK_SIZE);
+	dc->dirty_map = alloc_bitset(dc->nr_map_blocks);
+	dc->dirty_digests = alloc_bitset(dc->nr_digest_blocks);
+	if (!dc->mappings || !dc->digests || !dc->dirty_map ||
+	    !dc->dirty_digests) {
+		*error = "Error allocating metadata arrays";
+		return -ENOMEM;
+	}
+
+	/* About four blocks per bucket when the data device is full */
+	nr_buckets = roundup_pow_of_two(max_t(dm_block_t,
+					      dc->nr_data_blocks >> 2, 1));
+	dc->bucket_mask = nr_buckets - 1;
+
+	dc->refcounts = alloc_array(dc->nr_data_blocks, sizeof(uint32_t));
+	dc->in_use = alloc_bitset(dc->nr_data_blocks);
+	dc->held = alloc_bitset(dc->nr_data_blocks);
+	dc->buckets = alloc_array(nr_buckets, sizeof(dm_block_t));
+	dc->chain = alloc_array(dc->nr_data_blocks, sizeof(dm_block_t));
+	if (!dc->refcounts || !dc->in_use || !dc->held || !dc->buckets ||
+	    !dc->chain) {
+		*error = "Error allocating space map";
+		return -ENOMEM;
+	}
+
+	dc->desc = kmalloc(sizeof(*dc->desc) + crypto_shash_descsize(dc->tfm),
+			   GFP_KERNEL);
+	if (!dc->desc) {
+		*error = "Error allocating hash descriptor";
+		return -ENOMEM;
+	}
+	dc->desc->tfm = dc->tfm;
+	dc->desc->flags = 0;
+
+	if (dc->verify) {
+		dc->verify_buf = kmalloc(DEDUP_BLOCK_SIZE, GFP_KERNEL);
+		if (!dc->verify_buf) {
+			*error = "Error allocating compare buffer";
+			return -ENOMEM;
+		}
+	}
+
+	dc->io_client = dm_io_client_create(DEDUP_IO_PAGES);
+	if (IS_ERR(dc->io_client)) {
+		*error = "Error creating io client";
+		return PTR_ERR(dc->io_client);
+	}
+
+	dc->io_pool = mempool_create_slab_pool(MIN_IOS, _io_cache);
+	dc->page_pool = mempool_create_page_pool(MIN_IOS, 0);
+	if (!dc->io_pool || !dc->page_pool) {
+		*error = "Error creating mempools";
+		return -ENOMEM;
+	}
+
+	dc->wq = create_singlethread_workqueue("kdedupd");
+	if (!dc->wq) {
+		*error = "Error creating workqueue";
+		return -ENOMEM;
+	}
+
+	return 0;
+}
+
+/*
+ * dedup <metadata dev> <data dev> <hash algorithm>
+ */
+static int dedup_ctr(struct dm_target *ti, unsigned argc, char **argv)
+{
+	struct dedup_c *dc;
+	sector_t data_sectors, meta_sectors;
+	int r;
+
+	if (argc != 3) {
+		ti->error = "Invalid argument count";
+		return -EINVAL;
+	}
+
+	if (!ti->len || ti->len & (DEDUP_BLOCK_SECTORS - 1)) {
+		ti->error = "Target length is not a multiple of the block size";
+		return -EINVAL;
+	}
+
+	if (strlen(argv[2]) >= CRYPTO_MAX_ALG_NAME) {
+		ti->error = "Hash algorithm name too long";
+		return -EINVAL;
+	}
+
+	dc = kzalloc(sizeof(*dc), GFP_KERNEL);
+	if (!dc) {
+		ti->error = "Error allocating dedup context";
+		return -ENOMEM;
+	}
+
+	dc->ti = ti;
+	dc->nr_virt_blocks = ti->len >> (DEDUP_BLOCK_SHIFT - SECTOR_SHIFT);
+	strcpy(dc->hash_name, argv[2]);
+
+	spin_lock_init(&dc->lock);
+	bio_list_init(&dc->deferred_bios);
+	bio_list_init(&dc->blocked_bios);
+	INIT_LIST_HEAD(&dc->completed);
+	INIT_LIST_HEAD(&dc->in_flight);
+	INIT_WORK(&dc->worker, do_worker);
+	INIT_DELAYED_WORK(&dc->waker, do_waker);
+
+	dc->tfm = crypto_alloc_shash(dc->hash_name, 0, 0);
+	if (IS_ERR(dc->tfm)) {
+		ti->error = "Error allocating hash";
+		r = PTR_ERR(dc->tfm);
+		goto bad_hash;
+	}
+
+	r = -EINVAL;
+	dc->digest_size = crypto_shash_digestsize(dc->tfm);
+	if (dc->digest_size < sizeof(u32) ||
+	    dc->digest_size > MAX_DIGEST_SIZE) {
+		ti->error = "Unsupported hash digest size";
+		goto bad_hash;
+	}
+	dc->digests_per_block = METADATA_BLOCK_SIZE / dc->digest_size;
+	dc->verify = dc->digest_size < STRONG_DIGEST_SIZE;
+
+	r = dm_get_device(ti, argv[0], 0, 0, FMODE_READ | FMODE_WRITE,
+			  &dc->metadata_dev);
+	if (r) {
+		ti->error = "Error opening metadata device";
+		goto bad_hash;
+	}
+
+	r = dm_get_device(ti, argv[1], 0, 0, FMODE_READ | FMODE_WRITE,
+			  &dc->data_dev);
+	if (r) {
+		ti->error = "Error opening data device";
+		goto bad_data_dev;
+	}
+
+	r = -EINVAL;
+	data_sectors = i_size_read(dc->data_dev->bdev->bd_inode) >>
+		       SECTOR_SHIFT;
+	dc->nr_data_blocks = data_sectors >> (DEDUP_BLOCK_SHIFT - SECTOR_SHIFT);
+	if (!dc->nr_data_blocks) {
+		ti->error = "Data device too small";
+		goto bad_size;
+	}
+
+	dc->nr_map_blocks = DIV_ROUND_UP(dc->nr_virt_blocks,
+					 MAPPINGS_PER_BLOCK);
+	dc->nr_digest_blocks = DIV_ROUND_UP(dc->nr_data_blocks,
+					    dc->digests_per_block);
+
+	meta_sectors = i_size_read(dc->metadata_dev->bdev->bd_inode) >>
+		       SECTOR_SHIFT;
+	if (meta_sectors < (sector_t) (1 + dc->nr_map_blocks +
+				       dc->nr_digest_blocks) *
+			   METADATA_BLOCK_SECTORS) {
+		ti->error = "Metadata device too small";
+		goto bad_size;
+	}
+
+	r = dedup_alloc_core(dc, &ti->error);
+	if (r)
+		goto bad_size;
+
+	ti->split_io = DEDUP_BLOCK_SECTORS;
+	ti->private = dc;
+
+	return 0;
+
+bad_size:
+	dm_put_device(ti, dc->data_dev);
+bad_data_dev:
+	dm_put_device(ti, dc->metadata_dev);
+bad_hash:
+	dedup_free(dc);
+	return r;
+}
+
+static void dedup_dtr(struct dm_target *ti)
+{
+	struct dedup_c *dc = ti->private;
+
+	/* A live table is always suspended first, which committed */
+	dm_put_device(ti, dc->data_dev);
+	dm_put_device(ti, dc->metadata_dev);
+	dedup_free(dc);
+}
+
+static int dedup_map(struct dm_target *ti, struct bio *bio,
+		     union map_info *map_context)
+{
+	struct dedup_c *dc = ti->private;
+	unsigned long flags;
+	dm_block_t m;
+
+	/* Writes need hashing, which is left to the worker */
+	if (bio_barrier(bio) || bio_data_dir(bio) == WRITE) {
+		spin_lock_irqsave(&dc->lock, flags);
+		bio_list_add(&dc->deferred_bios, bio);
+		spin_unlock_irqrestore(&dc->lock, flags);
+
+		wake_worker(dc);
+		return DM_MAPIO_SUBMITTED;
+	}
+
+	m = get_mapping(dc, get_bio_block(dc, bio));
+	if (!m) {
+		zero_fill_bio(bio);
+		bio_endio(bio, 0);
+		return DM_MAPIO_SUBMITTED;
+	}
+
+	remap_to_data(dc, bio, m - 1);
+	return DM_MAPIO_REMAPPED;
+}
+
+static void dedup_postsuspend(struct dm_target *ti)
+{
+	struct dedup_c *dc = ti->private;
+
+	cancel_delayed_work_sync(&dc->waker);
+	flush_workqueue(dc->wq);
+
+	if (dc->loaded)
+		dedup_commit(dc);
+}
+
+/*
+ * The metadata is read here rather than in the constructor, by now
+ * any table this one replaces has been suspended and has committed.
+ */
+static int dedup_preresume(struct dm_target *ti)
+{
+	struct dedup_c *dc = ti->private;
+	int r;
+
+	if (!dc->loaded) {
+		r = load_metadata(dc);
+		if (r) {
+			DMERR("error loading metadata: %d", r);
+			return r;
+		}
+		dc->loaded = 1;
+	}
+
+	return 0;
+}
+
+static void dedup_resume(struct dm_target *ti)
+{
+	struct dedup_c *dc = ti->private;
+
+	queue_delayed_work(dc->wq, &dc->waker, COMMIT_PERIOD);
+}
+
+static int dedup_status(struct dm_target *ti, status_type_t type,
+			char *result, unsigned maxlen)
+{
+	struct dedup_c *dc = ti->private;
+	unsigned long flags;
+	unsigned sz = 0;
+
+	switch (type) {
+	case STATUSTYPE_INFO:
+		spin_lock_irqsave(&dc->lock, flags);
+		DMEMIT("%llu %llu/%llu %lu %lu %lu",
+		       (unsigned long long) dc->nr_mapped,
+		       (unsigned long long) (dc->nr_used - dc->nr_held),
+		       (unsigned long long) dc->nr_data_blocks,
+		       dc->writes, dc->duplicates, dc->zero_writes);
+		spin_unlock_irqrestore(&dc->lock, flags);
+		break;
+
+	case STATUSTYPE_TABLE:
+		DMEMIT("%s %s %s", dc->metadata_dev->name, dc->data_dev->name,
+		       dc->hash_name);
+		break;
+	}
+
+	return 0;
+}
+
+static struct target_type dedup_target = {
+	.name = "dedup",
+	.module = THIS_MODULE,
+	.version = {1, 0, 0},
+	.ctr = dedup_ctr,
+	.dtr = dedup_dtr,
+	.map = dedup_map,
+	.postsuspend = dedup_postsuspend,
+	.preresume = dedup_preresume,
+	.resume = dedup_resume,
+	.status = dedup_status,
+};
+
+static int __init dm_dedup_init(void)
+{
+	int r;
+
+	BUILD_BUG_ON(sizeof(struct disk_superblock) > METADATA_BLOCK_SIZE);
+
+	_io_cache = KMEM_CACHE(dedup_io, 0);
+	if (!_io_cache)
+		return -ENOMEM;
+
+	r = dm_register_target(&dedup_target);
+	if (r) {
+		DMERR("dedup target register failed %d", r);
+		kmem_cache_destroy(_io_cache);
+	}
+
+	return r;
+}
+
+static void __exit dm_dedup_exit(void)
+{
+	dm_unregister_target(&dedup_target);
+	kmem_cache_destroy(_io_cache);
+}
+
+module_init(dm_dedup_init);
+module_exit(dm_dedup_exit);
+
+MODULE_DESCRIPTION(DM_NAME " deduplication target");
+MODULE_LICENSE("GPL");
@@ -47,11 +47,19 @@ struct dm_kcopyd_client {
 	struct workqueue_struct *kcopyd_wq;
 	struct work_struct kcopyd_work;
 
+	/*
+	 * Large jobs are copied in sub_job_size pieces, queue_depth of
+	 * them at a time.
+	 */
+	sector_t sub_job_size;
+	unsigned int queue_depth;
+
 /*
  * We maintain three lists of jobs:
  *
  * i)   jobs waiting for pages
  * ii)  jobs that have pages, and are waiting for the io to be issued.
+ *      These are sorted by the region they are about to touch.
  * iii) jobs that have completed.
  *
  * All three of these are protected by job_lock.
@@ -62,6 +70,19 @@ struct dm_kcopyd_client {
 	struct list_head pages_jobs;
 };
 
+/*
+ * Defaults for new clients, in sectors and sub-jobs per job.
+ */
+static unsigned int kcopyd_sub_job_size = 128;
+static unsigned int kcopyd_queue_depth = 8;
+
+module_param(kcopyd_sub_job_size, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(kcopyd_sub_job_size,
+		 "Size in sectors of the pieces large copies are split into");
+module_param(kcopyd_queue_depth, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(kcopyd_queue_depth,
+		 "Number of pieces of a copy in flight at once");
+
 static void wake(struct dm_kcopyd_client *kc)
 {
 	queue_work(kc->kcopyd_wq, &kc->kcopyd_work);
@@ -269,6 +290,39 @@ static void push(struct list_head *jobs, struct kcopyd_job *job)
 	spin_unlock_irqrestore(&kc->job_lock, flags);
 }
 
+static struct dm_io_region *job_region(struct kcopyd_job *job)
+{
+	return job->rw == READ ? &job->source : job->dests;
+}
+
+static int job_before(struct kcopyd_job *a, struct kcopyd_job *b)
+{
+	struct dm_io_region *ra = job_region(a), *rb = job_region(b);
+
+	if (ra->bdev != rb->bdev)
+		return ra->bdev < rb->bdev;
+
+	return ra->sector < rb->sector;
+}
+
+/*
+ * Keeps the io jobs in ascending order, so the sub-jobs of several
+ * copies are issued to the disks in order rather than interleaved.
+ * Jobs mostly arrive in order, so search from the tail.
+ */
+static void push_sorted(struct list_head *jobs, struct kcopyd_job *job)
+{
+	unsigned long flags;
+	struct dm_kcopyd_client *kc = job->kc;
+	struct kcopyd_job *pos;
+
+	spin_lock_irqsave(&kc->job_lock, flags);
+	list_for_each_entry_reverse(pos, jobs, list)
+		if (!job_before(job, pos))
+			break;
+	list_add(&job->list, &pos->list);
+	spin_unlock_irqrestore(&kc->job_lock, flags);
+}
 
 static void push_head(struct list_head *jobs, struct kcopyd_job *job)
 {
@@ -331,7 +385,7 @@ static void complete_io(unsigned long error, void *context)
 
 	else {
 		job->rw = WRITE;
-		push(&kc->io_jobs, job);
+		push_sorted(&kc->io_jobs, job);
 	}
 
 	wake(kc);
@@ -371,7 +425,7 @@ static int run_pages_job(struct kcopyd_job *job)
 	r = kcopyd_get_pages(job->kc, job->nr_pages, &job->pages);
 	if (!r) {
 		/* this job is ready for io */
-		push(&job->kc->io_jobs, job);
+		push_sorted(&job->kc->io_jobs, job);
 		return 0;
 	}
 
@@ -454,7 +508,6 @@ static void dispatch_job(struct kcopyd_job *job)
 	wake(kc);
 }
 
-#define SUB_JOB_SIZE 128
 static void segment_complete(int read_err, unsigned long write_err,
 			     void *context)
 {
@@ -482,8 +535,8 @@ static void segment_complete(int read_err, unsigned long write_err,
 		progress = job->progress;
 		count = job->source.count - progress;
 		if (count) {
-			if (count > SUB_JOB_SIZE)
-				count = SUB_JOB_SIZE;
+			if (count > kc->sub_job_size)
+				count = kc->sub_job_size;
 
 			job->progress += count;
 		}
@@ -526,17 +579,17 @@ static void segment_complete(int read_err, unsigned long write_err,
 
 /*
  * Create some little jobs that will do the move between
- * them.
+ * them.  Each one starts the next piece when it completes, so
+ * queue_depth of them are in flight until the end of the job.
  */
-#define SPLIT_COUNT 8
 static void split_job(struct kcopyd_job *job)
 {
-	int i;
+	unsigned int i, depth = job->kc->queue_depth;
 
 	atomic_inc(&job->kc->nr_jobs);
 
-	atomic_set(&job->sub_jobs, SPLIT_COUNT);
-	for (i = 0; i < SPLIT_COUNT; i++)
+	atomic_set(&job->sub_jobs, depth);
+	for (i = 0; i < depth; i++)
 		segment_complete(0, 0u, job);
 }
 
@@ -572,7 +625,7 @@ int dm_kcopyd_copy(struct dm_kcopyd_client *kc, struct dm_io_region *from,
 	job->fn = fn;
 	job->context = context;
 
-	if (job->source.count < SUB_JOB_SIZE)
+	if (job->source.count < kc->sub_job_size)
 		dispatch_job(job);
 
 	else {
@@ -620,6 +673,11 @@ int dm_kcopyd_client_create(unsigned int nr_pages,
 	if (!kc->job_pool)
 		goto bad_slab;
 
+	/* A piece must always fit in the client's pages */
+	kc->sub_job_size = min_t(sector_t, max(kcopyd_sub_job_size, 1u),
+				 (sector_t) nr_pages * (PAGE_SIZE >> 9));
+	kc->queue_depth = max(kcopyd_queue_depth, 1u);
+
 	INIT_WORK(&kc->kcopyd_work, do_work);
 	kc->kcopyd_wq = create_singlethread_workqueue("kcopyd");
 	if (!kc->kcopyd_wq)
@@ -54,9 +54,12 @@ struct path_selector_type {
 	 * repeat_count is the number of times to use the path before
 	 * calling the function again.  0 means don't call it again unless
 	 * the path fails.
+	 *
+	 * nr_bytes is the size of the io the path is chosen for.
 	 */
 	struct dm_path *(*select_path) (struct path_selector *ps,
-				     unsigned *repeat_count);
+					unsigned *repeat_count,
+					size_t nr_bytes);
 
 	/*
 	 * Notify the selector that a path has failed.
@@ -75,7 +78,15 @@ struct path_selector_type {
 	int (*status) (struct path_selector *ps, struct dm_path *path,
 		       status_type_t type, char *result, unsigned int maxlen);
 
-	int (*end_io) (struct path_selector *ps, struct dm_path *path);
+	/*
+	 * Called when an io of nr_bytes is dispatched to, and completed
+	 * on, the path.  Selectors that balance on load use these to
+	 * track what is in flight.
+	 */
+	int (*start_io) (struct path_selector *ps, struct dm_path *path,
+			 size_t nr_bytes);
+	int (*end_io) (struct path_selector *ps, struct dm_path *path,
+		       size_t nr_bytes);
 };
 
 /* Register a path selector */
@@ -0,0 +1,1963 @@
+/*
+ * This file is released under the GPL.
+ *
+ * Thin provisioning target.  A pool hands out fixed size data blocks
+ * on demand to any number of thin devices, and snapshots of a thin
+ * device share its data blocks until either side writes to them.
+ */
+
+#include <linux/device-mapper.h>
+#include <linux/dm-io.h>
+#include <linux/dm-kcopyd.h>
+
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/crc32c.h>
+#include <linux/init.h>
+#include <linux/list.h>
+#include <linux/module.h>
+#include <linux/radix-tree.h>
+#include <linux/rwsem.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+
+#define DM_MSG_PREFIX "thin"
+
+/*-----------------------------------------------------------------
+ * On disk format
+ *---------------------------------------------------------------*/
+
+/*
+ * The metadata device is divided into 4k blocks.  Blocks 0 and 1
+ * hold the superblock, which is written to them alternately; the copy
+ * with the highest transaction id that passes its checksum is the
+ * current one.  Every other block is a node of a mapping tree.
+ *
+ * Each thin device has its own tree, which maps a virtual block to a
+ * data block.  The trees have a fixed depth of three and a node is an
+ * array of 512 little-endian 64 bit entries.  An entry in an interior
+ * node is the metadata block of the child, an entry in a leaf is the
+ * data block plus one.  Zero means nothing is mapped there.
+ *
+ * A committed node is never changed in place.  Updates shadow the
+ * path from the root to the leaf into newly allocated blocks, so the
+ * superblock always points at a consistent set of trees.  Taking a
+ * snapshot just shares the root of the origin.  Nodes and data blocks
+ * are reference counted, and the two trees only diverge when one of
+ * them is written to.
+ *
+ * The reference counts are not stored.  They are recalculated from
+ * the trees when the pool is opened.
+ *
+ * As with persistent snapshots, the tools are expected to zero the
+ * start of a fresh metadata device; a blank device is formatted.
+ */
+#define THIN_MAGIC 0x6e696854		/* "Thin" */
+#define THIN_DISK_VERSION 1
+
+#define METADATA_BLOCK_SHIFT 12
+#define METADATA_BLOCK_SIZE (1 << METADATA_BLOCK_SHIFT)
+#define METADATA_BLOCK_SECTORS (METADATA_BLOCK_SIZE >> SECTOR_SHIFT)
+#define MAX_METADATA_BLOCKS (1 << 22)	/* 16GB of metadata */
+#define NR_SUPERBLOCKS 2
+
+#define NODE_SHIFT 9
+#define NODE_ENTRIES (1 << NODE_SHIFT)
+#define TREE_DEPTH 3
+#define LEAF_LEVEL (TREE_DEPTH - 1)
+#define MAX_VIRT_BLOCKS (1ULL << (NODE_SHIFT * TREE_DEPTH))
+
+#define MAX_THIN_DEVS 128
+
+struct disk_thin_dev {
+	__le64 dev_id;
+	__le64 root;
+	__le64 mapped_blocks;
+} __attribute__ ((packed));
+
+struct disk_superblock {
+	__le32 csum;		/* crc32c of the rest of the block */
+	__le32 magic;
+	__le32 version;
+	__le32 nr_devs;
+
+	__le64 transaction_id;
+
+	/* In sectors */
+	__le64 data_block_size;
+
+	__le64 nr_data_blocks;
+	__le64 nr_metadata_blocks;
+
+	struct disk_thin_dev devs[MAX_THIN_DEVS];
+} __attribute__ ((packed));
+
+/*-----------------------------------------------------------------
+ * Tunables
+ *---------------------------------------------------------------*/
+#define MIN_BLOCK_SIZE 128		/* 64KB */
+#define MAX_BLOCK_SIZE (1 << 21)	/* 1GB */
+#define COMMIT_PERIOD HZ
+#define MIN_MAPPINGS 64
+#define THIN_IO_PAGES 64
+#define THIN_COPY_PAGES (((1UL << 20) >> PAGE_SHIFT) ? : 1)
+
+#define MESG_STR(x) x, sizeof(x)
+
+typedef sector_t dm_block_t;
+
+static struct kmem_cache *_mapping_cache;
+
+/*-----------------------------------------------------------------
+ * Space maps: reference counts of metadata and data blocks
+ *---------------------------------------------------------------*/
+struct space_map {
+	dm_block_t nr_blocks;
+	dm_block_t nr_allocated;
+	dm_block_t first;	/* Lowest block that may be allocated */
+	dm_block_t search;	/* Where the next allocation starts */
+	uint32_t *counts;
+
+	/*
+	 * Blocks freed in the current transaction.  The last committed
+	 * metadata may still use them, so they can't be handed out again
+	 * before the next commit.
+	 */
+	unsigned long *held;
+};
+
+static size_t sm_held_size(struct space_map *sm)
+{
+	return BITS_TO_LONGS((unsigned long) sm->nr_blocks) * sizeof(long);
+}
+
+static int sm_create(struct space_map *sm, dm_block_t nr_blocks,
+		     dm_block_t first)
+{
+	if (nr_blocks > ULONG_MAX / sizeof(*sm->counts))
+		return -ENOMEM;
+
+	sm->nr_blocks = nr_blocks;
+	sm->nr_allocated = 0;
+	sm->first = sm->search = first;
+
+	sm->counts = vmalloc(nr_blocks * sizeof(*sm->counts));
+	sm->held = vmalloc(sm_held_size(sm));
+	if (!sm->counts || !sm->held) {
+		vfree(sm->counts);
+		vfree(sm->held);
+		return -ENOMEM;
+	}
+
+	memset(sm->counts, 0, nr_blocks * sizeof(*sm->counts));
+	memset(sm->held, 0, sm_held_size(sm));
+
+	return 0;
+}
+
+static void sm_destroy(struct space_map *sm)
+{
+	vfree(sm->counts);
+	vfree(sm->held);
+}
+
+static uint32_t sm_count(struct space_map *sm, dm_block_t b)
+{
+	return sm->counts[b];
+}
+
+static void sm_inc(struct space_map *sm, dm_block_t b)
+{
+	if (!sm->counts[b]++)
+		sm->nr_allocated++;
+}
+
+/*
+ * Returns the new reference count.
+ */
+static uint32_t sm_dec(struct space_map *sm, dm_block_t b)
+{
+	BUG_ON(!sm->counts[b]);
+
+	if (!--sm->counts[b]) {
+		sm->nr_allocated--;
+		__set_bit(b, sm->held);
+	}
+
+	return sm->counts[b];
+}
+
+static int sm_new_block(struct space_map *sm, dm_block_t *result)
+{
+	dm_block_t i, b = sm->search;
+
+	for (i = sm->first; i < sm->nr_blocks; i++) {
+		if (!sm->counts[b] && !test_bit(b, sm->held)) {
+			sm->counts[b] = 1;
+			sm->nr_allocated++;
+			sm->search = b + 1 < sm->nr_blocks ? b + 1 : sm->first;
+			*result = b;
+			return 0;
+		}
+
+		if (++b == sm->nr_blocks)
+			b = sm->first;
+	}
+
+	return -ENOSPC;
+}
+
+static void sm_commit(struct space_map *sm)
+{
+	memset(sm->held, 0, sm_held_size(sm));
+}
+
+/*-----------------------------------------------------------------
+ * Pool and thin device structures
+ *---------------------------------------------------------------*/
+struct thin_dev {
+	struct list_head list;
+	uint64_t dev_id;
+	dm_block_t root;	/* Zero if nothing is mapped */
+	dm_block_t mapped_blocks;
+	unsigned open_count;
+};
+
+/*
+ * In-core copy of a tree node.
+ */
+struct node {
+	dm_block_t where;
+	__le64 *entries;
+};
+
+/*
+ * Radix tree tag of the nodes allocated since the last commit.  They
+ * may be changed in place and the next commit writes them out.
+ */
+#define NODE_DIRTY 0
+
+/*
+ * A pool is shared by all the tables of the pool device, so that a
+ * reload doesn't reopen the metadata, and by the thin devices that
+ * use it.
+ */
+struct pool {
+	struct list_head list;
+	struct mapped_device *pool_md;
+	unsigned ref_count;
+
+	struct block_device *metadata_bdev;
+	struct block_device *data_bdev;
+	unsigned long block_size;	/* In sectors, a power of two */
+	unsigned block_shift;
+
+	struct dm_io_client *io_client;
+	struct dm_kcopyd_client *copier;
+
+	/*
+	 * The metadata.  All of it is kept in core and root_lock
+	 * protects it; commit_metadata() writes out the changes.
+	 */
+	struct rw_semaphore root_lock;
+	uint64_t transaction_id;
+	int dirty;
+	struct list_head thin_devs;
+	unsigned nr_thin_devs;
+	struct radix_tree_root nodes;
+	struct space_map metadata_sm;
+	struct space_map data_sm;
+	void *sb_buf;
+
+	struct workqueue_struct *wq;
+	struct work_struct worker;
+	struct delayed_work waker;
+
+	spinlock_t lock;
+	struct bio_list deferred_bios;
+	struct list_head prepared_mappings;
+
+	/* Only used by the worker */
+	struct list_head in_progress;
+
+	mempool_t *mapping_pool;
+	struct page_list zero_page;
+};
+
+struct pool_c {
+	struct pool *pool;
+	struct dm_dev *metadata_dev;
+	struct dm_dev *data_dev;
+};
+
+struct thin_c {
+	struct dm_target *ti;
+	struct dm_dev *pool_dev;
+	struct pool *pool;
+	struct thin_dev *td;
+};
+
+/*
+ * A data block being zeroed or copied before it gets mapped.  Other
+ * bios for the same virtual block wait until it is done.
+ */
+struct new_mapping {
+	struct list_head list;		/* pool->in_progress */
+	struct list_head prepared;	/* pool->prepared_mappings */
+	struct thin_c *tc;
+	dm_block_t virt_block;
+	dm_block_t data_block;
+	int err;
+	struct bio *bio;		/* The write needing the block */
+	struct bio_list bios;
+
+	/* Set while a write covering the whole block is in flight */
+	bio_end_io_t *saved_bi_end_io;
+	void *saved_bi_private;
+};
+
+/*-----------------------------------------------------------------
+ * Mapping trees
+ *---------------------------------------------------------------*/
+static struct node *alloc_node(void)
+{
+	struct node *n = kmalloc(sizeof(*n), GFP_NOIO);
+
+	if (!n)
+		return NULL;
+
+	n->entries = kmalloc(METADATA_BLOCK_SIZE, GFP_NOIO);
+	if (!n->entries) {
+		kfree(n);
+		return NULL;
+	}
+
+	return n;
+}
+
+static void free_node(struct node *n)
+{
+	kfree(n->entries);
+	kfree(n);
+}
+
+static struct node *get_node(struct pool *pool, dm_block_t where)
+{
+	return radix_tree_lookup(&pool->nodes, where);
+}
+
+static int insert_node(struct pool *pool, struct node *n)
+{
+	int r = radix_tree_preload(GFP_NOIO);
+
+	if (r)
+		return r;
+
+	r = radix_tree_insert(&pool->nodes, n->where, n);
+	radix_tree_preload_end();
+
+	return r;
+}
+
+static void drop_node(struct pool *pool, struct node *n)
+{
+	radix_tree_delete(&pool->nodes, n->where);
+	free_node(n);
+}
+
+static int new_node(struct pool *pool, struct node **result)
+{
+	struct node *n;
+	dm_block_t where;
+	int r;
+
+	r = sm_new_block(&pool->metadata_sm, &where);
+	if (r)
+		return r;
+
+	n = alloc_node();
+	if (!n) {
+		r = -ENOMEM;
+		goto bad;
+	}
+
+	n->where = where;
+	memset(n->entries, 0, METADATA_BLOCK_SIZE);
+
+	r = insert_node(pool, n);
+	if (r) {
+		free_node(n);
+		goto bad;
+	}
+
+	radix_tree_tag_set(&pool->nodes, where, NODE_DIRTY);
+	*result = n;
+	return 0;
+
+bad:
+	sm_dec(&pool->metadata_sm, where);
+	return r;
+}
+
+static void inc_children(struct pool *pool, struct node *n, unsigned level)
+{
+	dm_block_t e;
+	unsigned i;
+
+	for (i = 0; i < NODE_ENTRIES; i++) {
+		e = le64_to_cpu(n->entries[i]);
+		if (!e)
+			continue;
+
+		if (level == LEAF_LEVEL)
+			sm_inc(&pool->data_sm, e - 1);
+		else
+			sm_inc(&pool->metadata_sm, e);
+	}
+}
+
+static void dec_node(struct pool *pool, dm_block_t where, unsigned level)
+{
+	struct node *n;
+	dm_block_t e;
+	unsigned i;
+
+	if (sm_dec(&pool->metadata_sm, where))
+		return;
+
+	n = get_node(pool, where);
+	for (i = 0; i < NODE_ENTRIES; i++) {
+		e = le64_to_cpu(n->entries[i]);
+		if (!e)
+			continue;
+
+		if (level == LEAF_LEVEL)
+			sm_dec(&pool->data_sm, e - 1);
+		else
+			dec_node(pool, e, level + 1);
+	}
+
+	drop_node(pool, n);
+}
+
+/*
+ * Get a version of node 'where' that may be changed.  A node written
+ * since the last commit and not shared is changed in place, anything
+ * else is copied to a new block.  The caller must point the parent at
+ * the node returned.
+ */
+static int shadow_node(struct pool *pool, dm_block_t where, unsigned level,
+		       struct node **result)
+{
+	struct node *old = get_node(pool, where), *n;
+	int r;
+
+	if (sm_count(&pool->metadata_sm, where) == 1 &&
+	    radix_tree_tag_get(&pool->nodes, where, NODE_DIRTY)) {
+		*result = old;
+		return 0;
+	}
+
+	r = new_node(pool, &n);
+	if (r)
+		return r;
+
+	memcpy(n->entries, old->entries, METADATA_BLOCK_SIZE);
+
+	if (sm_dec(&pool->metadata_sm, where))
+		/* Still shared, so the copy takes its own references */
+		inc_children(pool, n, level);
+	else
+		/* The copy inherits the references of the old node */
+		drop_node(pool, old);
+
+	*result = n;
+	return 0;
+}
+
+static unsigned node_index(dm_block_t block, unsigned level)
+{
+	return (block >> (NODE_SHIFT * (LEAF_LEVEL - level))) &
+		(NODE_ENTRIES - 1);
+}
+
+/*
+ * Look up the data block that virtual block 'block' of a thin device
+ * maps to.  Returns -ENODATA if nothing is mapped.  *shared is set if
+ * another device may see the same data block, in which case it must
+ * not be written to.
+ */
+static int find_block(struct pool *pool, struct thin_dev *td,
+		      dm_block_t block, dm_block_t *result, int *shared)
+{
+	dm_block_t where = td->root;
+	unsigned level;
+
+	*shared = 0;
+	for (level = 0; level < TREE_DEPTH; level++) {
+		if (!where)
+			return -ENODATA;
+
+		if (sm_count(&pool->metadata_sm, where) > 1)
+			*shared = 1;
+
+		where = le64_to_cpu(get_node(pool, where)->
+				    entries[node_index(block, level)]);
+	}
+
+	if (!where)
+		return -ENODATA;
+
+	*result = where - 1;
+	if (sm_count(&pool->data_sm, *result) > 1)
+		*shared = 1;
+
+	return 0;
+}
+
+/*
+ * Map virtual block 'block' of a thin device to 'data'.  The caller's
+ * reference to 'data' passes to the mapping.
+ */
+static int insert_block(struct pool *pool, struct thin_dev *td,
+			dm_block_t block, dm_block_t data)
+{
+	struct node *n, *child;
+	__le64 *entry;
+	dm_block_t old;
+	unsigned level;
+	int r;
+
+	if (td->root)
+		r = shadow_node(pool, td->root, 0, &n);
+	else
+		r = new_node(pool, &n);
+	if (r)
+		return r;
+
+	td->root = n->where;
+	pool->dirty = 1;
+
+	for (level = 0; level < LEAF_LEVEL; level++) {
+		entry = n->entries + node_index(block, level);
+		old = le64_to_cpu(*entry);
+
+		if (old)
+			r = shadow_node(pool, old, level + 1, &child);
+		else
+			r = new_node(pool, &child);
+		if (r)
+			return r;
+
+		*entry = cpu_to_le64(child->where);
+		n = child;
+	}
+
+	entry = n->entries + node_index(block, LEAF_LEVEL);
+	old = le64_to_cpu(*entry);
+	if (old)
+		sm_dec(&pool->data_sm, old - 1);
+	else
+		td->mapped_blocks++;
+
+	*entry = cpu_to_le64(data + 1);
+
+	return 0;
+}
+
+/*-----------------------------------------------------------------
+ * Thin devices
+ *---------------------------------------------------------------*/
+static struct thin_dev *find_thin_dev(struct pool *pool, uint64_t dev_id)
+{
+	struct thin_dev *td;
+
+	list_for_each_entry(td, &pool->thin_devs, list)
+		if (td->dev_id == dev_id)
+			return td;
+
+	return NULL;
+}
+
+static struct thin_dev *add_thin_dev(struct pool *pool, uint64_t dev_id)
+{
+	struct thin_dev *td = kzalloc(sizeof(*td), GFP_NOIO);
+
+	if (!td)
+		return NULL;
+
+	td->dev_id = dev_id;
+	list_add_tail(&td->list, &pool->thin_devs);
+	pool->nr_thin_devs++;
+
+	return td;
+}
+
+static int create_thin(struct pool *pool, uint64_t dev_id,
+		       struct thin_dev **result)
+{
+	struct thin_dev *td;
+
+	if (find_thin_dev(pool, dev_id))
+		return -EEXIST;
+
+	if (pool->nr_thin_devs == MAX_THIN_DEVS)
+		return -ENOSPC;
+
+	td = add_thin_dev(pool, dev_id);
+	if (!td)
+		return -ENOMEM;
+
+	pool->dirty = 1;
+	if (result)
+		*result = td;
+
+	return 0;
+}
+
+/*
+ * Taking a snapshot only shares the root of the origin's tree.  The
+ * origin must be suspended while this happens.
+ */
+static int create_snap(struct pool *pool, uint64_t dev_id, uint64_t origin_id)
+{
+	struct thin_dev *origin, *td;
+	int r;
+
+	origin = find_thin_dev(pool, origin_id);
+	if (!origin)
+		return -ENODEV;
+
+	r = create_thin(pool, dev_id, &td);
+	if (r)
+		return r;
+
+	td->root = origin->root;
+	td->mapped_blocks = origin->mapped_blocks;
+	if (td->root)
+		sm_inc(&pool->metadata_sm, td->root);
+
+	return 0;
+}
+
+static int delete_thin(struct pool *pool, uint64_t dev_id)
+{
+	struct thin_dev *td = find_thin_dev(pool, dev_id);
+
+	if (!td)
+		return -ENODEV;
+
+	if (td->open_count)
+		return -EBUSY;
+
+	if (td->root)
+		dec_node(pool, td->root, 0);
+
+	list_del(&td->list);
+	kfree(td);
+	pool->nr_thin_devs--;
+	pool->dirty = 1;
+
+	return 0;
+}
+
+/*-----------------------------------------------------------------
+ * Loading and committing the metadata
+ *---------------------------------------------------------------*/
+static int metadata_io(struct pool *pool, dm_block_t where, int rw,
+		       void *data)
+{
+	struct dm_io_region region = {
+		.bdev = pool->metadata_bdev,
+		.sector = where * METADATA_BLOCK_SECTORS,
+		.count = METADATA_BLOCK_SECTORS,
+	};
+	struct dm_io_request io_req = {
+		.bi_rw = rw,
+		.mem.type = DM_IO_KMEM,
+		.mem.ptr.addr = data,
+		.notify.fn = NULL,
+		.client = pool->io_client,
+	};
+
+	return dm_io(&io_req, 1, &region, NULL);
+}
+
+static int flush_device(struct block_device *bdev)
+{
+	int r = blkdev_issue_flush(bdev, NULL);
+
+	return r == -EOPNOTSUPP ? 0 : r;
+}
+
+static u32 superblock_csum(struct disk_superblock *sb)
+{
+	return crc32c(~(u32) 0, &sb->magic,
+		      METADATA_BLOCK_SIZE - sizeof(sb->csum));
+}
+
+static int superblock_valid(struct disk_superblock *sb)
+{
+	return le32_to_cpu(sb->magic) == THIN_MAGIC &&
+		le32_to_cpu(sb->version) == THIN_DISK_VERSION &&
+		le32_to_cpu(sb->csum) == superblock_csum(sb);
+}
+
+/*
+ * The two superblock copies are used alternately.
+ */
+static dm_block_t superblock_location(uint64_t transaction_id)
+{
+	return transaction_id & 1;
+}
+
+static int block_is_zero(void *data)
+{
+	unsigned long *p = data;
+	unsigned i;
+
+	for (i = 0; i < METADATA_BLOCK_SIZE / sizeof(*p); i++)
+		if (p[i])
+			return 0;
+
+	return 1;
+}
+
+static void free_metadata(struct pool *pool)
+{
+	struct node *nodes[16];
+	struct thin_dev *td, *tmp;
+	unsigned i, nr;
+
+	while ((nr = radix_tree_gang_lookup(&pool->nodes, (void **) nodes,
+					    0, ARRAY_SIZE(nodes))))
+		for (i = 0; i < nr; i++)
+			drop_node(pool, nodes[i]);
+
+	list_for_each_entry_safe(td, tmp, &pool->thin_devs, list) {
+		list_del(&td->list);
+		kfree(td);
+	}
+	pool->nr_thin_devs = 0;
+}
+
+static int load_node(struct pool *pool, dm_block_t where, unsigned level)
+{
+	struct node *n;
+	dm_block_t e;
+	unsigned i;
+	int r;
+
+	if (where < NR_SUPERBLOCKS || where >= pool->metadata_sm.nr_blocks) {
+		DMERR("metadata block %llu out of range",
+		      (unsigned long long) where);
+		return -EINVAL;
+	}
+
+	/* A shared node, its children have already been counted */
+	if (sm_count(&pool->metadata_sm, where)) {
+		sm_inc(&pool->metadata_sm, where);
+		return 0;
+	}
+
+	n = alloc_node();
+	if (!n)
+		return -ENOMEM;
+
+	n->where = where;
+	r = metadata_io(pool, where, READ, n->entries);
+	if (!r)
+		r = insert_node(pool, n);
+	if (r) {
+		free_node(n);
+		return r;
+	}
+
+	sm_inc(&pool->metadata_sm, where);
+
+	for (i = 0; i < NODE_ENTRIES; i++) {
+		e = le64_to_cpu(n->entries[i]);
+		if (!e)
+			continue;
+
+		if (level < LEAF_LEVEL) {
+			r = load_node(pool, e, level + 1);
+			if (r)
+				return r;
+		} else if (e > pool->data_sm.nr_blocks) {
+			DMERR("data block %llu out of range",
+			      (unsigned long long) e - 1);
+			return -EINVAL;
+		} else
+			sm_inc(&pool->data_sm, e - 1);
+	}
+
+	return 0;
+}
+
+static int load_superblock(struct pool *pool, struct disk_superblock *sb)
+{
+	struct disk_thin_dev *disk;
+	struct thin_dev *td;
+	unsigned i, nr_devs;
+	int r;
+
+	if (le64_to_cpu(sb->data_block_size) != pool->block_size) {
+		DMERR("data block size %llu doesn't match the table (%lu)",
+		      (unsigned long long) le64_to_cpu(sb->data_block_size),
+		      pool->block_size);
+		return -EINVAL;
+	}
+
+	if (le64_to_cpu(sb->nr_data_blocks) > pool->data_sm.nr_blocks) {
+		DMERR("data device is smaller than recorded in the metadata");
+		return -EINVAL;
+	}
+
+	if (le64_to_cpu(sb->nr_metadata_blocks) >
+	    pool->metadata_sm.nr_blocks) {
+		DMERR("metadata device is smaller than recorded");
+		return -EINVAL;
+	}
+
+	nr_devs = le32_to_cpu(sb->nr_devs);
+	if (nr_devs > MAX_THIN_DEVS) {
+		DMERR("too many thin devices (%u)", nr_devs);
+		return -EINVAL;
+	}
+
+	pool->transaction_id = le64_to_cpu(sb->transaction_id);
+
+	for (i = 0; i < nr_devs; i++) {
+		disk = sb->devs + i;
+
+		td = add_thin_dev(pool, le64_to_cpu(disk->dev_id));
+		if (!td)
+			return -ENOMEM;
+
+		td->root = le64_to_cpu(disk->root);
+		td->mapped_blocks = le64_to_cpu(disk->mapped_blocks);
+		if (td->root) {
+			r = load_node(pool, td->root, 0);
+			if (r)
+				return r;
+		}
+	}
+
+	/* Record any growth of the devices */
+	if (le64_to_cpu(sb->nr_data_blocks) != pool->data_sm.nr_blocks ||
+	    le64_to_cpu(sb->nr_metadata_blocks) != pool->metadata_sm.nr_blocks)
+		pool->dirty = 1;
+
+	return 0;
+}
+
+struct commit_io {
+	atomic_t count;
+	unsigned long error;
+	struct completion done;
+};
+
+static void node_written(unsigned long error, void *context)
+{
+	struct commit_io *io = context;
+
+	if (error)
+		io->error = error;
+
+	if (atomic_dec_and_test(&io->count))
+		complete(&io->done);
+}
+
+static int write_dirty_nodes(struct pool *pool)
+{
+	struct node *nodes[16];
+	struct commit_io io;
+	struct dm_io_region region = {
+		.bdev = pool->metadata_bdev,
+		.count = METADATA_BLOCK_SECTORS,
+	};
+	struct dm_io_request io_req = {
+		.bi_rw = WRITE,
+		.mem.type = DM_IO_KMEM,
+		.notify.fn = node_written,
+		.notify.context = &io,
+		.client = pool->io_client,
+	};
+	unsigned long index = 0;
+	unsigned i, nr;
+
+	atomic_set(&io.count, 1);
+	io.error = 0;
+	init_completion(&io.done);
+
+	while ((nr = radix_tree_gang_lookup_tag(&pool->nodes, (void **) nodes,
+						index, ARRAY_SIZE(nodes),
+						NODE_DIRTY))) {
+		for (i = 0; i < nr; i++) {
+			region.sector = nodes[i]->where *
+					METADATA_BLOCK_SECTORS;
+			io_req.mem.ptr.addr = nodes[i]->entries;
+			atomic_inc(&io.count);
+			dm_io(&io_req, 1, &region, NULL);
+		}
+		index = nodes[nr - 1]->where + 1;
+	}
+
+	node_written(0, &io);
+	wait_for_completion(&io.done);
+
+	return io.error ? -EIO : 0;
+}
+
+static void clear_dirty_nodes(struct pool *pool)
+{
+	struct node *nodes[16];
+	unsigned long index = 0;
+	unsigned i, nr;
+
+	while ((nr = radix_tree_gang_lookup_tag(&pool->nodes, (void **) nodes,
+						index, ARRAY_SIZE(nodes),
+						NODE_DIRTY))) {
+		for (i = 0; i < nr; i++)
+			radix_tree_tag_clear(&pool->nodes, nodes[i]->where,
+					     NODE_DIRTY);
+		index = nodes[nr - 1]->where + 1;
+	}
+}
+
+/*
+ * Make the current transaction durable.  The caller holds root_lock
+ * for writing.
+ */
+static int commit_metadata(struct pool *pool)
+{
+	struct disk_superblock *sb = pool->sb_buf;
+	struct thin_dev *td;
+	unsigned i = 0;
+	int r;
+
+	if (!pool->dirty)
+		return 0;
+
+	r = write_dirty_nodes(pool);
+	if (r)
+		return r;
+
+	/*
+	 * New mappings may point at blocks that have just been zeroed,
+	 * copied or overwritten, that data must reach the disk before the
+	 * superblock referring to it.
+	 */
+	r = flush_device(pool->data_bdev);
+	if (!r)
+		r = flush_device(pool->metadata_bdev);
+	if (r)
+		return r;
+
+	memset(sb, 0, METADATA_BLOCK_SIZE);
+	sb->magic = cpu_to_le32(THIN_MAGIC);
+	sb->version = cpu_to_le32(THIN_DISK_VERSION);
+	sb->nr_devs = cpu_to_le32(pool->nr_thin_devs);
+	sb->transaction_id = cpu_to_le64(pool->transaction_id + 1);
+	sb->data_block_size = cpu_to_le64(pool->block_size);
+	sb->nr_data_blocks = cpu_to_le64(pool->data_sm.nr_blocks);
+	sb->nr_metadata_blocks = cpu_to_le64(pool->metadata_sm.nr_blocks);
+
+	list_for_each_entry(td, &pool->thin_devs, list) {
+		sb->devs[i].dev_id = cpu_to_le64(td->dev_id);
+		sb->devs[i].root = cpu_to_le64(td->root);
+		sb->devs[i].mapped_blocks = cpu_to_le64(td->mapped_blocks);
+		i++;
+	}
+
+	sb->csum = cpu_to_le32(superblock_csum(sb));
+
+	r = metadata_io(pool, superblock_location(pool->transaction_id + 1),
+			WRITE, sb);
+	if (!r)
+		r = flush_device(pool->metadata_bdev);
+	if (r)
+		return r;
+
+	pool->transaction_id++;
+	clear_dirty_nodes(pool);
+	sm_commit(&pool->metadata_sm);
+	sm_commit(&pool->data_sm);
+	pool->dirty = 0;
+
+	return 0;
+}
+
+static int pool_commit(struct pool *pool)
+{
+	int r = commit_metadata(pool);
+
+	if (r)
+		DMERR("%s: metadata commit failed: error = %d",
+		      dm_device_name(pool->pool_md), r);
+
+	return r;
+}
+
+static int open_metadata(struct pool *pool)
+{
+	struct disk_superblock *sb = pool->sb_buf;
+	dm_block_t i, slot = 0;
+	uint64_t best = 0;
+	int r, found = 0, blank = 1;
+
+	for (i = 0; i < NR_SUPERBLOCKS; i++) {
+		r = metadata_io(pool, i, READ, sb);
+		if (r)
+			return r;
+
+		if (superblock_valid(sb)) {
+			if (!found || le64_to_cpu(sb->transaction_id) > best) {
+				best = le64_to_cpu(sb->transaction_id);
+				slot = i;
+			}
+			found = 1;
+		}
+
+		if (!block_is_zero(sb))
+			blank = 0;
+	}
+
+	if (!found) {
+		if (!blank) {
+			DMERR("metadata device has no valid superblock");
+			return -EINVAL;
+		}
+
+		pool->transaction_id = 0;
+		pool->dirty = 1;
+		return pool_commit(pool);
+	}
+
+	r = metadata_io(pool, slot, READ, sb);
+	if (r)
+		return r;
+
+	return load_superblock(pool, sb);
+}
+
+/*-----------------------------------------------------------------
+ * Bio processing
+ *---------------------------------------------------------------*/
+static void wake_worker(struct pool *pool)
+{
+	queue_work(pool->wq, &pool->worker);
+}
+
+static void defer_bio(struct pool *pool, struct bio *bio)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&pool->lock, flags);
+	bio_list_add(&pool->deferred_bios, bio);
+	spin_unlock_irqrestore(&pool->lock, flags);
+
+	wake_worker(pool);
+}
+
+static dm_block_t get_bio_block(struct thin_c *tc, struct bio *bio)
+{
+	return (bio->bi_sector - tc->ti->begin) >> tc->pool->block_shift;
+}
+
+static void remap(struct thin_c *tc, struct bio *bio, dm_block_t block)
+{
+	struct pool *pool = tc->pool;
+	sector_t offset = bio->bi_sector - tc->ti->begin;
+
+	bio->bi_bdev = pool->data_bdev;
+	bio->bi_sector = (block << pool->block_shift) +
+			 (offset & (pool->block_size - 1));
+}
+
+static void remap_and_issue(struct thin_c *tc, struct bio *bio,
+			    dm_block_t block)
+{
+	remap(tc, bio, block);
+	generic_make_request(bio);
+}
+
+static int io_overwrites_block(struct pool *pool, struct bio *bio)
+{
+	return bio_data_dir(bio) == WRITE &&
+		bio->bi_size == (pool->block_size << SECTOR_SHIFT);
+}
+
+static void complete_mapping(struct new_mapping *m, int err)
+{
+	struct pool *pool = m->tc->pool;
+	unsigned long flags;
+
+	m->err = err;
+
+	spin_lock_irqsave(&pool->lock, flags);
+	list_add_tail(&m->prepared, &pool->prepared_mappings);
+	spin_unlock_irqrestore(&pool->lock, flags);
+
+	wake_worker(pool);
+}
+
+static void copy_complete(int read_err, unsigned long write_err, void *context)
+{
+	complete_mapping(context, (read_err || write_err) ? -EIO : 0);
+}
+
+static void zero_complete(unsigned long error, void *context)
+{
+	complete_mapping(context, error ? -EIO : 0);
+}
+
+/*
+ * A write covering the whole block needs no zeroing or copying, but
+ * the block is only mapped once the write has completed.
+ */
+static void overwrite_endio(struct bio *bio, int err)
+{
+	struct new_mapping *m = bio->bi_private;
+
+	bio->bi_end_io = m->saved_bi_end_io;
+	bio->bi_private = m->saved_bi_private;
+	complete_mapping(m, err);
+}
+
+static void copy_block(struct pool *pool, dm_block_t from,
+		       struct new_mapping *m)
+{
+	struct dm_io_region src, dest;
+
+	src.bdev = pool->data_bdev;
+	src.sector = from << pool->block_shift;
+	src.count = pool->block_size;
+
+	dest.bdev = pool->data_bdev;
+	dest.sector = m->data_block << pool->block_shift;
+	dest.count = pool->block_size;
+
+	dm_kcopyd_copy(pool->copier, &src, 1, &dest, 0, copy_complete, m);
+}
+
+/*
+ * A block that is only partially written must not expose whatever
+ * was left on the disk, so it is zeroed first.  zero_page is a list
+ * that loops back on itself, so dm-io writes the zero page over and
+ * over again.
+ */
+static void zero_block(struct pool *pool, struct new_mapping *m)
+{
+	struct dm_io_region region = {
+		.bdev = pool->data_bdev,
+		.sector = m->data_block << pool->block_shift,
+		.count = pool->block_size,
+	};
+	struct dm_io_request io_req = {
+		.bi_rw = WRITE,
+		.mem.type = DM_IO_PAGE_LIST,
+		.mem.ptr.pl = &pool->zero_page,
+		.mem.offset = 0,
+		.notify.fn = zero_complete,
+		.notify.context = m,
+		.client = pool->io_client,
+	};
+
+	dm_io(&io_req, 1, &region, NULL);
+}
+
+static struct new_mapping *find_mapping(struct pool *pool,
+					struct thin_dev *td, dm_block_t block)
+{
+	struct new_mapping *m;
+
+	list_for_each_entry(m, &pool->in_progress, list)
+		if (m->tc->td == td && m->virt_block == block)
+			return m;
+
+	return NULL;
+}
+
+static void process_bio(struct thin_c *tc, struct bio *bio)
+{
+	struct pool *pool = tc->pool;
+	dm_block_t block = get_bio_block(tc, bio), data, new;
+	struct new_mapping *m;
+	int r, mapped, shared;
+
+	m = find_mapping(pool, tc->td, block);
+	if (m) {
+		bio_list_add(&m->bios, bio);
+		return;
+	}
+
+	down_write(&pool->root_lock);
+
+	if (bio_barrier(bio)) {
+		r = pool_commit(pool);
+		if (r) {
+			up_write(&pool->root_lock);
+			bio_endio(bio, r);
+			return;
+		}
+	}
+
+	mapped = !find_block(pool, tc->td, block, &data, &shared);
+
+	if (mapped && (bio_data_dir(bio) == READ || !shared)) {
+		up_write(&pool->root_lock);
+		remap_and_issue(tc, bio, data);
+		return;
+	}
+
+	if (!mapped && bio_data_dir(bio) == READ) {
+		up_write(&pool->root_lock);
+		zero_fill_bio(bio);
+		bio_endio(bio, 0);
+		return;
+	}
+
+	/*
+	 * A write to an unmapped or shared block needs a new data block.
+	 */
+	r = sm_new_block(&pool->data_sm, &new);
+	if (r) {
+		up_write(&pool->root_lock);
+		DMERR_LIMIT("%s: no free data space",
+			    dm_device_name(pool->pool_md));
+		bio_endio(bio, r);
+		return;
+	}
+
+	up_write(&pool->root_lock);
+
+	m = mempool_alloc(pool->mapping_pool, GFP_NOIO);
+	m->tc = tc;
+	m->virt_block = block;
+	m->data_block = new;
+	m->err = 0;
+	m->bio = bio;
+	bio_list_init(&m->bios);
+	m->saved_bi_end_io = NULL;
+	list_add(&m->list, &pool->in_progress);
+
+	if (io_overwrites_block(pool, bio)) {
+		m->saved_bi_end_io = bio->bi_end_io;
+		m->saved_bi_private = bio->bi_private;
+		bio->bi_end_io = overwrite_endio;
+		bio->bi_private = m;
+		remap_and_issue(tc, bio, new);
+	} else if (mapped)
+		copy_block(pool, data, m);
+	else
+		zero_block(pool, m);
+}
+
+static void process_prepared_mappings(struct pool *pool)
+{
+	struct new_mapping *m, *tmp;
+	struct list_head maps;
+	unsigned long flags;
+	int r;
+
+	INIT_LIST_HEAD(&maps);
+	spin_lock_irqsave(&pool->lock, flags);
+	list_splice_init(&pool->prepared_mappings, &maps);
+	spin_unlock_irqrestore(&pool->lock, flags);
+
+	list_for_each_entry_safe(m, tmp, &maps, prepared) {
+		down_write(&pool->root_lock);
+		r = m->err;
+		if (!r)
+			r = insert_block(pool, m->tc->td, m->virt_block,
+					 m->data_block);
+		if (r)
+			sm_dec(&pool->data_sm, m->data_block);
+		up_write(&pool->root_lock);
+
+		list_del(&m->list);
+
+		if (r)
+			bio_endio(m->bio, r);
+		else if (m->saved_bi_end_io)
+			/* The data is already there */
+			bio_endio(m->bio, 0);
+		else
+			remap_and_issue(m->tc, m->bio, m->data_block);
+
+		/* Whatever queued up behind the mapping goes round again */
+		spin_lock_irqsave(&pool->lock, flags);
+		bio_list_merge(&pool->deferred_bios, &m->bios);
+		spin_unlock_irqrestore(&pool->lock, flags);
+
+		mempool_free(m, pool->mapping_pool);
+	}
+}
+
+static void process_deferred_bios(struct pool *pool)
+{
+	struct bio_list bios;
+	struct bio *bio;
+	unsigned long flags;
+
+	bio_list_init(&bios);
+
+	spin_lock_irqsave(&pool->lock, flags);
+	bio_list_merge(&bios, &pool->deferred_bios);
+	bio_list_init(&pool->deferred_bios);
+	spin_unlock_irqrestore(&pool->lock, flags);
+
+	while ((bio = bio_list_pop(&bios)))
+		process_bio(dm_get_mapinfo(bio)->ptr, bio);
+}
+
+static void do_worker(struct work_struct *ws)
+{
+	struct pool *pool = container_of(ws, struct pool, worker);
+
+	process_prepared_mappings(pool);
+	process_deferred_bios(pool);
+}
+
+/*
+ * Commit periodically so that little provisioning is lost in a crash.
+ */
+static void do_waker(struct work_struct *ws)
+{
+	struct pool *pool = container_of(to_delayed_work(ws), struct pool,
+					 waker);
+
+	down_write(&pool->root_lock);
+	pool_commit(pool);
+	up_write(&pool->root_lock);
+
+	queue_delayed_work(pool->wq, &pool->waker, COMMIT_PERIOD);
+}
+
+/*-----------------------------------------------------------------
+ * Pool objects
+ *---------------------------------------------------------------*/
+static LIST_HEAD(_pools);
+static DEFINE_MUTEX(_pools_lock);
+
+static struct pool *__pool_table_lookup(struct mapped_device *md)
+{
+	struct pool *pool;
+
+	list_for_each_entry(pool, &_pools, list)
+		if (pool->pool_md == md)
+			return pool;
+
+	return NULL;
+}
+
+static void pool_destroy(struct pool *pool)
+{
+	cancel_delayed_work_sync(&pool->waker);
+	destroy_workqueue(pool->wq);
+
+	down_write(&pool->root_lock);
+	pool_commit(pool);
+	up_write(&pool->root_lock);
+
+	free_metadata(pool);
+	mempool_destroy(pool->mapping_pool);
+	dm_kcopyd_client_destroy(pool->copier);
+	dm_io_client_destroy(pool->io_client);
+	sm_destroy(&pool->data_sm);
+	sm_destroy(&pool->metadata_sm);
+	kfree(pool->sb_buf);
+	kfree(pool);
+}
+
+static void __pool_dec(struct pool *pool)
+{
+	if (--pool->ref_count)
+		return;
+
+	list_del(&pool->list);
+	pool_destroy(pool);
+}
+
+static struct pool *pool_create(struct mapped_device *pool_md,
+				struct block_device *metadata_bdev,
+				struct block_device *data_bdev,
+				unsigned long block_size, char **error)
+{
+	struct pool *pool;
+	dm_block_t nr_blocks;
+	int r = -ENOMEM;
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (!pool) {
+		*error = "Error allocating memory for pool";
+		return ERR_PTR(-ENOMEM);
+	}
+
+	pool->pool_md = pool_md;
+	pool->ref_count = 1;
+	pool->metadata_bdev = metadata_bdev;
+	pool->data_bdev = data_bdev;
+	pool->block_size = block_size;
+	pool->block_shift = __ffs(block_size);
+
+	init_rwsem(&pool->root_lock);
+	INIT_LIST_HEAD(&pool->thin_devs);
+	INIT_RADIX_TREE(&pool->nodes, GFP_ATOMIC);
+
+	spin_lock_init(&pool->lock);
+	bio_list_init(&pool->deferred_bios);
+	INIT_LIST_HEAD(&pool->prepared_mappings);
+	INIT_LIST_HEAD(&pool->in_progress);
+	INIT_WORK(&pool->worker, do_worker);
+	INIT_DELAYED_WORK(&pool->waker, do_waker);
+
+	pool->zero_page.next = &pool->zero_page;
+	pool->zero_page.page = ZERO_PAGE(0);
+
+	pool->sb_buf = kmalloc(METADATA_BLOCK_SIZE, GFP_KERNEL);
+	if (!pool->sb_buf) {
+		*error = "Error allocating superblock buffer";
+		goto bad_sb;
+	}
+
+	nr_blocks = i_size_read(metadata_bdev->bd_inode) >>
+		    METADATA_BLOCK_SHIFT;
+	if (nr_blocks > MAX_METADATA_BLOCKS)
+		nr_blocks = MAX_METADATA_BLOCKS;
+	if (nr_blocks <= NR_SUPERBLOCKS) {
+		*error = "Metadata device too small";
+		r = -EINVAL;
+		goto bad_metadata_sm;
+	}
+
+	r = sm_create(&pool->metadata_sm, nr_blocks, NR_SUPERBLOCKS);
+	if (r) {
+		*error = "Error creating metadata space map";
+		goto bad_metadata_sm;
+	}
+
+	nr_blocks = (i_size_read(data_bdev->bd_inode) >> SECTOR_SHIFT) >>
+		    pool->block_shift;
+	r = sm_create(&pool->data_sm, nr_blocks, 0);
+	if (r) {
+		*error = "Error creating data space map";
+		goto bad_data_sm;
+	}
+
+	pool->io_client = dm_io_client_create(THIN_IO_PAGES);
+	if (IS_ERR(pool->io_client)) {
+		r = PTR_ERR(pool->io_client);
+		*error = "Error creating pool's io client";
+		goto bad_io_client;
+	}
+
+	r = dm_kcopyd_client_create(THIN_COPY_PAGES, &pool->copier);
+	if (r) {
+		*error = "Error creating pool's kcopyd client";
+		goto bad_kcopyd_client;
+	}
+
+	pool->mapping_pool = mempool_create_slab_pool(MIN_MAPPINGS,
+						      _mapping_cache);
+	if (!pool->mapping_pool) {
+		r = -ENOMEM;
+		*error = "Error creating pool's mapping mempool";
+		goto bad_mapping_pool;
+	}
+
+	pool->wq = create_singlethread_workqueue("kthind");
+	if (!pool->wq) {
+		r = -ENOMEM;
+		*error = "Error creating pool's workqueue";
+		goto bad_wq;
+	}
+
+	r = open_metadata(pool);
+	if (r) {
+		*error = "Error opening metadata";
+		goto bad_metadata;
+	}
+
+	return pool;
+
+bad_metadata:
+	free_metadata(pool);
+	destroy_workqueue(pool->wq);
+bad_wq:
+	mempool_destroy(pool->mapping_pool);
+bad_mapping_pool:
+	dm_kcopyd_client_destroy(pool->copier);
+bad_kcopyd_client:
+	dm_io_client_destroy(pool->io_client);
+bad_io_client:
+	sm_destroy(&pool->data_sm);
+bad_data_sm:
+	sm_destroy(&pool->metadata_sm);
+bad_metadata_sm:
+	kfree(pool->sb_buf);
+bad_sb:
+	kfree(pool);
+	return ERR_PTR(r);
+}
+
+/*-----------------------------------------------------------------
+ * Pool target methods
+ *---------------------------------------------------------------*/
+
+/*
+ * thin-pool <metadata dev> <data dev> <data block size (sectors)>
+ */
+static int pool_ctr(struct dm_target *ti, unsigned argc, char **argv)
+{
+	struct pool_c *pt;
+	struct pool *pool;
+	struct mapped_device *md;
+	unsigned long block_size;
+	int r;
+
+	if (argc != 3) {
+		ti->error = "Invalid argument count";
+		return -EINVAL;
+	}
+
+	if (sscanf(argv[2], "%lu", &block_size) != 1 ||
+	    block_size < MIN_BLOCK_SIZE || block_size > MAX_BLOCK_SIZE ||
+	    (block_size & (block_size - 1))) {
+		ti->error = "Invalid data block size";
+		return -EINVAL;
+	}
+
+	pt = kzalloc(sizeof(*pt), GFP_KERNEL);
+	if (!pt) {
+		ti->error = "Error allocating pool context";
+		return -ENOMEM;
+	}
+
+	r = dm_get_device(ti, argv[0], 0, 0, FMODE_READ | FMODE_WRITE,
+			  &pt->metadata_dev);
+	if (r) {
+		ti->error = "Error opening metadata device";
+		goto bad_metadata_dev;
+	}
+
+	r = dm_get_device(ti, argv[1], 0, ti->len, FMODE_READ | FMODE_WRITE,
+			  &pt->data_dev);
+	if (r) {
+		ti->error = "Error opening data device";
+		goto bad_data_dev;
+	}
+
+	md = dm_table_get_md(ti->table);
+
+	mutex_lock(&_pools_lock);
+	pool = __pool_table_lookup(md);
+	if (pool) {
+		if (pool->metadata_bdev != pt->metadata_dev->bdev ||
+		    pool->data_bdev != pt->data_dev->bdev ||
+		    pool->block_size != block_size) {
+			ti->error = "Pool is already active with other devices";
+			r = -EINVAL;
+			goto bad_pool;
+		}
+		pool->ref_count++;
+	} else {
+		pool = pool_create(md, pt->metadata_dev->bdev,
+				   pt->data_dev->bdev, block_size, &ti->error);
+		if (IS_ERR(pool)) {
+			r = PTR_ERR(pool);
+			goto bad_pool;
+		}
+		list_add(&pool->list, &_pools);
+	}
+	mutex_unlock(&_pools_lock);
+	dm_put(md);
+
+	pt->pool = pool;
+	ti->split_io = block_size;
+	ti->private = pt;
+
+	return 0;
+
+bad_pool:
+	mutex_unlock(&_pools_lock);
+	dm_put(md);
+	dm_put_device(ti, pt->data_dev);
+bad_data_dev:
+	dm_put_device(ti, pt->metadata_dev);
+bad_metadata_dev:
+	kfree(pt);
+	return r;
+}
+
+static void pool_dtr(struct dm_target *ti)
+{
+	struct pool_c *pt = ti->private;
+
+	mutex_lock(&_pools_lock);
+	__pool_dec(pt->pool);
+	mutex_unlock(&_pools_lock);
+
+	dm_put_device(ti, pt->data_dev);
+	dm_put_device(ti, pt->metadata_dev);
+	kfree(pt);
+}
+
+static int pool_map(struct dm_target *ti, struct bio *bio,
+		    union map_info *map_context)
+{
+	struct pool_c *pt = ti->private;
+
+	bio->bi_bdev = pt->data_dev->bdev;
+	bio->bi_sector = bio->bi_sector - ti->begin;
+
+	return DM_MAPIO_REMAPPED;
+}
+
+static void pool_postsuspend(struct dm_target *ti)
+{
+	struct pool_c *pt = ti->private;
+	struct pool *pool = pt->pool;
+
+	cancel_delayed_work_sync(&pool->waker);
+	flush_workqueue(pool->wq);
+
+	down_write(&pool->root_lock);
+	pool_commit(pool);
+	up_write(&pool->root_lock);
+}
+
+static void pool_resume(struct dm_target *ti)
+{
+	struct pool_c *pt = ti->private;
+	struct pool *pool = pt->pool;
+
+	queue_delayed_work(pool->wq, &pool->waker, COMMIT_PERIOD);
+}
+
+/*
+ * Messages supported:
+ *   create_thin <dev id>
+ *   create_snap <dev id> <origin id>
+ *   delete <dev id>
+ */
+static int pool_message(struct dm_target *ti, unsigned argc, char **argv)
+{
+	struct pool_c *pt = ti->private;
+	struct pool *pool = pt->pool;
+	unsigned long long dev_id, origin_id;
+	int r;
+
+	if (argc < 2 || sscanf(argv[1], "%llu", &dev_id) != 1)
+		goto bad;
+
+	down_write(&pool->root_lock);
+
+	if (argc == 2 && !strnicmp(argv[0], MESG_STR("create_thin")))
+		r = create_thin(pool, dev_id, NULL);
+	else if (argc == 3 && !strnicmp(argv[0], MESG_STR("create_snap")) &&
+		 sscanf(argv[2], "%llu", &origin_id) == 1)
+		r = create_snap(pool, dev_id, origin_id);
+	else if (argc == 2 && !strnicmp(argv[0], MESG_STR("delete")))
+		r = delete_thin(pool, dev_id);
+	else {
+		up_write(&pool->root_lock);
+		goto bad;
+	}
+
+	if (!r)
+		r = pool_commit(pool);
+
+	up_write(&pool->root_lock);
+
+	return r;
+
+bad:
+	DMWARN("Unrecognised thin pool message received.");
+	return -EINVAL;
+}
+
+/*
+ * Status line is:
+ *    <transaction id> <used metadata blocks>/<total metadata blocks>
+ *    <used data blocks>/<total data blocks>
+ */
+static int pool_status(struct dm_target *ti, status_type_t type,
+		       char *result, unsigned maxlen)
+{
+	struct pool_c *pt = ti->private;
+	struct pool *pool = pt->pool;
+	unsigned sz = 0;
+
+	switch (type) {
+	case STATUSTYPE_INFO:
+		down_read(&pool->root_lock);
+		DMEMIT("%llu %llu/%llu %llu/%llu",
+		       (unsigned long long) pool->transaction_id,
+		       (unsigned long long) pool->metadata_sm.nr_allocated,
+		       (unsigned long long) pool->metadata_sm.nr_blocks,
+		       (unsigned long long) pool->data_sm.nr_allocated,
+		       (unsigned long long) pool->data_sm.nr_blocks);
+		up_read(&pool->root_lock);
+		break;
+
+	case STATUSTYPE_TABLE:
+		DMEMIT("%s %s %lu", pt->metadata_dev->name,
+		       pt->data_dev->name, pool->block_size);
+		break;
+	}
+
+	return 0;
+}
+
+static struct target_type pool_target = {
+	.name = "thin-pool",
+	.module = THIS_MODULE,
+	.version = {1, 0, 0},
+	.ctr = pool_ctr,
+	.dtr = pool_dtr,
+	.map = pool_map,
+	.postsuspend = pool_postsuspend,
+	.resume = pool_resume,
+	.message = pool_message,
+	.status = pool_status,
+};
+
+/*-----------------------------------------------------------------
+ * Thin target methods
+ *---------------------------------------------------------------*/
+
+/*
+ * thin <pool dev> <dev id>
+ */
+static int thin_ctr(struct dm_target *ti, unsigned argc, char **argv)
+{
+	struct thin_c *tc;
+	struct pool *pool;
+	struct thin_dev *td;
+	struct mapped_device *pool_md;
+	unsigned long long dev_id;
+	int r;
+
+	if (argc != 2) {
+		ti->error = "Invalid argument count";
+		return -EINVAL;
+	}
+
+	if (sscanf(argv[1], "%llu", &dev_id) != 1) {
+		ti->error = "Invalid device id";
+		return -EINVAL;
+	}
+
+	tc = kzalloc(sizeof(*tc), GFP_KERNEL);
+	if (!tc) {
+		ti->error = "Error allocating thin context";
+		return -ENOMEM;
+	}
+
+	r = dm_get_device(ti, argv[0], 0, 0, dm_table_get_mode(ti->table),
+			  &tc->pool_dev);
+	if (r) {
+		ti->error = "Error opening pool device";
+		goto bad_pool_dev;
+	}
+
+	pool_md = dm_get_md(tc->pool_dev->bdev->bd_dev);
+	if (!pool_md) {
+		ti->error = "Pool device is not a mapped device";
+		r = -EINVAL;
+		goto bad_pool_md;
+	}
+
+	mutex_lock(&_pools_lock);
+
+	pool = __pool_table_lookup(pool_md);
+	if (!pool) {
+		ti->error = "Couldn't find pool object";
+		r = -EINVAL;
+		goto bad_pool;
+	}
+
+	down_write(&pool->root_lock);
+	td = find_thin_dev(pool, dev_id);
+	if (!td) {
+		up_write(&pool->root_lock);
+		ti->error = "Thin device doesn't exist";
+		r = -ENODEV;
+		goto bad_pool;
+	}
+	td->open_count++;
+	up_write(&pool->root_lock);
+
+	if (((ti->len - 1) >> pool->block_shift) >= MAX_VIRT_BLOCKS) {
+		ti->error = "Thin device too large";
+		r = -EINVAL;
+		goto bad_size;
+	}
+
+	pool->ref_count++;
+	mutex_unlock(&_pools_lock);
+	dm_put(pool_md);
+
+	tc->ti = ti;
+	tc->pool = pool;
+	tc->td = td;
+
+	ti->split_io = pool->block_size;
+	ti->private = tc;
+
+	return 0;
+
+bad_size:
+	down_write(&pool->root_lock);
+	td->open_count--;
+	up_write(&pool->root_lock);
+bad_pool:
+	mutex_unlock(&_pools_lock);
+	dm_put(pool_md);
+bad_pool_md:
+	dm_put_device(ti, tc->pool_dev);
+bad_pool_dev:
+	kfree(tc);
+	return r;
+}
+
+static void thin_dtr(struct dm_target *ti)
+{
+	struct thin_c *tc = ti->private;
+	struct pool *pool = tc->pool;
+
+	mutex_lock(&_pools_lock);
+
+	down_write(&pool->root_lock);
+	tc->td->open_count--;
+	up_write(&pool->root_lock);
+
+	__pool_dec(pool);
+	mutex_unlock(&_pools_lock);
+
+	dm_put_device(ti, tc->pool_dev);
+	kfree(tc);
+}
+
+/*
+ * Only what can be done without blocking is done here: remapping
+ * to a block we may write to, and reads of unmapped blocks.  Anything
+ * else goes to the pool's worker.
+ */
+static int thin_map(struct dm_target *ti, struct bio *bio,
+		    union map_info *map_context)
+{
+	struct thin_c *tc = ti->private;
+	struct pool *pool = tc->pool;
+	dm_block_t block = get_bio_block(tc, bio), result;
+	int r, shared;
+
+	map_context->ptr = tc;
+
+	/* Barriers must commit the metadata first */
+	if (bio_barrier(bio) || !down_read_trylock(&pool->root_lock)) {
+		defer_bio(pool, bio);
+		return DM_MAPIO_SUBMITTED;
+	}
+
+	r = find_block(pool, tc->td, block, &result, &shared);
+	up_read(&pool->root_lock);
+
+	if (!r && (bio_data_dir(bio) == READ || !shared)) {
+		remap(tc, bio, result);
+		return DM_MAPIO_REMAPPED;
+	}
+
+	if (r && bio_data_dir(bio) == READ) {
+		zero_fill_bio(bio);
+		bio_endio(bio, 0);
+		return DM_MAPIO_SUBMITTED;
+	}
+
+	defer_bio(pool, bio);
+	return DM_MAPIO_SUBMITTED;
+}
+
+static int thin_status(struct dm_target *ti, status_type_t type,
+		       char *result, unsigned maxlen)
+{
+	struct thin_c *tc = ti->private;
+	struct pool *pool = tc->pool;
+	unsigned sz = 0;
+
+	switch (type) {
+	case STATUSTYPE_INFO:
+		down_read(&pool->root_lock);
+		DMEMIT("%llu", (unsigned long long)
+		       tc->td->mapped_blocks << pool->block_shift);
+		up_read(&pool->root_lock);
+		break;
+
+	case STATUSTYPE_TABLE:
+		DMEMIT("%s %llu", tc->pool_dev->name,
+		       (unsigned long long) tc->td->dev_id);
+		break;
+	}
+
+	return 0;
+}
+
+static struct target_type thin_target = {
+	.name = "thin",
+	.module = THIS_MODULE,
+	.version = {1, 0, 0},
+	.ctr = thin_ctr,
+	.dtr = thin_dtr,
+	.map = thin_map,
+	.status = thin_status,
+};
+
+/*-----------------------------------------------------------------*/
+
+static int __init dm_thin_init(void)
+{
+	int r;
+
+	BUILD_BUG_ON(sizeof(struct disk_superblock) > METADATA_BLOCK_SIZE);
+
+	_mapping_cache = KMEM_CACHE(new_mapping, 0);
+	if (!_mapping_cache)
+		return -ENOMEM;
+
+	r = dm_register_target(&thin_target);
+	if (r) {
+		DMERR("thin target register failed %d", r);
+		goto bad_thin_target;
+	}
+
+	r = dm_register_target(&pool_target);
+	if (r) {
+		DMERR("pool target register failed %d", r);
+		goto bad_pool_target;
+	}
+
+	return 0;
+
+bad_pool_target:
+	dm_unregister_target(&thin_target);
+bad_thin_target:
+	kmem_cache_destroy(_mapping_cache);
+	return r;
+}
+
+static void __exit dm_thin_exit(void)
+{
+	dm_unregister_target(&thin_target);
+	dm_unregister_target(&pool_target);
+	kmem_cache_destroy(_mapping_cache);
+}
+
+module_init(dm_thin_init);
+module_exit(dm_thin_exit);
+
+MODULE_DESCRIPTION(DM_NAME " thin provisioning target");
+MODULE_LICENSE("GPL");
@@ -1306,6 +1306,12 @@ static int super_1_validate(mddev_t *mddev, mdk_rdev_t *rdev)
 			mddev->new_chunk = mddev->chunk_size;
 		}
 
+		if ((le32_to_cpu(sb->feature_map) & MD_FEATURE_JOURNAL))
+			mddev->journal_dev =
+				new_decode_dev(le32_to_cpu(sb->journal_dev));
+		else
+			mddev->journal_dev = 0;
+
 	} else if (mddev->pers == NULL) {
 		/* Insist of good event counter while assembling */
 		++ev1;
@@ -1405,6 +1411,12 @@ static void super_1_sync(mddev_t *mddev, mdk_rdev_t *rdev)
 		sb->new_chunk = cpu_to_le32(mddev->new_chunk>>9);
 	}
 
+	if (mddev->journal_dev) {
+		sb->feature_map |= cpu_to_le32(MD_FEATURE_JOURNAL);
+		sb->journal_dev = cpu_to_le32(new_encode_dev(mddev->journal_dev));
+	} else
+		sb->journal_dev = 0;
+
 	max_dev = 0;
 	list_for_each_entry(rdev2, &mddev->disks, same_set)
 		if (rdev2->desc_nr+1 > max_dev)
@@ -1891,7 +1903,7 @@ static void sync_sbs(mddev_t * mddev, int nospares)
 	}
 }
 
-static void md_update_sb(mddev_t * mddev, int force_change)
+void md_update_sb(mddev_t * mddev, int force_change)
 {
 	mdk_rdev_t *rdev;
 	int sync_req;
@@ -2024,6 +2036,7 @@ repeat:
 		sysfs_notify(&mddev->kobj, NULL, "sync_completed");
 
 }
+EXPORT_SYMBOL_GPL(md_update_sb);
 
 /* words written to sysfs files may, or may not, be \n terminated.
  * We want to accept with case. For this we use cmd_match.
@@ -3438,6 +3451,28 @@ sync_max_store(mddev_t *mddev, const char *buf, size_t len)
 static struct md_sysfs_entry md_sync_max =
 __ATTR(sync_speed_max, S_IRUGO|S_IWUSR, sync_max_show, sync_max_store);
 
+static ssize_t
+sync_latency_show(mddev_t *mddev, char *page)
+{
+	return sprintf(page, "%d\n", mddev->sync_latency_target);
+}
+
+static ssize_t
+sync_latency_store(mddev_t *mddev, const char *buf, size_t len)
+{
+	int target;
+	char *e;
+	target = simple_strtoul(buf, &e, 10);
+	if (buf == e || (*e && *e != '\n') || target < 0)
+		return -EINVAL;
+	mddev->sync_latency_target = target;
+	return len;
+}
+
+static struct md_sysfs_entry md_sync_latency =
+__ATTR(sync_latency_target, S_IRUGO|S_IWUSR,
+       sync_latency_show, sync_latency_store);
+
 static ssize_t
 degraded_show(mddev_t *mddev, char *page)
 {
@@ -3739,6 +3774,7 @@ static struct attribute *md_redundancy_attrs[] = {
 	&md_mismatches.attr,
 	&md_sync_min.attr,
 	&md_sync_max.attr,
+	&md_sync_latency.attr,
 	&md_sync_speed.attr,
 	&md_sync_force_parallel.attr,
 	&md_sync_completed.attr,
@@ -4402,6 +4438,7 @@ static int do_md_stop(mddev_t * mddev, int mode, int is_open)
 		mddev->resync_min = 0;
 		mddev->resync_max = MaxSector;
 		mddev->reshape_position = MaxSector;
+		mddev->journal_dev = 0;
 		mddev->external = 0;
 		mddev->persistent = 0;
 		mddev->level = LEVEL_NONE;
@@ -4422,6 +4459,7 @@ static int do_md_stop(mddev_t * mddev, int mode, int is_open)
 		mddev->resync_mismatches = 0;
 		mddev->suspend_lo = mddev->suspend_hi = 0;
 		mddev->sync_speed_min = mddev->sync_speed_max = 0;
+		mddev->sync_latency_target = 0;
 		mddev->recovery = 0;
 		mddev->in_sync = 0;
 		mddev->changed = 0;
@@ -6099,6 +6137,60 @@ static int is_mddev_idle(mddev_t *mddev, int init)
 	return idle;
 }
 
+/*
+ * Average msec the requests that completed on the member disks since
+ * the last call took, 0 if there were none.  Resync IO is included;
+ * what matters is how long other IO queued behind it has to wait.
+ */
+static unsigned int mddev_io_latency(mddev_t *mddev)
+{
+	mdk_rdev_t *rdev;
+	unsigned long ticks = 0, ios = 0;
+	unsigned long curr_ticks, curr_ios;
+
+	rcu_read_lock();
+	rdev_for_each_rcu(rdev, mddev) {
+		struct gendisk *disk = rdev->bdev->bd_contains->bd_disk;
+		curr_ticks = part_stat_read(&disk->part0, ticks[0]) +
+			     part_stat_read(&disk->part0, ticks[1]);
+		curr_ios = part_stat_read(&disk->part0, ios[0]) +
+			   part_stat_read(&disk->part0, ios[1]);
+		ticks += curr_ticks - rdev->last_ticks;
+		ios += curr_ios - rdev->last_ios;
+		rdev->last_ticks = curr_ticks;
+		rdev->last_ios = curr_ios;
+	}
+	rcu_read_unlock();
+	return ios ? jiffies_to_msecs(ticks) / ios : 0;
+}
+
+#define SYNC_DELAY_MIN	10	/* msec */
+#define SYNC_DELAY_MAX	500
+
+/*
+ * Resync is competing with other IO.  Without a latency target it
+ * backs off for half a second.  With one it carries on while the
+ * member disks meet the target, and backs off for twice as long each
+ * time in a row they miss it.  Returns 1 if it slept.
+ */
+static int sync_throttle(mddev_t *mddev)
+{
+	if (!mddev->sync_latency_target) {
+		msleep(SYNC_DELAY_MAX);
+		return 1;
+	}
+
+	if (mddev_io_latency(mddev) <= mddev->sync_latency_target) {
+		mddev->sync_delay /= 2;
+		return 0;
+	}
+
+	mddev->sync_delay = clamp(mddev->sync_delay * 2,
+				  SYNC_DELAY_MIN, SYNC_DELAY_MAX);
+	msleep(mddev->sync_delay);
+	return 1;
+}
+
 void md_done_sync(mddev_t *mddev, int blocks, int ok)
 {
 	/* another "blocks" (512byte) blocks have been synced */
@@ -6334,6 +6426,8 @@ void md_do_sync(mddev_t *mddev)
 	       speed_max(mddev), desc);
 
 	is_mddev_idle(mddev, 1); /* this initializes IO event counters */
+	mddev_io_latency(mddev); /* ... and the latency sample */
+	mddev->sync_delay = 0;
 
 	io_sectors = 0;
 	for (m = 0; m < SYNC_MARKS; m++) {
@@ -6452,11 +6546,12 @@ void md_do_sync(mddev_t *mddev)
 			/((jiffies-mddev->resync_mark)/HZ +1) +1;
 
 		if (currspeed > speed_min(mddev)) {
-			if ((currspeed > speed_max(mddev)) ||
-					!is_mddev_idle(mddev, 0)) {
+			if (currspeed > speed_max(mddev)) {
 				msleep(500);
 				goto repeat;
 			}
+			if (!is_mddev_idle(mddev, 0) && sync_throttle(mddev))
+				goto repeat;
 		}
 	}
 	printk(KERN_INFO "md: %s: %s done.\n",mdname(mddev), desc);
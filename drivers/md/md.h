@@ -46,6 +46,8 @@ struct mdk_rdev_s
 	sector_t sectors;		/* Device size (in 512bytes sectors) */
 	mddev_t *mddev;			/* RAID array if running */
 	int last_events;		/* IO event timestamp */
+	unsigned long last_ticks;	/* IO time and count at the last */
+	unsigned long last_ios;		/* resync latency sample */
 
 	struct block_device *bdev;	/* block device handle */
 
@@ -168,6 +170,11 @@ struct mddev_s
 	sector_t			reshape_position;
 	int				delta_disks, new_level, new_layout, new_chunk;
 
+	/* raid4/5/6 journal device, 0 if none.  Written to the superblock
+	 * so the journal is replayed when the array is next assembled.
+	 */
+	dev_t				journal_dev;
+
 	struct mdk_thread_s		*thread;	/* management thread */
 	struct mdk_thread_s		*sync_thread;	/* doing resync or reconstruct */
 	sector_t			curr_resync;	/* last block scheduled */
@@ -194,6 +201,10 @@ struct mddev_s
 	/* if zero, use the system-wide default */
 	int				sync_speed_min;
 	int				sync_speed_max;
+	/* if non-zero, resync yields to other IO only while the member
+	 * disks take longer than this many msec per request */
+	int				sync_latency_target;
+	int				sync_delay;	/* current backoff, msec */
 
 	/* resync even though the same disks are shared among md-devices */
 	int				parallel_resync;
@@ -435,6 +446,7 @@ extern int sync_page_io(struct block_device *bdev, sector_t sector, int size,
 extern void md_do_sync(mddev_t *mddev);
 extern void md_new_event(mddev_t *mddev);
 extern int md_allow_write(mddev_t *mddev);
+extern void md_update_sb(mddev_t *mddev, int force_change);
 extern void md_wait_for_blocked_rdev(mdk_rdev_t *rdev, mddev_t *mddev);
 extern void md_set_array_sectors(mddev_t *mddev, sector_t array_sectors);
 
@@ -0,0 +1,1415 @@
+/*
+ * raid5-cache.c : journal and write-back cache for raid4/5/6
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * You should have received a copy of the GNU General Public License
+ * (for example /usr/src/linux/COPYING); if not, write to the Free
+ * Software Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+ */
+
+/*
+ * A small write to a raid4/5/6 array costs a read-modify-write of the
+ * parity, and a crash in the middle of it can leave the parity wrong
+ * (the "write hole").  With a journal device, typically an SSD, writes
+ * are handled differently:
+ *
+ * - the data is copied into the cache, which is organised by stripe, and
+ *   appended to the journal as a record.  The bio completes as soon as
+ *   the record is on the journal.
+ * - a stripe is written to the array when all its data blocks are in
+ *   the cache, as a full stripe write which needs no reads, or when the
+ *   journal or the cache runs short of space, oldest first.
+ * - reads, and anything else that bypasses the cache, first wait for
+ *   the cached stripes they touch to be written to the array.
+ *
+ * The journal is a ring.  A record can be reused once every stripe
+ * first dirtied by it or by an earlier record has been written to the
+ * array; the super block records the oldest record which can't.  When
+ * the journal is attached again after a crash, the records from there
+ * on are written to the array before the cache is enabled.  Replaying
+ * a full stripe rewrites the parity from the data alone, which closes
+ * the write hole for it.
+ *
+ * The journal is attached through the journal_device attribute and
+ * stays until the array is stopped.  It is recorded in the array's
+ * super block, and attached and replayed by run() when the array is
+ * next assembled, before anything can read or write it.  An array whose
+ * journal can't be attached then fails all I/O until it is, or until
+ * 'none' is written to journal_device to give up on it.  A journal which
+ * fails while attached is dropped from the super block, and writes then
+ * go straight to the array.
+ */
+
+#include <linux/blkdev.h>
+#include <linux/crc32.h>
+#include <linux/kthread.h>
+#include <linux/mempool.h>
+#include <linux/random.h>
+#include <linux/raid/md_p.h>
+#include "md.h"
+#include "raid5.h"
+
+#define R5L_BLOCK_SECTORS	(PAGE_SIZE >> 9)
+#define R5L_META_PAYLOADS	((PAGE_SIZE - sizeof(struct r5l_meta_block)) / \
+				 sizeof(struct r5l_payload))
+#define R5L_MAX_PAYLOADS	(R5L_META_PAYLOADS < BIO_MAX_PAGES - 1 ? \
+				 R5L_META_PAYLOADS : BIO_MAX_PAGES - 1)
+#define R5L_MAX_IO_SECTORS	((R5L_MAX_PAYLOADS + 1) * R5L_BLOCK_SECTORS)
+#define R5L_MIN_SECTORS		(R5L_MAX_IO_SECTORS * 8)
+
+#define R5C_MAX_STRIPES		1024	/* writers wait beyond this */
+#define R5C_FLUSH_BATCH		32	/* stripes flushed per pass */
+#define R5C_NR_HASH		(PAGE_SIZE / sizeof(struct hlist_head))
+
+enum r5l_io_state {
+	R5L_IO_OPEN,		/* payloads can be added */
+	R5L_IO_SUBMITTED,
+	R5L_IO_DONE,
+};
+
+/*
+ * A record on its way to the journal.  It stays on log->io_list after
+ * completion until the journal space it takes can be reused.
+ */
+struct r5l_io_unit {
+	struct list_head	list;
+	struct r5l_log		*log;
+	u64			seq;
+	sector_t		pos;
+	enum r5l_io_state	state;
+	int			error;
+	int			pending_stripe;	/* stripes first dirtied here */
+	atomic_t		pending_bios;
+	struct page		*meta_page;
+	int			nr_payloads;
+	struct page		*pages[R5L_MAX_PAYLOADS];
+	struct r5c_stripe	*stripes[R5L_MAX_PAYLOADS];
+	struct bio		*bios[R5L_MAX_PAYLOADS];
+};
+
+struct r5c_block {
+	struct page		*page;
+	sector_t		logical;	/* array sector of the page */
+	DECLARE_BITMAP(valid, R5L_BLOCK_SECTORS);
+};
+
+enum r5c_stripe_state {
+	R5C_FLUSH_WANTED,
+	R5C_FLUSHING,
+};
+
+/*
+ * Data cached for a stripe.  Stripes are only in the cache while they
+ * have data which isn't on the array yet.
+ */
+struct r5c_stripe {
+	struct hlist_node	hash;
+	struct list_head	lru;		/* log->stripe_list */
+	struct list_head	flush_list;	/* log->flush_list */
+	struct r5l_log		*log;
+	sector_t		sector;		/* as stripe_head.sector */
+	unsigned long		state;
+	struct r5l_io_unit	*first_io;	/* oldest record with our data */
+	int			pending_io;	/* payloads not on the journal */
+	int			nr_full;	/* entirely valid data blocks */
+	atomic_t		pending_flush;
+	struct r5c_block	blocks[0];	/* indexed like stripe_head.dev */
+};
+
+struct r5l_log {
+	raid5_conf_t		*conf;
+	struct block_device	*bdev;
+	mdk_thread_t		*thread;
+	int			barriers;	/* journal device takes them */
+	int			failed;		/* journal write error */
+	int			dropped;	/* ... and no longer recorded */
+
+	spinlock_t		lock;
+	wait_queue_head_t	wait;
+
+	sector_t		log_start, log_end;
+	sector_t		head;		/* where the next record goes */
+	u64			seq;		/* of the next record opened */
+	sector_t		reserved;	/* by records not yet placed */
+	sector_t		checkpoint;	/* oldest record still needed */
+	u64			checkpoint_seq;
+	sector_t		disk_checkpoint; /* ... as on the journal */
+	int			need_space;
+
+	struct r5l_io_unit	*current_io;
+	struct list_head	io_list;	/* in seq order */
+
+	struct hlist_head	*stripe_hash;
+	struct list_head	stripe_list;	/* oldest first */
+	struct list_head	flush_list;
+	int			nr_stripes;
+
+	mempool_t		*io_pool;
+	mempool_t		*page_pool;
+	struct page		*super_page;
+	atomic_t		pending_replay;
+};
+
+static sector_t r5l_ring_distance(struct r5l_log *log, sector_t from,
+				  sector_t to)
+{
+	if (to >= from)
+		return to - from;
+	return to + (log->log_end - log->log_start) - from;
+}
+
+/*
+ * Journal space in use, counting from the checkpoint on disk: the
+ * records behind it can't be overwritten until it has moved.  One
+ * record of the largest size is held back for the space lost when a
+ * record doesn't fit before the end of the ring.
+ */
+static int r5l_has_space(struct r5l_log *log, sector_t sectors)
+{
+	sector_t used = r5l_ring_distance(log, log->disk_checkpoint,
+					  log->head) + log->reserved;
+
+	return used + sectors + R5L_MAX_IO_SECTORS <
+		log->log_end - log->log_start;
+}
+
+static struct hlist_head *r5c_hash(struct r5l_log *log, sector_t sector)
+{
+	return &log->stripe_hash[(sector >> STRIPE_SHIFT) & (R5C_NR_HASH - 1)];
+}
+
+static struct r5c_stripe *r5c_find(struct r5l_log *log, sector_t sector)
+{
+	struct r5c_stripe *sh;
+	struct hlist_node *hn;
+
+	hlist_for_each_entry(sh, hn, r5c_hash(log, sector), hash)
+		if (sh->sector == sector)
+			return sh;
+	return NULL;
+}
+
+/* Is the stripe in the cache, or being written to the array? */
+static int r5c_cached(struct r5l_log *log, sector_t sector, int flushing)
+{
+	struct r5c_stripe *sh;
+	int ret;
+
+	spin_lock_irq(&log->lock);
+	sh = r5c_find(log, sector);
+	ret = sh && (!flushing || test_bit(R5C_FLUSHING, &sh->state));
+	spin_unlock_irq(&log->lock);
+	return ret;
+}
+
+static void r5c_want_flush(struct r5l_log *log, struct r5c_stripe *sh)
+{
+	if (test_bit(R5C_FLUSHING, &sh->state) ||
+	    test_and_set_bit(R5C_FLUSH_WANTED, &sh->state))
+		return;
+	list_add_tail(&sh->flush_list, &log->flush_list);
+}
+
+static int r5c_data_disks(struct r5l_log *log)
+{
+	return log->conf->raid_disks - log->conf->max_degraded;
+}
+
+/* Copy 'len' bytes at array sector 'sector' of a bio to 'dst' */
+static void r5l_copy_from_bio(struct bio *bio, sector_t sector, void *dst,
+			      int len)
+{
+	struct bio_vec *bvl;
+	int offset = (sector - bio->bi_sector) << 9;
+	int i;
+
+	bio_for_each_segment(bvl, bio, i) {
+		int clen = bvl->bv_len;
+		char *src;
+
+		if (offset >= clen) {
+			offset -= clen;
+			continue;
+		}
+		clen -= offset;
+		if (clen > len)
+			clen = len;
+		src = kmap_atomic(bvl->bv_page, KM_USER0);
+		memcpy(dst, src + bvl->bv_offset + offset, clen);
+		kunmap_atomic(src, KM_USER0);
+		dst += clen;
+		len -= clen;
+		offset = 0;
+		if (!len)
+			break;
+	}
+}
+
+static void r5l_open_io(struct r5l_log *log, struct r5l_io_unit *io,
+			struct page *meta_page)
+{
+	memset(io, 0, sizeof(*io));
+	io->log = log;
+	io->seq = log->seq++;
+	io->state = R5L_IO_OPEN;
+	io->meta_page = meta_page;
+	memset(page_address(meta_page), 0, PAGE_SIZE);
+	list_add_tail(&io->list, &log->io_list);
+	log->current_io = io;
+	log->reserved += R5L_BLOCK_SECTORS;
+}
+
+/*
+ * Journal and cache the part of a write bio which falls in one block of
+ * one device: 'sectors' sectors at array sector 'logical'.
+ */
+static void r5l_write_block(struct r5l_log *log, struct bio *bi,
+			    sector_t logical, int sectors)
+{
+	sector_t block = logical & ~(sector_t)(R5L_BLOCK_SECTORS - 1);
+	int offset = logical - block;
+	struct r5c_stripe *sh, *new_sh = NULL;
+	struct r5l_io_unit *io, *new_io = NULL;
+	struct page *data, *cache_page = NULL, *meta_page = NULL;
+	struct r5l_payload *payload;
+	struct r5c_block *blk;
+	sector_t sector, need;
+	int dd_idx, full, i;
+
+	sector = raid5_compute_sector(log->conf, block, 0, &dd_idx, NULL);
+
+	/*
+	 * The record gets its own copy of the data, so the checksum stays
+	 * valid whatever happens to the cache meanwhile.
+	 */
+	data = mempool_alloc(log->page_pool, GFP_NOWAIT);
+	if (!data) {
+		md_wakeup_thread(log->thread);
+		data = mempool_alloc(log->page_pool, GFP_NOIO);
+	}
+	r5l_copy_from_bio(bi, logical, page_address(data), sectors << 9);
+
+	spin_lock_irq(&log->lock);
+again:
+	sh = r5c_find(log, sector);
+	if (sh && test_bit(R5C_FLUSHING, &sh->state)) {
+		/* the cache pages are being written to the array */
+		spin_unlock_irq(&log->lock);
+		wait_event(log->wait, !r5c_cached(log, sector, 1));
+		spin_lock_irq(&log->lock);
+		goto again;
+	}
+	if (!sh && log->nr_stripes >= R5C_MAX_STRIPES) {
+		spin_unlock_irq(&log->lock);
+		md_wakeup_thread(log->thread);
+		wait_event(log->wait, log->nr_stripes < R5C_MAX_STRIPES);
+		spin_lock_irq(&log->lock);
+		goto again;
+	}
+
+	need = R5L_BLOCK_SECTORS;
+	io = log->current_io;
+	if (!io || io->nr_payloads == R5L_MAX_PAYLOADS)
+		need += R5L_BLOCK_SECTORS;
+	if (!r5l_has_space(log, need)) {
+		log->need_space = 1;
+		spin_unlock_irq(&log->lock);
+		md_wakeup_thread(log->thread);
+		wait_event(log->wait, !log->need_space);
+		spin_lock_irq(&log->lock);
+		goto again;
+	}
+
+	/* allocations can sleep, so drop the lock and look again */
+	if (!sh && !new_sh) {
+		spin_unlock_irq(&log->lock);
+		while (!(new_sh = kzalloc(sizeof(*sh) + log->conf->raid_disks *
+					  sizeof(struct r5c_block), GFP_NOIO)))
+			congestion_wait(WRITE, HZ/50);
+		spin_lock_irq(&log->lock);
+		goto again;
+	}
+	if ((!sh || !sh->blocks[dd_idx].page) && !cache_page) {
+		spin_unlock_irq(&log->lock);
+		while (!(cache_page = alloc_page(GFP_NOIO)))
+			congestion_wait(WRITE, HZ/50);
+		spin_lock_irq(&log->lock);
+		goto again;
+	}
+	if (need > R5L_BLOCK_SECTORS && !new_io) {
+		spin_unlock_irq(&log->lock);
+		md_wakeup_thread(log->thread);
+		new_io = mempool_alloc(log->io_pool, GFP_NOIO);
+		meta_page = mempool_alloc(log->page_pool, GFP_NOIO);
+		spin_lock_irq(&log->lock);
+		goto again;
+	}
+
+	if (!sh) {
+		sh = new_sh;
+		new_sh = NULL;
+		sh->log = log;
+		sh->sector = sector;
+		INIT_LIST_HEAD(&sh->flush_list);
+		hlist_add_head(&sh->hash, r5c_hash(log, sector));
+		list_add_tail(&sh->lru, &log->stripe_list);
+		log->nr_stripes++;
+	}
+	blk = &sh->blocks[dd_idx];
+	if (!blk->page) {
+		blk->page = cache_page;
+		blk->logical = block;
+		cache_page = NULL;
+	}
+
+	if (need > R5L_BLOCK_SECTORS) {
+		r5l_open_io(log, new_io, meta_page);
+		new_io = NULL;
+		meta_page = NULL;
+	}
+	io = log->current_io;
+	payload = &((struct r5l_meta_block *)
+		    page_address(io->meta_page))->payloads[io->nr_payloads];
+	payload->location = cpu_to_le64(logical);
+	payload->sectors = cpu_to_le32(sectors);
+	payload->checksum = cpu_to_le32(crc32_le(~0, page_address(data),
+						 sectors << 9));
+	io->pages[io->nr_payloads] = data;
+	io->stripes[io->nr_payloads] = sh;
+	io->bios[io->nr_payloads] = bi;
+	io->nr_payloads++;
+	log->reserved += R5L_BLOCK_SECTORS;
+
+	if (!sh->first_io) {
+		sh->first_io = io;
+		io->pending_stripe++;
+	}
+	sh->pending_io++;
+	bi->bi_phys_segments++;
+
+	memcpy(page_address(blk->page) + (offset << 9), page_address(data),
+	       sectors << 9);
+	full = bitmap_full(blk->valid, R5L_BLOCK_SECTORS);
+	for (i = offset; i < offset + sectors; i++)
+		__set_bit(i, blk->valid);
+	if (!full && bitmap_full(blk->valid, R5L_BLOCK_SECTORS) &&
+	    ++sh->nr_full == r5c_data_disks(log)) {
+		/* a full stripe: write it out without reading anything */
+		r5c_want_flush(log, sh);
+	}
+	spin_unlock_irq(&log->lock);
+
+	kfree(new_sh);
+	if (cache_page)
+		put_page(cache_page);
+	if (new_io) {
+		mempool_free(new_io, log->io_pool);
+		mempool_free(meta_page, log->page_pool);
+	}
+}
+
+/*
+ * Split a write into blocks and complete it once all of them are on the
+ * journal.  bi_phys_segments counts the blocks in flight, plus one while
+ * we are still splitting.
+ */
+static void r5l_write(struct r5l_log *log, struct bio *bi)
+{
+	sector_t logical = bi->bi_sector;
+	sector_t end = logical + (bi->bi_size >> 9);
+	int remaining;
+
+	bi->bi_next = NULL;
+	bi->bi_phys_segments = 1;
+	while (logical < end) {
+		int sectors = R5L_BLOCK_SECTORS -
+			(logical & (R5L_BLOCK_SECTORS - 1));
+
+		if (sectors > end - logical)
+			sectors = end - logical;
+		r5l_write_block(log, bi, logical, sectors);
+		logical += sectors;
+	}
+
+	spin_lock_irq(&log->lock);
+	remaining = --bi->bi_phys_segments;
+	spin_unlock_irq(&log->lock);
+	if (!remaining)
+		bio_endio(bi, 0);
+	md_wakeup_thread(log->thread);
+}
+
+/* Write the cached stripes a bio touches to the array, and wait for them */
+static void r5c_flush_range(struct r5l_log *log, struct bio *bi)
+{
+	sector_t first = bi->bi_sector & ~(sector_t)(STRIPE_SECTORS - 1);
+	sector_t end = bi->bi_sector + (bi->bi_size >> 9);
+	sector_t logical, sector;
+	struct r5c_stripe *sh;
+	int dd_idx, cached = 0;
+
+	if (!log->nr_stripes)
+		return;
+
+	spin_lock_irq(&log->lock);
+	for (logical = first; logical < end; logical += STRIPE_SECTORS) {
+		sector = raid5_compute_sector(log->conf, logical, 0,
+					      &dd_idx, NULL);
+		sh = r5c_find(log, sector);
+		if (sh) {
+			r5c_want_flush(log, sh);
+			cached = 1;
+		}
+	}
+	spin_unlock_irq(&log->lock);
+	if (!cached)
+		return;
+
+	md_wakeup_thread(log->thread);
+	for (logical = first; logical < end; logical += STRIPE_SECTORS) {
+		sector = raid5_compute_sector(log->conf, logical, 0,
+					      &dd_idx, NULL);
+		wait_event(log->wait, !r5c_cached(log, sector, 0));
+	}
+}
+
+/*
+ * Called by make_request for every bio while a journal is attached.
+ * Returns 1 if the bio has been taken over by the journal, 0 if it is
+ * to go to the array as usual.
+ *
+ * Once the journal has failed, writes go to the array too, but only
+ * after the journal is dropped from the super block, so that it is
+ * never replayed over them.
+ */
+int r5l_make_request(struct r5l_log *log, struct bio *bi)
+{
+	mddev_t *mddev = log->conf->mddev;
+
+	if (bio_data_dir(bi) == WRITE) {
+		if (!log->failed) {
+			r5l_write(log, bi);
+			return 1;
+		}
+		md_wakeup_thread(log->thread);
+		wait_event(log->wait, log->dropped);
+		wait_event(mddev->sb_wait,
+			   !test_bit(MD_CHANGE_DEVS, &mddev->flags) &&
+			   !test_bit(MD_CHANGE_PENDING, &mddev->flags));
+	}
+	r5c_flush_range(log, bi);
+	return 0;
+}
+
+static void r5c_stripe_flushed(struct r5c_stripe *sh)
+{
+	struct r5l_log *log = sh->log;
+	unsigned long flags;
+	int i;
+
+	spin_lock_irqsave(&log->lock, flags);
+	hlist_del(&sh->hash);
+	list_del(&sh->lru);
+	log->nr_stripes--;
+	sh->first_io->pending_stripe--;
+	spin_unlock_irqrestore(&log->lock, flags);
+
+	for (i = 0; i < log->conf->raid_disks; i++)
+		if (sh->blocks[i].page)
+			put_page(sh->blocks[i].page);
+	kfree(sh);
+
+	md_wakeup_thread(log->thread);
+	wake_up(&log->wait);
+}
+
+static void r5c_flush_endio(struct bio *bio, int error)
+{
+	struct r5c_stripe *sh = bio->bi_private;
+
+	if (error && printk_ratelimit())
+		printk(KERN_ERR "raid5: %s: error %d writing cached data "
+		       "at sector %llu\n", mdname(sh->log->conf->mddev),
+		       error, (unsigned long long)bio->bi_sector);
+	bio_put(bio);
+	if (atomic_dec_and_test(&sh->pending_flush))
+		r5c_stripe_flushed(sh);
+}
+
+/* A single page write to the array, submitted through raid5_make_request */
+static struct bio *r5l_alloc_bio(sector_t sector, struct page *page,
+				 int offset, int len)
+{
+	struct bio *bio = bio_alloc(GFP_NOIO, 1);
+
+	bio->bi_sector = sector;
+	bio->bi_rw = WRITE;
+	bio->bi_io_vec[0].bv_page = page;
+	bio->bi_io_vec[0].bv_offset = offset;
+	bio->bi_io_vec[0].bv_len = len;
+	bio->bi_vcnt = 1;
+	bio->bi_idx = 0;
+	bio->bi_size = len;
+	return bio;
+}
+
+/*
+ * Write every run of valid sectors of a stripe to the array.  raid5
+ * delays stripes which need reads while the queue is plugged, so a
+ * stripe which is entirely in the cache is written as a full stripe.
+ */
+static void r5c_flush_stripe(struct r5l_log *log, struct r5c_stripe *sh)
+{
+	struct bio *bio;
+	int i, start, end;
+
+	atomic_set(&sh->pending_flush, 1);
+	for (i = 0; i < log->conf->raid_disks; i++) {
+		struct r5c_block *blk = &sh->blocks[i];
+
+		if (!blk->page)
+			continue;
+		start = find_first_bit(blk->valid, R5L_BLOCK_SECTORS);
+		while (start < R5L_BLOCK_SECTORS) {
+			end = find_next_zero_bit(blk->valid, R5L_BLOCK_SECTORS,
+						 start);
+			bio = r5l_alloc_bio(blk->logical + start, blk->page,
+					    start << 9, (end - start) << 9);
+			bio->bi_end_io = r5c_flush_endio;
+			bio->bi_private = sh;
+			atomic_inc(&sh->pending_flush);
+			raid5_make_request(log->conf->mddev, bio);
+			start = find_next_bit(blk->valid, R5L_BLOCK_SECTORS,
+					      end);
+		}
+	}
+	if (atomic_dec_and_test(&sh->pending_flush))
+		r5c_stripe_flushed(sh);
+}
+
+/*
+ * Mark the oldest stripes for flushing when the journal or the cache
+ * is getting full.  Stripes are only flushed once all their data is on
+ * the journal, as replay relies on the records of a stripe still being
+ * there until it has reached the array.
+ */
+static void r5c_flush_stripes(struct r5l_log *log)
+{
+	sector_t capacity = log->log_end - log->log_start;
+	struct r5c_stripe *sh, *tmp;
+	LIST_HEAD(list);
+	int cnt = 0;
+
+	/* md_write_start must not be called on a read-only array */
+	if (log->conf->mddev->ro == 1)
+		return;
+
+	spin_lock_irq(&log->lock);
+	if (log->need_space || !r5l_has_space(log, capacity / 4) ||
+	    log->nr_stripes > R5C_MAX_STRIPES / 4 * 3)
+		list_for_each_entry(sh, &log->stripe_list, lru) {
+			if (cnt++ == R5C_FLUSH_BATCH)
+				break;
+			r5c_want_flush(log, sh);
+		}
+
+	list_for_each_entry_safe(sh, tmp, &log->flush_list, flush_list) {
+		if (sh->pending_io)
+			continue;
+		clear_bit(R5C_FLUSH_WANTED, &sh->state);
+		set_bit(R5C_FLUSHING, &sh->state);
+		list_move_tail(&sh->flush_list, &list);
+	}
+	spin_unlock_irq(&log->lock);
+
+	list_for_each_entry_safe(sh, tmp, &list, flush_list) {
+		list_del_init(&sh->flush_list);
+		r5c_flush_stripe(log, sh);
+	}
+}
+
+static void r5l_io_endio(struct bio *bio, int error)
+{
+	struct r5l_io_unit *io = bio->bi_private;
+	struct r5l_log *log = io->log;
+	struct bio *bi, *done = NULL;
+	unsigned long flags;
+	int i;
+
+	if (error)
+		io->error = error;
+	bio_put(bio);
+	if (!atomic_dec_and_test(&io->pending_bios))
+		return;
+
+	spin_lock_irqsave(&log->lock, flags);
+	io->state = R5L_IO_DONE;
+	if (io->error && !log->failed) {
+		log->failed = 1;
+		printk(KERN_ERR "raid5: %s: error %d writing the journal, "
+		       "journal disabled\n", mdname(log->conf->mddev),
+		       io->error);
+	}
+	for (i = 0; i < io->nr_payloads; i++) {
+		bi = io->bios[i];
+		if (io->error)
+			clear_bit(BIO_UPTODATE, &bi->bi_flags);
+		if (--bi->bi_phys_segments == 0) {
+			bi->bi_next = done;
+			done = bi;
+		}
+		io->stripes[i]->pending_io--;
+		mempool_free(io->pages[i], log->page_pool);
+	}
+	mempool_free(io->meta_page, log->page_pool);
+	io->meta_page = NULL;
+	spin_unlock_irqrestore(&log->lock, flags);
+
+	while ((bi = done) != NULL) {
+		done = bi->bi_next;
+		bi->bi_next = NULL;
+		bio_endio(bi, 0);
+	}
+	md_wakeup_thread(log->thread);
+	wake_up(&log->wait);
+}
+
+static void r5l_submit_io(struct r5l_log *log, struct r5l_io_unit *io)
+{
+	struct r5l_meta_block *mb = page_address(io->meta_page);
+	struct bio *bio = NULL;
+	sector_t pos = io->pos;
+	struct page *page;
+	int i;
+
+	mb->magic = cpu_to_le32(R5L_MAGIC);
+	mb->checksum = 0;
+	mb->seq = cpu_to_le64(io->seq);
+	mb->position = cpu_to_le64(io->pos);
+	mb->nr_payloads = cpu_to_le32(io->nr_payloads);
+	mb->checksum = cpu_to_le32(crc32_le(~0, (void *)mb, PAGE_SIZE));
+
+	atomic_set(&io->pending_bios, 1);
+	for (i = -1; i < io->nr_payloads; i++) {
+		page = i < 0 ? io->meta_page : io->pages[i];
+		if (bio && bio_add_page(bio, page, PAGE_SIZE, 0))
+			goto next;
+		if (bio) {
+			atomic_inc(&io->pending_bios);
+			submit_bio(WRITE, bio);
+		}
+		bio = bio_alloc(GFP_NOIO, io->nr_payloads - i);
+		bio->bi_bdev = log->bdev;
+		bio->bi_sector = pos;
+		bio->bi_end_io = r5l_io_endio;
+		bio->bi_private = io;
+		bio_add_page(bio, page, PAGE_SIZE, 0);
+next:
+		pos += R5L_BLOCK_SECTORS;
+	}
+	/*
+	 * The barrier orders the record after the ones before it, and
+	 * makes it stable before the writes in it are acknowledged.
+	 */
+	submit_bio(log->barriers ? WRITE_BARRIER : WRITE, bio);
+}
+
+/* Place the open record on the journal and write it */
+static void r5l_submit_current(struct r5l_log *log)
+{
+	struct r5l_io_unit *io;
+	sector_t size;
+
+	spin_lock_irq(&log->lock);
+	io = log->current_io;
+	if (!io || !io->nr_payloads) {
+		spin_unlock_irq(&log->lock);
+		return;
+	}
+	size = (io->nr_payloads + 1) * R5L_BLOCK_SECTORS;
+	if (log->head + size > log->log_end)
+		log->head = log->log_start;
+	io->pos = log->head;
+	log->head += size;
+	if (log->head == log->log_end)
+		log->head = log->log_start;
+	log->reserved -= size;
+	io->state = R5L_IO_SUBMITTED;
+	log->current_io = NULL;
+	spin_unlock_irq(&log->lock);
+
+	r5l_submit_io(log, io);
+}
+
+static int r5l_write_super(struct r5l_log *log, sector_t checkpoint, u64 seq)
+{
+	struct r5l_super_block *sb = page_address(log->super_page);
+	char b[BDEVNAME_SIZE];
+
+	memset(sb, 0, PAGE_SIZE);
+	sb->magic = cpu_to_le32(R5L_MAGIC);
+	sb->version = cpu_to_le32(R5L_VERSION);
+	sb->block_size = cpu_to_le32(PAGE_SIZE);
+	memcpy(sb->uuid, log->conf->mddev->uuid, sizeof(sb->uuid));
+	sb->log_start = cpu_to_le64(log->log_start);
+	sb->log_end = cpu_to_le64(log->log_end);
+	sb->checkpoint = cpu_to_le64(checkpoint);
+	sb->seq = cpu_to_le64(seq);
+	sb->checksum = cpu_to_le32(crc32_le(~0, (void *)sb, PAGE_SIZE));
+
+	if (log->barriers) {
+		if (sync_page_io(log->bdev, 0, PAGE_SIZE, log->super_page,
+				 WRITE_BARRIER))
+			return 0;
+		printk(KERN_NOTICE "raid5: %s: barriers not supported by "
+		       "journal %s\n", mdname(log->conf->mddev),
+		       bdevname(log->bdev, b));
+		log->barriers = 0;
+	}
+	if (sync_page_io(log->bdev, 0, PAGE_SIZE, log->super_page, WRITE))
+		return 0;
+	return -EIO;
+}
+
+/*
+ * The stripes flushed since the last checkpoint may still be in the
+ * member disks' write caches, and the records holding them are given up
+ * once the checkpoint moves past them.  A disk which can't flush its
+ * cache is failed, as for a write error.
+ */
+static void r5l_flush_disks(struct r5l_log *log)
+{
+	raid5_conf_t *conf = log->conf;
+	mdk_rdev_t *rdev;
+	int i, err;
+
+	for (i = 0; i < conf->raid_disks; i++) {
+		rcu_read_lock();
+		rdev = rcu_dereference(conf->disks[i].rdev);
+		if (rdev && test_bit(Faulty, &rdev->flags))
+			rdev = NULL;
+		if (rdev)
+			atomic_inc(&rdev->nr_pending);
+		rcu_read_unlock();
+		if (!rdev)
+			continue;
+
+		err = blkdev_issue_flush(rdev->bdev, NULL);
+		if (err && err != -EOPNOTSUPP)
+			md_error(conf->mddev, rdev);
+		rdev_dec_pending(rdev, conf->mddev);
+	}
+}
+
+/*
+ * Free the records which are no longer needed, and move the checkpoint
+ * on the journal when that frees enough space, or someone waits for it.
+ */
+static void r5l_reclaim(struct r5l_log *log, int force)
+{
+	sector_t capacity = log->log_end - log->log_start;
+	struct r5l_io_unit *io, *tmp;
+	sector_t checkpoint;
+	LIST_HEAD(done);
+	int write, wake = 0;
+	u64 seq;
+
+	spin_lock_irq(&log->lock);
+	list_for_each_entry_safe(io, tmp, &log->io_list, list) {
+		if (io->state != R5L_IO_DONE || io->pending_stripe)
+			break;
+		list_move_tail(&io->list, &done);
+	}
+	checkpoint = log->head;
+	seq = log->seq;
+	if (!list_empty(&log->io_list)) {
+		/* an open record will be placed at the head, or wrap */
+		io = list_first_entry(&log->io_list, struct r5l_io_unit, list);
+		if (io->state != R5L_IO_OPEN)
+			checkpoint = io->pos;
+		seq = io->seq;
+	}
+	log->checkpoint = checkpoint;
+	log->checkpoint_seq = seq;
+
+	write = force || (checkpoint != log->disk_checkpoint &&
+			  (log->need_space ||
+			   r5l_ring_distance(log, log->disk_checkpoint,
+					     checkpoint) > capacity / 4));
+	if (!write && log->need_space &&
+	    r5l_has_space(log, 2 * R5L_BLOCK_SECTORS)) {
+		log->need_space = 0;
+		wake = 1;
+	}
+	spin_unlock_irq(&log->lock);
+
+	list_for_each_entry_safe(io, tmp, &done, list) {
+		list_del(&io->list);
+		mempool_free(io, log->io_pool);
+	}
+
+	if (write) {
+		/* a failed journal is dropped, not moved on */
+		if (!log->failed) {
+			r5l_flush_disks(log);
+			if (r5l_write_super(log, checkpoint, seq)) {
+				log->failed = 1;
+				printk(KERN_ERR "raid5: %s: error writing the "
+				       "journal super block, journal "
+				       "disabled\n", mdname(log->conf->mddev));
+			}
+		}
+		spin_lock_irq(&log->lock);
+		log->disk_checkpoint = checkpoint;
+		log->need_space = 0;
+		spin_unlock_irq(&log->lock);
+		wake = 1;
+	}
+	if (wake)
+		wake_up(&log->wait);
+}
+
+/*
+ * After a journal error the records from the checkpoint on may be older
+ * than what is written to the array next.  Wipe the journal's super
+ * block, and clear journal_dev so the array is assembled without it;
+ * the md thread writes the array's super block, and writers wait for
+ * that in r5l_make_request.
+ */
+static void r5l_drop_log(struct r5l_log *log)
+{
+	mddev_t *mddev = log->conf->mddev;
+
+	memset(page_address(log->super_page), 0, PAGE_SIZE);
+	sync_page_io(log->bdev, 0, PAGE_SIZE, log->super_page, WRITE);
+
+	mddev->journal_dev = 0;
+	set_bit(MD_CHANGE_DEVS, &mddev->flags);
+	md_wakeup_thread(mddev->thread);
+
+	log->dropped = 1;
+	wake_up(&log->wait);
+}
+
+static void r5l_thread(mddev_t *mddev)
+{
+	raid5_conf_t *conf = mddev_to_conf(mddev);
+	struct r5l_log *log = conf->log;
+
+	if (!log)
+		return;
+	r5l_submit_current(log);
+	r5l_reclaim(log, 0);
+	if (log->failed && !log->dropped)
+		r5l_drop_log(log);
+	r5c_flush_stripes(log);
+}
+
+static void r5l_replay_endio(struct bio *bio, int error)
+{
+	struct r5l_log *log = bio->bi_private;
+
+	if (error)
+		log->failed = 1;
+	__free_page(bio->bi_io_vec[0].bv_page);
+	bio_put(bio);
+	if (atomic_dec_and_test(&log->pending_replay))
+		wake_up(&log->wait);
+}
+
+/* Read the meta block of the record at 'pos', and check it is record 'seq' */
+static int r5l_read_meta(struct r5l_log *log, sector_t pos, u64 seq,
+			 struct page *page)
+{
+	struct r5l_meta_block *mb = page_address(page);
+	u32 crc, nr;
+
+	if (pos + R5L_BLOCK_SECTORS > log->log_end ||
+	    !sync_page_io(log->bdev, pos, PAGE_SIZE, page, READ))
+		return 0;
+
+	nr = le32_to_cpu(mb->nr_payloads);
+	if (le32_to_cpu(mb->magic) != R5L_MAGIC ||
+	    le64_to_cpu(mb->seq) != seq ||
+	    le64_to_cpu(mb->position) != pos ||
+	    nr == 0 || nr > R5L_MAX_PAYLOADS ||
+	    pos + (nr + 1) * R5L_BLOCK_SECTORS > log->log_end)
+		return 0;
+	crc = le32_to_cpu(mb->checksum);
+	mb->checksum = 0;
+	return crc32_le(~0, (void *)mb, PAGE_SIZE) == crc;
+}
+
+/*
+ * Write the data of the record at 'pos' to the array.  Nothing is
+ * written unless every block of it checks out: a torn record was never
+ * acknowledged, and neither was anything after it.  Returns 1 if the
+ * record was replayed, 0 if it is torn.
+ */
+static int r5l_replay_io(struct r5l_log *log, sector_t pos, struct page *meta)
+{
+	struct r5l_meta_block *mb = page_address(meta);
+	int nr = le32_to_cpu(mb->nr_payloads);
+	struct r5l_payload *payload;
+	struct page **pages;
+	struct bio *bio;
+	sector_t location;
+	int sectors, i, ret = 0;
+
+	pages = kcalloc(nr, sizeof(struct page *), GFP_KERNEL);
+	if (!pages)
+		return -ENOMEM;
+
+	for (i = 0; i < nr; i++) {
+		payload = &mb->payloads[i];
+		location = le64_to_cpu(payload->location);
+		sectors = le32_to_cpu(payload->sectors);
+
+		pages[i] = alloc_page(GFP_KERNEL);
+		if (!pages[i]) {
+			ret = -ENOMEM;
+			goto out;
+		}
+		if (sectors <= 0 || sectors > R5L_BLOCK_SECTORS ||
+		    (location & (R5L_BLOCK_SECTORS - 1)) + sectors >
+		    R5L_BLOCK_SECTORS ||
+		    location + sectors > log->conf->mddev->array_sectors)
+			goto out;
+		if (!sync_page_io(log->bdev, pos + (i + 1) * R5L_BLOCK_SECTORS,
+				  PAGE_SIZE, pages[i], READ) ||
+		    crc32_le(~0, page_address(pages[i]), sectors << 9) !=
+		    le32_to_cpu(payload->checksum))
+			goto out;
+	}
+
+	for (i = 0; i < nr; i++) {
+		payload = &mb->payloads[i];
+		bio = r5l_alloc_bio(le64_to_cpu(payload->location), pages[i],
+				    0, le32_to_cpu(payload->sectors) << 9);
+		bio->bi_end_io = r5l_replay_endio;
+		bio->bi_private = log;
+		atomic_inc(&log->pending_replay);
+		raid5_make_request(log->conf->mddev, bio);
+		pages[i] = NULL;
+	}
+	ret = 1;
+out:
+	for (i = 0; i < nr; i++)
+		if (pages[i])
+			__free_page(pages[i]);
+	kfree(pages);
+	return ret;
+}
+
+/*
+ * Write the records from the checkpoint on to the array, and start the
+ * journal after the last one.
+ */
+static int r5l_recover(struct r5l_log *log, sector_t pos, u64 seq)
+{
+	struct page *meta = alloc_page(GFP_KERNEL);
+	struct r5l_meta_block *mb;
+	int count = 0, ret = 0;
+
+	if (!meta)
+		return -ENOMEM;
+	mb = page_address(meta);
+	atomic_set(&log->pending_replay, 0);
+
+	for (;;) {
+		if (!r5l_read_meta(log, pos, seq, meta)) {
+			/* the record may not have fitted before the end */
+			if (pos == log->log_start ||
+			    !r5l_read_meta(log, log->log_start, seq, meta))
+				break;
+			pos = log->log_start;
+		}
+		ret = r5l_replay_io(log, pos, meta);
+		if (ret <= 0)
+			break;
+		pos += (le32_to_cpu(mb->nr_payloads) + 1) * R5L_BLOCK_SECTORS;
+		seq++;
+		count++;
+	}
+	__free_page(meta);
+
+	wait_event(log->wait, !atomic_read(&log->pending_replay));
+	if (ret < 0)
+		return ret;
+	if (log->failed)
+		return -EIO;
+
+	if (pos >= log->log_end)
+		pos = log->log_start;
+	log->head = log->checkpoint = log->disk_checkpoint = pos;
+	log->seq = log->checkpoint_seq = seq;
+	if (count)
+		printk(KERN_INFO "raid5: %s: replayed %d journal records\n",
+		       mdname(log->conf->mddev), count);
+	return 0;
+}
+
+static int r5l_super_valid(struct r5l_log *log, struct r5l_super_block *sb)
+{
+	sector_t start = le64_to_cpu(sb->log_start);
+	sector_t end = le64_to_cpu(sb->log_end);
+	sector_t checkpoint = le64_to_cpu(sb->checkpoint);
+	u32 crc = le32_to_cpu(sb->checksum);
+
+	if (le32_to_cpu(sb->magic) != R5L_MAGIC ||
+	    le32_to_cpu(sb->version) != R5L_VERSION ||
+	    le32_to_cpu(sb->block_size) != PAGE_SIZE)
+		return 0;
+	sb->checksum = 0;
+	if (crc32_le(~0, (void *)sb, PAGE_SIZE) != crc)
+		return 0;
+	/* log->log_end is the end of the device here */
+	return start >= R5L_BLOCK_SECTORS && end <= log->log_end &&
+		start + R5L_MIN_SECTORS <= end &&
+		checkpoint >= start && checkpoint < end;
+}
+
+/* As md_write_start does, but we hold the mddev lock */
+static int r5l_allow_write(mddev_t *mddev)
+{
+	if (mddev->ro == 1)
+		return -EROFS;
+	if (mddev->ro == 2) {
+		mddev->ro = 0;
+		set_bit(MD_RECOVERY_NEEDED, &mddev->recovery);
+		md_wakeup_thread(mddev->thread);
+		md_wakeup_thread(mddev->sync_thread);
+		sysfs_notify_dirent(mddev->sysfs_state);
+	}
+	return md_allow_write(mddev);
+}
+
+/* As open_bdev_exclusive, for the journal recorded in the super block */
+static struct block_device *r5l_open_by_devnum(dev_t dev, void *holder)
+{
+	struct block_device *bdev;
+	int err;
+
+	bdev = open_by_devnum(dev, FMODE_READ | FMODE_WRITE);
+	if (IS_ERR(bdev))
+		return bdev;
+	err = -EACCES;
+	if (bdev_read_only(bdev))
+		goto out;
+	err = bd_claim(bdev, holder);
+	if (err)
+		goto out;
+	return bdev;
+out:
+	blkdev_put(bdev, FMODE_READ | FMODE_WRITE);
+	return ERR_PTR(err);
+}
+
+/*
+ * Attach the journal at 'path', or at 'dev' if there is no path.  Only
+ * a journal given by path is formatted; the one recorded in the array's
+ * super block must still carry our super block, or it is not the
+ * journal we recorded.
+ */
+static int r5l_init_log(raid5_conf_t *conf, const char *path, dev_t dev)
+{
+	mddev_t *mddev = conf->mddev;
+	struct r5l_super_block *sb;
+	struct r5l_log *log;
+	char b[BDEVNAME_SIZE];
+	int ret;
+
+	if (conf->log || mddev->reshape_position != MaxSector)
+		return -EBUSY;
+	/* only a v1 super block has room to record the journal */
+	if (!mddev->persistent || mddev->major_version != 1)
+		return -EINVAL;
+	/* replay, and later flushes, write to the array */
+	ret = r5l_allow_write(mddev);
+	if (ret)
+		return ret;
+
+	log = kzalloc(sizeof(*log), GFP_KERNEL);
+	if (!log)
+		return -ENOMEM;
+	log->conf = conf;
+	log->barriers = 1;
+	spin_lock_init(&log->lock);
+	init_waitqueue_head(&log->wait);
+	INIT_LIST_HEAD(&log->io_list);
+	INIT_LIST_HEAD(&log->stripe_list);
+	INIT_LIST_HEAD(&log->flush_list);
+
+	if (path)
+		log->bdev = open_bdev_exclusive(path, FMODE_READ | FMODE_WRITE,
+						log);
+	else
+		log->bdev = r5l_open_by_devnum(dev, log);
+	if (IS_ERR(log->bdev)) {
+		ret = PTR_ERR(log->bdev);
+		goto out_free;
+	}
+
+	ret = -ENOMEM;
+	log->io_pool = mempool_create_kmalloc_pool(2,
+					sizeof(struct r5l_io_unit));
+	if (!log->io_pool)
+		goto out;
+	log->page_pool = mempool_create_page_pool(R5L_MAX_PAYLOADS + 1, 0);
+	if (!log->page_pool)
+		goto out;
+	log->stripe_hash = kzalloc(PAGE_SIZE, GFP_KERNEL);
+	if (!log->stripe_hash)
+		goto out;
+	log->super_page = alloc_page(GFP_KERNEL);
+	if (!log->super_page)
+		goto out;
+
+	/* the super block takes the first block, the ring the rest */
+	log->log_start = R5L_BLOCK_SECTORS;
+	log->log_end = (i_size_read(log->bdev->bd_inode) >> 9) &
+		~(sector_t)(R5L_BLOCK_SECTORS - 1);
+	ret = -ENOSPC;
+	if (log->log_end < log->log_start + R5L_MIN_SECTORS)
+		goto out;
+
+	ret = -EIO;
+	if (!sync_page_io(log->bdev, 0, PAGE_SIZE, log->super_page, READ))
+		goto out;
+	sb = page_address(log->super_page);
+	if (r5l_super_valid(log, sb)) {
+		ret = -EINVAL;
+		if (memcmp(sb->uuid, mddev->uuid, sizeof(sb->uuid))) {
+			printk(KERN_ERR "raid5: %s: journal %s belongs to "
+			       "another array\n", mdname(mddev),
+			       bdevname(log->bdev, b));
+			goto out;
+		}
+		log->log_start = le64_to_cpu(sb->log_start);
+		log->log_end = le64_to_cpu(sb->log_end);
+		ret = r5l_recover(log, le64_to_cpu(sb->checkpoint),
+				  le64_to_cpu(sb->seq));
+		if (ret)
+			goto out;
+	} else if (!path) {
+		ret = -EINVAL;
+		printk(KERN_ERR "raid5: %s: no journal super block on %s\n",
+		       mdname(mddev), bdevname(log->bdev, b));
+		goto out;
+	} else {
+		get_random_bytes(&log->seq, sizeof(log->seq));
+		log->head = log->checkpoint = log->disk_checkpoint =
+			log->log_start;
+		log->checkpoint_seq = log->seq;
+	}
+	ret = r5l_write_super(log, log->checkpoint, log->checkpoint_seq);
+	if (ret)
+		goto out;
+
+	ret = -ENOMEM;
+	log->thread = md_register_thread(r5l_thread, mddev, "%s_r5l");
+	if (!log->thread)
+		goto out;
+
+	/* from here on the array must not be assembled without it */
+	if (mddev->journal_dev != log->bdev->bd_dev) {
+		mddev->journal_dev = log->bdev->bd_dev;
+		set_bit(MD_CHANGE_DEVS, &mddev->flags);
+		md_update_sb(mddev, 1);
+	}
+
+	/* make_request looks at conf->log without a lock */
+	smp_wmb();
+	conf->log = log;
+	conf->journal_missing = 0;
+	printk(KERN_INFO "raid5: %s: journal on %s\n", mdname(mddev),
+	       bdevname(log->bdev, b));
+	return 0;
+
+out:
+	if (log->super_page)
+		__free_page(log->super_page);
+	kfree(log->stripe_hash);
+	if (log->page_pool)
+		mempool_destroy(log->page_pool);
+	if (log->io_pool)
+		mempool_destroy(log->io_pool);
+	close_bdev_exclusive(log->bdev, FMODE_READ | FMODE_WRITE);
+out_free:
+	kfree(log);
+	return ret;
+}
+
+/*
+ * Called by run() before the array is visible.  The journal recorded in
+ * the super block has to be replayed before anything else reads or
+ * writes the array, so if it can't be attached all I/O fails until it
+ * is.
+ */
+void r5l_start_log(raid5_conf_t *conf)
+{
+	mddev_t *mddev = conf->mddev;
+	char b[BDEVNAME_SIZE];
+	int ret;
+
+	if (!mddev->journal_dev)
+		return;
+	ret = r5l_init_log(conf, NULL, mddev->journal_dev);
+	if (ret) {
+		printk(KERN_ERR "raid5: %s: cannot attach journal %s (%d), "
+		       "I/O disabled until journal_device is set\n",
+		       mdname(mddev), __bdevname(mddev->journal_dev, b), ret);
+		conf->journal_missing = 1;
+	}
+}
+
+/* Give up on a journal which can't be attached, and what it held */
+static int r5l_forget_log(raid5_conf_t *conf)
+{
+	mddev_t *mddev = conf->mddev;
+	int ret;
+
+	if (!mddev->journal_dev)
+		return 0;
+	ret = r5l_allow_write(mddev);
+	if (ret)
+		return ret;
+	mddev->journal_dev = 0;
+	set_bit(MD_CHANGE_DEVS, &mddev->flags);
+	md_update_sb(mddev, 1);
+	if (conf->journal_missing) {
+		printk(KERN_WARNING "raid5: %s: journal dropped, data it "
+		       "held is lost\n", mdname(mddev));
+		conf->journal_missing = 0;
+	}
+	return 0;
+}
+
+/*
+ * Nothing on its way to the journal or to the array, and with 'all',
+ * nothing left in the cache.
+ */
+static int r5l_quiet(struct r5l_log *log, int all)
+{
+	struct r5l_io_unit *io;
+	struct r5c_stripe *sh;
+	int ret;
+
+	spin_lock_irq(&log->lock);
+	ret = !all || !log->nr_stripes;
+	list_for_each_entry(io, &log->io_list, list)
+		if (io->state == R5L_IO_SUBMITTED ||
+		    (io->state == R5L_IO_OPEN && io->nr_payloads))
+			ret = 0;
+	list_for_each_entry(sh, &log->stripe_list, lru)
+		if (test_bit(R5C_FLUSHING, &sh->state))
+			ret = 0;
+	spin_unlock_irq(&log->lock);
+	return ret;
+}
+
+/*
+ * Called when the array is stopped.  The cache is written to the array
+ * if it can be; otherwise what is left is replayed from the journal
+ * when it is next attached.
+ */
+void r5l_exit_log(raid5_conf_t *conf)
+{
+	struct r5l_log *log = conf->log;
+	mddev_t *mddev = conf->mddev;
+	struct r5l_io_unit *io, *tmp;
+	struct r5c_stripe *sh, *stmp;
+	int i, flush;
+
+	if (!log)
+		return;
+
+	flush = r5l_allow_write(mddev) == 0;
+	spin_lock_irq(&log->lock);
+	if (flush)
+		list_for_each_entry(sh, &log->stripe_list, lru)
+			r5c_want_flush(log, sh);
+	spin_unlock_irq(&log->lock);
+	md_wakeup_thread(log->thread);
+	wait_event(log->wait, r5l_quiet(log, flush));
+
+	md_unregister_thread(log->thread);
+	r5l_reclaim(log, 1);
+	/* the super block is written once the array is stopped */
+	if (log->failed && !log->dropped)
+		r5l_drop_log(log);
+	if (log->nr_stripes)
+		printk(KERN_WARNING "raid5: %s: %d stripes are only on the "
+		       "journal\n", mdname(mddev), log->nr_stripes);
+
+	list_for_each_entry_safe(io, tmp, &log->io_list, list) {
+		list_del(&io->list);
+		if (io->meta_page)
+			mempool_free(io->meta_page, log->page_pool);
+		mempool_free(io, log->io_pool);
+	}
+	list_for_each_entry_safe(sh, stmp, &log->stripe_list, lru) {
+		for (i = 0; i < conf->raid_disks; i++)
+			if (sh->blocks[i].page)
+				put_page(sh->blocks[i].page);
+		kfree(sh);
+	}
+
+	conf->log = NULL;
+	__free_page(log->super_page);
+	kfree(log->stripe_hash);
+	mempool_destroy(log->page_pool);
+	mempool_destroy(log->io_pool);
+	close_bdev_exclusive(log->bdev, FMODE_READ | FMODE_WRITE);
+	kfree(log);
+}
+
+static ssize_t
+r5l_show_journal_device(mddev_t *mddev, char *page)
+{
+	raid5_conf_t *conf = mddev_to_conf(mddev);
+	char b[BDEVNAME_SIZE];
+
+	if (!conf)
+		return 0;
+	if (conf->journal_missing)
+		return sprintf(page, "missing\n");
+	if (!conf->log)
+		return sprintf(page, "none\n");
+	return sprintf(page, "%s\n", bdevname(conf->log->bdev, b));
+}
+
+static ssize_t
+r5l_store_journal_device(mddev_t *mddev, const char *page, size_t len)
+{
+	raid5_conf_t *conf = mddev_to_conf(mddev);
+	char *path;
+	int err;
+
+	if (len >= PAGE_SIZE)
+		return -EINVAL;
+	if (!conf)
+		return -ENODEV;
+
+	path = kstrndup(page, len, GFP_KERNEL);
+	if (!path)
+		return -ENOMEM;
+	if (len && path[len - 1] == '\n')
+		path[len - 1] = 0;
+	if (strcmp(path, "none") == 0)
+		/* the journal can't be detached from a running array */
+		err = conf->log ? -EBUSY : r5l_forget_log(conf);
+	else
+		err = r5l_init_log(conf, path, 0);
+	kfree(path);
+	return err ? err : len;
+}
+
+struct md_sysfs_entry
+r5l_journal_device = __ATTR(journal_device, S_IRUGO | S_IWUSR,
+			    r5l_show_journal_device,
+			    r5l_store_journal_device);
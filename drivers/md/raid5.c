@@ -57,15 +57,13 @@
  */
 
 #define NR_STRIPES		256
-#define STRIPE_SIZE		PAGE_SIZE
-#define STRIPE_SHIFT		(PAGE_SHIFT - 9)
-#define STRIPE_SECTORS		(STRIPE_SIZE>>9)
 #define	IO_THRESHOLD		1
 #define BYPASS_THRESHOLD	1
 #define NR_HASH			(PAGE_SIZE / sizeof(struct hlist_head))
 #define HASH_MASK		(NR_HASH - 1)
 
 #define stripe_hash(conf, sect)	(&((conf)->stripe_hashtbl[((sect) >> STRIPE_SHIFT) & HASH_MASK]))
+#define stripe_hash_locks_hash(sect) (((sect) >> STRIPE_SHIFT) & STRIPE_HASH_LOCKS_MASK)
 
 /* bio's attached to a stripe+device for I/O are linked together in bi_sector
  * order without overlap.  There may be several bio's per stripe+device, and
@@ -178,6 +176,7 @@ static void return_io(struct bio *return_bi)
 }
 
 static void print_raid5_conf (raid5_conf_t *conf);
+static void raid5_quiesce(mddev_t *mddev, int state);
 
 static int stripe_operations_active(struct stripe_head *sh)
 {
@@ -186,6 +185,40 @@ static int stripe_operations_active(struct stripe_head *sh)
 	       test_bit(STRIPE_COMPUTE_RUN, &sh->state);
 }
 
+static inline int cpu_to_group(int cpu)
+{
+	return cpu_to_node(cpu);
+}
+
+/*
+ * Queue a stripe to the worker group of its cpu, and make sure enough
+ * workers of the group are running: one for every MAX_STRIPE_BATCH
+ * queued stripes.  Caller holds device_lock.
+ */
+static void raid5_wakeup_stripe_thread(struct stripe_head *sh)
+{
+	raid5_conf_t *conf = sh->raid_conf;
+	struct r5worker_group *group;
+	int thread_cnt;
+	int i;
+
+	group = conf->worker_groups + cpu_to_group(sh->cpu);
+	list_add_tail(&sh->lru, &group->handle_list);
+	group->stripes_cnt++;
+	sh->group = group;
+
+	thread_cnt = group->stripes_cnt / MAX_STRIPE_BATCH + 1;
+	for (i = 0; i < conf->worker_cnt_per_group && thread_cnt > 0; i++) {
+		struct r5worker *worker = &group->workers[i];
+
+		if (!worker->working) {
+			worker->working = 1;
+			wake_up_process(worker->tsk);
+		}
+		thread_cnt--;
+	}
+}
+
 static void __release_stripe(raid5_conf_t *conf, struct stripe_head *sh)
 {
 	if (atomic_dec_and_test(&sh->count)) {
@@ -201,6 +234,10 @@ static void __release_stripe(raid5_conf_t *conf, struct stripe_head *sh)
 				blk_plug_device(conf->mddev->queue);
 			} else {
 				clear_bit(STRIPE_BIT_DELAY, &sh->state);
+				if (conf->worker_cnt_per_group) {
+					raid5_wakeup_stripe_thread(sh);
+					return;
+				}
 				list_add_tail(&sh->lru, &conf->handle_list);
 			}
 			md_wakeup_thread(conf->mddev->thread);
@@ -213,7 +250,11 @@ static void __release_stripe(raid5_conf_t *conf, struct stripe_head *sh)
 			}
 			atomic_dec(&conf->active_stripes);
 			if (!test_bit(STRIPE_EXPANDING, &sh->state)) {
-				list_add_tail(&sh->lru, &conf->inactive_list);
+				int hash = sh->hash_lock_index;
+
+				spin_lock(conf->hash_locks + hash);
+				list_add_tail(&sh->lru, conf->inactive_list + hash);
+				spin_unlock(conf->hash_locks + hash);
 				wake_up(&conf->wait_for_stripe);
 				if (conf->retry_read_aligned)
 					md_wakeup_thread(conf->mddev->thread);
@@ -227,6 +268,10 @@ static void release_stripe(struct stripe_head *sh)
 	raid5_conf_t *conf = sh->raid_conf;
 	unsigned long flags;
 
+	/* only dropping the last reference needs the lock */
+	if (atomic_add_unless(&sh->count, -1, 1))
+		return;
+
 	spin_lock_irqsave(&conf->device_lock, flags);
 	__release_stripe(conf, sh);
 	spin_unlock_irqrestore(&conf->device_lock, flags);
@@ -252,16 +297,18 @@ static inline void insert_hash(raid5_conf_t *conf, struct stripe_head *sh)
 }
 
 
-/* find an idle stripe, make sure it is unhashed, and return it. */
-static struct stripe_head *get_free_stripe(raid5_conf_t *conf)
+/*
+ * find an idle stripe in a partition of the cache, make sure it is
+ * unhashed, and return it.  Caller holds the hash lock.
+ */
+static struct stripe_head *get_free_stripe(raid5_conf_t *conf, int hash)
 {
 	struct stripe_head *sh = NULL;
 	struct list_head *first;
 
-	CHECK_DEVLOCK();
-	if (list_empty(&conf->inactive_list))
+	if (list_empty(conf->inactive_list + hash))
 		goto out;
-	first = conf->inactive_list.next;
+	first = conf->inactive_list[hash].next;
 	sh = list_entry(first, struct stripe_head, lru);
 	list_del_init(first);
 	remove_hash(sh);
@@ -323,6 +370,7 @@ static void init_stripe(struct stripe_head *sh, sector_t sector, int previous)
 	sh->sector = sector;
 	stripe_set_idx(sector, conf, previous, sh);
 	sh->state = 0;
+	sh->cpu = smp_processor_id();
 
 
 	for (i = sh->disks; i--; ) {
@@ -348,7 +396,6 @@ static struct stripe_head *__find_stripe(raid5_conf_t *conf, sector_t sector,
 	struct stripe_head *sh;
 	struct hlist_node *hn;
 
-	CHECK_DEVLOCK();
 	pr_debug("__find_stripe, sector %llu\n", (unsigned long long)sector);
 	hlist_for_each_entry(sh, hn, stripe_hash(conf, sector), hash)
 		if (sh->sector == sector && sh->generation == generation)
@@ -365,25 +412,44 @@ get_active_stripe(raid5_conf_t *conf, sector_t sector,
 		  int previous, int noblock, int noquiesce)
 {
 	struct stripe_head *sh;
+	int hash = stripe_hash_locks_hash(sector);
 
 	pr_debug("get_stripe, sector %llu\n", (unsigned long long)sector);
 
+	/*
+	 * Fast path: the stripe is in the cache and somebody is using it,
+	 * so all we need is another reference.
+	 */
+	if (conf->quiesce == 0 || noquiesce) {
+		spin_lock_irq(conf->hash_locks + hash);
+		sh = __find_stripe(conf, sector, conf->generation - previous);
+		if (sh && atomic_inc_not_zero(&sh->count)) {
+			spin_unlock_irq(conf->hash_locks + hash);
+			return sh;
+		}
+		spin_unlock_irq(conf->hash_locks + hash);
+	}
+
 	spin_lock_irq(&conf->device_lock);
 
 	do {
 		wait_event_lock_irq(conf->wait_for_stripe,
 				    conf->quiesce == 0 || noquiesce,
 				    conf->device_lock, /* nothing */);
+		spin_lock(conf->hash_locks + hash);
 		sh = __find_stripe(conf, sector, conf->generation - previous);
 		if (!sh) {
 			if (!conf->inactive_blocked)
-				sh = get_free_stripe(conf);
+				sh = get_free_stripe(conf, hash);
+			if (sh)
+				init_stripe(sh, sector, previous);
+			spin_unlock(conf->hash_locks + hash);
 			if (noblock && sh == NULL)
 				break;
 			if (!sh) {
 				conf->inactive_blocked = 1;
 				wait_event_lock_irq(conf->wait_for_stripe,
-						    !list_empty(&conf->inactive_list) &&
+						    !list_empty(conf->inactive_list + hash) &&
 						    (atomic_read(&conf->active_stripes)
 						     < (conf->max_nr_stripes *3/4)
 						     || !conf->inactive_blocked),
@@ -391,8 +457,7 @@ get_active_stripe(raid5_conf_t *conf, sector_t sector,
 						    raid5_unplug_device(conf->mddev->queue)
 					);
 				conf->inactive_blocked = 0;
-			} else
-				init_stripe(sh, sector, previous);
+			}
 		} else {
 			if (atomic_read(&sh->count)) {
 				BUG_ON(!list_empty(&sh->lru)
@@ -404,7 +469,12 @@ get_active_stripe(raid5_conf_t *conf, sector_t sector,
 				    !test_bit(STRIPE_EXPANDING, &sh->state))
 					BUG();
 				list_del_init(&sh->lru);
+				if (sh->group) {
+					sh->group->stripes_cnt--;
+					sh->group = NULL;
+				}
 			}
+			spin_unlock(conf->hash_locks + hash);
 		}
 	} while (sh == NULL);
 
@@ -901,7 +971,7 @@ static void raid5_run_ops(struct stripe_head *sh, unsigned long ops_request)
 		}
 }
 
-static int grow_one_stripe(raid5_conf_t *conf)
+static int grow_one_stripe(raid5_conf_t *conf, int hash)
 {
 	struct stripe_head *sh;
 	sh = kmem_cache_alloc(conf->slab_cache, GFP_KERNEL);
@@ -909,6 +979,7 @@ static int grow_one_stripe(raid5_conf_t *conf)
 		return 0;
 	memset(sh, 0, sizeof(*sh) + (conf->raid_disks-1)*sizeof(struct r5dev));
 	sh->raid_conf = conf;
+	sh->hash_lock_index = hash;
 	spin_lock_init(&sh->lock);
 
 	if (grow_buffers(sh, conf->raid_disks)) {
@@ -929,6 +1000,7 @@ static int grow_stripes(raid5_conf_t *conf, int num)
 {
 	struct kmem_cache *sc;
 	int devs = conf->raid_disks;
+	int i;
 
 	sprintf(conf->cache_name[0],
 		"raid%d-%s", conf->level, mdname(conf->mddev));
@@ -942,8 +1014,9 @@ static int grow_stripes(raid5_conf_t *conf, int num)
 		return 1;
 	conf->slab_cache = sc;
 	conf->pool_size = devs;
-	while (num--)
-		if (!grow_one_stripe(conf))
+	/* spread the stripes evenly over the hash partitions */
+	for (i = 0; i < num; i++)
+		if (!grow_one_stripe(conf, i & STRIPE_HASH_LOCKS_MASK))
 			return 1;
 	return 0;
 }
@@ -979,6 +1052,7 @@ static int resize_stripes(raid5_conf_t *conf, int newsize)
 	int err;
 	struct kmem_cache *sc;
 	int i;
+	int hash;
 
 	if (newsize <= conf->pool_size)
 		return 0; /* never bother to shrink */
@@ -1018,18 +1092,24 @@ static int resize_stripes(raid5_conf_t *conf, int newsize)
 	}
 	/* Step 2 - Must use GFP_NOIO now.
 	 * OK, we have enough stripes, start collecting inactive
-	 * stripes and copying them over
+	 * stripes and copying them over.  Each partition of the cache
+	 * keeps as many stripes as it had.
 	 */
+	hash = 0;
 	list_for_each_entry(nsh, &newstripes, lru) {
 		spin_lock_irq(&conf->device_lock);
 		wait_event_lock_irq(conf->wait_for_stripe,
-				    !list_empty(&conf->inactive_list),
+				    !list_empty(conf->inactive_list + hash),
 				    conf->device_lock,
 				    unplug_slaves(conf->mddev)
 			);
-		osh = get_free_stripe(conf);
+		spin_lock(conf->hash_locks + hash);
+		osh = get_free_stripe(conf, hash);
+		spin_unlock(conf->hash_locks + hash);
 		spin_unlock_irq(&conf->device_lock);
 		atomic_set(&nsh->count, 1);
+		nsh->hash_lock_index = hash;
+		hash = (hash + 1) & STRIPE_HASH_LOCKS_MASK;
 		for(i=0; i<conf->pool_size; i++)
 			nsh->dev[i].page = osh->dev[i].page;
 		for( ; i<newsize; i++)
@@ -1073,13 +1153,13 @@ static int resize_stripes(raid5_conf_t *conf, int newsize)
 	return err;
 }
 
-static int drop_one_stripe(raid5_conf_t *conf)
+static int drop_one_stripe(raid5_conf_t *conf, int hash)
 {
 	struct stripe_head *sh;
 
-	spin_lock_irq(&conf->device_lock);
-	sh = get_free_stripe(conf);
-	spin_unlock_irq(&conf->device_lock);
+	spin_lock_irq(conf->hash_locks + hash);
+	sh = get_free_stripe(conf, hash);
+	spin_unlock_irq(conf->hash_locks + hash);
 	if (!sh)
 		return 0;
 	BUG_ON(atomic_read(&sh->count));
@@ -1091,8 +1171,11 @@ static int drop_one_stripe(raid5_conf_t *conf)
 
 static void shrink_stripes(raid5_conf_t *conf)
 {
-	while (drop_one_stripe(conf))
-		;
+	int hash;
+
+	for (hash = 0; hash < NR_STRIPE_HASH_LOCKS; hash++)
+		while (drop_one_stripe(conf, hash))
+			;
 
 	if (conf->slab_cache)
 		kmem_cache_destroy(conf->slab_cache);
@@ -1262,9 +1345,9 @@ static void error(mddev_t *mddev, mdk_rdev_t *rdev)
  * Input: a 'big' sector number,
  * Output: index of the data and parity disk, and the sector # in them.
  */
-static sector_t raid5_compute_sector(raid5_conf_t *conf, sector_t r_sector,
-				     int previous, int *dd_idx,
-				     struct stripe_head *sh)
+sector_t raid5_compute_sector(raid5_conf_t *conf, sector_t r_sector,
+			      int previous, int *dd_idx,
+			      struct stripe_head *sh)
 {
 	long stripe;
 	unsigned long chunk_number;
@@ -3328,6 +3411,7 @@ static int raid5_congested(void *data, int bits)
 {
 	mddev_t *mddev = data;
 	raid5_conf_t *conf = mddev_to_conf(mddev);
+	int hash;
 
 	/* No difference between reads and writes.  Just check
 	 * how busy the stripe_cache is
@@ -3336,8 +3420,9 @@ static int raid5_congested(void *data, int bits)
 		return 1;
 	if (conf->quiesce)
 		return 1;
-	if (list_empty_careful(&conf->inactive_list))
-		return 1;
+	for (hash = 0; hash < NR_STRIPE_HASH_LOCKS; hash++)
+		if (list_empty_careful(conf->inactive_list + hash))
+			return 1;
 
 	return 0;
 }
@@ -3552,19 +3637,26 @@ static int chunk_aligned_read(struct request_queue *q, struct bio * raid_bio)
  * stripe with in flight i/o.  The bypass_count will be reset when the
  * head of the hold_list has changed, i.e. the head was promoted to the
  * handle_list.
+ *
+ * Worker threads pass their group and take stripes from the group's
+ * handle_list; raid5d passes NULL and uses conf->handle_list.
  */
-static struct stripe_head *__get_priority_stripe(raid5_conf_t *conf)
+static struct stripe_head *__get_priority_stripe(raid5_conf_t *conf,
+						 struct r5worker_group *group)
 {
 	struct stripe_head *sh;
+	struct list_head *handle_list;
+
+	handle_list = group ? &group->handle_list : &conf->handle_list;
 
 	pr_debug("%s: handle: %s hold: %s full_writes: %d bypass_count: %d\n",
 		  __func__,
-		  list_empty(&conf->handle_list) ? "empty" : "busy",
+		  list_empty(handle_list) ? "empty" : "busy",
 		  list_empty(&conf->hold_list) ? "empty" : "busy",
 		  atomic_read(&conf->pending_full_writes), conf->bypass_count);
 
-	if (!list_empty(&conf->handle_list)) {
-		sh = list_entry(conf->handle_list.next, typeof(*sh), lru);
+	if (!list_empty(handle_list)) {
+		sh = list_entry(handle_list->next, typeof(*sh), lru);
 
 		if (list_empty(&conf->hold_list))
 			conf->bypass_count = 0;
@@ -3591,8 +3683,11 @@ static struct stripe_head *__get_priority_stripe(raid5_conf_t *conf)
 		return NULL;
 
 	list_del_init(&sh->lru);
-	atomic_inc(&sh->count);
-	BUG_ON(atomic_read(&sh->count) != 1);
+	if (sh->group) {
+		sh->group->stripes_cnt--;
+		sh->group = NULL;
+	}
+	BUG_ON(atomic_inc_return(&sh->count) != 1);
 	return sh;
 }
 
@@ -3600,29 +3695,51 @@ static int make_request(struct request_queue *q, struct bio * bi)
 {
 	mddev_t *mddev = q->queuedata;
 	raid5_conf_t *conf = mddev_to_conf(mddev);
-	int dd_idx;
-	sector_t new_sector;
-	sector_t logical_sector, last_sector;
-	struct stripe_head *sh;
 	const int rw = bio_data_dir(bi);
-	int cpu, remaining;
+	int cpu;
 
 	if (unlikely(bio_barrier(bi))) {
 		bio_endio(bi, -EOPNOTSUPP);
 		return 0;
 	}
 
-	md_write_start(mddev, bi);
-
 	cpu = part_stat_lock();
 	part_stat_inc(cpu, &mddev->gendisk->part0, ios[rw]);
 	part_stat_add(cpu, &mddev->gendisk->part0, sectors[rw],
 		      bio_sectors(bi));
 	part_stat_unlock();
 
+	/* the journal may hold newer data than the array */
+	if (unlikely(conf->journal_missing)) {
+		bio_endio(bi, -EIO);
+		return 0;
+	}
+
+	if (conf->log && r5l_make_request(conf->log, bi))
+		return 0;
+
+	return raid5_make_request(mddev, bi);
+}
+
+/*
+ * Map a bio onto the stripe cache.  Besides make_request(), this is used
+ * by the journal to write cached data to the array.
+ */
+int raid5_make_request(mddev_t *mddev, struct bio *bi)
+{
+	raid5_conf_t *conf = mddev_to_conf(mddev);
+	int dd_idx;
+	sector_t new_sector;
+	sector_t logical_sector, last_sector;
+	struct stripe_head *sh;
+	const int rw = bio_data_dir(bi);
+	int remaining;
+
+	md_write_start(mddev, bi);
+
 	if (rw == READ &&
 	     mddev->reshape_position == MaxSector &&
-	     chunk_aligned_read(q,bi))
+	     chunk_aligned_read(mddev->queue, bi))
 		return 0;
 
 	logical_sector = bi->bi_sector & ~((sector_t)STRIPE_SECTORS-1);
@@ -4120,6 +4237,153 @@ static int  retry_aligned_read(raid5_conf_t *conf, struct bio *raid_bio)
 }
 
 
+/*
+ * Handle the stripes queued to a worker group, MAX_STRIPE_BATCH at a
+ * time so that device_lock is taken once per batch rather than twice
+ * per stripe.
+ */
+static void raid5_do_work(struct r5worker *worker)
+{
+	struct r5worker_group *group = worker->group;
+	raid5_conf_t *conf = group->conf;
+	struct stripe_head *batch[MAX_STRIPE_BATCH];
+	int handled = 0;
+	int i, cnt;
+
+	pr_debug("+++ raid5 worker active\n");
+
+	spin_lock_irq(&conf->device_lock);
+	while (1) {
+		for (cnt = 0; cnt < MAX_STRIPE_BATCH; cnt++) {
+			batch[cnt] = __get_priority_stripe(conf, group);
+			if (!batch[cnt])
+				break;
+		}
+		if (!cnt) {
+			worker->working = 0;
+			break;
+		}
+		spin_unlock_irq(&conf->device_lock);
+
+		for (i = 0; i < cnt; i++)
+			handle_stripe(batch[i], worker->spare_page);
+		handled += cnt;
+
+		spin_lock_irq(&conf->device_lock);
+		for (i = 0; i < cnt; i++)
+			__release_stripe(conf, batch[i]);
+	}
+	pr_debug("%d stripes handled\n", handled);
+
+	spin_unlock_irq(&conf->device_lock);
+
+	async_tx_issue_pending_all();
+	unplug_slaves(conf->mddev);
+
+	pr_debug("--- raid5 worker inactive\n");
+}
+
+static int raid5_worker_thread(void *arg)
+{
+	struct r5worker *worker = arg;
+
+	while (1) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		if (kthread_should_stop())
+			break;
+		if (!worker->working) {
+			schedule();
+			continue;
+		}
+		__set_current_state(TASK_RUNNING);
+		raid5_do_work(worker);
+	}
+	__set_current_state(TASK_RUNNING);
+	return 0;
+}
+
+/*
+ * Stop the workers and free the groups.  The caller has made sure that
+ * no stripes are queued to them.
+ */
+static void free_thread_groups(raid5_conf_t *conf, int cnt)
+{
+	struct r5worker_group *group;
+	struct r5worker *worker;
+	int i, j;
+
+	if (!conf->worker_groups)
+		return;
+
+	for (i = 0; i < conf->group_cnt; i++) {
+		group = &conf->worker_groups[i];
+		if (!group->workers)
+			continue;
+		for (j = 0; j < cnt; j++) {
+			worker = &group->workers[j];
+			if (worker->tsk)
+				kthread_stop(worker->tsk);
+			safe_put_page(worker->spare_page);
+		}
+		kfree(group->workers);
+	}
+	kfree(conf->worker_groups);
+	conf->worker_groups = NULL;
+	conf->group_cnt = 0;
+}
+
+/*
+ * Start 'cnt' workers for every NUMA node.  Stripes are only queued to
+ * the groups once the caller sets conf->worker_cnt_per_group.
+ */
+static int alloc_thread_groups(raid5_conf_t *conf, int cnt)
+{
+	struct r5worker_group *group;
+	struct r5worker *worker;
+	int i, j;
+
+	conf->worker_groups = kzalloc(nr_node_ids * sizeof(*group),
+				      GFP_KERNEL);
+	if (!conf->worker_groups)
+		return -ENOMEM;
+	conf->group_cnt = nr_node_ids;
+
+	for (i = 0; i < conf->group_cnt; i++) {
+		const struct cpumask *mask = cpumask_of_node(i);
+
+		group = &conf->worker_groups[i];
+		INIT_LIST_HEAD(&group->handle_list);
+		group->conf = conf;
+		group->workers = kzalloc(cnt * sizeof(*worker), GFP_KERNEL);
+		if (!group->workers)
+			goto abort;
+
+		for (j = 0; j < cnt; j++) {
+			worker = &group->workers[j];
+			worker->group = group;
+			if (conf->level == 6) {
+				worker->spare_page = alloc_page(GFP_KERNEL);
+				if (!worker->spare_page)
+					goto abort;
+			}
+			worker->tsk = kthread_create(raid5_worker_thread, worker,
+						     "%s_raid5w%d.%d",
+						     mdname(conf->mddev), i, j);
+			if (IS_ERR(worker->tsk)) {
+				worker->tsk = NULL;
+				goto abort;
+			}
+			if (!cpumask_empty(mask))
+				set_cpus_allowed_ptr(worker->tsk, mask);
+			wake_up_process(worker->tsk);
+		}
+	}
+	return 0;
+
+abort:
+	free_thread_groups(conf, cnt);
+	return -ENOMEM;
+}
 
 /*
  * This is our raid5 kernel thread.
@@ -4162,7 +4426,7 @@ static void raid5d(mddev_t *mddev)
 			handled++;
 		}
 
-		sh = __get_priority_stripe(conf);
+		sh = __get_priority_stripe(conf, NULL);
 
 		if (!sh)
 			break;
@@ -4211,7 +4475,8 @@ raid5_store_stripe_cache_size(mddev_t *mddev, const char *page, size_t len)
 	if (new <= 16 || new > 32768)
 		return -EINVAL;
 	while (new < conf->max_nr_stripes) {
-		if (drop_one_stripe(conf))
+		if (drop_one_stripe(conf, (conf->max_nr_stripes - 1) &
+					  STRIPE_HASH_LOCKS_MASK))
 			conf->max_nr_stripes--;
 		else
 			break;
@@ -4220,7 +4485,8 @@ raid5_store_stripe_cache_size(mddev_t *mddev, const char *page, size_t len)
 	if (err)
 		return err;
 	while (new > conf->max_nr_stripes) {
-		if (grow_one_stripe(conf))
+		if (grow_one_stripe(conf, conf->max_nr_stripes &
+					  STRIPE_HASH_LOCKS_MASK))
 			conf->max_nr_stripes++;
 		else break;
 	}
@@ -4279,10 +4545,67 @@ stripe_cache_active_show(mddev_t *mddev, char *page)
 static struct md_sysfs_entry
 raid5_stripecache_active = __ATTR_RO(stripe_cache_active);
 
+static ssize_t
+raid5_show_group_thread_cnt(mddev_t *mddev, char *page)
+{
+	raid5_conf_t *conf = mddev_to_conf(mddev);
+	if (conf)
+		return sprintf(page, "%d\n", conf->worker_cnt_per_group);
+	else
+		return 0;
+}
+
+static ssize_t
+raid5_store_group_thread_cnt(mddev_t *mddev, const char *page, size_t len)
+{
+	raid5_conf_t *conf = mddev_to_conf(mddev);
+	unsigned long new;
+	int err = 0;
+	int old;
+
+	if (len >= PAGE_SIZE)
+		return -EINVAL;
+	if (!conf)
+		return -ENODEV;
+
+	if (strict_strtoul(page, 10, &new))
+		return -EINVAL;
+	if (new > num_possible_cpus())
+		return -EINVAL;
+	if (new == conf->worker_cnt_per_group)
+		return len;
+
+	/* once quiesced, no stripe is queued to the old groups */
+	raid5_quiesce(mddev, 1);
+	old = conf->worker_cnt_per_group;
+	spin_lock_irq(&conf->device_lock);
+	conf->worker_cnt_per_group = 0;
+	spin_unlock_irq(&conf->device_lock);
+	free_thread_groups(conf, old);
+	if (new) {
+		err = alloc_thread_groups(conf, new);
+		if (!err) {
+			spin_lock_irq(&conf->device_lock);
+			conf->worker_cnt_per_group = new;
+			spin_unlock_irq(&conf->device_lock);
+		}
+	}
+	raid5_quiesce(mddev, 0);
+
+	return err ? err : len;
+}
+
+static struct md_sysfs_entry
+raid5_group_thread_cnt = __ATTR(group_thread_cnt, S_IRUGO | S_IWUSR,
+				raid5_show_group_thread_cnt,
+				raid5_store_group_thread_cnt);
+
 static struct attribute *raid5_attrs[] =  {
 	&raid5_stripecache_size.attr,
 	&raid5_stripecache_active.attr,
 	&raid5_preread_bypass_threshold.attr,
+	&raid5_group_thread_cnt.attr,
+	&r5l_journal_device.attr,
 	NULL,
 };
 static struct attribute_group raid5_attrs_group = {
@@ -4316,6 +4639,7 @@ static raid5_conf_t *setup_conf(mddev_t *mddev)
 	int raid_disk, memory;
 	mdk_rdev_t *rdev;
 	struct disk_info *disk;
+	int i;
 
 	if (mddev->new_level != 5
 	    && mddev->new_level != 4
@@ -4376,7 +4700,10 @@ static raid5_conf_t *setup_conf(mddev_t *mddev)
 	INIT_LIST_HEAD(&conf->hold_list);
 	INIT_LIST_HEAD(&conf->delayed_list);
 	INIT_LIST_HEAD(&conf->bitmap_list);
-	INIT_LIST_HEAD(&conf->inactive_list);
+	for (i = 0; i < NR_STRIPE_HASH_LOCKS; i++) {
+		spin_lock_init(conf->hash_locks + i);
+		INIT_LIST_HEAD(conf->inactive_list + i);
+	}
 	atomic_set(&conf->active_stripes, 0);
 	atomic_set(&conf->preread_active_stripes, 0);
 	atomic_set(&conf->active_aligned_reads, 0);
@@ -4604,6 +4931,8 @@ static int run(mddev_t *mddev)
 
 	blk_queue_merge_bvec(mddev->queue, raid5_mergeable_bvec);
 
+	r5l_start_log(conf);
+
 	return 0;
 abort:
 	md_unregister_thread(mddev->thread);
@@ -4627,6 +4956,9 @@ static int stop(mddev_t *mddev)
 {
 	raid5_conf_t *conf = (raid5_conf_t *) mddev->private;
 
+	r5l_exit_log(conf);
+	free_thread_groups(conf, conf->worker_cnt_per_group);
+	conf->worker_cnt_per_group = 0;
 	md_unregister_thread(mddev->thread);
 	mddev->thread = NULL;
 	shrink_stripes(conf);
@@ -4856,6 +5188,9 @@ static int raid5_check_reshape(mddev_t *mddev)
 	if (mddev->bitmap)
 		/* Cannot grow a bitmap yet */
 		return -EBUSY;
+	if (conf->log || conf->journal_missing)
+		/* the journal records array sectors of the current layout */
+		return -EBUSY;
 	if (mddev->degraded > conf->max_degraded)
 		return -EINVAL;
 	if (mddev->delta_disks < 0) {
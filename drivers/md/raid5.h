@@ -3,6 +3,10 @@
 
 #include <linux/raid/xor.h>
 
+#define STRIPE_SIZE		PAGE_SIZE
+#define STRIPE_SHIFT		(PAGE_SHIFT - 9)
+#define STRIPE_SECTORS		(STRIPE_SIZE>>9)
+
 /*
  *
  * Each stripe contains one buffer per disc.  Each buffer can be in
@@ -198,6 +202,11 @@ struct stripe_head {
 	struct hlist_node	hash;
 	struct list_head	lru;	      /* inactive_list or handle_list */
 	struct raid5_private_data *raid_conf;
+	struct r5worker_group	*group;	      /* group whose handle_list we
+					       * are on, if any */
+	int			hash_lock_index; /* inactive_list we belong to */
+	int			cpu;	      /* cpu which brought us into
+					       * the cache */
 	short			generation;	/* increments with every
 						 * reshape */
 	sector_t		sector;		/* sector of this row */
@@ -330,6 +339,48 @@ struct disk_info {
 	mdk_rdev_t	*rdev;
 };
 
+/*
+ * Stripe cache locking:
+ *
+ * The hash table and the inactive stripes are split in
+ * NR_STRIPE_HASH_LOCKS partitions, each with its own lock and
+ * inactive_list.  Stripe hash bucket 'b' belongs to partition
+ * 'b & STRIPE_HASH_LOCKS_MASK', and a stripe always stays in the same
+ * partition so it can only be reused for sectors of that partition.
+ *
+ * Finding a stripe which is already active only needs the hash lock.
+ * Everything else, in particular the handle/hold/delayed lists and
+ * activating an idle stripe, needs device_lock.  If both are needed,
+ * device_lock is taken first.
+ */
+#define NR_STRIPE_HASH_LOCKS	8
+#define STRIPE_HASH_LOCKS_MASK	(NR_STRIPE_HASH_LOCKS - 1)
+
+/*
+ * Worker threads:
+ *
+ * With group_thread_cnt set, stripes are not handled by raid5d but by
+ * worker threads.  There is a group of workers for every NUMA node,
+ * and a stripe is handled by the group of the node of the cpu which
+ * brought it into the cache.  Only raid5d handles preread ('hold')
+ * stripes, bitmap updates and retried aligned reads.
+ */
+#define MAX_STRIPE_BATCH	8
+
+struct r5worker {
+	struct task_struct	*tsk;
+	struct r5worker_group	*group;
+	struct page		*spare_page;	/* Used when checking P/Q in raid6 */
+	int			working;	/* protected by device_lock */
+};
+
+struct r5worker_group {
+	struct list_head	handle_list;	/* stripes needing handling */
+	struct raid5_private_data *conf;
+	struct r5worker		*workers;
+	int			stripes_cnt;	/* stripes on handle_list */
+};
+
 struct raid5_private_data {
 	struct hlist_head	*stripe_hashtbl;
 	mddev_t			*mddev;
@@ -390,7 +441,8 @@ struct raid5_private_data {
 	 * Free stripes pool
 	 */
 	atomic_t		active_stripes;
-	struct list_head	inactive_list;
+	spinlock_t		hash_locks[NR_STRIPE_HASH_LOCKS];
+	struct list_head	inactive_list[NR_STRIPE_HASH_LOCKS];
 	wait_queue_head_t	wait_for_stripe;
 	wait_queue_head_t	wait_for_overlap;
 	int			inactive_blocked;	/* release of inactive stripes blocked,
@@ -404,6 +456,13 @@ struct raid5_private_data {
 	 * the new thread here until we fully activate the array.
 	 */
 	struct mdk_thread_s	*thread;
+
+	struct r5worker_group	*worker_groups;	/* one per NUMA node */
+	int			group_cnt;
+	int			worker_cnt_per_group;
+
+	struct r5l_log		*log;		/* journal, see raid5-cache.c */
+	int			journal_missing; /* ... recorded, not attached */
 };
 
 typedef struct raid5_private_data raid5_conf_t;
@@ -471,4 +530,16 @@ static inline int algorithm_is_DDF(int layout)
 {
 	return layout >= 8 && layout <= 10;
 }
+
+extern sector_t raid5_compute_sector(raid5_conf_t *conf, sector_t r_sector,
+				     int previous, int *dd_idx,
+				     struct stripe_head *sh);
+extern int raid5_make_request(mddev_t *mddev, struct bio *bi);
+
+/* raid5-cache.c */
+extern struct md_sysfs_entry r5l_journal_device;
+extern int r5l_make_request(struct r5l_log *log, struct bio *bi);
+extern void r5l_start_log(raid5_conf_t *conf);
+extern void r5l_exit_log(raid5_conf_t *conf);
+
 #endif
@@ -0,0 +1,188 @@
+/* -*- linux-c -*- ------------------------------------------------------- *
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation, Inc., 53 Temple Place Ste 330,
+ *   Boston MA 02111-1307, USA; either version 2 of the License, or
+ *   (at your option) any later version; incorporated herein by reference.
+ *
+ * ----------------------------------------------------------------------- */
+
+/*
+ * raid6recov_ssse3.c
+ *
+ * RAID-6 dual failure recovery using SSSE3.  Multiplying by a constant
+ * is done 16 bytes at a time with PSHUFB: each byte is split into its
+ * two nibbles, which index the products of the constant with the
+ * nibble values kept in raid6_vgfmul, and the two products are XORed.
+ */
+
+#if (defined(__i386__) || defined(__x86_64__)) && !defined(__arch_um__) && \
+	defined(CONFIG_AS_SSSE3)
+
+#include <linux/raid/pq.h>
+#include "raid6x86.h"
+
+static const u8 raid6_ssse3_x0f[16] __attribute__((aligned(16))) = {
+	0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f,
+	0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f,
+};
+
+static int raid6_has_ssse3(void)
+{
+	return boot_cpu_has(X86_FEATURE_XMM) &&
+		boot_cpu_has(X86_FEATURE_XMM2) &&
+		boot_cpu_has(X86_FEATURE_SSSE3);
+}
+
+/* Recover two failed data blocks. */
+static void raid6_2data_recov_ssse3(int disks, size_t bytes, int faila,
+				    int failb, void **ptrs)
+{
+	u8 *p, *q, *dp, *dq;
+	const u8 *pbmul;	/* P multiplier table for B data */
+	const u8 *qmul;		/* Q multiplier table (for both) */
+
+	p = (u8 *)ptrs[disks-2];
+	q = (u8 *)ptrs[disks-1];
+
+	/* Compute syndrome with zero for the missing data pages
+	   Use the dead data pages as temporary storage for
+	   delta p and delta q */
+	dp = (u8 *)ptrs[faila];
+	ptrs[faila] = (void *)raid6_empty_zero_page;
+	ptrs[disks-2] = dp;
+	dq = (u8 *)ptrs[failb];
+	ptrs[failb] = (void *)raid6_empty_zero_page;
+	ptrs[disks-1] = dq;
+
+	raid6_call.gen_syndrome(disks, bytes, ptrs);
+
+	/* Restore pointer table */
+	ptrs[faila]   = dp;
+	ptrs[failb]   = dq;
+	ptrs[disks-2] = p;
+	ptrs[disks-1] = q;
+
+	/* Now, pick the proper data tables */
+	pbmul = raid6_vgfmul[raid6_gfexi[failb-faila]];
+	qmul  = raid6_vgfmul[raid6_gfinv[raid6_gfexp[faila] ^
+					 raid6_gfexp[failb]]];
+
+	kernel_fpu_begin();
+
+	asm volatile("movdqa %0,%%xmm7" : : "m" (raid6_ssse3_x0f[0]));
+
+	while (bytes) {
+		/* xmm0 = px = *p ^ *dp, xmm1 = *q ^ *dq */
+		asm volatile("movdqa %0,%%xmm0" : : "m" (p[0]));
+		asm volatile("movdqa %0,%%xmm1" : : "m" (q[0]));
+		asm volatile("pxor %0,%%xmm0" : : "m" (dp[0]));
+		asm volatile("pxor %0,%%xmm1" : : "m" (dq[0]));
+
+		/* xmm5 = qx = qmul[*q ^ *dq] */
+		asm volatile("movdqa %0,%%xmm4" : : "m" (qmul[0]));
+		asm volatile("movdqa %0,%%xmm5" : : "m" (qmul[16]));
+		asm volatile("movdqa %xmm1,%xmm3");
+		asm volatile("psrlw $4,%xmm1");
+		asm volatile("pand %xmm7,%xmm3");
+		asm volatile("pand %xmm7,%xmm1");
+		asm volatile("pshufb %xmm3,%xmm4");
+		asm volatile("pshufb %xmm1,%xmm5");
+		asm volatile("pxor %xmm4,%xmm5");
+
+		/* xmm1 = pbmul[px] */
+		asm volatile("movdqa %0,%%xmm4" : : "m" (pbmul[0]));
+		asm volatile("movdqa %0,%%xmm1" : : "m" (pbmul[16]));
+		asm volatile("movdqa %xmm0,%xmm2");
+		asm volatile("movdqa %xmm0,%xmm3");
+		asm volatile("psrlw $4,%xmm2");
+		asm volatile("pand %xmm7,%xmm3");
+		asm volatile("pand %xmm7,%xmm2");
+		asm volatile("pshufb %xmm3,%xmm4");
+		asm volatile("pshufb %xmm2,%xmm1");
+		asm volatile("pxor %xmm4,%xmm1");
+
+		/* Reconstructed B = pbmul[px] ^ qx, A = B ^ px */
+		asm volatile("pxor %xmm5,%xmm1");
+		asm volatile("movdqa %%xmm1,%0" : "=m" (dq[0]));
+		asm volatile("pxor %xmm1,%xmm0");
+		asm volatile("movdqa %%xmm0,%0" : "=m" (dp[0]));
+
+		bytes -= 16;
+		p += 16;
+		q += 16;
+		dp += 16;
+		dq += 16;
+	}
+
+	kernel_fpu_end();
+}
+
+/* Recover failure of one data block plus the P block */
+static void raid6_datap_recov_ssse3(int disks, size_t bytes, int faila,
+				    void **ptrs)
+{
+	u8 *p, *q, *dq;
+	const u8 *qmul;		/* Q multiplier table */
+
+	p = (u8 *)ptrs[disks-2];
+	q = (u8 *)ptrs[disks-1];
+
+	/* Compute syndrome with zero for the missing data page
+	   Use the dead data page as temporary storage for delta q */
+	dq = (u8 *)ptrs[faila];
+	ptrs[faila] = (void *)raid6_empty_zero_page;
+	ptrs[disks-1] = dq;
+
+	raid6_call.gen_syndrome(disks, bytes, ptrs);
+
+	/* Restore pointer table */
+	ptrs[faila]   = dq;
+	ptrs[disks-1] = q;
+
+	/* Now, pick the proper data tables */
+	qmul  = raid6_vgfmul[raid6_gfinv[raid6_gfexp[faila]]];
+
+	kernel_fpu_begin();
+
+	asm volatile("movdqa %0,%%xmm7" : : "m" (raid6_ssse3_x0f[0]));
+
+	while (bytes) {
+		/* xmm1 = *dq = qmul[*q ^ *dq] */
+		asm volatile("movdqa %0,%%xmm3" : : "m" (dq[0]));
+		asm volatile("movdqa %0,%%xmm0" : : "m" (qmul[0]));
+		asm volatile("movdqa %0,%%xmm1" : : "m" (qmul[16]));
+		asm volatile("pxor %0,%%xmm3" : : "m" (q[0]));
+		asm volatile("movdqa %xmm3,%xmm2");
+		asm volatile("psrlw $4,%xmm2");
+		asm volatile("pand %xmm7,%xmm3");
+		asm volatile("pand %xmm7,%xmm2");
+		asm volatile("pshufb %xmm3,%xmm0");
+		asm volatile("pshufb %xmm2,%xmm1");
+		asm volatile("pxor %xmm0,%xmm1");
+		asm volatile("movdqa %%xmm1,%0" : "=m" (dq[0]));
+
+		/* *p ^= *dq */
+		asm volatile("movdqa %0,%%xmm2" : : "m" (p[0]));
+		asm volatile("pxor %xmm1,%xmm2");
+		asm volatile("movdqa %%xmm2,%0" : "=m" (p[0]));
+
+		bytes -= 16;
+		p += 16;
+		q += 16;
+		dq += 16;
+	}
+
+	kernel_fpu_end();
+}
+
+const struct raid6_recov_calls raid6_recov_ssse3 = {
+	.data2 = raid6_2data_recov_ssse3,
+	.datap = raid6_datap_recov_ssse3,
+	.valid = raid6_has_ssse3,
+	.name = "ssse3",
+	.priority = 1,
+};
+
+#endif
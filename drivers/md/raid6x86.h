@@ -41,18 +41,39 @@ static inline void kernel_fpu_end(void)
 #define X86_FEATURE_XMM		(0*32+25) /* Streaming SIMD Extensions */
 #define X86_FEATURE_XMM2	(0*32+26) /* Streaming SIMD Extensions-2 */
 #define X86_FEATURE_MMXEXT	(1*32+22) /* AMD MMX extensions */
+#define X86_FEATURE_SSSE3	(4*32+ 9) /* Supplemental SSE-3 */
+#define X86_FEATURE_XSAVE	(4*32+26) /* XSAVE/XRSTOR/XSETBV/XGETBV */
+#define X86_FEATURE_AVX		(4*32+28) /* Advanced Vector Extensions */
+#define X86_FEATURE_AVX2	(7*32+ 2) /* AVX2 instructions */
 
 /* Should work well enough on modern CPUs for testing */
 static inline int boot_cpu_has(int flag)
 {
-	u32 eax = (flag >> 5) ? 0x80000001 : 1;
-	u32 edx;
+	u32 eax, ebx, ecx = 0, edx;
+
+	switch (flag >> 5) {
+	case 1:
+		eax = 0x80000001;
+		break;
+	case 7:
+		eax = 7;	/* the only one we use is AVX2, in ebx */
+		break;
+	default:
+		eax = 1;
+		break;
+	}
 
 	asm volatile("cpuid"
-		     : "+a" (eax), "=d" (edx)
-		     : : "ecx", "ebx");
+		     : "+a" (eax), "=b" (ebx), "+c" (ecx), "=d" (edx));
 
-	return (edx >> (flag & 31)) & 1;
+	switch (flag >> 5) {
+	case 4:
+		return (ecx >> (flag & 31)) & 1;
+	case 7:
+		return (ebx >> 5) & 1;
+	default:
+		return (edx >> (flag & 31)) & 1;
+	}
 }
 
 #endif /* ndef __KERNEL__ */
@@ -62,12 +62,14 @@ struct btrfs_worker_thread {
 
 /*
  * helper function to move a thread onto the idle list after it
- * has finished some requests.
+ * has finished some requests.  The threshold is rounded up, so that
+ * a worker of a pool with an idle_thresh of 1 still becomes idle once
+ * it has nothing left to do.
  */
 static void check_idle_worker(struct btrfs_worker_thread *worker)
 {
 	if (!worker->idle && atomic_read(&worker->num_pending) <
-	    worker->workers->idle_thresh / 2) {
+	    (worker->workers->idle_thresh + 1) / 2) {
 		unsigned long flags;
 		spin_lock_irqsave(&worker->workers->lock, flags);
 		worker->idle = 1;
@@ -350,7 +352,6 @@ static struct btrfs_worker_thread *next_worker(struct btrfs_workers *workers)
 	 */
 	next = workers->worker_list.next;
 	worker = list_entry(next, struct btrfs_worker_thread, worker_list);
-	atomic_inc(&worker->num_pending);
 	worker->sequence++;
 
 	if (worker->sequence % workers->idle_thresh == 0)
@@ -357,7 +357,14 @@ struct btrfs_super_block {
  */
 #define BTRFS_FEATURE_COMPAT_SUPP	0x0
 #define BTRFS_FEATURE_COMPAT_RO_SUPP	0x0
-#define BTRFS_FEATURE_INCOMPAT_SUPP	0x0
+
+/*
+ * some extents are compressed with lzo, which older kernels can't read
+ */
+#define BTRFS_FEATURE_INCOMPAT_COMPRESS_LZO	(1ULL << 0)
+
+#define BTRFS_FEATURE_INCOMPAT_SUPP		\
+	BTRFS_FEATURE_INCOMPAT_COMPRESS_LZO
 
 /*
  * A leaf is full of items. offset and size tell us where to find
@@ -464,7 +471,9 @@ struct btrfs_timespec {
 enum btrfs_compression_type {
 	BTRFS_COMPRESS_NONE = 0,
 	BTRFS_COMPRESS_ZLIB = 1,
-	BTRFS_COMPRESS_LAST = 2,
+	BTRFS_COMPRESS_LZO = 2,
+	BTRFS_COMPRESS_TYPES = 2,
+	BTRFS_COMPRESS_LAST = 3,
 };
 
 struct btrfs_inode_item {
@@ -736,6 +745,8 @@ struct btrfs_fs_info {
 	u64 last_trans_log_full_commit;
 	u64 open_ioctl_trans;
 	unsigned long mount_opt;
+	/* the algorithm new compressed extents use, if COMPRESS is set */
+	int compress_type;
 	u64 max_extent;
 	u64 max_inline;
 	u64 alloc_start;
@@ -1708,7 +1708,12 @@ struct btrfs_root *open_ctree(struct super_block *sb,
 	fs_info->workers.idle_thresh = 16;
 	fs_info->workers.ordered = 1;
 
-	fs_info->delalloc_workers.idle_thresh = 2;
+	/*
+	 * every delalloc job is a compressed extent worth of cpu time,
+	 * so a worker with one queued is busy and the next job should go
+	 * to another one, started on demand up to the thread pool size
+	 */
+	fs_info->delalloc_workers.idle_thresh = 1;
 	fs_info->delalloc_workers.ordered = 1;
 
 	btrfs_init_workers(&fs_info->fixup_workers, "fixup", 1);
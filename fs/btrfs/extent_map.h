@@ -27,6 +27,8 @@ struct extent_map {
 	struct block_device *bdev;
 	atomic_t refs;
 	int in_tree;
+	/* if EXTENT_FLAG_COMPRESSED, the compression algorithm used */
+	int compress_type;
 };
 
 struct extent_map_tree {
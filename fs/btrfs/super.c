@@ -67,7 +67,8 @@ static void btrfs_put_super(struct super_block *sb)
 enum {
 	Opt_degraded, Opt_subvol, Opt_device, Opt_nodatasum, Opt_nodatacow,
 	Opt_max_extent, Opt_max_inline, Opt_alloc_start, Opt_nobarrier,
-	Opt_ssd, Opt_thread_pool, Opt_noacl,  Opt_compress, Opt_notreelog,
+	Opt_ssd, Opt_thread_pool, Opt_noacl,  Opt_compress, Opt_compress_type,
+	Opt_notreelog,
 	Opt_ratio, Opt_flushoncommit, Opt_err,
 };
 
@@ -83,6 +84,7 @@ static match_table_t tokens = {
 	{Opt_alloc_start, "alloc_start=%s"},
 	{Opt_thread_pool, "thread_pool=%d"},
 	{Opt_compress, "compress"},
+	{Opt_compress_type, "compress=%s"},
 	{Opt_ssd, "ssd"},
 	{Opt_noacl, "noacl"},
 	{Opt_notreelog, "notreelog"},
@@ -116,6 +118,21 @@ u64 btrfs_parse_size(char *str)
 	return res;
 }
 
+/*
+ * lzo compressed extents can't be read by kernels which don't know about
+ * lzo, so flag the filesystem before any are written.  The flag goes to
+ * disk with the next commit of the super.
+ */
+static void btrfs_set_lzo_incompat(struct btrfs_fs_info *info)
+{
+	struct btrfs_super_block *disk_super = &info->super_copy;
+	u64 features;
+
+	features = btrfs_super_incompat_flags(disk_super);
+	features |= BTRFS_FEATURE_INCOMPAT_COMPRESS_LZO;
+	btrfs_set_super_incompat_flags(disk_super, features);
+}
+
 /*
  * Regular mount options parser.  Everything that is needed only when
  * reading in a new superblock is parsed here.
@@ -124,8 +141,9 @@ int btrfs_parse_options(struct btrfs_root *root, char *options)
 {
 	struct btrfs_fs_info *info = root->fs_info;
 	substring_t args[MAX_OPT_ARGS];
-	char *p, *num;
+	char *p, *num, *orig;
 	int intarg;
+	int ret = 0;
 
 	if (!options)
 		return 0;
@@ -138,6 +156,8 @@ int btrfs_parse_options(struct btrfs_root *root, char *options)
 	if (!options)
 		return -ENOMEM;
 
+	orig = options;
+
 
 	while ((p = strsep(&options, ",")) != NULL) {
 		int token;
@@ -167,7 +187,30 @@ int btrfs_parse_options(struct btrfs_root *root, char *options)
 			btrfs_set_opt(info->mount_opt, NODATASUM);
 			break;
 		case Opt_compress:
-			printk(KERN_INFO "btrfs: use compression\n");
+			printk(KERN_INFO "btrfs: use zlib compression\n");
+			info->compress_type = BTRFS_COMPRESS_ZLIB;
+			btrfs_set_opt(info->mount_opt, COMPRESS);
+			break;
+		case Opt_compress_type:
+			num = match_strdup(&args[0]);
+			if (!num) {
+				ret = -ENOMEM;
+				goto out;
+			}
+			if (!strcmp(num, "zlib")) {
+				info->compress_type = BTRFS_COMPRESS_ZLIB;
+			} else if (!strcmp(num, "lzo")) {
+				info->compress_type = BTRFS_COMPRESS_LZO;
+				btrfs_set_lzo_incompat(info);
+			} else {
+				printk(KERN_ERR "btrfs: unknown compression "
+				       "type '%s'\n", num);
+				kfree(num);
+				ret = -EINVAL;
+				goto out;
+			}
+			printk(KERN_INFO "btrfs: use %s compression\n", num);
+			kfree(num);
 			btrfs_set_opt(info->mount_opt, COMPRESS);
 			break;
 		case Opt_ssd:
@@ -248,8 +291,9 @@ int btrfs_parse_options(struct btrfs_root *root, char *options)
 			break;
 		}
 	}
-	kfree(options);
-	return 0;
+out:
+	kfree(orig);
+	return ret;
 }
 
 /*
@@ -431,8 +475,12 @@ static int btrfs_show_options(struct seq_file *seq, struct vfsmount *vfs)
 	if (info->thread_pool_size !=  min_t(unsigned long,
 					     num_online_cpus() + 2, 8))
 		seq_printf(seq, ",thread_pool=%d", info->thread_pool_size);
-	if (btrfs_test_opt(root, COMPRESS))
-		seq_puts(seq, ",compress");
+	if (btrfs_test_opt(root, COMPRESS)) {
+		if (info->compress_type == BTRFS_COMPRESS_LZO)
+			seq_puts(seq, ",compress=lzo");
+		else
+			seq_puts(seq, ",compress");
+	}
 	if (btrfs_test_opt(root, SSD))
 		seq_puts(seq, ",ssd");
 	if (btrfs_test_opt(root, NOTREELOG))
@@ -726,10 +774,14 @@ static int __init init_btrfs_fs(void)
 	if (err)
 		goto free_sysfs;
 
-	err = extent_io_init();
+	err = btrfs_init_compress();
 	if (err)
 		goto free_cachep;
 
+	err = extent_io_init();
+	if (err)
+		goto free_compress;
+
 	err = extent_map_init();
 	if (err)
 		goto free_extent_io;
@@ -751,6 +803,8 @@ free_extent_map:
 	extent_map_exit();
 free_extent_io:
 	extent_io_exit();
+free_compress:
+	btrfs_exit_compress();
 free_cachep:
 	btrfs_destroy_cachep();
 free_sysfs:
@@ -767,7 +821,7 @@ static void __exit exit_btrfs_fs(void)
 	unregister_filesystem(&btrfs_fs_type);
 	btrfs_exit_sysfs();
 	btrfs_cleanup_fs_uuids();
-	btrfs_zlib_exit();
+	btrfs_exit_compress();
 }
 
 module_init(init_btrfs_fs)
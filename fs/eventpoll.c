@@ -33,6 +33,8 @@
 #include <linux/bitops.h>
 #include <linux/mutex.h>
 #include <linux/anon_inodes.h>
+#include <linux/vmalloc.h>
+#include <linux/log2.h>
 #include <asm/uaccess.h>
 #include <asm/system.h>
 #include <asm/io.h>
@@ -41,18 +43,20 @@
 
 /*
  * LOCKING:
- * There are three level of locking required by epoll :
+ * There are two level of locking required by epoll :
  *
  * 1) epmutex (mutex)
  * 2) ep->mtx (mutex)
- * 3) ep->lock (spinlock)
  *
- * The acquire order is the one listed above, from 1 to 3.
- * We need a spinlock (ep->lock) because we manipulate objects
- * from inside the poll callback, that might be triggered from
- * a wake_up() that in turn might be called from IRQ context.
- * So we can't sleep inside the poll callback and hence we need
- * a spinlock. During the event transfer loop (from kernel to
+ * The acquire order is the one listed above, from 1 to 2.
+ * The poll callback, that might be triggered from a wake_up() that in
+ * turn might be called from IRQ context, does not take any epoll lock.
+ * It pushes ready items on a lockless singly linked chain (ep->rdlhead)
+ * with cmpxchg(), so many producers never contend with each other or
+ * with the task harvesting events. The chain is detached in one shot
+ * with xchg() by the consumer, which holds ep->mtx, and its items are
+ * moved to the ready list (ep->rdllist), that is only ever touched with
+ * ep->mtx held. During the event transfer loop (from kernel to
  * user space) we could end up sleeping due a copy_to_user(), so
  * we need a lock that will allow us to sleep. This lock is a
  * mutex (ep->mtx). It is acquired during the event transfer loop,
@@ -64,7 +68,7 @@
  * if a file has been pushed inside an epoll set and it is then
  * close()d without a previous call toepoll_ctl(EPOLL_CTL_DEL).
  * It is possible to drop the "ep->mtx" and to use the global
- * mutex "epmutex" (together with "ep->lock") to have it working,
+ * mutex "epmutex" to have it working,
  * but having "ep->mtx" will make the interface more scalable.
  * Events that require holding "epmutex" are very rare, while for
  * normal operations the epoll private "ep->mtx" will guarantee
@@ -86,6 +90,9 @@
 
 #define EP_ITEM_COST (sizeof(struct epitem) + sizeof(struct eppoll_entry))
 
+/* Maximum number of event slots of a mmap()ed event ring */
+#define EP_MAX_RING_EVENTS (1U << 16)
+
 struct epoll_filefd {
 	struct file *file;
 	int fd;
@@ -122,8 +129,9 @@ struct epitem {
 	struct list_head rdllink;
 
 	/*
-	 * Works together "struct eventpoll"->ovflist in keeping the
-	 * single linked chain of items.
+	 * Works together "struct eventpoll"->rdlhead in keeping the lockless
+	 * single linked chain of items. Set to EP_UNACTIVE_PTR when the item
+	 * is not chained.
 	 */
 	struct epitem *next;
 
@@ -152,9 +160,6 @@ struct epitem {
  * interface.
  */
 struct eventpoll {
-	/* Protect the this structure access */
-	spinlock_t lock;
-
 	/*
 	 * This mutex is used to ensure that files are not removed
 	 * while epoll is using them. This is held during the event
@@ -169,21 +174,30 @@ struct eventpoll {
 	/* Wait queue used by file->poll() */
 	wait_queue_head_t poll_wait;
 
-	/* List of ready file descriptors */
+	/* List of ready file descriptors, protected by "mtx" */
 	struct list_head rdllist;
 
 	/* RB tree root used to store monitored fd structs */
 	struct rb_root rbr;
 
 	/*
-	 * This is a single linked list that chains all the "struct epitem" that
-	 * happened while transfering ready events to userspace w/out
-	 * holding ->lock.
+	 * This is a lockless single linked list that chains all the
+	 * "struct epitem" signaled by the poll callback and not yet moved
+	 * to "rdllist". Producers push with cmpxchg(), the consumer takes
+	 * the whole chain with xchg().
 	 */
-	struct epitem *ovflist;
+	struct epitem *rdlhead;
 
 	/* The user that created the eventpoll descriptor */
 	struct user_struct *user;
+
+	/* Event ring mmap()ed by userspace, and its size in bytes */
+	struct epoll_ring *ring;
+	unsigned long ring_size;
+
+	/* Ring slot mask and the kernel private copy of the ring tail */
+	unsigned int ring_mask;
+	unsigned int ring_tail;
 };
 
 /* Wait structure used by the poll hooks */
@@ -214,6 +228,9 @@ struct ep_pqueue {
 struct ep_send_events_data {
 	int maxevents;
 	struct epoll_event __user *events;
+
+	/* If not NULL, events are stored here instead of in "events" */
+	struct epoll_ring *ring;
 };
 
 /*
@@ -281,6 +298,63 @@ static inline int ep_is_linked(struct list_head *p)
 	return !list_empty(p);
 }
 
+/*
+ * Pushes the item on the lockless ready chain, unless it is already
+ * chained. Can be called from any context, concurrently with other
+ * producers and with ep_drain_ready(). Returns 1 if the item has been
+ * chained by this call. Both the atomic operations below imply a full
+ * memory barrier, so the caller can test the wait queues right after.
+ */
+static inline int ep_push_ready(struct eventpoll *ep, struct epitem *epi)
+{
+	struct epitem *first;
+
+	/* Claim the item, so that only one producer can chain it */
+	if (cmpxchg(&epi->next, EP_UNACTIVE_PTR, NULL) != EP_UNACTIVE_PTR)
+		return 0;
+
+	do {
+		first = ACCESS_ONCE(ep->rdlhead);
+		epi->next = first;
+	} while (cmpxchg(&ep->rdlhead, first, epi) != first);
+
+	return 1;
+}
+
+/*
+ * Detaches the lockless ready chain and moves its items to the tail of
+ * @head, in the order they have been signaled. Items that are already
+ * linked to a ready list are skipped. Must be called with "mtx" held (or
+ * "epmutex" if called from ep_free), since it touches the items "rdllink".
+ */
+static void ep_drain_ready(struct eventpoll *ep, struct list_head *head)
+{
+	struct epitem *epi, *nepi, *rev = NULL;
+
+	/* The chain is LIFO, reverse it to keep the signaling order */
+	for (epi = xchg(&ep->rdlhead, NULL); epi; epi = nepi) {
+		nepi = epi->next;
+		epi->next = rev;
+		rev = epi;
+	}
+
+	for (epi = rev; epi; epi = nepi) {
+		/*
+		 * Once we store EP_UNACTIVE_PTR the poll callback can chain the
+		 * item again, so we need to fetch the link in the same shot.
+		 */
+		nepi = xchg(&epi->next, EP_UNACTIVE_PTR);
+		if (!ep_is_linked(&epi->rdllink))
+			list_add_tail(&epi->rdllink, head);
+	}
+}
+
+/* Tells if there are events to harvest, without taking any lock */
+static inline int ep_events_available(struct eventpoll *ep)
+{
+	return !list_empty(&ep->rdllist) || ACCESS_ONCE(ep->rdlhead) != NULL;
+}
+
 /* Get the "struct epitem" from a wait queue pointer */
 static inline struct epitem *ep_item_from_wait(wait_queue_t *p)
 {
@@ -451,8 +525,6 @@ static int ep_scan_ready_list(struct eventpoll *ep,
 			      void *priv)
 {
 	int error, pwake = 0;
-	unsigned long flags;
-	struct epitem *epi, *nepi;
 	LIST_HEAD(txlist);
 
 	/*
@@ -463,62 +535,46 @@ static int ep_scan_ready_list(struct eventpoll *ep,
 
 	/*
 	 * Steal the ready list, and re-init the original one to the
-	 * empty list. Also, set ep->ovflist to NULL so that events
-	 * happening while looping w/out locks, are not lost. We cannot
-	 * have the poll callback to queue directly on ep->rdllist,
-	 * because we want the "sproc" callback to be able to do it
-	 * in a lockless way.
+	 * empty list. Then collect what the poll callback chained so far.
+	 * Events happening while looping w/out locks are not lost, since
+	 * the poll callback keeps chaining them on ep->rdlhead.
 	 */
-	spin_lock_irqsave(&ep->lock, flags);
 	list_splice_init(&ep->rdllist, &txlist);
-	ep->ovflist = NULL;
-	spin_unlock_irqrestore(&ep->lock, flags);
+	ep_drain_ready(ep, &txlist);
 
 	/*
 	 * Now call the callback function.
 	 */
 	error = (*sproc)(ep, &txlist, priv);
 
-	spin_lock_irqsave(&ep->lock, flags);
 	/*
-	 * During the time we spent inside the "sproc" callback, some
-	 * other events might have been queued by the poll callback.
-	 * We re-insert them inside the main ready-list here.
+	 * Quickly re-inject items left on "txlist".
 	 */
-	for (nepi = ep->ovflist; (epi = nepi) != NULL;
-	     nepi = epi->next, epi->next = EP_UNACTIVE_PTR) {
-		/*
-		 * We need to check if the item is already in the list.
-		 * During the "sproc" callback execution time, items are
-		 * queued into ->ovflist but the "txlist" might already
-		 * contain them, and the list_splice() below takes care of them.
-		 */
-		if (!ep_is_linked(&epi->rdllink))
-			list_add_tail(&epi->rdllink, &ep->rdllist);
-	}
+	list_splice(&txlist, &ep->rdllist);
+
 	/*
-	 * We need to set back ep->ovflist to EP_UNACTIVE_PTR, so that after
-	 * releasing the lock, events will be queued in the normal way inside
-	 * ep->rdllist.
+	 * During the time we spent inside the "sproc" callback, some
+	 * other events might have been chained by the poll callback.
+	 * We re-insert them inside the main ready-list here. Items that
+	 * were on "txlist" at that time are already linked, and skipped.
 	 */
-	ep->ovflist = EP_UNACTIVE_PTR;
+	ep_drain_ready(ep, &ep->rdllist);
 
 	/*
-	 * Quickly re-inject items left on "txlist".
+	 * Pairs with set_current_state() in ep_poll(), so that either we see
+	 * the waiter, or the waiter sees the items re-injected above.
 	 */
-	list_splice(&txlist, &ep->rdllist);
-
+	smp_mb();
 	if (!list_empty(&ep->rdllist)) {
 		/*
 		 * Wake up (if active) both the eventpoll wait list and
-		 * the ->poll() wait list (delayed after we release the lock).
+		 * the ->poll() wait list (delayed after we release the mutex).
 		 */
 		if (waitqueue_active(&ep->wq))
-			wake_up_locked(&ep->wq);
+			wake_up(&ep->wq);
 		if (waitqueue_active(&ep->poll_wait))
 			pwake++;
 	}
-	spin_unlock_irqrestore(&ep->lock, flags);
 
 	mutex_unlock(&ep->mtx);
 
@@ -535,16 +591,12 @@ static int ep_scan_ready_list(struct eventpoll *ep,
  */
 static int ep_remove(struct eventpoll *ep, struct epitem *epi)
 {
-	unsigned long flags;
 	struct file *file = epi->ffd.file;
 
 	/*
-	 * Removes poll wait queue hooks. We _have_ to do this without holding
-	 * the "ep->lock" otherwise a deadlock might occur. This because of the
-	 * sequence of the lock acquisition. Here we do "ep->lock" then the wait
-	 * queue head lock when unregistering the wait queue. The wakeup callback
-	 * will run by holding the wait queue head lock and will call our callback
-	 * that will try to get "ep->lock".
+	 * Removes poll wait queue hooks. The wakeup callback runs by holding
+	 * the wait queue head lock, so once this returns the poll callback
+	 * cannot chain the item anymore.
 	 */
 	ep_unregister_pollwait(ep, epi);
 
@@ -556,10 +608,13 @@ static int ep_remove(struct eventpoll *ep, struct epitem *epi)
 
 	rb_erase(&epi->rbn, &ep->rbr);
 
-	spin_lock_irqsave(&ep->lock, flags);
+	/*
+	 * The item might still sit on the lockless chain, from where it
+	 * cannot be unlinked. Flush the chain inside the ready list first.
+	 */
+	ep_drain_ready(ep, &ep->rdllist);
 	if (ep_is_linked(&epi->rdllink))
 		list_del_init(&epi->rdllink);
-	spin_unlock_irqrestore(&ep->lock, flags);
 
 	/* At this point it is safe to free the eventpoll item */
 	kmem_cache_free(epi_cache, epi);
@@ -601,7 +656,7 @@ static void ep_free(struct eventpoll *ep)
 	 * Walks through the whole tree by freeing each "struct epitem". At this
 	 * point we are sure no poll callbacks will be lingering around, and also by
 	 * holding "epmutex" we can be sure that no file cleanup code will hit
-	 * us during this operation. So we can avoid the lock on "ep->lock".
+	 * us during this operation. So we can avoid the lock on "ep->mtx".
 	 */
 	while ((rbp = rb_first(&ep->rbr)) != NULL) {
 		epi = rb_entry(rbp, struct epitem, rbn);
@@ -611,6 +666,11 @@ static void ep_free(struct eventpoll *ep)
 	mutex_unlock(&epmutex);
 	mutex_destroy(&ep->mtx);
 	free_uid(ep->user);
+	/*
+	 * The ring mappings hold a reference to the epoll file, so nobody
+	 * can still be looking at the ring pages here.
+	 */
+	vfree(ep->ring);
 	kfree(ep);
 }
 
@@ -671,10 +731,68 @@ static unsigned int ep_eventpoll_poll(struct file *file, poll_table *wait)
 	return pollflags != -1 ? pollflags : 0;
 }
 
+/*
+ * Maps the event ring filled by sys_epoll_wait_ring(). The ring is
+ * allocated by the first mmap(), whose size sets the number of event
+ * slots, a power of two up to EP_MAX_RING_EVENTS. The mapping must not
+ * be larger than needed for them. Further mappings must have the same
+ * size, and share the ring.
+ */
+static int ep_eventpoll_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	int error;
+	unsigned int nr;
+	struct epoll_ring *ring;
+	struct eventpoll *ep = file->private_data;
+	unsigned long size = vma->vm_end - vma->vm_start;
+
+	if (vma->vm_pgoff || !(vma->vm_flags & VM_SHARED))
+		return -EINVAL;
+	if (size < sizeof(struct epoll_ring) + sizeof(struct epoll_event))
+		return -EINVAL;
+
+	mutex_lock(&ep->mtx);
+
+	ring = ep->ring;
+	if (!ring) {
+		nr = (size - sizeof(struct epoll_ring)) / sizeof(struct epoll_event);
+		nr = rounddown_pow_of_two(min(nr, EP_MAX_RING_EVENTS));
+
+		error = -EINVAL;
+		if (size != PAGE_ALIGN(sizeof(struct epoll_ring) +
+				       nr * sizeof(struct epoll_event)))
+			goto out_unlock;
+
+		error = -ENOMEM;
+		ring = vmalloc_user(size);
+		if (!ring)
+			goto out_unlock;
+		ring->nr_events = nr;
+
+		ep->ring_size = size;
+		ep->ring_mask = nr - 1;
+		ep->ring_tail = 0;
+		/* Make the ring setup visible before sys_epoll_wait_ring() sees it */
+		smp_wmb();
+		ep->ring = ring;
+	} else if (size != ep->ring_size) {
+		error = -EBUSY;
+		goto out_unlock;
+	}
+
+	error = remap_vmalloc_range(vma, ring, 0);
+
+out_unlock:
+	mutex_unlock(&ep->mtx);
+
+	return error;
+}
+
 /* File callbacks that implement the eventpoll file behaviour */
 static const struct file_operations eventpoll_fops = {
 	.release	= ep_eventpoll_release,
-	.poll		= ep_eventpoll_poll
+	.poll		= ep_eventpoll_poll,
+	.mmap		= ep_eventpoll_mmap
 };
 
 /* Fast test to see if the file is an evenpoll file */
@@ -734,13 +852,12 @@ static int ep_alloc(struct eventpoll **pep)
 	if (unlikely(!ep))
 		goto free_uid;
 
-	spin_lock_init(&ep->lock);
 	mutex_init(&ep->mtx);
 	init_waitqueue_head(&ep->wq);
 	init_waitqueue_head(&ep->poll_wait);
 	INIT_LIST_HEAD(&ep->rdllist);
 	ep->rbr = RB_ROOT;
-	ep->ovflist = EP_UNACTIVE_PTR;
+	ep->rdlhead = NULL;
 	ep->user = user;
 
 	*pep = ep;
@@ -789,12 +906,9 @@ static struct epitem *ep_find(struct eventpoll *ep, struct file *file, int fd)
 static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *key)
 {
 	int pwake = 0;
-	unsigned long flags;
 	struct epitem *epi = ep_item_from_wait(wait);
 	struct eventpoll *ep = epi->ep;
 
-	spin_lock_irqsave(&ep->lock, flags);
-
 	/*
 	 * If the event mask does not contain any poll(2) event, we consider the
 	 * descriptor to be disabled. This condition is likely the effect of the
@@ -802,7 +916,7 @@ static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *k
 	 * until the next EPOLL_CTL_MOD will be issued.
 	 */
 	if (!(epi->event.events & ~EP_PRIVATE_BITS))
-		goto out_unlock;
+		goto out;
 
 	/*
 	 * Check the events coming with the callback. At this stage, not
@@ -811,39 +925,28 @@ static int ep_poll_callback(wait_queue_t *wait, unsigned mode, int sync, void *k
 	 * test for "key" != NULL before the event match test.
 	 */
 	if (key && !((unsigned long) key & epi->event.events))
-		goto out_unlock;
+		goto out;
 
 	/*
-	 * If we are trasfering events to userspace, we can hold no locks
-	 * (because we're accessing user memory, and because of linux f_op->poll()
-	 * semantics). All the events that happens during that period of time are
-	 * chained in ep->ovflist and requeued later on.
+	 * Chain the item for the consumer. This is done without any lock, also
+	 * while the consumer is transfering events to userspace. If this file
+	 * is already chained we exit soon, the waiters have been woken up by
+	 * whoever chained it.
 	 */
-	if (unlikely(ep->ovflist != EP_UNACTIVE_PTR)) {
-		if (epi->next == EP_UNACTIVE_PTR) {
-			epi->next = ep->ovflist;
-			ep->ovflist = epi;
-		}
-		goto out_unlock;
-	}
-
-	/* If this file is already in the ready list we exit soon */
-	if (!ep_is_linked(&epi->rdllink))
-		list_add_tail(&epi->rdllink, &ep->rdllist);
+	if (!ep_push_ready(ep, epi))
+		goto out;
 
 	/*
 	 * Wake up ( if active ) both the eventpoll wait list and the ->poll()
 	 * wait list.
 	 */
 	if (waitqueue_active(&ep->wq))
-		wake_up_locked(&ep->wq);
+		wake_up(&ep->wq);
 	if (waitqueue_active(&ep->poll_wait))
 		pwake++;
 
-out_unlock:
-	spin_unlock_irqrestore(&ep->lock, flags);
-
-	/* We have to call this outside the lock */
+out:
+	/* Wake up the ->poll() waiters, which can be nested epoll sets */
 	if (pwake)
 		ep_poll_safewake(&ep->poll_wait);
 
@@ -899,7 +1002,6 @@ static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
 		     struct file *tfile, int fd)
 {
 	int error, revents, pwake = 0;
-	unsigned long flags;
 	struct epitem *epi;
 	struct ep_pqueue epq;
 
@@ -952,22 +1054,15 @@ static int ep_insert(struct eventpoll *ep, struct epoll_event *event,
 	 */
 	ep_rbtree_insert(ep, epi);
 
-	/* We have to drop the new item inside our item list to keep track of it */
-	spin_lock_irqsave(&ep->lock, flags);
-
 	/* If the file is already "ready" we drop it inside the ready list */
-	if ((revents & event->events) && !ep_is_linked(&epi->rdllink)) {
-		list_add_tail(&epi->rdllink, &ep->rdllist);
-
+	if ((revents & event->events) && ep_push_ready(ep, epi)) {
 		/* Notify waiting tasks that events are available */
 		if (waitqueue_active(&ep->wq))
-			wake_up_locked(&ep->wq);
+			wake_up(&ep->wq);
 		if (waitqueue_active(&ep->poll_wait))
 			pwake++;
 	}
 
-	spin_unlock_irqrestore(&ep->lock, flags);
-
 	atomic_inc(&ep->user->epoll_watches);
 
 	/* We have to call this outside the lock */
@@ -981,14 +1076,13 @@ error_unregister:
 
 	/*
 	 * We need to do this because an event could have been arrived on some
-	 * allocated wait queue. Note that we don't care about the ep->ovflist
-	 * list, since that is used/cleaned only inside a section bound by "mtx".
-	 * And ep_insert() is called with "mtx" held.
+	 * allocated wait queue, and chained the item. The ready list and the
+	 * chain consumer side are bound by "mtx", and ep_insert() is called
+	 * with "mtx" held.
 	 */
-	spin_lock_irqsave(&ep->lock, flags);
+	ep_drain_ready(ep, &ep->rdllist);
 	if (ep_is_linked(&epi->rdllink))
 		list_del_init(&epi->rdllink);
-	spin_unlock_irqrestore(&ep->lock, flags);
 
 	kmem_cache_free(epi_cache, epi);
 
@@ -1022,18 +1116,13 @@ static int ep_modify(struct eventpoll *ep, struct epitem *epi, struct epoll_even
 	 * If the item is "hot" and it is not registered inside the ready
 	 * list, push it inside.
 	 */
-	if (revents & event->events) {
-		spin_lock_irq(&ep->lock);
-		if (!ep_is_linked(&epi->rdllink)) {
-			list_add_tail(&epi->rdllink, &ep->rdllist);
-
-			/* Notify waiting tasks that events are available */
-			if (waitqueue_active(&ep->wq))
-				wake_up_locked(&ep->wq);
-			if (waitqueue_active(&ep->poll_wait))
-				pwake++;
-		}
-		spin_unlock_irq(&ep->lock);
+	if ((revents & event->events) && !ep_is_linked(&epi->rdllink) &&
+	    ep_push_ready(ep, epi)) {
+		/* Notify waiting tasks that events are available */
+		if (waitqueue_active(&ep->wq))
+			wake_up(&ep->wq);
+		if (waitqueue_active(&ep->poll_wait))
+			pwake++;
 	}
 
 	/* We have to call this outside the lock */
@@ -1047,10 +1136,29 @@ static int ep_send_events_proc(struct eventpoll *ep, struct list_head *head,
 			       void *priv)
 {
 	struct ep_send_events_data *esed = priv;
-	int eventcnt;
-	unsigned int revents;
+	int eventcnt, maxevents = esed->maxevents;
+	unsigned int revents, used;
 	struct epitem *epi;
 	struct epoll_event __user *uevent;
+	struct epoll_event *kevent;
+
+	if (esed->ring) {
+		/*
+		 * The ring "head" is owned by userspace, and it is only used to
+		 * bound the free space. The tail is published from our private
+		 * copy, since userspace could scribble over the shared one.
+		 */
+		used = ep->ring_tail - ACCESS_ONCE(esed->ring->head);
+		if (used > ep->ring_mask + 1)
+			return -EINVAL;
+		if (used == ep->ring_mask + 1)
+			return -EOVERFLOW;
+		maxevents = min_t(unsigned int, maxevents,
+				  ep->ring_mask + 1 - used);
+
+		/* Do not overwrite slots before userspace is done reading them */
+		smp_mb();
+	}
 
 	/*
 	 * We can loop without lock because we are passed a task private list.
@@ -1058,7 +1166,7 @@ static int ep_send_events_proc(struct eventpoll *ep, struct list_head *head,
 	 * holding "mtx" during this call.
 	 */
 	for (eventcnt = 0, uevent = esed->events;
-	     !list_empty(head) && eventcnt < esed->maxevents;) {
+	     !list_empty(head) && eventcnt < maxevents;) {
 		epi = list_first_entry(head, struct epitem, rdllink);
 
 		list_del_init(&epi->rdllink);
@@ -1073,13 +1181,18 @@ static int ep_send_events_proc(struct eventpoll *ep, struct list_head *head,
 		 * can change the item.
 		 */
 		if (revents) {
-			if (__put_user(revents, &uevent->events) ||
-			    __put_user(epi->event.data, &uevent->data)) {
+			if (esed->ring) {
+				kevent = &esed->ring->events[(ep->ring_tail + eventcnt) &
+							     ep->ring_mask];
+				kevent->events = revents;
+				kevent->data = epi->event.data;
+			} else if (__put_user(revents, &uevent->events) ||
+				   __put_user(epi->event.data, &uevent->data)) {
 				list_add(&epi->rdllink, head);
 				return eventcnt ? eventcnt : -EFAULT;
-			}
+			} else
+				uevent++;
 			eventcnt++;
-			uevent++;
 			if (epi->event.events & EPOLLONESHOT)
 				epi->event.events &= EP_PRIVATE_BITS;
 			else if (!(epi->event.events & EPOLLET)) {
@@ -1092,29 +1205,31 @@ static int ep_send_events_proc(struct eventpoll *ep, struct list_head *head,
 				 * into ep->rdllist besides us. The epoll_ctl()
 				 * callers are locked out by
 				 * ep_scan_ready_list() holding "mtx" and the
-				 * poll callback will queue them in ep->ovflist.
+				 * poll callback will chain them on ep->rdlhead.
 				 */
 				list_add_tail(&epi->rdllink, &ep->rdllist);
 			}
 		}
 	}
 
+	if (esed->ring && eventcnt) {
+		/* Make the events visible before the new tail */
+		ep->ring_tail += eventcnt;
+		smp_wmb();
+		esed->ring->tail = ep->ring_tail;
+	}
+
 	return eventcnt;
 }
 
 static int ep_send_events(struct eventpoll *ep,
-			  struct epoll_event __user *events, int maxevents)
+			  struct ep_send_events_data *esed)
 {
-	struct ep_send_events_data esed;
-
-	esed.maxevents = maxevents;
-	esed.events = events;
-
-	return ep_scan_ready_list(ep, ep_send_events_proc, &esed);
+	return ep_scan_ready_list(ep, ep_send_events_proc, esed);
 }
 
-static int ep_poll(struct eventpoll *ep, struct epoll_event __user *events,
-		   int maxevents, long timeout)
+static int ep_poll(struct eventpoll *ep, struct ep_send_events_data *esed,
+		   long timeout)
 {
 	int res, eavail;
 	unsigned long flags;
@@ -1130,10 +1245,8 @@ static int ep_poll(struct eventpoll *ep, struct epoll_event __user *events,
 		MAX_SCHEDULE_TIMEOUT : (timeout * HZ + 999) / 1000;
 
 retry:
-	spin_lock_irqsave(&ep->lock, flags);
-
 	res = 0;
-	if (list_empty(&ep->rdllist)) {
+	if (!ep_events_available(ep)) {
 		/*
 		 * We don't have any available event to return to the caller.
 		 * We need to sleep here, and we will be wake up by
@@ -1141,34 +1254,37 @@ retry:
 		 */
 		init_waitqueue_entry(&wait, current);
 		wait.flags |= WQ_FLAG_EXCLUSIVE;
+
+		spin_lock_irqsave(&ep->wq.lock, flags);
 		__add_wait_queue(&ep->wq, &wait);
 
 		for (;;) {
 			/*
 			 * We don't want to sleep if the ep_poll_callback() sends us
 			 * a wakeup in between. That's why we set the task state
-			 * to TASK_INTERRUPTIBLE before doing the checks.
+			 * to TASK_INTERRUPTIBLE before doing the checks. The
+			 * barrier implied here pairs with the atomic operations
+			 * in ep_push_ready().
 			 */
 			set_current_state(TASK_INTERRUPTIBLE);
-			if (!list_empty(&ep->rdllist) || !jtimeout)
+			if (ep_events_available(ep) || !jtimeout)
 				break;
 			if (signal_pending(current)) {
 				res = -EINTR;
 				break;
 			}
 
-			spin_unlock_irqrestore(&ep->lock, flags);
+			spin_unlock_irqrestore(&ep->wq.lock, flags);
 			jtimeout = schedule_timeout(jtimeout);
-			spin_lock_irqsave(&ep->lock, flags);
+			spin_lock_irqsave(&ep->wq.lock, flags);
 		}
 		__remove_wait_queue(&ep->wq, &wait);
+		spin_unlock_irqrestore(&ep->wq.lock, flags);
 
 		set_current_state(TASK_RUNNING);
 	}
 	/* Is it worth to try to dig for events ? */
-	eavail = !list_empty(&ep->rdllist) || ep->ovflist != EP_UNACTIVE_PTR;
-
-	spin_unlock_irqrestore(&ep->lock, flags);
+	eavail = ep_events_available(ep);
 
 	/*
 	 * Try to transfer events to user space. In case we get 0 events and
@@ -1176,7 +1292,7 @@ retry:
 	 * more luck.
 	 */
 	if (!res && eavail &&
-	    !(res = ep_send_events(ep, events, maxevents)) && jtimeout)
+	    !(res = ep_send_events(ep, esed)) && jtimeout)
 		goto retry;
 
 	return res;
@@ -1324,6 +1440,7 @@ SYSCALL_DEFINE4(epoll_wait, int, epfd, struct epoll_event __user *, events,
 	int error;
 	struct file *file;
 	struct eventpoll *ep;
+	struct ep_send_events_data esed;
 
 	/* The maximum number of event must be greater than zero */
 	if (maxevents <= 0 || maxevents > EP_MAX_EVENTS)
@@ -1356,7 +1473,59 @@ SYSCALL_DEFINE4(epoll_wait, int, epfd, struct epoll_event __user *, events,
 	ep = file->private_data;
 
 	/* Time to fish for events ... */
-	error = ep_poll(ep, events, maxevents, timeout);
+	esed.maxevents = maxevents;
+	esed.events = events;
+	esed.ring = NULL;
+	error = ep_poll(ep, &esed, timeout);
+
+error_fput:
+	fput(file);
+error_return:
+
+	return error;
+}
+
+/*
+ * Same as sys_epoll_wait(), but the events are stored inside the ring that
+ * has been mmap()ed on the eventpoll file, instead of being copied one by
+ * one to a user buffer. Returns the number of events added to the ring,
+ * or -EOVERFLOW if the ring has no free slots.
+ */
+SYSCALL_DEFINE3(epoll_wait_ring, int, epfd, int, maxevents, int, timeout)
+{
+	int error;
+	struct file *file;
+	struct eventpoll *ep;
+	struct ep_send_events_data esed;
+
+	/* The maximum number of event must be greater than zero */
+	if (maxevents <= 0 || maxevents > EP_MAX_EVENTS)
+		return -EINVAL;
+
+	/* Get the "struct file *" for the eventpoll file */
+	error = -EBADF;
+	file = fget(epfd);
+	if (!file)
+		goto error_return;
+
+	/*
+	 * We have to check that the file structure underneath the fd
+	 * the user passed to us _is_ an eventpoll file, and that the
+	 * event ring has been mapped.
+	 */
+	error = -EINVAL;
+	if (!is_file_epoll(file))
+		goto error_fput;
+	ep = file->private_data;
+	esed.ring = ACCESS_ONCE(ep->ring);
+	if (!esed.ring)
+		goto error_fput;
+	smp_rmb();
+
+	/* Time to fish for events ... */
+	esed.maxevents = maxevents;
+	esed.events = NULL;
+	error = ep_poll(ep, &esed, timeout);
 
 error_fput:
 	fput(file);
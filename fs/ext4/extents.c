@@ -1935,8 +1935,8 @@ errout:
 /*
  * ext4_ext_rm_idx:
  * removes index from the index block.
- * It's used in truncate case only, thus all requests are for
- * last index in the block only.
+ * Truncate always removes the last index in the block, a punched
+ * hole may remove one from the middle.
  */
 static int ext4_ext_rm_idx(handle_t *handle, struct inode *inode,
 			struct ext4_ext_path *path)
@@ -1952,6 +1952,10 @@ static int ext4_ext_rm_idx(handle_t *handle, struct inode *inode,
 	err = ext4_ext_get_access(handle, inode, path);
 	if (err)
 		return err;
+	if (path->p_idx != EXT_LAST_INDEX(path->p_hdr))
+		memmove(path->p_idx, path->p_idx + 1,
+			(EXT_LAST_INDEX(path->p_hdr) - path->p_idx) *
+			sizeof(struct ext4_extent_idx));
 	le16_add_cpu(&path->p_hdr->eh_entries, -1);
 	err = ext4_ext_dirty(handle, inode, path);
 	if (err)
@@ -2062,8 +2066,18 @@ static int ext4_remove_blocks(handle_t *handle, struct inode *inode,
 		ext4_free_blocks(handle, inode, start, num, metadata);
 	} else if (from == le32_to_cpu(ex->ee_block)
 		   && to <= le32_to_cpu(ex->ee_block) + ee_len - 1) {
-		printk(KERN_INFO "strange request: removal %u-%u from %u:%u\n",
-			from, to, le32_to_cpu(ex->ee_block), ee_len);
+		/* head removal, for punched holes */
+		ext4_lblk_t num;
+		ext4_fsblk_t start;
+
+		num = to - from + 1;
+		start = ext_pblock(ex);
+		ext_debug("free first %u blocks starting %llu\n", num, start);
+		for (i = 0; i < num; i++) {
+			bh = sb_find_get_block(inode->i_sb, start + i);
+			ext4_forget(handle, 0, inode, bh, start + i);
+		}
+		ext4_free_blocks(handle, inode, start, num, metadata);
 	} else {
 		printk(KERN_INFO "strange request: removal(2) "
 				"%u-%u from %u:%u\n",
@@ -2074,7 +2088,7 @@ static int ext4_remove_blocks(handle_t *handle, struct inode *inode,
 
 static int
 ext4_ext_rm_leaf(handle_t *handle, struct inode *inode,
-		struct ext4_ext_path *path, ext4_lblk_t start)
+		struct ext4_ext_path *path, ext4_lblk_t start, ext4_lblk_t end)
 {
 	int err = 0, correct_index = 0;
 	int depth = ext_depth(inode), credits;
@@ -2083,11 +2097,12 @@ ext4_ext_rm_leaf(handle_t *handle, struct inode *inode,
 	unsigned num;
 	ext4_lblk_t ex_ee_block;
 	unsigned short ex_ee_len;
-	unsigned uninitialized = 0;
+	unsigned uninitialized;
 	struct ext4_extent *ex;
+	ext4_fsblk_t pblock;
 
 	/* the header must be checked already in ext4_ext_remove_space() */
-	ext_debug("truncate since %u in leaf\n", start);
+	ext_debug("truncate %u:%u in leaf\n", start, end);
 	if (!path[depth].p_hdr)
 		path[depth].p_hdr = ext_block_hdr(path[depth].p_bh);
 	eh = path[depth].p_hdr;
@@ -2097,35 +2112,46 @@ ext4_ext_rm_leaf(handle_t *handle, struct inode *inode,
 	ex = EXT_LAST_EXTENT(eh);
 
 	ex_ee_block = le32_to_cpu(ex->ee_block);
-	if (ext4_ext_is_uninitialized(ex))
-		uninitialized = 1;
 	ex_ee_len = ext4_ext_get_actual_len(ex);
 
 	while (ex >= EXT_FIRST_EXTENT(eh) &&
 			ex_ee_block + ex_ee_len > start) {
+
+		/* extents past a punched hole stay */
+		if (ex_ee_block > end) {
+			ex--;
+			ex_ee_block = le32_to_cpu(ex->ee_block);
+			ex_ee_len = ext4_ext_get_actual_len(ex);
+			continue;
+		}
+
 		ext_debug("remove ext %lu:%u\n", ex_ee_block, ex_ee_len);
 		path[depth].p_ext = ex;
+		uninitialized = ext4_ext_is_uninitialized(ex);
+		pblock = ext_pblock(ex);
 
 		a = ex_ee_block > start ? ex_ee_block : start;
-		b = ex_ee_block + ex_ee_len - 1 < EXT_MAX_BLOCK ?
-			ex_ee_block + ex_ee_len - 1 : EXT_MAX_BLOCK;
+		b = ex_ee_block + ex_ee_len - 1 < end ?
+			ex_ee_block + ex_ee_len - 1 : end;
 
 		ext_debug("  border %u:%u\n", a, b);
 
 		if (a != ex_ee_block && b != ex_ee_block + ex_ee_len - 1) {
-			block = 0;
-			num = 0;
-			BUG();
+			/* ext4_ext_remove_space() splits such extents */
+			ext4_error(inode->i_sb, __func__,
+				   "can not remove %u:%u from extent %u:%u",
+				   start, end, ex_ee_block, ex_ee_len);
+			err = -EIO;
+			goto out;
 		} else if (a != ex_ee_block) {
 			/* remove tail of the extent */
 			block = ex_ee_block;
 			num = a - block;
 		} else if (b != ex_ee_block + ex_ee_len - 1) {
 			/* remove head of the extent */
-			block = a;
-			num = b - a;
-			/* there is no "make a hole" API yet */
-			BUG();
+			block = b + 1;
+			num = ex_ee_block + ex_ee_len - block;
+			pblock += block - ex_ee_block;
 		} else {
 			/* remove whole extent: excellent! */
 			block = ex_ee_block;
@@ -2162,18 +2188,28 @@ ext4_ext_rm_leaf(handle_t *handle, struct inode *inode,
 		if (num == 0) {
 			/* this extent is removed; mark slot entirely unused */
 			ext4_ext_store_pblock(ex, 0);
+			ex->ee_block = cpu_to_le32(block);
+			ex->ee_len = 0;
+			/* a punched hole may leave extents to the right */
+			if (ex != EXT_LAST_EXTENT(eh)) {
+				memmove(ex, ex + 1, (EXT_LAST_EXTENT(eh) - ex) *
+					sizeof(struct ext4_extent));
+				memset(EXT_LAST_EXTENT(eh), 0,
+					sizeof(struct ext4_extent));
+			}
 			le16_add_cpu(&eh->eh_entries, -1);
+		} else {
+			ext4_ext_store_pblock(ex, pblock);
+			ex->ee_block = cpu_to_le32(block);
+			ex->ee_len = cpu_to_le16(num);
+			/*
+			 * Do not mark uninitialized if all the blocks in the
+			 * extent have been removed.
+			 */
+			if (uninitialized)
+				ext4_ext_mark_uninitialized(ex);
 		}
 
-		ex->ee_block = cpu_to_le32(block);
-		ex->ee_len = cpu_to_le16(num);
-		/*
-		 * Do not mark uninitialized if all the blocks in the
-		 * extent have been removed.
-		 */
-		if (uninitialized && num)
-			ext4_ext_mark_uninitialized(ex);
-
 		err = ext4_ext_dirty(handle, inode, path + depth);
 		if (err)
 			goto out;
@@ -2202,7 +2238,7 @@ out:
  * returns 1 if current index has to be freed (even partial)
  */
 static int
-ext4_ext_more_to_rm(struct ext4_ext_path *path)
+ext4_ext_more_to_rm(struct ext4_ext_path *path, ext4_lblk_t start)
 {
 	BUG_ON(path->p_idx == NULL);
 
@@ -2210,15 +2246,104 @@ ext4_ext_more_to_rm(struct ext4_ext_path *path)
 		return 0;
 
 	/*
-	 * if truncate on deeper level happened, it wasn't partial,
-	 * so we have to consider current index for truncation
+	 * the index on the right begins at or before start, so
+	 * everything below this one lies before the removed range
 	 */
-	if (le16_to_cpu(path->p_hdr->eh_entries) == path->p_block)
+	if (path->p_idx != EXT_LAST_INDEX(path->p_hdr) &&
+	    le32_to_cpu(path->p_idx[1].ei_block) <= start)
 		return 0;
 	return 1;
 }
 
-static int ext4_ext_remove_space(struct inode *inode, ext4_lblk_t start)
+/*
+ * ext4_ext_punch_extent:
+ * a hole strictly inside one extent splits it in two.  The tail goes
+ * in as a new extent first, so that a failure leaves the file intact.
+ * Returns 1 if [start, end] was handled here.
+ */
+static int ext4_ext_punch_extent(handle_t *handle, struct inode *inode,
+				 ext4_lblk_t start, ext4_lblk_t end)
+{
+	struct ext4_ext_path *path;
+	struct ext4_extent *ex, newex;
+	ext4_lblk_t ee_block;
+	unsigned int ee_len;
+	ext4_fsblk_t pblock;
+	int depth, uninitialized, credits, i, err;
+
+	path = ext4_ext_find_extent(inode, start, NULL);
+	if (IS_ERR(path))
+		return PTR_ERR(path);
+	depth = ext_depth(inode);
+	ex = path[depth].p_ext;
+	if (!ex)
+		goto none;
+	ee_block = le32_to_cpu(ex->ee_block);
+	ee_len = ext4_ext_get_actual_len(ex);
+	if (ee_block >= start || ee_block + ee_len - 1 <= end)
+		goto none;
+
+	uninitialized = ext4_ext_is_uninitialized(ex);
+	pblock = ext_pblock(ex);
+
+	credits = ext4_ext_calc_credits_for_single_extent(inode, 1, path) +
+		7 + 2 * EXT4_QUOTA_TRANS_BLOCKS(inode->i_sb);
+	err = ext4_ext_journal_restart(handle, credits);
+	if (err)
+		goto out;
+
+	newex.ee_block = cpu_to_le32(end + 1);
+	newex.ee_len = cpu_to_le16(ee_block + ee_len - end - 1);
+	ext4_ext_store_pblock(&newex, pblock + end + 1 - ee_block);
+	if (uninitialized)
+		ext4_ext_mark_uninitialized(&newex);
+	err = ext4_ext_insert_extent(handle, inode, path, &newex);
+	if (err)
+		goto out;
+
+	/* the insert may have rearranged the tree, look the head up again */
+	ext4_ext_drop_refs(path);
+	kfree(path);
+	path = ext4_ext_find_extent(inode, start, NULL);
+	if (IS_ERR(path))
+		return PTR_ERR(path);
+	depth = ext_depth(inode);
+	ex = path[depth].p_ext;
+	err = ext4_ext_get_access(handle, inode, path + depth);
+	if (err)
+		goto out;
+	ex->ee_len = cpu_to_le16(start - ee_block);
+	if (uninitialized)
+		ext4_ext_mark_uninitialized(ex);
+	err = ext4_ext_dirty(handle, inode, path + depth);
+	if (err)
+		goto out;
+
+	pblock += start - ee_block;
+	for (i = 0; i < end - start + 1; i++) {
+		struct buffer_head *bh;
+
+		bh = sb_find_get_block(inode->i_sb, pblock + i);
+		ext4_forget(handle, 0, inode, bh, pblock + i);
+	}
+	ext4_free_blocks(handle, inode, pblock, end - start + 1, 0);
+	err = 1;
+	goto out;
+none:
+	err = 0;
+out:
+	ext4_ext_drop_refs(path);
+	kfree(path);
+	return err;
+}
+
+/*
+ * ext4_ext_remove_space:
+ * removes blocks [start, end] from the extent tree, end being
+ * EXT_MAX_BLOCK for truncate.
+ */
+static int ext4_ext_remove_space(struct inode *inode, ext4_lblk_t start,
+				 ext4_lblk_t end)
 {
 	struct super_block *sb = inode->i_sb;
 	int depth = ext_depth(inode);
@@ -2226,7 +2351,7 @@ static int ext4_ext_remove_space(struct inode *inode, ext4_lblk_t start)
 	handle_t *handle;
 	int i = 0, err = 0;
 
-	ext_debug("truncate since %u\n", start);
+	ext_debug("truncate %u:%u\n", start, end);
 
 	/* probably first extent we're gonna free will be last in block */
 	handle = ext4_journal_start(inode, depth + 1);
@@ -2235,6 +2360,15 @@ static int ext4_ext_remove_space(struct inode *inode, ext4_lblk_t start)
 
 	ext4_ext_invalidate_cache(inode);
 
+	if (end != EXT_MAX_BLOCK) {
+		err = ext4_ext_punch_extent(handle, inode, start, end);
+		if (err) {
+			ext4_journal_stop(handle);
+			return err < 0 ? err : 0;
+		}
+		depth = ext_depth(inode);
+	}
+
 	/*
 	 * We start scanning from right side, freeing all the blocks
 	 * after i_size and walking into the tree depth-wise.
@@ -2254,7 +2388,7 @@ static int ext4_ext_remove_space(struct inode *inode, ext4_lblk_t start)
 	while (i >= 0 && err == 0) {
 		if (i == depth) {
 			/* this is leaf block */
-			err = ext4_ext_rm_leaf(handle, inode, path, start);
+			err = ext4_ext_rm_leaf(handle, inode, path, start, end);
 			/* root level has p_bh == NULL, brelse() eats this */
 			brelse(path[i].p_bh);
 			path[i].p_bh = NULL;
@@ -2271,7 +2405,6 @@ static int ext4_ext_remove_space(struct inode *inode, ext4_lblk_t start)
 		if (!path[i].p_idx) {
 			/* this level hasn't been touched yet */
 			path[i].p_idx = EXT_LAST_INDEX(path[i].p_hdr);
-			path[i].p_block = le16_to_cpu(path[i].p_hdr->eh_entries)+1;
 			ext_debug("init index ptr: hdr 0x%p, num %d\n",
 				  path[i].p_hdr,
 				  le16_to_cpu(path[i].p_hdr->eh_entries));
@@ -2283,8 +2416,12 @@ static int ext4_ext_remove_space(struct inode *inode, ext4_lblk_t start)
 		ext_debug("level %d - index, first 0x%p, cur 0x%p\n",
 				i, EXT_FIRST_INDEX(path[i].p_hdr),
 				path[i].p_idx);
-		if (ext4_ext_more_to_rm(path + i)) {
+		if (ext4_ext_more_to_rm(path + i, start)) {
 			struct buffer_head *bh;
+
+			/* the subtree lies past a punched hole */
+			if (le32_to_cpu(path[i].p_idx->ei_block) > end)
+				continue;
 			/* go to the next level */
 			ext_debug("move to level %d (block %llu)\n",
 				  i + 1, idx_pblock(path[i].p_idx));
@@ -2305,10 +2442,6 @@ static int ext4_ext_remove_space(struct inode *inode, ext4_lblk_t start)
 				break;
 			}
 			path[i + 1].p_bh = bh;
-
-			/* save actual number of indexes since this
-			 * number is changed at the next iteration */
-			path[i].p_block = le16_to_cpu(path[i].p_hdr->eh_entries);
 			i++;
 		} else {
 			/* we finished processing this index, go up */
@@ -3051,7 +3184,7 @@ void ext4_ext_truncate(struct inode *inode)
 
 	last_block = (inode->i_size + sb->s_blocksize - 1)
 			>> EXT4_BLOCK_SIZE_BITS(sb);
-	err = ext4_ext_remove_space(inode, last_block);
+	err = ext4_ext_remove_space(inode, last_block, EXT_MAX_BLOCK);
 
 	/* In a multi-transaction truncate, we only make the final
 	 * transaction synchronous.
@@ -3099,12 +3232,202 @@ static void ext4_falloc_update_inode(struct inode *inode,
 
 }
 
+/*
+ * ext4_ext_shift_extents:
+ * moves every extent from block start on down by shift blocks,
+ * [start - shift, start) having been punched out already.
+ */
+static int ext4_ext_shift_extents(handle_t *handle, struct inode *inode,
+				  ext4_lblk_t start, ext4_lblk_t shift)
+{
+	struct ext4_ext_path *path;
+	struct ext4_extent_header *eh;
+	struct ext4_extent *ex;
+	ext4_lblk_t next = start;
+	int depth, err = 0;
+
+	while (next != EXT_MAX_BLOCK) {
+		path = ext4_ext_find_extent(inode, next, NULL);
+		if (IS_ERR(path))
+			return PTR_ERR(path);
+		depth = ext_depth(inode);
+		eh = path[depth].p_hdr;
+		if (!path[depth].p_ext)
+			goto out;
+
+		/* skip the extents before the collapsed range */
+		ex = EXT_FIRST_EXTENT(eh);
+		while (ex <= EXT_LAST_EXTENT(eh) &&
+		       le32_to_cpu(ex->ee_block) < start)
+			ex++;
+
+		if (ex <= EXT_LAST_EXTENT(eh)) {
+			err = ext4_ext_journal_restart(handle, depth + 2);
+			if (err)
+				goto out;
+			err = ext4_ext_get_access(handle, inode, path + depth);
+			if (err)
+				goto out;
+			path[depth].p_ext = ex;
+			for (; ex <= EXT_LAST_EXTENT(eh); ex++)
+				le32_add_cpu(&ex->ee_block, -shift);
+			err = ext4_ext_dirty(handle, inode, path + depth);
+			if (err)
+				goto out;
+			/* moving the first extent moves the indexes above */
+			err = ext4_ext_correct_indexes(handle, inode, path);
+			if (err)
+				goto out;
+		}
+
+		next = ext4_ext_next_leaf_block(inode, path);
+		ext4_ext_drop_refs(path);
+		kfree(path);
+	}
+	return 0;
+out:
+	ext4_ext_drop_refs(path);
+	kfree(path);
+	return err;
+}
+
+/*
+ * Deallocate the blocks fully inside [offset, offset + length), zeroing
+ * the partial blocks at either edge.  Called with i_mutex held.
+ */
+static long ext4_ext_punch_hole(struct inode *inode, loff_t offset,
+				loff_t length)
+{
+	struct super_block *sb = inode->i_sb;
+	struct address_space *mapping = inode->i_mapping;
+	unsigned int blkbits = inode->i_blkbits;
+	ext4_lblk_t first_block, stop_block;
+	loff_t end;
+	handle_t *handle;
+	int err;
+
+	if (!S_ISREG(inode->i_mode))
+		return -EOPNOTSUPP;
+	if (offset >= inode->i_size)
+		return 0;
+	end = min_t(loff_t, offset + length, inode->i_size);
+
+	/* get delayed allocations in the range onto disk first */
+	err = filemap_write_and_wait_range(mapping, offset, end - 1);
+	if (err)
+		return err;
+	truncate_inode_pages_range(mapping, offset, end - 1);
+
+	handle = ext4_journal_start(inode, ext4_writepage_trans_blocks(inode));
+	if (IS_ERR(handle))
+		return PTR_ERR(handle);
+
+	first_block = (offset + sb->s_blocksize - 1) >> blkbits;
+	stop_block = end >> blkbits;
+	if (offset & (sb->s_blocksize - 1)) {
+		loff_t edge = min_t(loff_t, (loff_t)first_block << blkbits,
+				    end);
+
+		err = ext4_block_zero_page_range(handle, mapping, offset,
+						 edge - offset);
+		if (err)
+			goto out_stop;
+	}
+	if ((end & (sb->s_blocksize - 1)) && stop_block >= first_block) {
+		err = ext4_block_zero_page_range(handle, mapping,
+				(loff_t)stop_block << blkbits,
+				end & (sb->s_blocksize - 1));
+		if (err)
+			goto out_stop;
+	}
+
+	if (first_block < stop_block) {
+		down_write(&EXT4_I(inode)->i_data_sem);
+		ext4_ext_invalidate_cache(inode);
+		ext4_discard_preallocations(inode);
+		err = ext4_ext_remove_space(inode, first_block,
+					    stop_block - 1);
+		ext4_ext_invalidate_cache(inode);
+		up_write(&EXT4_I(inode)->i_data_sem);
+	}
+
+	if (IS_SYNC(inode))
+		ext4_handle_sync(handle);
+	inode->i_mtime = inode->i_ctime = ext4_current_time(inode);
+	ext4_mark_inode_dirty(handle, inode);
+out_stop:
+	ext4_journal_stop(handle);
+	return err;
+}
+
+/*
+ * Remove [offset, offset + len) and move the rest of the file down.
+ * Both must be block aligned.  Called with i_mutex held.
+ */
+static long ext4_ext_collapse_range(struct inode *inode, loff_t offset,
+				    loff_t len)
+{
+	struct address_space *mapping = inode->i_mapping;
+	unsigned int blkbits = inode->i_blkbits;
+	ext4_lblk_t start, shift;
+	loff_t new_size;
+	handle_t *handle;
+	int err;
+
+	if (!S_ISREG(inode->i_mode))
+		return -EOPNOTSUPP;
+	if ((offset | len) & (inode->i_sb->s_blocksize - 1))
+		return -EINVAL;
+	/* the VFS checked this without i_mutex, a truncate may have raced */
+	if (offset + len >= i_size_read(inode))
+		return -EINVAL;
+
+	/* everything from offset on moves, so drop it from the page cache */
+	err = filemap_write_and_wait_range(mapping, offset, LLONG_MAX);
+	if (err)
+		return err;
+	truncate_inode_pages(mapping, offset);
+
+	handle = ext4_journal_start(inode, ext4_writepage_trans_blocks(inode));
+	if (IS_ERR(handle))
+		return PTR_ERR(handle);
+
+	start = offset >> blkbits;
+	shift = len >> blkbits;
+
+	down_write(&EXT4_I(inode)->i_data_sem);
+	ext4_ext_invalidate_cache(inode);
+	ext4_discard_preallocations(inode);
+	err = ext4_ext_remove_space(inode, start, start + shift - 1);
+	if (!err)
+		err = ext4_ext_shift_extents(handle, inode, start + shift,
+					     shift);
+	ext4_ext_invalidate_cache(inode);
+	if (!err) {
+		new_size = i_size_read(inode) - len;
+		i_size_write(inode, new_size);
+		EXT4_I(inode)->i_disksize = new_size;
+	}
+	up_write(&EXT4_I(inode)->i_data_sem);
+
+	if (IS_SYNC(inode))
+		ext4_handle_sync(handle);
+	inode->i_mtime = inode->i_ctime = ext4_current_time(inode);
+	ext4_mark_inode_dirty(handle, inode);
+	ext4_journal_stop(handle);
+	return err;
+}
+
 /*
  * preallocate space for a file. This implements ext4's fallocate inode
  * operation, which gets called from sys_fallocate system call.
  * For block-mapped files, posix_fallocate should fall back to the method
  * of writing zeroes to the required new blocks (the same behavior which is
  * expected for file systems which do not support fallocate() system call).
+ *
+ * FALLOC_FL_PUNCH_HOLE and FALLOC_FL_COLLAPSE_RANGE are handed to the
+ * helpers above; FALLOC_FL_ZERO_RANGE punches the range out and then
+ * preallocates uninitialized extents over it.
  */
 long ext4_fallocate(struct inode *inode, int mode, loff_t offset, loff_t len)
 {
@@ -3141,6 +3464,19 @@ long ext4_fallocate(struct inode *inode, int mode, loff_t offset, loff_t len)
 	 */
 	credits = ext4_chunk_trans_blocks(inode, max_blocks);
 	mutex_lock(&inode->i_mutex);
+	if (mode & FALLOC_FL_PUNCH_HOLE) {
+		ret = ext4_ext_punch_hole(inode, offset, len);
+		goto out;
+	}
+	if (mode & FALLOC_FL_COLLAPSE_RANGE) {
+		ret = ext4_ext_collapse_range(inode, offset, len);
+		goto out;
+	}
+	if (mode & FALLOC_FL_ZERO_RANGE) {
+		ret = ext4_ext_punch_hole(inode, offset, len);
+		if (ret)
+			goto out;
+	}
 retry:
 	while (ret >= 0 && ret < max_blocks) {
 		block = block + ret;
@@ -3183,8 +3519,11 @@ retry:
 		ret = 0;
 		goto retry;
 	}
+	if (ret > 0)
+		ret = ret2;
+out:
 	mutex_unlock(&inode->i_mutex);
-	return ret > 0 ? ret2 : ret;
+	return ret;
 }
 
 /*
@@ -40,14 +40,18 @@
  * Another task could have dirtied this inode.  Its data can be in any
  * state in the journalling system.
  *
- * What we do is just kick off a commit and wait on it.  This will snapshot the
- * inode to disk.
+ * What we do is wait for the commit of the transaction which last changed
+ * the inode (or, for fdatasync, its size and block mapping), asking for it
+ * if need be.  If that transaction is already on disk there is nothing to
+ * commit at all.
  */
 
 int ext4_sync_file(struct file *file, struct dentry *dentry, int datasync)
 {
 	struct inode *inode = dentry->d_inode;
+	struct ext4_inode_info *ei = EXT4_I(inode);
 	journal_t *journal = EXT4_SB(inode->i_sb)->s_journal;
+	tid_t commit_tid;
 	int ret = 0;
 
 	J_ASSERT(ext4_journal_current_handle() == NULL);
@@ -59,12 +63,12 @@ int ext4_sync_file(struct file *file, struct dentry *dentry, int datasync)
 	/*
 	 * data=writeback:
 	 *  The caller's filemap_fdatawrite()/wait will sync the data.
-	 *  sync_inode() will sync the metadata
+	 *  The inode's metadata is in the journal since it was dirtied.
 	 *
 	 * data=ordered:
 	 *  The caller's filemap_fdatawrite() will write the data and
-	 *  sync_inode() will write the inode if it is dirty.  Then the caller's
-	 *  filemap_fdatawait() will wait on the pages.
+	 *  filemap_fdatawait() will wait on the pages.  The commit of
+	 *  the inode's transaction then orders the metadata after them.
 	 *
 	 * data=journal:
 	 *  filemap_fdatawrite won't do anything (the buffers are clean).
@@ -79,20 +83,29 @@ int ext4_sync_file(struct file *file, struct dentry *dentry, int datasync)
 		goto out;
 	}
 
-	if (datasync && !(inode->i_state & I_DIRTY_DATASYNC))
-		goto out;
-
-	/*
-	 * The VFS has written the file data.  If the inode is unaltered
-	 * then we need not start a commit.
-	 */
-	if (inode->i_state & (I_DIRTY_SYNC|I_DIRTY_DATASYNC)) {
+	if (!journal) {
 		struct writeback_control wbc = {
 			.sync_mode = WB_SYNC_ALL,
 			.nr_to_write = 0, /* sys_fsync did this */
 		};
-		ret = sync_inode(inode, &wbc);
-		if (journal && (journal->j_flags & JBD2_BARRIER))
+
+		if (datasync && !(inode->i_state & I_DIRTY_DATASYNC))
+			goto out;
+		if (inode->i_state & (I_DIRTY_SYNC|I_DIRTY_DATASYNC))
+			ret = sync_inode(inode, &wbc);
+		goto out;
+	}
+
+	/*
+	 * The commit issues a barrier which also covers the data the caller
+	 * has just written.  If the transaction was already on disk, that
+	 * data may still be sitting in the disk cache, so flush it.
+	 */
+	commit_tid = datasync ? ei->i_datasync_tid : ei->i_sync_tid;
+	ret = jbd2_complete_transaction(journal, commit_tid);
+	if (ret > 0) {
+		ret = 0;
+		if (journal->j_flags & JBD2_BARRIER)
 			blkdev_issue_flush(inode->i_sb->s_bdev, NULL);
 	}
 out:
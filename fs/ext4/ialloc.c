@@ -1020,6 +1020,7 @@ got:
 	spin_unlock(&sbi->s_next_gen_lock);
 
 	ei->i_state = EXT4_STATE_NEW;
+	ext4_update_inode_fsync_trans(handle, inode, 1);
 
 	ei->i_extra_isize = EXT4_SB(sb)->s_want_extra_isize;
 
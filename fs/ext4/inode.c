@@ -1240,6 +1240,10 @@ int ext4_get_blocks_wrap(handle_t *handle, struct inode *inode, sector_t block,
 			ext4_da_update_reserve_space(inode, retval);
 	}
 
+	/* the block mapping changed, which fdatasync has to commit */
+	if (retval > 0)
+		ext4_update_inode_fsync_trans(handle, inode, 1);
+
 	up_write((&EXT4_I(inode)->i_data_sem));
 	return retval;
 }
@@ -3464,10 +3468,25 @@ void ext4_set_aops(struct inode *inode)
  */
 int ext4_block_truncate_page(handle_t *handle,
 		struct address_space *mapping, loff_t from)
+{
+	unsigned offset = from & (PAGE_CACHE_SIZE-1);
+	unsigned blocksize = mapping->host->i_sb->s_blocksize;
+
+	return ext4_block_zero_page_range(handle, mapping, from,
+				blocksize - (offset & (blocksize - 1)));
+}
+
+/*
+ * ext4_block_zero_page_range() zeroes out a mapping of `length' bytes from
+ * file offset `from'.  The range must not cross a block boundary, the
+ * punched edges of a hole are zeroed this way.
+ */
+int ext4_block_zero_page_range(handle_t *handle,
+		struct address_space *mapping, loff_t from, unsigned length)
 {
 	ext4_fsblk_t index = from >> PAGE_CACHE_SHIFT;
 	unsigned offset = from & (PAGE_CACHE_SIZE-1);
-	unsigned blocksize, length, pos;
+	unsigned blocksize, pos;
 	ext4_lblk_t iblock;
 	struct inode *inode = mapping->host;
 	struct buffer_head *bh;
@@ -3479,7 +3498,7 @@ int ext4_block_truncate_page(handle_t *handle,
 		return -EINVAL;
 
 	blocksize = inode->i_sb->s_blocksize;
-	length = blocksize - (offset & (blocksize - 1));
+	BUG_ON((offset & (blocksize - 1)) + length > blocksize);
 	iblock = index << (PAGE_CACHE_SHIFT - inode->i_sb->s_blocksize_bits);
 
 	/*
@@ -3543,7 +3562,7 @@ int ext4_block_truncate_page(handle_t *handle,
 
 	zero_user(page, offset, length);
 
-	BUFFER_TRACE(bh, "zeroed end of block");
+	BUFFER_TRACE(bh, "zeroed block range");
 
 	err = 0;
 	if (ext4_should_journal_data(inode)) {
@@ -4328,6 +4347,7 @@ struct inode *ext4_iget(struct super_block *sb, unsigned long ino)
 	struct ext4_inode_info *ei;
 	struct buffer_head *bh;
 	struct inode *inode;
+	journal_t *journal = EXT4_SB(sb)->s_journal;
 	long ret;
 	int block;
 
@@ -4360,6 +4380,28 @@ struct inode *ext4_iget(struct super_block *sb, unsigned long ino)
 	ei->i_state = 0;
 	ei->i_dir_start_lookup = 0;
 	ei->i_dtime = le32_to_cpu(raw_inode->i_dtime);
+	/*
+	 * The inode may have been evicted from the cache while changes to
+	 * it were still in the journal, so assume the worst: fsync has to
+	 * wait for whatever transaction is currently open.
+	 */
+	if (journal) {
+		transaction_t *transaction;
+		tid_t tid;
+
+		spin_lock(&journal->j_state_lock);
+		if (journal->j_running_transaction)
+			transaction = journal->j_running_transaction;
+		else
+			transaction = journal->j_committing_transaction;
+		if (transaction)
+			tid = transaction->t_tid;
+		else
+			tid = journal->j_commit_sequence;
+		spin_unlock(&journal->j_state_lock);
+		ei->i_sync_tid = tid;
+		ei->i_datasync_tid = tid;
+	}
 	/* We now have enough fields to check if the inode was active or not.
 	 * This is needed because nfsd might try to access dead inodes
 	 * the test is that same one that e2fsck uses
@@ -4605,6 +4647,9 @@ static int ext4_do_update_inode(handle_t *handle,
 		raw_inode->i_file_acl_high =
 			cpu_to_le16(ei->i_file_acl >> 32);
 	raw_inode->i_file_acl_lo = cpu_to_le32(ei->i_file_acl);
+	/* a size change must reach the disk on fdatasync as well */
+	ext4_update_inode_fsync_trans(handle, inode,
+				ext4_isize(raw_inode) != ei->i_disksize);
 	ext4_isize_set(raw_inode, ei->i_disksize);
 	if (ei->i_disksize > 0x7fffffffULL) {
 		struct super_block *sb = inode->i_sb;
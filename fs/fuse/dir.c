@@ -775,6 +775,12 @@ static void fuse_fillattr(struct inode *inode, struct fuse_attr *attr,
 	stat->size = attr->size;
 	stat->blocks = attr->blocks;
 	stat->blksize = (1 << inode->i_blkbits);
+
+	/* With the writeback cache the kernel has the size and mtime */
+	if (get_fuse_conn(inode)->writeback_cache && S_ISREG(inode->i_mode)) {
+		stat->size = i_size_read(inode);
+		stat->mtime = inode->i_mtime;
+	}
 }
 
 static int fuse_do_getattr(struct inode *inode, struct kstat *stat,
@@ -1233,6 +1239,10 @@ static int fuse_do_setattr(struct dentry *entry, struct iattr *attr,
 	if ((attr->ia_valid & ATTR_OPEN) && fc->atomic_o_trunc)
 		return 0;
 
+	/* An explicitly set mtime replaces the one updated by writes */
+	if (fc->writeback_cache && (attr->ia_valid & ATTR_MTIME))
+		clear_bit(FUSE_I_MTIME_DIRTY, &get_fuse_inode(inode)->state);
+
 	if (attr->ia_valid & ATTR_SIZE) {
 		unsigned long limit;
 		if (IS_SWAPFILE(inode))
@@ -1295,7 +1305,12 @@ static int fuse_do_setattr(struct dentry *entry, struct iattr *attr,
 	fuse_change_attributes_common(inode, &outarg.attr,
 				      attr_timeout(&outarg));
 	oldsize = inode->i_size;
-	i_size_write(inode, outarg.attr.size);
+	/*
+	 * With the writeback cache the size returned by userspace may not
+	 * include cached writes, so only a truncate changes it.
+	 */
+	if (!fc->writeback_cache || is_truncate || !S_ISREG(inode->i_mode))
+		i_size_write(inode, outarg.attr.size);
 
 	if (is_truncate) {
 		/* NOTE: this may release/reacquire fc->lock */
@@ -1307,10 +1322,11 @@ static int fuse_do_setattr(struct dentry *entry, struct iattr *attr,
 	 * Only call invalidate_inode_pages2() after removing
 	 * FUSE_NOWRITE, otherwise fuse_launder_page() would deadlock.
 	 */
-	if (S_ISREG(inode->i_mode) && oldsize != outarg.attr.size) {
-		if (outarg.attr.size < oldsize)
-			fuse_truncate(inode->i_mapping, outarg.attr.size);
-		invalidate_inode_pages2(inode->i_mapping);
+	if (S_ISREG(inode->i_mode) && oldsize != inode->i_size) {
+		if (inode->i_size < oldsize)
+			fuse_truncate(inode->i_mapping, inode->i_size);
+		if (!fc->writeback_cache)
+			invalidate_inode_pages2(inode->i_mapping);
 	}
 
 	return 0;
@@ -1322,6 +1338,53 @@ error:
 	return err;
 }
 
+/*
+ * In writeback cache mode writes only update i_mtime in the kernel.
+ * Send it to userspace, unless it has been set explicitly since.
+ */
+int fuse_flush_mtime(struct inode *inode)
+{
+	struct fuse_conn *fc = get_fuse_conn(inode);
+	struct fuse_inode *fi = get_fuse_inode(inode);
+	struct fuse_req *req;
+	struct fuse_setattr_in inarg;
+	struct fuse_attr_out outarg;
+	int err;
+
+	if (!test_and_clear_bit(FUSE_I_MTIME_DIRTY, &fi->state))
+		return 0;
+
+	req = fuse_get_req(fc);
+	if (IS_ERR(req)) {
+		set_bit(FUSE_I_MTIME_DIRTY, &fi->state);
+		return PTR_ERR(req);
+	}
+
+	memset(&inarg, 0, sizeof(inarg));
+	memset(&outarg, 0, sizeof(outarg));
+	inarg.valid = FATTR_MTIME;
+	inarg.mtime = inode->i_mtime.tv_sec;
+	inarg.mtimensec = inode->i_mtime.tv_nsec;
+	req->in.h.opcode = FUSE_SETATTR;
+	req->in.h.nodeid = get_node_id(inode);
+	req->in.numargs = 1;
+	req->in.args[0].size = sizeof(inarg);
+	req->in.args[0].value = &inarg;
+	req->out.numargs = 1;
+	if (fc->minor < 9)
+		req->out.args[0].size = FUSE_COMPAT_ATTR_OUT_SIZE;
+	else
+		req->out.args[0].size = sizeof(outarg);
+	req->out.args[0].value = &outarg;
+	fuse_request_send(fc, req);
+	err = req->out.h.error;
+	fuse_put_request(fc, req);
+	if (err)
+		set_bit(FUSE_I_MTIME_DIRTY, &fi->state);
+
+	return err;
+}
+
 static int fuse_setattr(struct dentry *entry, struct iattr *attr)
 {
 	if (attr->ia_valid & ATTR_FILE)
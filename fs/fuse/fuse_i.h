@@ -95,6 +95,15 @@ struct fuse_inode {
 
 	/** List of writepage requestst (pending or sent) */
 	struct list_head writepages;
+
+	/** Miscellaneous bits describing inode state */
+	unsigned long state;
+};
+
+/** FUSE inode state bits */
+enum {
+	/** i_mtime has been updated locally; a flush to userspace needed */
+	FUSE_I_MTIME_DIRTY,
 };
 
 /** FUSE specific file data */
@@ -433,6 +442,10 @@ struct fuse_conn {
 	/** Do multi-page cached writes */
 	unsigned big_writes:1;
 
+	/** Use the page cache for buffered writes, the kernel keeps the
+	    size and mtime of regular files.  Only set in INIT */
+	unsigned writeback_cache:1;
+
 	/** The number of requests waiting for completion */
 	atomic_t num_waiting;
 
@@ -692,6 +705,11 @@ void fuse_flush_writepages(struct inode *inode);
 void fuse_set_nowrite(struct inode *inode);
 void fuse_release_nowrite(struct inode *inode);
 
+/**
+ * Send a locally updated mtime to userspace (writeback cache mode)
+ */
+int fuse_flush_mtime(struct inode *inode);
+
 u64 fuse_get_attr_version(struct fuse_conn *fc);
 
 #endif /* _FS_FUSE_I_H */
@@ -22,6 +22,7 @@
 #include <linux/cdev.h>
 #include <linux/bootmem.h>
 #include <linux/inotify.h>
+#include <linux/fsnotify_backend.h>
 #include <linux/mount.h>
 #include <linux/async.h>
 
@@ -188,6 +189,9 @@ struct inode *inode_init_always(struct super_block *sb, struct inode *inode)
 	}
 	inode->i_private = NULL;
 	inode->i_mapping = mapping;
+#ifdef CONFIG_FSNOTIFY
+	inode->i_fsnotify_mask = 0;
+#endif
 
 	return inode;
 
@@ -252,6 +256,9 @@ void inode_init_once(struct inode *inode)
 	INIT_LIST_HEAD(&inode->inotify_watches);
 	mutex_init(&inode->inotify_mutex);
 #endif
+#ifdef CONFIG_FSNOTIFY
+	INIT_LIST_HEAD(&inode->i_fsnotify_marks);
+#endif
 }
 EXPORT_SYMBOL(inode_init_once);
 
@@ -396,6 +403,7 @@ int invalidate_inodes(struct super_block *sb)
 	LIST_HEAD(throw_away);
 
 	mutex_lock(&iprune_mutex);
+	fsnotify_unmount_inodes(&sb->s_inodes);
 	spin_lock(&inode_lock);
 	inotify_unmount_inodes(&sb->s_inodes);
 	busy = invalidate_list(&sb->s_inodes, &throw_away);
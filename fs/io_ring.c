@@ -0,0 +1,1340 @@
+/*
+ * Shared submission/completion ring interface for asynchronous I/O.
+ *
+ * The application and the kernel share three areas, mapped on the file
+ * descriptor returned by io_ring_setup(): the submission queue (SQ) ring,
+ * the array of submission queue entries it indexes, and the completion
+ * queue (CQ) ring. Requests are consumed from the SQ ring either from
+ * io_ring_enter(), or by a kernel thread polling the ring when the ring
+ * has been set up with IORING_SETUP_SQPOLL, in which case submitting does
+ * not need a system call at all.
+ *
+ * Requests that cannot complete without blocking are handed to the slow
+ * work thread pool. Buffered reads of pages that are already cached are
+ * served inline. The pool is shared with other subsystems, so reads and
+ * writes are only supported on regular files and block devices, whose
+ * I/O cannot wait forever; pipes and sockets are polled instead. Poll requests are armed on the file wait queue, and
+ * accept requests are retried from io_ring_enter(), in the context of the
+ * task owning the ring, once the listening socket becomes readable.
+ *
+ * Files and buffers can be registered up front with io_ring_register(),
+ * to save the per request file table lookup and to keep the buffers
+ * pinned in memory. The SQ thread has no file table of its own, so
+ * IORING_SETUP_SQPOLL rings can only use registered files.
+ *
+ * Distribute under the terms of the GPLv2 (see ../COPYING).
+ */
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/errno.h>
+#include <linux/syscalls.h>
+#include <linux/sched.h>
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/mm.h>
+#include <linux/mman.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/pagemap.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/kthread.h>
+#include <linux/workqueue.h>
+#include <linux/mutex.h>
+#include <linux/uio.h>
+#include <linux/net.h>
+#include <linux/socket.h>
+#include <linux/log2.h>
+#include <linux/anon_inodes.h>
+#include <linux/slow-work.h>
+#include <linux/mmu_context.h>
+#include <linux/io_ring.h>
+
+#include <asm/uaccess.h>
+
+#define IORING_MAX_ENTRIES	4096
+#define IORING_MAX_FIXED_FILES	1024
+#define IORING_MAX_FIXED_BUFS	1024
+
+/* Buffered reads up to this many cached pages are served inline */
+#define IORING_INLINE_READ_PAGES	16
+
+/* Layout of the rings shared with userspace, see struct io_*ring_offsets */
+struct io_sq_ring {
+	u32			head;
+	u32			tail;
+	u32			ring_mask;
+	u32			ring_entries;
+	u32			flags;
+	u32			dropped;
+	u32			array[0];
+};
+
+struct io_cq_ring {
+	u32			head;
+	u32			tail;
+	u32			ring_mask;
+	u32			ring_entries;
+	u32			overflow;
+	u32			resv;
+	struct io_ring_cqe	cqes[0];
+};
+
+/* A buffer registered with IORING_REGISTER_BUFFERS, pinned in memory */
+struct io_mapped_ubuf {
+	unsigned long		ubuf;
+	size_t			len;
+	struct page		**pages;
+	unsigned int		nr_pages;
+};
+
+struct io_ring_ctx {
+	unsigned int		flags;
+
+	/*
+	 * Submission side, protected by "uring_lock", or owned by the
+	 * SQ thread for IORING_SETUP_SQPOLL rings.
+	 */
+	struct mutex		uring_lock;
+	struct io_sq_ring	*sq_ring;
+	struct io_ring_sqe	*sq_sqes;
+	unsigned int		sq_entries;
+	unsigned int		sq_mask;
+	unsigned int		cached_sq_head;
+
+	/* Completion side, protected by "completion_lock" */
+	spinlock_t		completion_lock;
+	struct io_cq_ring	*cq_ring;
+	unsigned int		cq_entries;
+	unsigned int		cq_mask;
+	unsigned int		cached_cq_tail;
+
+	/* Armed poll requests, and accepts ready to be retried */
+	struct list_head	poll_list;
+	struct list_head	task_list;
+
+	/* Woken up on every completion, and when "task_list" is fed */
+	wait_queue_head_t	cq_wait;
+
+	/*
+	 * Requests submitted and not completed yet, plus one for the ring
+	 * file. Requests still running when the file is released keep the
+	 * ring alive, and the last one frees it through "free_work".
+	 */
+	atomic_t		refs;
+	struct work_struct	free_work;
+
+	/* Set on release, protected by "completion_lock" */
+	int			dead;
+
+	/*
+	 * Address space the requests buffers live in. Only the mm_struct
+	 * is pinned, see io_use_mm().
+	 */
+	struct mm_struct	*sqo_mm;
+
+	/* SQ polling thread, and how long it spins before sleeping */
+	struct task_struct	*sqo_thread;
+	wait_queue_head_t	sqo_wait;
+	unsigned long		sq_thread_idle;
+
+	/* Registered files and buffers, protected by "uring_lock" */
+	struct file		**user_files;
+	unsigned int		nr_user_files;
+	struct io_mapped_ubuf	*user_bufs;
+	unsigned int		nr_user_bufs;
+};
+
+struct io_kiocb {
+	struct io_ring_ctx	*ctx;
+	struct file		*file;
+	struct io_ring_sqe	sqe;
+
+	unsigned long		flags;
+#define REQ_F_FIXED_FILE	0	/* file comes from the registered set */
+#define REQ_F_POLL_DONE		1	/* poll has fired, or was cancelled */
+
+	atomic_t		refs;
+	struct slow_work	work;
+
+	/* Poll request state, also used by accepts waiting for a connection */
+	wait_queue_head_t	*head;
+	wait_queue_t		wait;
+	unsigned int		events;
+	unsigned int		mask;
+	struct list_head	list;
+};
+
+struct io_poll_table {
+	poll_table		pt;
+	struct io_kiocb		*req;
+	int			error;
+};
+
+static struct kmem_cache *req_cachep __read_mostly;
+
+static const struct file_operations io_ring_fops;
+
+/*
+ * The last reference may be dropped from a slow work thread, which
+ * cannot unregister from the pool itself, so the ring is freed from
+ * keventd.
+ */
+static void io_ring_ctx_put(struct io_ring_ctx *ctx)
+{
+	if (atomic_dec_and_test(&ctx->refs))
+		schedule_work(&ctx->free_work);
+}
+
+static void io_put_req(struct io_kiocb *req)
+{
+	if (atomic_dec_and_test(&req->refs))
+		kmem_cache_free(req_cachep, req);
+}
+
+static int io_work_get_ref(struct slow_work *work)
+{
+	atomic_inc(&container_of(work, struct io_kiocb, work)->refs);
+	return 0;
+}
+
+static void io_work_put_ref(struct slow_work *work)
+{
+	io_put_req(container_of(work, struct io_kiocb, work));
+}
+
+/*
+ * Posts a completion event. If the CQ ring is full the event is dropped,
+ * and the overflow counter of the ring is bumped.
+ */
+static void io_cqring_fill_event(struct io_ring_ctx *ctx, u64 user_data,
+				 long res)
+{
+	struct io_cq_ring *ring = ctx->cq_ring;
+	struct io_ring_cqe *cqe;
+	unsigned long flags;
+	unsigned int tail;
+
+	spin_lock_irqsave(&ctx->completion_lock, flags);
+
+	tail = ctx->cached_cq_tail;
+	if (tail - ACCESS_ONCE(ring->head) == ctx->cq_entries) {
+		ring->overflow++;
+	} else {
+		/* Don't overwrite a cqe the application is still reading */
+		smp_mb();
+		cqe = &ring->cqes[tail & ctx->cq_mask];
+		cqe->user_data = user_data;
+		cqe->res = res;
+		cqe->flags = 0;
+		ctx->cached_cq_tail++;
+		/* Make the cqe visible before the new tail */
+		smp_wmb();
+		ring->tail = ctx->cached_cq_tail;
+	}
+
+	spin_unlock_irqrestore(&ctx->completion_lock, flags);
+}
+
+/*
+ * Completes a request: posts its event, drops the file reference and the
+ * submission reference. Must be called from process context, since it
+ * might drop the last reference to the file.
+ */
+static void io_complete_req(struct io_kiocb *req, long res)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+
+	io_cqring_fill_event(ctx, req->sqe.user_data, res);
+
+	if (req->file && !test_bit(REQ_F_FIXED_FILE, &req->flags))
+		fput(req->file);
+	io_put_req(req);
+
+	wake_up(&ctx->cq_wait);
+	io_ring_ctx_put(ctx);
+}
+
+static unsigned int io_cqring_events(struct io_ring_ctx *ctx)
+{
+	return ACCESS_ONCE(ctx->cq_ring->tail) - ACCESS_ONCE(ctx->cq_ring->head);
+}
+
+/*
+ * Returns the user buffer a read or write request works on. Fixed buffers
+ * are pinned, so copies from and to them never wait for the pages to be
+ * faulted back in.
+ */
+static int io_prep_rw(struct io_kiocb *req, int rw, char __user **buf)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	const struct io_ring_sqe *sqe = &req->sqe;
+	struct io_mapped_ubuf *imu;
+	unsigned long addr = sqe->addr;
+
+	if (!(req->file->f_mode & (rw == READ ? FMODE_READ : FMODE_WRITE)))
+		return -EBADF;
+
+	if (sqe->opcode == IORING_OP_READ_FIXED ||
+	    sqe->opcode == IORING_OP_WRITE_FIXED) {
+		if (unlikely(sqe->buf_index >= ctx->nr_user_bufs))
+			return -EFAULT;
+		imu = &ctx->user_bufs[sqe->buf_index];
+		if (addr < imu->ubuf || addr + sqe->len < addr ||
+		    addr + sqe->len > imu->ubuf + imu->len)
+			return -EFAULT;
+	} else if (!access_ok(rw == READ ? VERIFY_WRITE : VERIFY_READ,
+			      (void __user *) addr, sqe->len))
+		return -EFAULT;
+
+	*buf = (char __user *) addr;
+	return 0;
+}
+
+static long io_do_rw(struct io_kiocb *req, int rw)
+{
+	char __user *buf;
+	loff_t pos = req->sqe.off;
+	long ret;
+
+	ret = io_prep_rw(req, rw, &buf);
+	if (ret)
+		return ret;
+
+	if (rw == READ)
+		return vfs_read(req->file, buf, req->sqe.len, &pos);
+	return vfs_write(req->file, buf, req->sqe.len, &pos);
+}
+
+/*
+ * Tells if reads and writes on @file are bounded in time, so they can
+ * occupy a slow work thread. A read from an idle pipe or socket would
+ * hold it until data shows up, starving the other slow work users.
+ */
+static int io_rw_supported(struct file *file)
+{
+	umode_t mode = file->f_path.dentry->d_inode->i_mode;
+
+	return S_ISREG(mode) || S_ISBLK(mode);
+}
+
+/*
+ * Tells if a buffered read can be served from the page cache without
+ * blocking, because every page it covers is cached and uptodate.
+ */
+static int io_read_cached(struct io_kiocb *req)
+{
+	struct file *file = req->file;
+	struct address_space *mapping = file->f_mapping;
+	pgoff_t index, end;
+	struct page *page;
+	int uptodate;
+
+	if (!S_ISREG(file->f_path.dentry->d_inode->i_mode) ||
+	    (file->f_flags & O_DIRECT))
+		return 0;
+	if (!req->sqe.len)
+		return 1;
+
+	index = req->sqe.off >> PAGE_CACHE_SHIFT;
+	end = (req->sqe.off + req->sqe.len - 1) >> PAGE_CACHE_SHIFT;
+	if (end - index >= IORING_INLINE_READ_PAGES)
+		return 0;
+
+	for (; index <= end; index++) {
+		page = find_get_page(mapping, index);
+		if (!page)
+			return 0;
+		uptodate = PageUptodate(page);
+		page_cache_release(page);
+		if (!uptodate)
+			return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Kernel threads borrow the ring owner mm to reach the user buffers.
+ * Holding mm_users for the life of the ring would keep the whole
+ * address space, and through the ring mappings the ring itself, alive
+ * after the owner exits, so it is only taken while the mm is in use.
+ * Returns 0 once the owner has exited.
+ */
+static int io_use_mm(struct io_ring_ctx *ctx)
+{
+	if (!atomic_inc_not_zero(&ctx->sqo_mm->mm_users))
+		return 0;
+	use_mm(ctx->sqo_mm);
+	return 1;
+}
+
+static void io_unuse_mm(struct io_ring_ctx *ctx)
+{
+	unuse_mm(ctx->sqo_mm);
+	mmput(ctx->sqo_mm);
+}
+
+/*
+ * Executes a request from the slow work thread pool.
+ */
+static void io_work_execute(struct slow_work *work)
+{
+	struct io_kiocb *req = container_of(work, struct io_kiocb, work);
+	struct io_ring_ctx *ctx = req->ctx;
+	struct file *file = req->file;
+	long ret;
+
+	switch (req->sqe.opcode) {
+	case IORING_OP_READ:
+	case IORING_OP_READ_FIXED:
+	case IORING_OP_WRITE:
+	case IORING_OP_WRITE_FIXED:
+		if (!io_use_mm(ctx)) {
+			ret = -EFAULT;
+			break;
+		}
+		ret = io_do_rw(req, (req->sqe.opcode == IORING_OP_READ ||
+				     req->sqe.opcode == IORING_OP_READ_FIXED) ?
+			       READ : WRITE);
+		io_unuse_mm(ctx);
+		break;
+	case IORING_OP_FSYNC:
+		ret = vfs_fsync(file, file->f_path.dentry,
+				req->sqe.fsync_flags & IORING_FSYNC_DATASYNC);
+		break;
+	case IORING_OP_POLL_ADD:
+		/* The waker did not tell us which events fired */
+		ret = req->mask;
+		if (!ret)
+			ret = file->f_op->poll(file, NULL) & req->events;
+		break;
+	case IORING_OP_ACCEPT:
+		/* Fired after the ring was released, see io_poll_wake() */
+		ret = -ECANCELED;
+		break;
+	default:
+		ret = -EINVAL;
+		break;
+	}
+
+	io_complete_req(req, ret);
+}
+
+static const struct slow_work_ops io_work_ops = {
+	.get_ref	= io_work_get_ref,
+	.put_ref	= io_work_put_ref,
+	.execute	= io_work_execute,
+};
+
+static void io_queue_work(struct io_kiocb *req)
+{
+	slow_work_init(&req->work, &io_work_ops);
+	if (slow_work_enqueue(&req->work) < 0)
+		io_complete_req(req, -EAGAIN);
+}
+
+static int io_poll_wake(wait_queue_t *wait, unsigned mode, int sync, void *key)
+{
+	struct io_kiocb *req = container_of(wait, struct io_kiocb, wait);
+	struct io_ring_ctx *ctx = req->ctx;
+	unsigned long mask = (unsigned long) key;
+	unsigned long flags;
+
+	if (mask && !(mask & req->events))
+		return 0;
+	if (test_and_set_bit(REQ_F_POLL_DONE, &req->flags))
+		return 0;
+
+	/* We are called with the wait queue head lock held */
+	list_del_init(&wait->task_list);
+	req->mask = mask & req->events;
+
+	spin_lock_irqsave(&ctx->completion_lock, flags);
+	list_del_init(&req->list);
+	if (req->sqe.opcode == IORING_OP_ACCEPT && !ctx->dead) {
+		/* The accept is retried by the ring owner, see io_run_task_list() */
+		list_add_tail(&req->list, &ctx->task_list);
+		spin_unlock_irqrestore(&ctx->completion_lock, flags);
+		wake_up(&ctx->cq_wait);
+		return 1;
+	}
+	spin_unlock_irqrestore(&ctx->completion_lock, flags);
+
+	/* We might hold the last reference to the file, complete elsewhere */
+	io_queue_work(req);
+	return 1;
+}
+
+static void io_poll_queue_proc(struct file *file, wait_queue_head_t *head,
+			       poll_table *p)
+{
+	struct io_poll_table *pt = container_of(p, struct io_poll_table, pt);
+	struct io_kiocb *req = pt->req;
+
+	/* Files that wait on more than one queue are not supported */
+	if (unlikely(req->head)) {
+		pt->error = -EINVAL;
+		return;
+	}
+
+	pt->error = 0;
+	req->head = head;
+	add_wait_queue(head, &req->wait);
+}
+
+/*
+ * Arms a poll on the request file. Returns 0 if the poll has been armed,
+ * and io_poll_wake() will take care of the request. Otherwise the caller
+ * owns the request again, and the return value is either the events that
+ * are ready, or an error.
+ */
+static int io_poll_arm(struct io_kiocb *req, unsigned int events)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	struct file *file = req->file;
+	struct io_poll_table ipt;
+	unsigned int mask;
+
+	if (!file->f_op->poll)
+		return -EOPNOTSUPP;
+
+	req->events = events | POLLERR | POLLHUP;
+	req->mask = 0;
+	req->head = NULL;
+	clear_bit(REQ_F_POLL_DONE, &req->flags);
+	init_waitqueue_func_entry(&req->wait, io_poll_wake);
+	INIT_LIST_HEAD(&req->wait.task_list);
+
+	/* Make the request visible to the teardown before it can fire */
+	spin_lock_irq(&ctx->completion_lock);
+	list_add_tail(&req->list, &ctx->poll_list);
+	spin_unlock_irq(&ctx->completion_lock);
+
+	ipt.req = req;
+	ipt.error = -EINVAL;
+	init_poll_funcptr(&ipt.pt, io_poll_queue_proc);
+
+	mask = file->f_op->poll(file, &ipt.pt) & req->events;
+	if (!mask && !ipt.error)
+		return 0;
+
+	/* Ready already, or failed: take the request back, unless it fired */
+	if (test_and_set_bit(REQ_F_POLL_DONE, &req->flags))
+		return 0;
+	if (req->head)
+		remove_wait_queue(req->head, &req->wait);
+	spin_lock_irq(&ctx->completion_lock);
+	list_del_init(&req->list);
+	spin_unlock_irq(&ctx->completion_lock);
+
+	return mask ? mask : ipt.error;
+}
+
+/*
+ * Accepts a connection without blocking. Must run in the context of the
+ * task owning the ring, since the new socket is installed in its file
+ * table. If no connection is pending yet, a poll is armed and the accept
+ * is retried from io_run_task_list() once the socket is readable.
+ */
+static void io_accept(struct io_kiocb *req)
+{
+	const struct io_ring_sqe *sqe = &req->sqe;
+	int ret;
+
+	for (;;) {
+		ret = __sys_accept4_file(req->file, O_NONBLOCK,
+				(struct sockaddr __user *) (unsigned long) sqe->addr,
+				(int __user *) (unsigned long) sqe->addr2,
+				sqe->accept_flags);
+		if (ret != -EAGAIN)
+			break;
+		ret = io_poll_arm(req, POLLIN);
+		if (!ret)
+			return;
+		if (ret < 0)
+			break;
+	}
+
+	io_complete_req(req, ret);
+}
+
+/* Retries the accepts whose listening socket became readable */
+static void io_run_task_list(struct io_ring_ctx *ctx)
+{
+	struct io_kiocb *req;
+	LIST_HEAD(list);
+
+	spin_lock_irq(&ctx->completion_lock);
+	list_splice_init(&ctx->task_list, &list);
+	spin_unlock_irq(&ctx->completion_lock);
+
+	while (!list_empty(&list)) {
+		req = list_first_entry(&list, struct io_kiocb, list);
+		list_del_init(&req->list);
+		io_accept(req);
+	}
+}
+
+static struct file *io_get_file(struct io_kiocb *req)
+{
+	struct io_ring_ctx *ctx = req->ctx;
+	struct file *file;
+	int fd = req->sqe.fd;
+
+	if (req->sqe.flags & IOSQE_FIXED_FILE) {
+		if (unlikely((unsigned int) fd >= ctx->nr_user_files))
+			return NULL;
+		__set_bit(REQ_F_FIXED_FILE, &req->flags);
+		return ctx->user_files[fd];
+	}
+
+	/* The SQ thread does not share the file table of the owner */
+	if (ctx->flags & IORING_SETUP_SQPOLL)
+		return NULL;
+
+	file = fget(fd);
+	/*
+	 * A ring would pin itself, and would never be released, if it had
+	 * requests pending on its own file.
+	 */
+	if (file && file->f_op == &io_ring_fops) {
+		fput(file);
+		file = NULL;
+	}
+	return file;
+}
+
+static void io_submit_sqe(struct io_ring_ctx *ctx, struct io_kiocb *req)
+{
+	const struct io_ring_sqe *sqe = &req->sqe;
+	long ret = 0;
+
+	if (unlikely(sqe->flags & ~IOSQE_FIXED_FILE)) {
+		ret = -EINVAL;
+		goto out_complete;
+	}
+
+	if (sqe->opcode != IORING_OP_NOP) {
+		req->file = io_get_file(req);
+		if (!req->file) {
+			ret = -EBADF;
+			goto out_complete;
+		}
+	}
+
+	switch (sqe->opcode) {
+	case IORING_OP_NOP:
+		break;
+	case IORING_OP_READ:
+	case IORING_OP_READ_FIXED:
+		if (!io_rw_supported(req->file)) {
+			ret = -EOPNOTSUPP;
+			break;
+		}
+		/* Buffered reads of cached pages do not block, do them now */
+		if (io_read_cached(req)) {
+			ret = io_do_rw(req, READ);
+			break;
+		}
+		io_queue_work(req);
+		return;
+	case IORING_OP_WRITE:
+	case IORING_OP_WRITE_FIXED:
+		if (!io_rw_supported(req->file)) {
+			ret = -EOPNOTSUPP;
+			break;
+		}
+		/* fall through */
+	case IORING_OP_FSYNC:
+		io_queue_work(req);
+		return;
+	case IORING_OP_POLL_ADD:
+		ret = io_poll_arm(req, sqe->poll_events);
+		if (!ret)
+			return;
+		break;
+	case IORING_OP_ACCEPT:
+		/* The SQ thread does not share the file table of the owner */
+		if (ctx->flags & IORING_SETUP_SQPOLL) {
+			ret = -EINVAL;
+			break;
+		}
+		io_accept(req);
+		return;
+	default:
+		ret = -EINVAL;
+		break;
+	}
+
+out_complete:
+	io_complete_req(req, ret);
+}
+
+static unsigned int io_sqring_entries(struct io_ring_ctx *ctx)
+{
+	return ACCESS_ONCE(ctx->sq_ring->tail) - ctx->cached_sq_head;
+}
+
+/*
+ * Consumes up to @to_submit entries from the SQ ring. Each entry is copied
+ * inside its request, so the application can reuse the slot as soon as the
+ * ring head moves past it. Returns the number of entries consumed.
+ */
+static int io_submit_sqes(struct io_ring_ctx *ctx, unsigned int to_submit)
+{
+	struct io_sq_ring *ring = ctx->sq_ring;
+	struct io_kiocb *req;
+	unsigned int head, idx;
+	int submitted = 0;
+
+	while (submitted < to_submit) {
+		head = ctx->cached_sq_head;
+		if (head == ACCESS_ONCE(ring->tail))
+			break;
+		/* Read the array and the sqe after the tail */
+		smp_rmb();
+
+		idx = ACCESS_ONCE(ring->array[head & ctx->sq_mask]);
+		if (unlikely(idx >= ctx->sq_entries)) {
+			ring->dropped++;
+			ctx->cached_sq_head++;
+			continue;
+		}
+
+		req = kmem_cache_alloc(req_cachep, GFP_KERNEL);
+		if (unlikely(!req)) {
+			if (!submitted)
+				submitted = -EAGAIN;
+			break;
+		}
+		req->ctx = ctx;
+		req->file = NULL;
+		req->flags = 0;
+		atomic_set(&req->refs, 1);
+		INIT_LIST_HEAD(&req->list);
+		memcpy(&req->sqe, &ctx->sq_sqes[idx], sizeof(req->sqe));
+
+		ctx->cached_sq_head++;
+		submitted++;
+		atomic_inc(&ctx->refs);
+
+		io_submit_sqe(ctx, req);
+	}
+
+	if (submitted > 0) {
+		/* We are done with the sqes, let the application reuse them */
+		smp_mb();
+		ring->head = ctx->cached_sq_head;
+	}
+
+	return submitted;
+}
+
+static int io_sq_thread(void *data)
+{
+	struct io_ring_ctx *ctx = data;
+	struct io_sq_ring *ring = ctx->sq_ring;
+	unsigned long timeout = jiffies + ctx->sq_thread_idle;
+	int owner_gone = 0;
+	DEFINE_WAIT(wait);
+
+	while (!kthread_should_stop()) {
+		if (!owner_gone && io_sqring_entries(ctx)) {
+			/* Nobody is left to submit or reap, idle until release */
+			if (!io_use_mm(ctx)) {
+				owner_gone = 1;
+				continue;
+			}
+			mutex_lock(&ctx->uring_lock);
+			io_submit_sqes(ctx, ctx->sq_entries);
+			mutex_unlock(&ctx->uring_lock);
+			io_unuse_mm(ctx);
+			timeout = jiffies + ctx->sq_thread_idle;
+			cond_resched();
+			continue;
+		}
+
+		/* Keep spinning for a while, new entries are likely to come */
+		if (!owner_gone && time_before(jiffies, timeout)) {
+			cpu_relax();
+			cond_resched();
+			continue;
+		}
+
+		prepare_to_wait(&ctx->sqo_wait, &wait, TASK_INTERRUPTIBLE);
+		/* Tell the application to wake us up, then check once more */
+		ring->flags |= IORING_SQ_NEED_WAKEUP;
+		smp_mb();
+		if ((owner_gone || !io_sqring_entries(ctx)) &&
+		    !kthread_should_stop())
+			schedule();
+		finish_wait(&ctx->sqo_wait, &wait);
+
+		ring->flags &= ~IORING_SQ_NEED_WAKEUP;
+		timeout = jiffies + ctx->sq_thread_idle;
+	}
+
+	return 0;
+}
+
+/*
+ * Waits until at least @min_events completions are available inside the
+ * CQ ring, running the accept retries on the way.
+ */
+static int io_cqring_wait(struct io_ring_ctx *ctx, unsigned int min_events)
+{
+	DEFINE_WAIT(wait);
+	int ret = 0;
+
+	min_events = min(min_events, ctx->cq_entries);
+
+	for (;;) {
+		io_run_task_list(ctx);
+		if (io_cqring_events(ctx) >= min_events)
+			break;
+
+		prepare_to_wait(&ctx->cq_wait, &wait, TASK_INTERRUPTIBLE);
+		if (io_cqring_events(ctx) < min_events &&
+		    list_empty(&ctx->task_list)) {
+			if (signal_pending(current))
+				ret = -EINTR;
+			else
+				schedule();
+		}
+		finish_wait(&ctx->cq_wait, &wait);
+		if (ret)
+			break;
+	}
+
+	return ret;
+}
+
+static void io_sqe_files_unregister(struct io_ring_ctx *ctx)
+{
+	unsigned int i;
+
+	for (i = 0; i < ctx->nr_user_files; i++)
+		fput(ctx->user_files[i]);
+	kfree(ctx->user_files);
+	ctx->user_files = NULL;
+	ctx->nr_user_files = 0;
+}
+
+static int io_sqe_files_register(struct io_ring_ctx *ctx, void __user *arg,
+				 unsigned int nr_args)
+{
+	__s32 __user *fds = arg;
+	unsigned int i;
+	int ret = 0;
+	s32 fd;
+
+	if (ctx->user_files)
+		return -EBUSY;
+	if (!nr_args || nr_args > IORING_MAX_FIXED_FILES)
+		return -EINVAL;
+
+	ctx->user_files = kcalloc(nr_args, sizeof(struct file *), GFP_KERNEL);
+	if (!ctx->user_files)
+		return -ENOMEM;
+
+	for (i = 0; i < nr_args; i++) {
+		ret = -EFAULT;
+		if (get_user(fd, &fds[i]))
+			break;
+		ret = -EBADF;
+		ctx->user_files[i] = fget(fd);
+		if (!ctx->user_files[i])
+			break;
+		if (ctx->user_files[i]->f_op == &io_ring_fops) {
+			fput(ctx->user_files[i]);
+			break;
+		}
+		ctx->nr_user_files++;
+		ret = 0;
+	}
+
+	if (ret)
+		io_sqe_files_unregister(ctx);
+
+	return ret;
+}
+
+/*
+ * Registered buffers stay pinned, so they are charged to the locked_vm
+ * of the ring owner and count against RLIMIT_MEMLOCK, like mlock()ed
+ * memory.
+ */
+static int io_account_mem(struct mm_struct *mm, unsigned long nr_pages)
+{
+	unsigned long lock_limit;
+	int ret = 0;
+
+	lock_limit = current->signal->rlim[RLIMIT_MEMLOCK].rlim_cur >> PAGE_SHIFT;
+
+	down_write(&mm->mmap_sem);
+	if (mm->locked_vm + nr_pages > lock_limit && !capable(CAP_IPC_LOCK))
+		ret = -ENOMEM;
+	else
+		mm->locked_vm += nr_pages;
+	up_write(&mm->mmap_sem);
+
+	return ret;
+}
+
+static void io_unaccount_mem(struct mm_struct *mm, unsigned long nr_pages)
+{
+	down_write(&mm->mmap_sem);
+	mm->locked_vm -= nr_pages;
+	up_write(&mm->mmap_sem);
+}
+
+static void io_sqe_buffers_unregister(struct io_ring_ctx *ctx)
+{
+	struct io_mapped_ubuf *imu;
+	unsigned int i, j;
+
+	for (i = 0; i < ctx->nr_user_bufs; i++) {
+		imu = &ctx->user_bufs[i];
+		for (j = 0; j < imu->nr_pages; j++)
+			put_page(imu->pages[j]);
+		kfree(imu->pages);
+		io_unaccount_mem(ctx->sqo_mm, imu->nr_pages);
+	}
+	kfree(ctx->user_bufs);
+	ctx->user_bufs = NULL;
+	ctx->nr_user_bufs = 0;
+}
+
+static int io_sqe_buffer_pin(struct io_ring_ctx *ctx,
+			     struct io_mapped_ubuf *imu, struct iovec *iov)
+{
+	unsigned long ubuf = (unsigned long) iov->iov_base;
+	unsigned long start = ubuf >> PAGE_SHIFT;
+	unsigned long end = (ubuf + iov->iov_len + PAGE_SIZE - 1) >> PAGE_SHIFT;
+	int nr_pages = end - start;
+	int ret;
+
+	if (!iov->iov_len || ubuf + iov->iov_len < ubuf)
+		return -EFAULT;
+
+	ret = io_account_mem(ctx->sqo_mm, nr_pages);
+	if (ret)
+		return ret;
+
+	imu->pages = kcalloc(nr_pages, sizeof(struct page *), GFP_KERNEL);
+	if (!imu->pages) {
+		io_unaccount_mem(ctx->sqo_mm, nr_pages);
+		return -ENOMEM;
+	}
+
+	down_read(&current->mm->mmap_sem);
+	ret = get_user_pages(current, current->mm, ubuf & PAGE_MASK, nr_pages,
+			     1, 0, imu->pages, NULL);
+	up_read(&current->mm->mmap_sem);
+
+	if (ret != nr_pages) {
+		while (ret > 0)
+			put_page(imu->pages[--ret]);
+		kfree(imu->pages);
+		io_unaccount_mem(ctx->sqo_mm, nr_pages);
+		return ret < 0 ? ret : -EFAULT;
+	}
+
+	imu->ubuf = ubuf;
+	imu->len = iov->iov_len;
+	imu->nr_pages = nr_pages;
+	return 0;
+}
+
+static int io_sqe_buffers_register(struct io_ring_ctx *ctx, void __user *arg,
+				   unsigned int nr_args)
+{
+	struct iovec iov;
+	unsigned int i;
+	int ret = 0;
+
+	if (ctx->user_bufs)
+		return -EBUSY;
+	if (!nr_args || nr_args > IORING_MAX_FIXED_BUFS)
+		return -EINVAL;
+	/* The buffers are used, and charged, in the address space of the owner */
+	if (current->mm != ctx->sqo_mm)
+		return -EPERM;
+
+	ctx->user_bufs = kcalloc(nr_args, sizeof(struct io_mapped_ubuf),
+				 GFP_KERNEL);
+	if (!ctx->user_bufs)
+		return -ENOMEM;
+
+	for (i = 0; i < nr_args; i++) {
+		ret = -EFAULT;
+		if (copy_from_user(&iov, (struct iovec __user *) arg + i,
+				   sizeof(iov)))
+			break;
+		ret = io_sqe_buffer_pin(ctx, &ctx->user_bufs[i], &iov);
+		if (ret)
+			break;
+		ctx->nr_user_bufs++;
+	}
+
+	if (ret)
+		io_sqe_buffers_unregister(ctx);
+
+	return ret;
+}
+
+/*
+ * Cancels the armed polls and the pending accept retries. Polls that are
+ * firing concurrently are completed by io_poll_wake() as usual.
+ */
+static void io_cancel_polls(struct io_ring_ctx *ctx)
+{
+	struct io_kiocb *req;
+	int cancel;
+
+	spin_lock_irq(&ctx->completion_lock);
+	while (!list_empty(&ctx->poll_list)) {
+		req = list_first_entry(&ctx->poll_list, struct io_kiocb, list);
+		list_del_init(&req->list);
+		cancel = !test_and_set_bit(REQ_F_POLL_DONE, &req->flags);
+		spin_unlock_irq(&ctx->completion_lock);
+
+		if (cancel) {
+			if (req->head)
+				remove_wait_queue(req->head, &req->wait);
+			io_complete_req(req, -ECANCELED);
+		}
+
+		spin_lock_irq(&ctx->completion_lock);
+	}
+	while (!list_empty(&ctx->task_list)) {
+		req = list_first_entry(&ctx->task_list, struct io_kiocb, list);
+		list_del_init(&req->list);
+		spin_unlock_irq(&ctx->completion_lock);
+		io_complete_req(req, -ECANCELED);
+		spin_lock_irq(&ctx->completion_lock);
+	}
+	spin_unlock_irq(&ctx->completion_lock);
+}
+
+static void io_ring_ctx_free(struct work_struct *work)
+{
+	struct io_ring_ctx *ctx = container_of(work, struct io_ring_ctx,
+					       free_work);
+
+	slow_work_unregister_user();
+
+	io_sqe_files_unregister(ctx);
+	io_sqe_buffers_unregister(ctx);
+	mmdrop(ctx->sqo_mm);
+
+	vfree(ctx->sq_ring);
+	vfree(ctx->sq_sqes);
+	vfree(ctx->cq_ring);
+	kfree(ctx);
+}
+
+/*
+ * Stops the submissions and cancels the requests waiting on a poll.
+ * Requests already running are not waited for, they could block for
+ * a long time; they drop their reference to the ring when done.
+ */
+static void io_ring_ctx_kill(struct io_ring_ctx *ctx)
+{
+	if (ctx->sqo_thread)
+		kthread_stop(ctx->sqo_thread);
+
+	/* Accepts firing from now on are not retried, see io_poll_wake() */
+	spin_lock_irq(&ctx->completion_lock);
+	ctx->dead = 1;
+	spin_unlock_irq(&ctx->completion_lock);
+
+	io_cancel_polls(ctx);
+	io_ring_ctx_put(ctx);
+}
+
+static int io_ring_release(struct inode *inode, struct file *file)
+{
+	io_ring_ctx_kill(file->private_data);
+	return 0;
+}
+
+static unsigned int io_ring_poll(struct file *file, poll_table *wait)
+{
+	struct io_ring_ctx *ctx = file->private_data;
+	unsigned int mask = 0;
+
+	poll_wait(file, &ctx->cq_wait, wait);
+	smp_rmb();
+	if (io_cqring_events(ctx))
+		mask |= POLLIN | POLLRDNORM;
+	if (io_sqring_entries(ctx) != ctx->sq_entries)
+		mask |= POLLOUT | POLLWRNORM;
+
+	return mask;
+}
+
+static int io_ring_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct io_ring_ctx *ctx = file->private_data;
+	loff_t offset = (loff_t) vma->vm_pgoff << PAGE_SHIFT;
+	void *ptr;
+
+	switch (offset) {
+	case IORING_OFF_SQ_RING:
+		ptr = ctx->sq_ring;
+		break;
+	case IORING_OFF_SQES:
+		ptr = ctx->sq_sqes;
+		break;
+	case IORING_OFF_CQ_RING:
+		ptr = ctx->cq_ring;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	/* This fails if the mapping is larger than the area */
+	return remap_vmalloc_range(vma, ptr, 0);
+}
+
+static const struct file_operations io_ring_fops = {
+	.release	= io_ring_release,
+	.mmap		= io_ring_mmap,
+	.poll		= io_ring_poll,
+};
+
+static int io_allocate_rings(struct io_ring_ctx *ctx, struct io_ring_params *p)
+{
+	ctx->sq_ring = vmalloc_user(sizeof(struct io_sq_ring) +
+				    p->sq_entries * sizeof(u32));
+	ctx->sq_sqes = vmalloc_user(p->sq_entries * sizeof(struct io_ring_sqe));
+	ctx->cq_ring = vmalloc_user(sizeof(struct io_cq_ring) +
+				    p->cq_entries * sizeof(struct io_ring_cqe));
+	if (!ctx->sq_ring || !ctx->sq_sqes || !ctx->cq_ring)
+		return -ENOMEM;
+
+	ctx->sq_entries = ctx->sq_ring->ring_entries = p->sq_entries;
+	ctx->sq_mask = ctx->sq_ring->ring_mask = p->sq_entries - 1;
+	ctx->cq_entries = ctx->cq_ring->ring_entries = p->cq_entries;
+	ctx->cq_mask = ctx->cq_ring->ring_mask = p->cq_entries - 1;
+
+	memset(&p->sq_off, 0, sizeof(p->sq_off));
+	p->sq_off.head = offsetof(struct io_sq_ring, head);
+	p->sq_off.tail = offsetof(struct io_sq_ring, tail);
+	p->sq_off.ring_mask = offsetof(struct io_sq_ring, ring_mask);
+	p->sq_off.ring_entries = offsetof(struct io_sq_ring, ring_entries);
+	p->sq_off.flags = offsetof(struct io_sq_ring, flags);
+	p->sq_off.dropped = offsetof(struct io_sq_ring, dropped);
+	p->sq_off.array = offsetof(struct io_sq_ring, array);
+
+	memset(&p->cq_off, 0, sizeof(p->cq_off));
+	p->cq_off.head = offsetof(struct io_cq_ring, head);
+	p->cq_off.tail = offsetof(struct io_cq_ring, tail);
+	p->cq_off.ring_mask = offsetof(struct io_cq_ring, ring_mask);
+	p->cq_off.ring_entries = offsetof(struct io_cq_ring, ring_entries);
+	p->cq_off.overflow = offsetof(struct io_cq_ring, overflow);
+	p->cq_off.cqes = offsetof(struct io_cq_ring, cqes);
+
+	return 0;
+}
+
+/*
+ * Sets up an I/O ring of at least @entries submission entries, and twice
+ * as many completion entries. Returns the ring file descriptor, to be
+ * mmap()ed at the IORING_OFF_* offsets.
+ */
+SYSCALL_DEFINE2(io_ring_setup, u32, entries,
+		struct io_ring_params __user *, params)
+{
+	struct io_ring_params p;
+	struct io_ring_ctx *ctx;
+	int ret;
+
+	if (copy_from_user(&p, params, sizeof(p)))
+		return -EFAULT;
+	if (p.flags & ~IORING_SETUP_SQPOLL)
+		return -EINVAL;
+	if (!entries || entries > IORING_MAX_ENTRIES)
+		return -EINVAL;
+	if ((p.flags & IORING_SETUP_SQPOLL) && !capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	p.sq_entries = roundup_pow_of_two(entries);
+	p.cq_entries = 2 * p.sq_entries;
+
+	ctx = kzalloc(sizeof(*ctx), GFP_KERNEL);
+	if (!ctx)
+		return -ENOMEM;
+
+	ret = slow_work_register_user();
+	if (ret < 0) {
+		kfree(ctx);
+		return ret;
+	}
+
+	ctx->flags = p.flags;
+	mutex_init(&ctx->uring_lock);
+	spin_lock_init(&ctx->completion_lock);
+	INIT_LIST_HEAD(&ctx->poll_list);
+	INIT_LIST_HEAD(&ctx->task_list);
+	init_waitqueue_head(&ctx->cq_wait);
+	init_waitqueue_head(&ctx->sqo_wait);
+	atomic_set(&ctx->refs, 1);
+	INIT_WORK(&ctx->free_work, io_ring_ctx_free);
+	ctx->sqo_mm = current->mm;
+
+	ret = -EINVAL;
+	if (!ctx->sqo_mm)
+		goto err;
+	atomic_inc(&ctx->sqo_mm->mm_count);
+	ret = io_allocate_rings(ctx, &p);
+	if (ret)
+		goto err;
+
+	if (p.flags & IORING_SETUP_SQPOLL) {
+		ctx->sq_thread_idle = msecs_to_jiffies(p.sq_thread_idle);
+		if (!ctx->sq_thread_idle)
+			ctx->sq_thread_idle = HZ;
+		ctx->sqo_thread = kthread_run(io_sq_thread, ctx, "io_ring-sq");
+		if (IS_ERR(ctx->sqo_thread)) {
+			ret = PTR_ERR(ctx->sqo_thread);
+			ctx->sqo_thread = NULL;
+			goto err;
+		}
+	}
+
+	ret = -EFAULT;
+	if (copy_to_user(params, &p, sizeof(p)))
+		goto err;
+
+	ret = anon_inode_getfd("[io_ring]", &io_ring_fops, ctx, O_RDWR);
+	if (ret < 0)
+		goto err;
+
+	return ret;
+
+err:
+	if (ctx->sqo_mm)
+		io_ring_ctx_kill(ctx);
+	else {
+		slow_work_unregister_user();
+		kfree(ctx);
+	}
+	return ret;
+}
+
+/*
+ * Submits up to @to_submit entries from the SQ ring, and waits for at least
+ * @min_complete completions if IORING_ENTER_GETEVENTS is set. For rings
+ * polled by the kernel, submission is done by the SQ thread, which is woken
+ * up by IORING_ENTER_SQ_WAKEUP.
+ */
+SYSCALL_DEFINE4(io_ring_enter, unsigned int, fd, u32, to_submit,
+		u32, min_complete, u32, flags)
+{
+	struct io_ring_ctx *ctx;
+	struct file *file;
+	int submitted = 0;
+	int ret;
+
+	if (flags & ~(IORING_ENTER_GETEVENTS | IORING_ENTER_SQ_WAKEUP))
+		return -EINVAL;
+
+	file = fget(fd);
+	if (!file)
+		return -EBADF;
+
+	ret = -EOPNOTSUPP;
+	if (file->f_op != &io_ring_fops)
+		goto out_fput;
+	ctx = file->private_data;
+
+	if (ctx->flags & IORING_SETUP_SQPOLL) {
+		if (flags & IORING_ENTER_SQ_WAKEUP)
+			wake_up(&ctx->sqo_wait);
+		submitted = to_submit;
+	} else if (to_submit) {
+		mutex_lock(&ctx->uring_lock);
+		submitted = io_submit_sqes(ctx, to_submit);
+		mutex_unlock(&ctx->uring_lock);
+	}
+
+	ret = 0;
+	if (flags & IORING_ENTER_GETEVENTS)
+		ret = io_cqring_wait(ctx, min_complete);
+	else
+		io_run_task_list(ctx);
+
+out_fput:
+	fput(file);
+	return submitted ? submitted : ret;
+}
+
+/*
+ * Registers buffers or files with a ring. The registered set cannot be
+ * changed while requests are in flight.
+ */
+SYSCALL_DEFINE4(io_ring_register, unsigned int, fd, unsigned int, opcode,
+		void __user *, arg, unsigned int, nr_args)
+{
+	struct io_ring_ctx *ctx;
+	struct file *file;
+	int ret;
+
+	file = fget(fd);
+	if (!file)
+		return -EBADF;
+
+	ret = -EOPNOTSUPP;
+	if (file->f_op != &io_ring_fops)
+		goto out_fput;
+	ctx = file->private_data;
+
+	mutex_lock(&ctx->uring_lock);
+
+	ret = -EBUSY;
+	if (atomic_read(&ctx->refs) > 1)
+		goto out_unlock;
+
+	switch (opcode) {
+	case IORING_REGISTER_BUFFERS:
+		ret = io_sqe_buffers_register(ctx, arg, nr_args);
+		break;
+	case IORING_UNREGISTER_BUFFERS:
+		ret = -ENXIO;
+		if (ctx->user_bufs) {
+			io_sqe_buffers_unregister(ctx);
+			ret = 0;
+		}
+		break;
+	case IORING_REGISTER_FILES:
+		ret = io_sqe_files_register(ctx, arg, nr_args);
+		break;
+	case IORING_UNREGISTER_FILES:
+		ret = -ENXIO;
+		if (ctx->user_files) {
+			io_sqe_files_unregister(ctx);
+			ret = 0;
+		}
+		break;
+	default:
+		ret = -EINVAL;
+		break;
+	}
+
+out_unlock:
+	mutex_unlock(&ctx->uring_lock);
+out_fput:
+	fput(file);
+	return ret;
+}
+
+static int __init io_ring_init(void)
+{
+	req_cachep = kmem_cache_create("io_kiocb", sizeof(struct io_kiocb),
+				       0, SLAB_HWCACHE_ALIGN | SLAB_PANIC, NULL);
+	return 0;
+}
+__initcall(io_ring_init);
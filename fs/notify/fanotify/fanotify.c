@@ -0,0 +1,417 @@
+/*
+ * fs/notify/fanotify/fanotify.c - filesystem wide access notification
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+/*
+ * A fanotify instance is an fsnotify group behind an anonymous inode file.
+ * fanotify_mark() attaches marks to single inodes, or with FAN_MARK_MOUNT
+ * to a whole vfsmount, so a listener needs one mark per filesystem instead
+ * of one watch per directory.  Events are only generated for open files,
+ * and read() hands the listener a new file descriptor for each object,
+ * opened with the flags given to fanotify_init().  Those files are marked
+ * FMODE_NONOTIFY, so the listener doesn't generate events of its own.
+ */
+
+#include <linux/capability.h>
+#include <linux/cred.h>
+#include <linux/err.h>
+#include <linux/fanotify.h>
+#include <linux/file.h>
+#include <linux/fs.h>
+#include <linux/anon_inodes.h>
+#include <linux/fsnotify_backend.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/mount.h>
+#include <linux/namei.h>
+#include <linux/pid.h>
+#include <linux/poll.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/syscalls.h>
+#include <linux/uaccess.h>
+
+#include <asm/ioctls.h>
+
+#define FANOTIFY_DEFAULT_MAX_EVENTS	16384
+#define FANOTIFY_DEFAULT_MAX_MARKS	8192
+
+/* flags the files handed to the listener may be opened with */
+#define FANOTIFY_EVENT_F_FLAGS	(O_ACCMODE | O_LARGEFILE | O_CLOEXEC | \
+				 O_NONBLOCK)
+
+struct fanotify_group_priv {
+	unsigned int event_f_flags;	/* flags to open event files with */
+};
+
+static const struct file_operations fanotify_fops;
+
+static int fanotify_should_send_event(struct fsnotify_group *group,
+				      struct fsnotify_mark *mark, __u32 mask,
+				      void *data, int data_is)
+{
+	/* fanotify only reports events it can open a file for */
+	return data_is == FSNOTIFY_EVENT_PATH && (mask & FAN_ALL_EVENTS);
+}
+
+/*
+ * Fold events on the same file, through the same mount and caused by the
+ * same process into one, so a writer doing many small writes doesn't fill
+ * the queue.
+ */
+static int fanotify_merge(struct fsnotify_event *old,
+			  struct fsnotify_event *new)
+{
+	if (old->mask == FS_Q_OVERFLOW)
+		return 0;
+	if (old->inode != new->inode || old->path.mnt != new->path.mnt ||
+	    old->tgid != new->tgid)
+		return 0;
+
+	old->mask |= new->mask;
+	return 1;
+}
+
+static void fanotify_free_group_priv(struct fsnotify_group *group)
+{
+	kfree(group->private);
+}
+
+static const struct fsnotify_ops fanotify_fsnotify_ops = {
+	.should_send_event	= fanotify_should_send_event,
+	.merge			= fanotify_merge,
+	.free_group_priv	= fanotify_free_group_priv,
+};
+
+/*
+ * Get an event if one exists, and the buffer is large enough for it.
+ *
+ * Called with the group's notification_mutex held.
+ */
+static struct fsnotify_event *get_one_event(struct fsnotify_group *group,
+					    size_t count)
+{
+	if (fsnotify_notify_queue_is_empty(group))
+		return NULL;
+
+	if (FAN_EVENT_METADATA_LEN > count)
+		return ERR_PTR(-EINVAL);
+
+	return fsnotify_remove_notify_event(group);
+}
+
+/*
+ * Open a file for the object of an event, and copy the event to user
+ * space.  The new file descriptor is only installed once the copy has
+ * succeeded.
+ */
+static ssize_t copy_event_to_user(struct fsnotify_group *group,
+				  struct fsnotify_event *event,
+				  char __user *buf)
+{
+	struct fanotify_group_priv *priv = group->private;
+	struct fanotify_event_metadata metadata;
+	struct file *new_file = NULL;
+	int fd = FAN_NOFD;
+
+	if (event->path.dentry) {
+		fd = get_unused_fd_flags(priv->event_f_flags);
+		if (fd < 0)
+			return fd;
+
+		/* dentry_open() consumes the references */
+		path_get(&event->path);
+		new_file = dentry_open(event->path.dentry, event->path.mnt,
+				       priv->event_f_flags, current_cred());
+		if (IS_ERR(new_file)) {
+			put_unused_fd(fd);
+			return PTR_ERR(new_file);
+		}
+		new_file->f_mode |= FMODE_NONOTIFY;
+	}
+
+	metadata.event_len = FAN_EVENT_METADATA_LEN;
+	metadata.vers = FANOTIFY_METADATA_VERSION;
+	metadata.mask = event->mask & (FAN_ALL_EVENTS | FAN_Q_OVERFLOW);
+	metadata.fd = fd;
+	metadata.pid = pid_vnr(event->tgid);
+
+	if (copy_to_user(buf, &metadata, FAN_EVENT_METADATA_LEN)) {
+		if (new_file) {
+			put_unused_fd(fd);
+			fput(new_file);
+		}
+		return -EFAULT;
+	}
+
+	if (new_file)
+		fd_install(fd, new_file);
+	return FAN_EVENT_METADATA_LEN;
+}
+
+/* fanotify userspace file descriptor functions */
+static unsigned int fanotify_poll(struct file *file, poll_table *wait)
+{
+	struct fsnotify_group *group = file->private_data;
+	int ret = 0;
+
+	poll_wait(file, &group->notification_waitq, wait);
+	mutex_lock(&group->notification_mutex);
+	if (!fsnotify_notify_queue_is_empty(group))
+		ret = POLLIN | POLLRDNORM;
+	mutex_unlock(&group->notification_mutex);
+
+	return ret;
+}
+
+static ssize_t fanotify_read(struct file *file, char __user *buf,
+			     size_t count, loff_t *pos)
+{
+	struct fsnotify_group *group;
+	struct fsnotify_event *event;
+	char __user *start;
+	int ret;
+	DEFINE_WAIT(wait);
+
+	start = buf;
+	group = file->private_data;
+
+	while (1) {
+		prepare_to_wait(&group->notification_waitq, &wait,
+				TASK_INTERRUPTIBLE);
+
+		mutex_lock(&group->notification_mutex);
+		event = get_one_event(group, count);
+		mutex_unlock(&group->notification_mutex);
+
+		if (event) {
+			ret = PTR_ERR(event);
+			if (IS_ERR(event))
+				break;
+			/* opening the file can sleep */
+			__set_current_state(TASK_RUNNING);
+			ret = copy_event_to_user(group, event, buf);
+			fsnotify_destroy_event(event);
+			if (ret < 0)
+				break;
+			buf += ret;
+			count -= ret;
+			continue;
+		}
+
+		ret = -EAGAIN;
+		if (file->f_flags & O_NONBLOCK)
+			break;
+		ret = -EINTR;
+		if (signal_pending(current))
+			break;
+
+		if (start != buf)
+			break;
+
+		schedule();
+	}
+
+	finish_wait(&group->notification_waitq, &wait);
+	if (start != buf && ret != -EFAULT)
+		ret = buf - start;
+	return ret;
+}
+
+static int fanotify_release(struct inode *ignored, struct file *file)
+{
+	struct fsnotify_group *group = file->private_data;
+
+	fsnotify_destroy_group(group);
+
+	return 0;
+}
+
+static long fanotify_ioctl(struct file *file, unsigned int cmd,
+			   unsigned long arg)
+{
+	struct fsnotify_group *group;
+	void __user *p;
+	int ret = -ENOTTY;
+
+	group = file->private_data;
+	p = (void __user *) arg;
+
+	switch (cmd) {
+	case FIONREAD:
+		mutex_lock(&group->notification_mutex);
+		ret = group->q_len * FAN_EVENT_METADATA_LEN;
+		mutex_unlock(&group->notification_mutex);
+		ret = put_user(ret, (int __user *) p);
+		break;
+	}
+
+	return ret;
+}
+
+static const struct file_operations fanotify_fops = {
+	.poll		= fanotify_poll,
+	.read		= fanotify_read,
+	.release	= fanotify_release,
+	.unlocked_ioctl	= fanotify_ioctl,
+	.compat_ioctl	= fanotify_ioctl,
+};
+
+/*
+ * Resolve the object of fanotify_mark(): pathname relative to dfd, or dfd
+ * itself when pathname is NULL.
+ */
+static int fanotify_find_path(int dfd, const char __user *filename,
+			      struct path *path, unsigned int flags)
+{
+	int ret;
+
+	if (filename == NULL) {
+		struct file *file;
+		int fput_needed;
+
+		file = fget_light(dfd, &fput_needed);
+		if (!file)
+			return -EBADF;
+
+		ret = -ENOTDIR;
+		if ((flags & FAN_MARK_ONLYDIR) &&
+		    !S_ISDIR(file->f_path.dentry->d_inode->i_mode)) {
+			fput_light(file, fput_needed);
+			return ret;
+		}
+
+		*path = file->f_path;
+		path_get(path);
+		fput_light(file, fput_needed);
+	} else {
+		unsigned int lookup_flags = 0;
+
+		if (!(flags & FAN_MARK_DONT_FOLLOW))
+			lookup_flags |= LOOKUP_FOLLOW;
+		if (flags & FAN_MARK_ONLYDIR)
+			lookup_flags |= LOOKUP_DIRECTORY;
+
+		ret = user_path_at(dfd, filename, lookup_flags, path);
+		if (ret)
+			return ret;
+	}
+
+	/* you can only watch an inode if you have read permissions on it */
+	ret = inode_permission(path->dentry->d_inode, MAY_READ);
+	if (ret)
+		path_put(path);
+	return ret;
+}
+
+SYSCALL_DEFINE2(fanotify_init, unsigned int, flags, unsigned int, event_f_flags)
+{
+	struct fanotify_group_priv *priv;
+	struct fsnotify_group *group;
+	int fd;
+
+	/* Check the FAN_* constants for consistency.  */
+	BUILD_BUG_ON(FAN_CLOEXEC != O_CLOEXEC);
+	BUILD_BUG_ON(FAN_NONBLOCK != O_NONBLOCK);
+
+	/* a listener sees, and can open, every file it has a mark on */
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	if (flags & ~FAN_ALL_INIT_FLAGS)
+		return -EINVAL;
+	if (event_f_flags & ~FANOTIFY_EVENT_F_FLAGS)
+		return -EINVAL;
+
+	priv = kmalloc(sizeof(struct fanotify_group_priv), GFP_KERNEL);
+	if (!priv)
+		return -ENOMEM;
+	priv->event_f_flags = event_f_flags;
+
+	group = fsnotify_alloc_group(&fanotify_fsnotify_ops,
+				     FANOTIFY_DEFAULT_MAX_EVENTS);
+	if (IS_ERR(group)) {
+		kfree(priv);
+		return PTR_ERR(group);
+	}
+	group->private = priv;
+
+	fd = anon_inode_getfd("[fanotify]", &fanotify_fops, group,
+			      O_RDONLY | flags);
+	if (fd < 0)
+		fsnotify_destroy_group(group);
+
+	return fd;
+}
+
+SYSCALL_DEFINE5(fanotify_mark, int, fanotify_fd, unsigned int, flags,
+		__u32, mask, int, dfd, const char __user *, pathname)
+{
+	struct fsnotify_group *group;
+	struct inode *inode;
+	struct file *filp;
+	struct path path;
+	int ret, fput_needed;
+
+	if (flags & ~FAN_ALL_MARK_FLAGS)
+		return -EINVAL;
+	switch (flags & (FAN_MARK_ADD | FAN_MARK_REMOVE | FAN_MARK_FLUSH)) {
+	case FAN_MARK_ADD:
+	case FAN_MARK_REMOVE:
+		if (!mask)
+			return -EINVAL;
+		break;
+	case FAN_MARK_FLUSH:
+		break;
+	default:
+		return -EINVAL;
+	}
+	if (mask & ~FAN_ALL_EVENTS)
+		return -EINVAL;
+
+	filp = fget_light(fanotify_fd, &fput_needed);
+	if (unlikely(!filp))
+		return -EBADF;
+
+	/* verify that this is indeed an fanotify instance */
+	ret = -EINVAL;
+	if (unlikely(filp->f_op != &fanotify_fops))
+		goto fput_and_out;
+	group = filp->private_data;
+
+	if (flags & FAN_MARK_FLUSH) {
+		fsnotify_clear_marks_by_group(group);
+		ret = 0;
+		goto fput_and_out;
+	}
+
+	ret = fanotify_find_path(dfd, pathname, &path, flags);
+	if (ret)
+		goto fput_and_out;
+
+	/* a mount mark covers every inode seen through the mount */
+	inode = NULL;
+	if (!(flags & FAN_MARK_MOUNT))
+		inode = path.dentry->d_inode;
+
+	if (flags & FAN_MARK_ADD)
+		ret = fsnotify_add_mark(group, mask, inode, path.mnt,
+					FANOTIFY_DEFAULT_MAX_MARKS);
+	else
+		ret = fsnotify_remove_mark(group, mask, inode, path.mnt);
+
+	path_put(&path);
+fput_and_out:
+	fput_light(filp, fput_needed);
+	return ret;
+}
@@ -0,0 +1,92 @@
+/*
+ * fs/notify/fsnotify.c - delivery of filesystem events to notification groups
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#include <linux/fs.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/mount.h>
+#include <linux/rculist.h>
+#include <linux/srcu.h>
+
+#include "fsnotify.h"
+
+struct srcu_struct fsnotify_mark_srcu;
+
+static void send_to_group(struct fsnotify_mark *mark, __u32 mask,
+			  void *data, int data_is)
+{
+	struct fsnotify_group *group = mark->group;
+	struct fsnotify_event *event;
+
+	mask &= mark->mask;
+	if (!group->ops->should_send_event(group, mark, mask, data, data_is))
+		return;
+
+	/*
+	 * Every group gets an event of its own, so that coalescing in one
+	 * queue can't change what another group sees.
+	 */
+	event = fsnotify_create_event(mask, data, data_is);
+	if (unlikely(!event))
+		return;
+
+	fsnotify_add_notify_event(group, event);
+}
+
+/*
+ * fsnotify - hand an event to every group with a mark on the object
+ *
+ * Marks on the inode itself are looked at, and for events which come with
+ * a path, the marks on the vfsmount the path belongs to.  The common case
+ * of nobody being interested costs two loads.  This function can sleep.
+ */
+void fsnotify(struct inode *to_tell, __u32 mask, void *data, int data_is)
+{
+	struct vfsmount *mnt = NULL;
+	struct fsnotify_mark *mark;
+	int idx;
+
+	if (data_is == FSNOTIFY_EVENT_PATH)
+		mnt = ((struct path *)data)->mnt;
+
+	if (!(mask & to_tell->i_fsnotify_mask) &&
+	    !(mnt && (mask & mnt->mnt_fsnotify_mask)))
+		return;
+
+	idx = srcu_read_lock(&fsnotify_mark_srcu);
+
+	if (mask & to_tell->i_fsnotify_mask) {
+		list_for_each_entry_rcu(mark, &to_tell->i_fsnotify_marks,
+					obj_list)
+			if (mask & mark->mask)
+				send_to_group(mark, mask, data, data_is);
+	}
+
+	if (mnt && (mask & mnt->mnt_fsnotify_mask)) {
+		list_for_each_entry_rcu(mark, &mnt->mnt_fsnotify_marks,
+					obj_list)
+			if (mask & mark->mask)
+				send_to_group(mark, mask, data, data_is);
+	}
+
+	srcu_read_unlock(&fsnotify_mark_srcu, idx);
+}
+EXPORT_SYMBOL_GPL(fsnotify);
+
+static __init int fsnotify_init(void)
+{
+	return init_srcu_struct(&fsnotify_mark_srcu);
+}
+core_initcall(fsnotify_init);
@@ -0,0 +1,14 @@
+#ifndef __FS_NOTIFY_FSNOTIFY_H_
+#define __FS_NOTIFY_FSNOTIFY_H_
+
+#include <linux/fsnotify_backend.h>
+#include <linux/spinlock.h>
+#include <linux/srcu.h>
+
+/* protects all mark lists, those of the objects and those of the groups */
+extern spinlock_t fsnotify_mark_lock;
+
+/* marks are walked by the hooks under this, and freed after a grace period */
+extern struct srcu_struct fsnotify_mark_srcu;
+
+#endif	/* __FS_NOTIFY_FSNOTIFY_H_ */
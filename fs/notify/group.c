@@ -0,0 +1,64 @@
+/*
+ * fs/notify/group.c - allocation and teardown of notification groups
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+#include <linux/err.h>
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/wait.h>
+
+#include "fsnotify.h"
+
+/*
+ * fsnotify_alloc_group - create a group with an empty queue and no marks
+ */
+struct fsnotify_group *fsnotify_alloc_group(const struct fsnotify_ops *ops,
+					    unsigned int max_events)
+{
+	struct fsnotify_group *group;
+
+	group = kzalloc(sizeof(struct fsnotify_group), GFP_KERNEL);
+	if (!group)
+		return ERR_PTR(-ENOMEM);
+
+	group->ops = ops;
+	mutex_init(&group->notification_mutex);
+	INIT_LIST_HEAD(&group->notification_list);
+	init_waitqueue_head(&group->notification_waitq);
+	group->max_events = max_events;
+	INIT_LIST_HEAD(&group->marks_list);
+
+	return group;
+}
+EXPORT_SYMBOL_GPL(fsnotify_alloc_group);
+
+/*
+ * fsnotify_destroy_group - destroy the marks of a group, its queued events
+ * and then the group itself
+ */
+void fsnotify_destroy_group(struct fsnotify_group *group)
+{
+	/* after this no hook can find the group, nor queue events to it */
+	fsnotify_clear_marks_by_group(group);
+
+	fsnotify_flush_notify(group);
+
+	if (group->ops->free_group_priv)
+		group->ops->free_group_priv(group);
+
+	kfree(group);
+}
+EXPORT_SYMBOL_GPL(fsnotify_destroy_group);
@@ -0,0 +1,313 @@
+/*
+ * fs/notify/mark.c - marks attach notification groups to inodes and mounts
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+/*
+ * A mark sits on two lists: the list of the object it watches (an inode's
+ * i_fsnotify_marks or a vfsmount's mnt_fsnotify_marks), which the hooks
+ * walk under SRCU, and the marks_list of its group.  Both are only changed
+ * under fsnotify_mark_lock, and the object's mask, which lets the hooks
+ * skip objects nobody is interested in, is recalculated at the same time.
+ *
+ * Marks are added and removed rarely compared to how often events are sent,
+ * so a single lock is enough.  Whoever takes a mark off its group's list
+ * owns it, and frees it once no hook can be looking at it any more.
+ *
+ * An inode mark holds a reference to its inode, but a mark never pins a
+ * vfsmount, which would make umount fail with EBUSY.  Instead the marks go
+ * away with the objects: vfsmount marks when the vfsmount is released, and
+ * inode marks when their superblock's inodes are invalidated.
+ */
+
+#include <linux/fs.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/module.h>
+#include <linux/mount.h>
+#include <linux/rculist.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/srcu.h>
+#include <linux/writeback.h>	/* for inode_lock */
+
+#include "fsnotify.h"
+
+DEFINE_SPINLOCK(fsnotify_mark_lock);
+
+static struct kmem_cache *fsnotify_mark_cachep __read_mostly;
+
+static struct list_head *obj_marks(struct inode *inode, struct vfsmount *mnt)
+{
+	return inode ? &inode->i_fsnotify_marks : &mnt->mnt_fsnotify_marks;
+}
+
+/*
+ * Recalculate the mask of events anybody is interested in for an object.
+ * Caller must hold fsnotify_mark_lock.
+ */
+static void recalc_obj_mask(struct inode *inode, struct vfsmount *mnt)
+{
+	struct fsnotify_mark *mark;
+	__u32 mask = 0;
+
+	list_for_each_entry(mark, obj_marks(inode, mnt), obj_list)
+		mask |= mark->mask;
+
+	if (inode)
+		inode->i_fsnotify_mask = mask;
+	else
+		mnt->mnt_fsnotify_mask = mask;
+}
+
+/*
+ * Find the mark of a group on an object.  Caller must hold
+ * fsnotify_mark_lock.
+ */
+static struct fsnotify_mark *find_mark(struct fsnotify_group *group,
+				       struct inode *inode,
+				       struct vfsmount *mnt)
+{
+	struct fsnotify_mark *mark;
+
+	list_for_each_entry(mark, obj_marks(inode, mnt), obj_list)
+		if (mark->group == group)
+			return mark;
+	return NULL;
+}
+
+/*
+ * Take a mark off its object and its group, and put it on the given list
+ * to be freed.  Caller must hold fsnotify_mark_lock.
+ */
+static void detach_mark(struct fsnotify_mark *mark, struct list_head *free)
+{
+	list_del_rcu(&mark->obj_list);
+	list_move(&mark->g_list, free);
+	mark->group->nr_marks--;
+	recalc_obj_mask(mark->inode, mark->mnt);
+}
+
+/*
+ * Free marks detached with detach_mark(), once the hooks are done with
+ * them.  This drops the references the marks held, so it can sleep.
+ */
+static void free_marks(struct list_head *free)
+{
+	struct fsnotify_mark *mark, *next;
+
+	if (list_empty(free))
+		return;
+
+	synchronize_srcu(&fsnotify_mark_srcu);
+
+	list_for_each_entry_safe(mark, next, free, g_list) {
+		list_del(&mark->g_list);
+		if (mark->inode)
+			iput(mark->inode);
+		kmem_cache_free(fsnotify_mark_cachep, mark);
+	}
+}
+
+/**
+ * fsnotify_add_mark - add events to a group's interest in an object
+ * @group:	the group
+ * @mask:	events to add
+ * @inode:	the inode to watch, or NULL to watch all of @mnt
+ * @mnt:	the vfsmount @inode was found through
+ * @max_marks:	maximum number of marks the group may have
+ *
+ * If the group already has a mark on the object, the events are added to
+ * it.  Otherwise a new mark is created, which holds a reference to @inode.
+ * @mnt is not pinned; the caller must hold a reference to it.
+ */
+int fsnotify_add_mark(struct fsnotify_group *group, __u32 mask,
+		      struct inode *inode, struct vfsmount *mnt,
+		      unsigned int max_marks)
+{
+	struct fsnotify_mark *mark, *new;
+	int ret = 0;
+
+	new = kmem_cache_alloc(fsnotify_mark_cachep, GFP_KERNEL);
+	if (unlikely(!new))
+		return -ENOMEM;
+
+	new->mask = mask;
+	new->group = group;
+	new->mnt = inode ? NULL : mnt;
+	new->inode = NULL;
+	if (inode) {
+		new->inode = igrab(inode);
+		if (unlikely(!new->inode)) {
+			ret = -ENOENT;
+			goto out_free;
+		}
+	}
+
+	spin_lock(&fsnotify_mark_lock);
+	mark = find_mark(group, inode, mnt);
+	if (mark) {
+		mark->mask |= mask;
+		recalc_obj_mask(inode, mnt);
+	} else if (group->nr_marks >= max_marks) {
+		ret = -ENOSPC;
+	} else {
+		list_add_tail(&new->g_list, &group->marks_list);
+		group->nr_marks++;
+		list_add_rcu(&new->obj_list, obj_marks(inode, mnt));
+		recalc_obj_mask(inode, mnt);
+		new = NULL;
+	}
+	spin_unlock(&fsnotify_mark_lock);
+
+	if (!new)
+		return 0;
+	if (new->inode)
+		iput(new->inode);
+out_free:
+	kmem_cache_free(fsnotify_mark_cachep, new);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(fsnotify_add_mark);
+
+/**
+ * fsnotify_remove_mark - remove events from a group's interest in an object
+ * @group:	the group
+ * @mask:	events to remove
+ * @inode:	the inode, or NULL for the mark on all of @mnt
+ * @mnt:	the vfsmount
+ *
+ * The mark is destroyed once it has no events left.  Returns -ENOENT if
+ * the group has no mark on the object.
+ */
+int fsnotify_remove_mark(struct fsnotify_group *group, __u32 mask,
+			 struct inode *inode, struct vfsmount *mnt)
+{
+	struct fsnotify_mark *mark;
+	LIST_HEAD(free);
+	int ret = 0;
+
+	spin_lock(&fsnotify_mark_lock);
+	mark = find_mark(group, inode, mnt);
+	if (!mark) {
+		ret = -ENOENT;
+	} else {
+		mark->mask &= ~mask;
+		if (mark->mask)
+			recalc_obj_mask(inode, mnt);
+		else
+			detach_mark(mark, &free);
+	}
+	spin_unlock(&fsnotify_mark_lock);
+
+	free_marks(&free);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(fsnotify_remove_mark);
+
+/*
+ * fsnotify_clear_marks_by_group - destroy all marks of a group
+ *
+ * Once this returns, no hook can reach the group any more.
+ */
+void fsnotify_clear_marks_by_group(struct fsnotify_group *group)
+{
+	struct fsnotify_mark *mark, *next;
+	LIST_HEAD(free);
+
+	spin_lock(&fsnotify_mark_lock);
+	list_for_each_entry_safe(mark, next, &group->marks_list, g_list)
+		detach_mark(mark, &free);
+	spin_unlock(&fsnotify_mark_lock);
+
+	free_marks(&free);
+}
+EXPORT_SYMBOL_GPL(fsnotify_clear_marks_by_group);
+
+/*
+ * __fsnotify_inode_delete - the last link to an inode went away
+ *
+ * Destroy the marks on it, which would otherwise keep the deleted inode
+ * around until their groups go away.
+ */
+void __fsnotify_inode_delete(struct inode *inode)
+{
+	struct fsnotify_mark *mark, *next;
+	LIST_HEAD(free);
+
+	if (list_empty(&inode->i_fsnotify_marks))
+		return;
+
+	spin_lock(&fsnotify_mark_lock);
+	list_for_each_entry_safe(mark, next, &inode->i_fsnotify_marks, obj_list)
+		detach_mark(mark, &free);
+	spin_unlock(&fsnotify_mark_lock);
+
+	free_marks(&free);
+}
+EXPORT_SYMBOL_GPL(__fsnotify_inode_delete);
+
+/*
+ * __fsnotify_vfsmount_delete - the last reference to a vfsmount went away
+ *
+ * Destroy the marks on it before it is freed.
+ */
+void __fsnotify_vfsmount_delete(struct vfsmount *mnt)
+{
+	struct fsnotify_mark *mark, *next;
+	LIST_HEAD(free);
+
+	if (list_empty(&mnt->mnt_fsnotify_marks))
+		return;
+
+	spin_lock(&fsnotify_mark_lock);
+	list_for_each_entry_safe(mark, next, &mnt->mnt_fsnotify_marks, obj_list)
+		detach_mark(mark, &free);
+	spin_unlock(&fsnotify_mark_lock);
+
+	free_marks(&free);
+}
+
+/**
+ * fsnotify_unmount_inodes - destroy the inode marks on a superblock
+ * @list:	list of inodes being unmounted (sb->s_inodes)
+ *
+ * Called with iprune_mutex held, keeping shrink_icache_memory() at bay,
+ * from invalidate_inodes().  The marks hold references to their inodes,
+ * which would otherwise still be busy when the superblock goes away.
+ */
+void fsnotify_unmount_inodes(struct list_head *list)
+{
+	struct fsnotify_mark *mark, *next;
+	struct inode *inode;
+	LIST_HEAD(free);
+
+	spin_lock(&inode_lock);
+	spin_lock(&fsnotify_mark_lock);
+	list_for_each_entry(inode, list, i_sb_list)
+		list_for_each_entry_safe(mark, next, &inode->i_fsnotify_marks,
+					 obj_list)
+			detach_mark(mark, &free);
+	spin_unlock(&fsnotify_mark_lock);
+	spin_unlock(&inode_lock);
+
+	free_marks(&free);
+}
+EXPORT_SYMBOL_GPL(fsnotify_unmount_inodes);
+
+static int __init fsnotify_mark_init(void)
+{
+	fsnotify_mark_cachep = KMEM_CACHE(fsnotify_mark, SLAB_PANIC);
+	return 0;
+}
+subsys_initcall(fsnotify_mark_init);
@@ -0,0 +1,199 @@
+/*
+ * fs/notify/notification.c - the event queues of notification groups
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2, or (at your option) any
+ * later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ */
+
+/*
+ * Each group has a queue of events, protected by its notification_mutex.
+ * Before a new event is queued, the group gets a chance to merge it into
+ * one of the most recent events already in the queue, so that a burst of
+ * identical events, like the writes of a large copy, takes a single slot.
+ *
+ * When the queue is full, one FS_Q_OVERFLOW event is queued and further
+ * events are dropped until the reader makes room.
+ */
+
+#include <linux/fs.h>
+#include <linux/init.h>
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/module.h>
+#include <linux/mount.h>
+#include <linux/mutex.h>
+#include <linux/namei.h>
+#include <linux/pid.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+
+#include "fsnotify.h"
+
+static struct kmem_cache *fsnotify_event_cachep __read_mostly;
+
+/*
+ * fsnotify_create_event - allocate an event, taking a reference to the
+ * object it describes
+ */
+struct fsnotify_event *fsnotify_create_event(__u32 mask, void *data,
+					     int data_is)
+{
+	struct fsnotify_event *event;
+
+	event = kmem_cache_alloc(fsnotify_event_cachep, GFP_NOFS);
+	if (unlikely(!event))
+		return NULL;
+
+	INIT_LIST_HEAD(&event->list);
+	event->mask = mask;
+	event->inode = NULL;
+	event->path.mnt = NULL;
+	event->path.dentry = NULL;
+
+	switch (data_is) {
+	case FSNOTIFY_EVENT_PATH:
+		event->path = *(struct path *)data;
+		path_get(&event->path);
+		event->inode = event->path.dentry->d_inode;
+		break;
+	case FSNOTIFY_EVENT_INODE:
+		event->inode = igrab(data);
+		break;
+	}
+
+	event->tgid = get_pid(task_tgid(current));
+	return event;
+}
+EXPORT_SYMBOL_GPL(fsnotify_create_event);
+
+/*
+ * Drop the references an event holds.  The hook which generated it still
+ * holds its own, so this never drops the last one while the event is being
+ * sent.
+ */
+static void fsnotify_release_event(struct fsnotify_event *event)
+{
+	if (event->path.dentry)
+		path_put(&event->path);
+	else if (event->inode)
+		iput(event->inode);
+	put_pid(event->tgid);
+
+	event->inode = NULL;
+	event->path.mnt = NULL;
+	event->path.dentry = NULL;
+	event->tgid = NULL;
+}
+
+void fsnotify_destroy_event(struct fsnotify_event *event)
+{
+	fsnotify_release_event(event);
+	kmem_cache_free(fsnotify_event_cachep, event);
+}
+EXPORT_SYMBOL_GPL(fsnotify_destroy_event);
+
+/*
+ * fsnotify_add_notify_event - queue an event to a group, or merge it into
+ * a queued one
+ *
+ * The event belongs to the queue afterwards, or has been freed.
+ */
+void fsnotify_add_notify_event(struct fsnotify_group *group,
+			       struct fsnotify_event *event)
+{
+	struct fsnotify_event *old;
+	int depth = 0;
+
+	mutex_lock(&group->notification_mutex);
+
+	if (group->ops->merge) {
+		list_for_each_entry_reverse(old, &group->notification_list,
+					    list) {
+			if (depth++ == FSNOTIFY_MERGE_DEPTH)
+				break;
+			if (group->ops->merge(old, event))
+				goto drop;
+		}
+	}
+
+	/* the queue overflowed and we already queued the Q_OVERFLOW event */
+	if (unlikely(group->q_len > group->max_events))
+		goto drop;
+
+	/* the queue is full: this event becomes the overflow event */
+	if (unlikely(group->q_len == group->max_events)) {
+		fsnotify_release_event(event);
+		event->mask = FS_Q_OVERFLOW;
+	}
+
+	group->q_len++;
+	list_add_tail(&event->list, &group->notification_list);
+	mutex_unlock(&group->notification_mutex);
+
+	wake_up(&group->notification_waitq);
+	return;
+
+drop:
+	mutex_unlock(&group->notification_mutex);
+	fsnotify_destroy_event(event);
+}
+EXPORT_SYMBOL_GPL(fsnotify_add_notify_event);
+
+/*
+ * Caller must hold group->notification_mutex for the functions below.
+ */
+int fsnotify_notify_queue_is_empty(struct fsnotify_group *group)
+{
+	BUG_ON(!mutex_is_locked(&group->notification_mutex));
+	return list_empty(&group->notification_list);
+}
+EXPORT_SYMBOL_GPL(fsnotify_notify_queue_is_empty);
+
+struct fsnotify_event *fsnotify_peek_notify_event(struct fsnotify_group *group)
+{
+	BUG_ON(!mutex_is_locked(&group->notification_mutex));
+	return list_first_entry(&group->notification_list,
+				struct fsnotify_event, list);
+}
+EXPORT_SYMBOL_GPL(fsnotify_peek_notify_event);
+
+struct fsnotify_event *fsnotify_remove_notify_event(struct fsnotify_group *group)
+{
+	struct fsnotify_event *event;
+
+	event = fsnotify_peek_notify_event(group);
+	list_del_init(&event->list);
+	group->q_len--;
+	return event;
+}
+EXPORT_SYMBOL_GPL(fsnotify_remove_notify_event);
+
+/*
+ * fsnotify_flush_notify - throw away all events queued to a group
+ */
+void fsnotify_flush_notify(struct fsnotify_group *group)
+{
+	struct fsnotify_event *event;
+
+	mutex_lock(&group->notification_mutex);
+	while (!fsnotify_notify_queue_is_empty(group)) {
+		event = fsnotify_remove_notify_event(group);
+		fsnotify_destroy_event(event);
+	}
+	mutex_unlock(&group->notification_mutex);
+}
+EXPORT_SYMBOL_GPL(fsnotify_flush_notify);
+
+static int __init fsnotify_notification_init(void)
+{
+	fsnotify_event_cachep = KMEM_CACHE(fsnotify_event, SLAB_PANIC);
+	return 0;
+}
+subsys_initcall(fsnotify_notification_init);
@@ -389,7 +389,22 @@ SYSCALL_DEFINE(fallocate)(int fd, int mode, loff_t offset, loff_t len)
 
 	/* Return error if mode is not supported */
 	ret = -EOPNOTSUPP;
-	if (mode && !(mode & FALLOC_FL_KEEP_SIZE))
+	if (mode & ~(FALLOC_FL_KEEP_SIZE | FALLOC_FL_PUNCH_HOLE |
+		     FALLOC_FL_COLLAPSE_RANGE | FALLOC_FL_ZERO_RANGE))
+		goto out;
+
+	/* Punch hole and zero range are mutually exclusive */
+	if ((mode & FALLOC_FL_PUNCH_HOLE) && (mode & FALLOC_FL_ZERO_RANGE))
+		goto out;
+
+	/* Punch hole must keep the file size */
+	if ((mode & FALLOC_FL_PUNCH_HOLE) && !(mode & FALLOC_FL_KEEP_SIZE))
+		goto out;
+
+	/* Collapse range changes the size by itself */
+	ret = -EINVAL;
+	if ((mode & FALLOC_FL_COLLAPSE_RANGE) &&
+	    (mode & ~FALLOC_FL_COLLAPSE_RANGE))
 		goto out;
 
 	ret = -EBADF;
@@ -412,6 +427,14 @@ SYSCALL_DEFINE(fallocate)(int fd, int mode, loff_t offset, loff_t len)
 	if (S_ISFIFO(inode->i_mode))
 		goto out_fput;
 
+	/* Append-only files may only grow at the end */
+	ret = -EPERM;
+	if ((mode & (FALLOC_FL_PUNCH_HOLE | FALLOC_FL_COLLAPSE_RANGE)) &&
+	    IS_APPEND(inode))
+		goto out_fput;
+	if (IS_IMMUTABLE(inode))
+		goto out_fput;
+
 	ret = -ENODEV;
 	/*
 	 * Let individual file system decide if it supports preallocation
@@ -425,6 +448,12 @@ SYSCALL_DEFINE(fallocate)(int fd, int mode, loff_t offset, loff_t len)
 	if (((offset + len) > inode->i_sb->s_maxbytes) || ((offset + len) < 0))
 		goto out_fput;
 
+	/* There has to be something left after a collapsed range */
+	ret = -EINVAL;
+	if ((mode & FALLOC_FL_COLLAPSE_RANGE) &&
+	    offset + len >= i_size_read(inode))
+		goto out_fput;
+
 	if (inode->i_op->fallocate)
 		ret = inode->i_op->fallocate(inode, mode, offset, len);
 	else
@@ -1038,7 +1067,7 @@ long do_sys_open(int dfd, const char __user *filename, int flags, int mode)
 				put_unused_fd(fd);
 				fd = PTR_ERR(f);
 			} else {
-				fsnotify_open(f->f_path.dentry);
+				fsnotify_open(f);
 				fd_install(fd, f);
 			}
 		}
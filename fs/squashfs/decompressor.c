@@ -0,0 +1,125 @@
+/*
+ * Squashfs - a compressed read only filesystem for Linux
+ *
+ * Copyright (c) 2002, 2003, 2004, 2005, 2006, 2007, 2008
+ * Phillip Lougher <phillip@lougher.demon.co.uk>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * decompressor.c
+ */
+
+/*
+ * This file looks up the decompressor of a filesystem from the compression
+ * id in its superblock.  Compression types which are known but whose
+ * decompressor hasn't been built in have an entry too, so that mounting
+ * them gives a meaningful error.
+ */
+
+#include <linux/types.h>
+#include <linux/mutex.h>
+#include <linux/buffer_head.h>
+#include <linux/string.h>
+#include <linux/pagemap.h>
+
+#include "squashfs_fs.h"
+#include "squashfs_fs_sb.h"
+#include "squashfs_fs_i.h"
+#include "decompressor.h"
+#include "squashfs.h"
+
+#ifndef CONFIG_SQUASHFS_LZMA
+static const struct squashfs_decompressor squashfs_lzma_comp_ops = {
+	NULL, NULL, NULL, LZMA_COMPRESSION, "lzma", 0
+};
+#endif
+
+#ifndef CONFIG_SQUASHFS_LZO
+static const struct squashfs_decompressor squashfs_lzo_comp_ops = {
+	NULL, NULL, NULL, LZO_COMPRESSION, "lzo", 0
+};
+#endif
+
+static const struct squashfs_decompressor squashfs_xz_comp_ops = {
+	NULL, NULL, NULL, XZ_COMPRESSION, "xz", 0
+};
+
+static const struct squashfs_decompressor squashfs_unknown_comp_ops = {
+	NULL, NULL, NULL, 0, "unknown", 0
+};
+
+static const struct squashfs_decompressor *decompressor[] = {
+	&squashfs_zlib_comp_ops,
+	&squashfs_lzma_comp_ops,
+	&squashfs_lzo_comp_ops,
+	&squashfs_xz_comp_ops,
+	&squashfs_unknown_comp_ops
+};
+
+
+const struct squashfs_decompressor *squashfs_lookup_decompressor(int id)
+{
+	int i;
+
+	for (i = 0; decompressor[i]->id; i++)
+		if (id == decompressor[i]->id)
+			break;
+
+	return decompressor[i];
+}
+
+
+/*
+ * Helpers for decompressors which work on contiguous buffers rather than
+ * on buffer_heads and pages: gather length bytes starting at offset into
+ * the first of the b buffer_heads into dest...
+ */
+void squashfs_bh_to_buffer(struct squashfs_sb_info *msblk, void *dest,
+	struct buffer_head **bh, int b, int offset, int length)
+{
+	int avail, k;
+
+	for (k = 0; k < b && length > 0; k++) {
+		avail = min(length, msblk->devblksize - offset);
+		memcpy(dest, bh[k]->b_data + offset, avail);
+		dest += avail;
+		length -= avail;
+		offset = 0;
+	}
+}
+
+
+/*
+ * ...and scatter bytes bytes of src over the pages of buffer.  Returns
+ * bytes, or -EIO if the pages can't hold them.
+ */
+int squashfs_buffer_to_pages(void *src, int bytes, void **buffer, int pages)
+{
+	int avail, page;
+
+	if (bytes > pages * PAGE_CACHE_SIZE) {
+		ERROR("Decompressed block larger than expected, data "
+			"probably corrupt\n");
+		return -EIO;
+	}
+
+	for (page = 0; page * PAGE_CACHE_SIZE < bytes; page++) {
+		avail = min_t(int, bytes - page * PAGE_CACHE_SIZE,
+			PAGE_CACHE_SIZE);
+		memcpy(buffer[page], src + page * PAGE_CACHE_SIZE, avail);
+	}
+
+	return bytes;
+}
@@ -0,0 +1,64 @@
+#ifndef DECOMPRESSOR_H
+#define DECOMPRESSOR_H
+/*
+ * Squashfs - a compressed read only filesystem for Linux
+ *
+ * Copyright (c) 2002, 2003, 2004, 2005, 2006, 2007, 2008
+ * Phillip Lougher <phillip@lougher.demon.co.uk>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * decompressor.h
+ */
+
+/*
+ * A decompressor is selected at mount time from the compression id in the
+ * superblock.  init() allocates the state of one stream (the filesystem may
+ * have several, see stream.c), free() releases it, and decompress()
+ * decompresses length bytes, starting at offset into the first of b uptodate
+ * buffer_heads, into the pages of buffer, returning the decompressed length
+ * or -EIO.
+ */
+struct squashfs_decompressor {
+	void	*(*init)(struct squashfs_sb_info *);
+	void	(*free)(void *);
+	int	(*decompress)(struct squashfs_sb_info *, void *, void **,
+		struct buffer_head **, int, int, int, int, int);
+	int	id;
+	char	*name;
+	int	supported;
+};
+
+/*
+ * Size of the buffers needed by decompressors which can't work on
+ * buffer_heads and pages directly: the largest compressed or uncompressed
+ * block of the filesystem.
+ */
+static inline int squashfs_max_block(struct squashfs_sb_info *msblk)
+{
+	return max_t(int, msblk->block_size, SQUASHFS_METADATA_SIZE);
+}
+
+#ifdef CONFIG_SQUASHFS_LZO
+extern const struct squashfs_decompressor squashfs_lzo_comp_ops;
+#endif
+
+#ifdef CONFIG_SQUASHFS_LZMA
+extern const struct squashfs_decompressor squashfs_lzma_comp_ops;
+#endif
+
+extern const struct squashfs_decompressor squashfs_zlib_comp_ops;
+
+#endif
@@ -47,7 +47,7 @@
 #include <linux/string.h>
 #include <linux/pagemap.h>
 #include <linux/mutex.h>
-#include <linux/zlib.h>
+#include <linux/highmem.h>
 
 #include "squashfs_fs.h"
 #include "squashfs_fs_sb.h"
@@ -372,6 +372,88 @@ static int read_blocklist(struct inode *inode, int index, u64 *block)
 }
 
 
+/*
+ * Decompress a datablock straight into the page cache pages it covers,
+ * rather than into the read_page cache and copying from there.  Returns
+ * 0 once the pages (including the one being read) are filled and
+ * unlocked, -EAGAIN if some of the pages couldn't be grabbed or are
+ * already uptodate, in which case the caller has to fall back to the
+ * read_page cache, or -EIO.
+ */
+static int squashfs_readpage_block(struct page *page, u64 block, int bsize)
+{
+	struct inode *inode = page->mapping->host;
+	struct squashfs_sb_info *msblk = inode->i_sb->s_fs_info;
+	int mask = (1 << (msblk->block_log - PAGE_CACHE_SHIFT)) - 1;
+	int start_index = page->index & ~mask;
+	int end_index = start_index | mask;
+	int file_end = (i_size_read(inode) - 1) >> PAGE_CACHE_SHIFT;
+	struct page **page_list;
+	void **buffer;
+	int i, pages, bytes, res = -ENOMEM;
+
+	if (end_index > file_end)
+		end_index = file_end;
+	pages = end_index - start_index + 1;
+
+	page_list = kcalloc(pages, sizeof(*page_list), GFP_KERNEL);
+	buffer = kcalloc(pages, sizeof(*buffer), GFP_KERNEL);
+	if (page_list == NULL || buffer == NULL)
+		goto out;
+
+	res = -EAGAIN;
+	for (i = 0; i < pages; i++) {
+		int n = start_index + i;
+
+		page_list[i] = n == page->index ? page :
+			grab_cache_page_nowait(page->mapping, n);
+		if (page_list[i] == NULL || PageUptodate(page_list[i]))
+			goto release_pages;
+	}
+
+	for (i = 0; i < pages; i++)
+		buffer[i] = kmap(page_list[i]);
+
+	/* buffer[] stops at EOF, so may cover less than a whole block */
+	bytes = squashfs_read_data(inode->i_sb, buffer, block, bsize, NULL,
+		pages << PAGE_CACHE_SHIFT, pages);
+
+	for (i = 0; i < pages; i++) {
+		int avail = clamp_t(int, bytes - i * PAGE_CACHE_SIZE, 0,
+			PAGE_CACHE_SIZE);
+
+		if (bytes >= 0)
+			memset(buffer[i] + avail, 0, PAGE_CACHE_SIZE - avail);
+		kunmap(page_list[i]);
+		if (bytes >= 0) {
+			flush_dcache_page(page_list[i]);
+			SetPageUptodate(page_list[i]);
+		}
+	}
+
+	if (bytes < 0) {
+		ERROR("Unable to read page, block %llx, size %x\n", block,
+			bsize);
+		res = -EIO;
+	} else
+		res = 0;
+
+release_pages:
+	for (i = 0; i < pages; i++) {
+		if (page_list[i] == NULL || page_list[i] == page)
+			continue;
+		unlock_page(page_list[i]);
+		page_cache_release(page_list[i]);
+	}
+	if (res == 0)
+		unlock_page(page);
+out:
+	kfree(buffer);
+	kfree(page_list);
+	return res == -ENOMEM ? -EAGAIN : res;
+}
+
+
 static int squashfs_readpage(struct file *file, struct page *page)
 {
 	struct inode *inode = page->mapping->host;
@@ -411,8 +493,16 @@ static int squashfs_readpage(struct file *file, struct page *page)
 			sparse = 1;
 		} else {
 			/*
-			 * Read and decompress datablock.
+			 * Read and decompress datablock, directly into the
+			 * page cache if possible.
 			 */
+			int res = squashfs_readpage_block(page, block, bsize);
+
+			if (res == 0)
+				return 0;
+			if (res != -EAGAIN)
+				goto error_out;
+
 			buffer = squashfs_get_datablock(inode->i_sb,
 								block, bsize);
 			if (buffer->error) {
@@ -0,0 +1,161 @@
+/*
+ * Squashfs - a compressed read only filesystem for Linux
+ *
+ * Copyright (c) 2002, 2003, 2004, 2005, 2006, 2007, 2008
+ * Phillip Lougher <phillip@lougher.demon.co.uk>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * lzma_wrapper.c
+ */
+
+/*
+ * LZMA support, using the lzma decompressor in lib/decompress_unlzma.c.
+ * Blocks are stored in the LZMA "alone" format: a 13 byte header (the
+ * lc/lp/pb properties, dictionary size and uncompressed size) followed by
+ * the compressed data.
+ */
+
+#include <linux/mutex.h>
+#include <linux/buffer_head.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/decompress/unlzma.h>
+#include <asm/unaligned.h>
+
+#include "squashfs_fs.h"
+#include "squashfs_fs_sb.h"
+#include "squashfs_fs_i.h"
+#include "decompressor.h"
+#include "squashfs.h"
+
+#define LZMA_HEADER_SIZE	13
+
+/*
+ * unlzma() only decompresses contiguous buffers.  The input buffer is
+ * embedded so that lzma_fill() can get back to the stream from it.
+ */
+struct squashfs_lzma {
+	int		error;
+	void		*output;
+	unsigned char	input[0];
+};
+
+static void *lzma_init(struct squashfs_sb_info *msblk)
+{
+	int block_size = squashfs_max_block(msblk);
+	struct squashfs_lzma *stream;
+
+	stream = vmalloc(sizeof(*stream) + block_size);
+	if (stream == NULL)
+		goto failed;
+	stream->output = vmalloc(block_size);
+	if (stream->output == NULL)
+		goto failed2;
+
+	return stream;
+
+failed2:
+	vfree(stream);
+failed:
+	ERROR("Failed to allocate lzma workspace\n");
+	return NULL;
+}
+
+
+static void lzma_free(void *strm)
+{
+	struct squashfs_lzma *stream = strm;
+
+	if (stream)
+		vfree(stream->output);
+	vfree(stream);
+}
+
+
+/*
+ * Called by unlzma() when it runs out of input, which means the block is
+ * truncated.  Returning an error makes unlzma() carry on within the input
+ * buffer, so remember to fail the block afterwards.
+ */
+static int lzma_fill(void *buf, unsigned int size)
+{
+	container_of(buf, struct squashfs_lzma, input)->error = 1;
+	return -1;
+}
+
+
+static void lzma_error(char *msg)
+{
+	ERROR("lzma error: %s\n", msg);
+}
+
+
+static int lzma_uncompress(struct squashfs_sb_info *msblk, void *strm,
+	void **buffer, struct buffer_head **bh, int b, int offset, int length,
+	int srclength, int pages)
+{
+	struct squashfs_lzma *stream = strm;
+	unsigned char *header = stream->input;
+	unsigned int props, lc, lp;
+	u64 size;
+	int pos;
+
+	if (length < LZMA_HEADER_SIZE)
+		goto corrupt;
+
+	squashfs_bh_to_buffer(msblk, stream->input, bh, b, offset, length);
+
+	/*
+	 * unlzma() trusts the header, check it first: the uncompressed size
+	 * must fit the output buffer, and the properties must be sane.
+	 */
+	props = header[0];
+	lc = props % 9;
+	lp = (props / 9) % 5;
+	size = get_unaligned_le64(header + 5);
+	if (props >= 9 * 5 * 5 || lc + lp > 4 || size > srclength)
+		goto corrupt;
+
+	/*
+	 * Without a flush function unlzma() takes the last 4 bytes of input
+	 * to be the uncompressed size appended by the pre-boot environment,
+	 * and ignores them.
+	 */
+	/*
+	 * An end of stream marker may come before size bytes, don't let what
+	 * is left of the previous block show through.
+	 */
+	memset(stream->output, 0, size);
+	stream->error = 0;
+	if (unlzma(stream->input, length + 4, lzma_fill, NULL, stream->output,
+			&pos, lzma_error) || stream->error)
+		goto corrupt;
+
+	return squashfs_buffer_to_pages(stream->output, size, buffer, pages);
+
+corrupt:
+	ERROR("lzma decompression failed, data probably corrupt\n");
+	return -EIO;
+}
+
+const struct squashfs_decompressor squashfs_lzma_comp_ops = {
+	.init = lzma_init,
+	.free = lzma_free,
+	.decompress = lzma_uncompress,
+	.id = LZMA_COMPRESSION,
+	.name = "lzma",
+	.supported = 1
+};
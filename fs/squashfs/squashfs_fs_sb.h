@@ -61,10 +61,11 @@ struct squashfs_sb_info {
 	__le64			*id_table;
 	__le64			*fragment_index;
 	unsigned int		*fragment_index_2;
-	struct mutex		read_data_mutex;
 	struct mutex		meta_index_mutex;
 	struct meta_index	*meta_index;
-	z_stream		stream;
+	const struct squashfs_decompressor *decompressor;
+	struct squashfs_stream_pool *streams;
+	int			threads;
 	__le64			*inode_lookup_table;
 	u64			inode_table;
 	u64			directory_table;
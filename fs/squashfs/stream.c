@@ -0,0 +1,257 @@
+/*
+ * Squashfs - a compressed read only filesystem for Linux
+ *
+ * Copyright (c) 2002, 2003, 2004, 2005, 2006, 2007, 2008
+ * Phillip Lougher <phillip@lougher.demon.co.uk>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2,
+ * or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+ *
+ * stream.c
+ */
+
+/*
+ * This file manages the decompressor streams of a mounted filesystem, so
+ * that concurrent readers need not serialise on a single stream.  What a
+ * stream holds is up to the filesystem's decompressor.
+ *
+ * Depending on the "threads=" mount option, a filesystem either has a pool
+ * of up to N streams, allocated on demand and shared by all CPUs (readers
+ * wait when all of them are busy), or one stream per possible CPU.  A
+ * reader uses the stream of the CPU it's running on, and only waits for
+ * another reader which got preempted or migrated while using it.  Some
+ * decompressors allocate memory, so streams are never used with
+ * preemption disabled.  A pool of one stream is the default, and behaves
+ * as the original single, mutex protected, stream.
+ */
+
+#include <linux/fs.h>
+#include <linux/vfs.h>
+#include <linux/slab.h>
+#include <linux/wait.h>
+#include <linux/sched.h>
+#include <linux/percpu.h>
+#include <linux/mutex.h>
+#include <linux/buffer_head.h>
+
+#include "squashfs_fs.h"
+#include "squashfs_fs_sb.h"
+#include "squashfs_fs_i.h"
+#include "decompressor.h"
+#include "squashfs.h"
+
+struct squashfs_stream {
+	void			*stream;	/* decompressor state */
+	struct list_head	list;
+	struct mutex		mutex;		/* per-cpu streams only */
+};
+
+struct squashfs_stream_pool {
+	struct squashfs_stream	*percpu;	/* per-cpu streams, or NULL */
+	spinlock_t		lock;
+	struct list_head	idle;		/* streams not in use */
+	int			count;		/* streams allocated */
+	int			max;		/* streams allowed */
+	wait_queue_head_t	wait;
+};
+
+
+static struct squashfs_stream *squashfs_stream_alloc(
+				struct squashfs_sb_info *msblk)
+{
+	struct squashfs_stream *stream = kmalloc(sizeof(*stream), GFP_KERNEL);
+
+	if (stream == NULL)
+		return NULL;
+
+	stream->stream = msblk->decompressor->init(msblk);
+	if (stream->stream == NULL) {
+		kfree(stream);
+		return NULL;
+	}
+	return stream;
+}
+
+
+static void squashfs_stream_free(struct squashfs_sb_info *msblk,
+				struct squashfs_stream *stream)
+{
+	msblk->decompressor->free(stream->stream);
+	kfree(stream);
+}
+
+
+/*
+ * Get a stream to decompress with, waiting for one to be free.
+ */
+static struct squashfs_stream *get_stream(struct squashfs_sb_info *msblk)
+{
+	struct squashfs_stream_pool *pool = msblk->streams;
+	struct squashfs_stream *stream;
+	DEFINE_WAIT(wait);
+
+	if (pool->percpu) {
+		stream = per_cpu_ptr(pool->percpu, raw_smp_processor_id());
+		mutex_lock(&stream->mutex);
+		return stream;
+	}
+
+	spin_lock(&pool->lock);
+	while (list_empty(&pool->idle)) {
+		if (pool->count < pool->max) {
+			pool->count++;
+			spin_unlock(&pool->lock);
+
+			stream = squashfs_stream_alloc(msblk);
+			if (stream)
+				return stream;
+
+			/*
+			 * Out of memory, make do with the streams we have,
+			 * at least one of which is always there.
+			 */
+			spin_lock(&pool->lock);
+			pool->max = --pool->count;
+			continue;
+		}
+
+		prepare_to_wait_exclusive(&pool->wait, &wait,
+						TASK_UNINTERRUPTIBLE);
+		spin_unlock(&pool->lock);
+		schedule();
+		spin_lock(&pool->lock);
+	}
+	finish_wait(&pool->wait, &wait);
+
+	stream = list_entry(pool->idle.next, struct squashfs_stream, list);
+	list_del(&stream->list);
+	spin_unlock(&pool->lock);
+
+	return stream;
+}
+
+
+static void put_stream(struct squashfs_stream_pool *pool,
+				struct squashfs_stream *stream)
+{
+	if (pool->percpu) {
+		mutex_unlock(&stream->mutex);
+		return;
+	}
+
+	spin_lock(&pool->lock);
+	list_add(&stream->list, &pool->idle);
+	spin_unlock(&pool->lock);
+	wake_up(&pool->wait);
+}
+
+
+/*
+ * Set up the decompressor streams of the filesystem, threads being the
+ * maximum number of streams, or 0 for one stream per possible cpu.
+ */
+int squashfs_streams_init(struct squashfs_sb_info *msblk, int threads)
+{
+	struct squashfs_stream_pool *pool;
+	struct squashfs_stream *stream;
+	int cpu;
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (pool == NULL)
+		return -ENOMEM;
+
+	spin_lock_init(&pool->lock);
+	INIT_LIST_HEAD(&pool->idle);
+	init_waitqueue_head(&pool->wait);
+	msblk->streams = pool;
+
+	if (threads == 0) {
+		pool->percpu = alloc_percpu(struct squashfs_stream);
+		if (pool->percpu == NULL)
+			goto failed;
+
+		for_each_possible_cpu(cpu) {
+			stream = per_cpu_ptr(pool->percpu, cpu);
+			mutex_init(&stream->mutex);
+			stream->stream = msblk->decompressor->init(msblk);
+			if (stream->stream == NULL)
+				goto failed;
+		}
+		return 0;
+	}
+
+	/*
+	 * Allocate the first stream now, so that there is always at least
+	 * one.  The others are allocated when they're first needed.
+	 */
+	stream = squashfs_stream_alloc(msblk);
+	if (stream == NULL)
+		goto failed;
+
+	list_add(&stream->list, &pool->idle);
+	pool->count = 1;
+	pool->max = threads;
+	return 0;
+
+failed:
+	squashfs_streams_destroy(msblk);
+	return -ENOMEM;
+}
+
+
+void squashfs_streams_destroy(struct squashfs_sb_info *msblk)
+{
+	struct squashfs_stream_pool *pool = msblk->streams;
+	struct squashfs_stream *stream, *next;
+	int cpu;
+
+	if (pool == NULL)
+		return;
+
+	if (pool->percpu) {
+		for_each_possible_cpu(cpu) {
+			stream = per_cpu_ptr(pool->percpu, cpu);
+			if (stream->stream)
+				msblk->decompressor->free(stream->stream);
+		}
+		free_percpu(pool->percpu);
+	}
+
+	list_for_each_entry_safe(stream, next, &pool->idle, list)
+		squashfs_stream_free(msblk, stream);
+
+	kfree(pool);
+	msblk->streams = NULL;
+}
+
+
+/*
+ * Decompress length bytes, starting at offset into the first of the b
+ * buffer_heads (all of which must be uptodate), into the pages of
+ * buffer, with the filesystem's decompressor.  Returns the decompressed
+ * length, or -EIO.
+ */
+int squashfs_decompress(struct squashfs_sb_info *msblk, void **buffer,
+	struct buffer_head **bh, int b, int offset, int length, int srclength,
+	int pages)
+{
+	struct squashfs_stream *stream = get_stream(msblk);
+	int res;
+
+	res = msblk->decompressor->decompress(msblk, stream->stream, buffer,
+		bh, b, offset, length, srclength, pages);
+	put_stream(msblk->streams, stream);
+
+	return res;
+}
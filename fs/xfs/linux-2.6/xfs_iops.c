@@ -620,6 +620,22 @@ xfs_vn_fallocate(
 	bf.l_len = len;
 
 	xfs_ilock(ip, XFS_IOLOCK_EXCL);
+	if (mode & FALLOC_FL_COLLAPSE_RANGE) {
+		error = xfs_collapse_file_space(ip, offset, len);
+		goto out_unlock;
+	}
+
+	/*
+	 * Punching and zeroing both start by freeing the range; zeroing
+	 * then preallocates it again as unwritten extents.
+	 */
+	if (mode & (FALLOC_FL_PUNCH_HOLE | FALLOC_FL_ZERO_RANGE)) {
+		error = xfs_change_file_space(ip, XFS_IOC_UNRESVSP, &bf,
+					      0, XFS_ATTR_NOLOCK);
+		if (error || (mode & FALLOC_FL_PUNCH_HOLE))
+			goto out_unlock;
+	}
+
 	error = xfs_change_file_space(ip, XFS_IOC_RESVSP, &bf,
 				      0, XFS_ATTR_NOLOCK);
 	if (!error && !(mode & FALLOC_FL_KEEP_SIZE) &&
@@ -635,7 +651,9 @@ xfs_vn_fallocate(
 		error = xfs_setattr(ip, &iattr, XFS_ATTR_NOLOCK);
 	}
 
+out_unlock:
 	xfs_iunlock(ip, XFS_IOLOCK_EXCL);
+	return -error;
 out_error:
 	return error;
 }
@@ -4510,6 +4510,111 @@ xfs_bmap_last_offset(
 	return 0;
 }
 
+/*
+ * Shift the data fork extents starting at file block start_fsb down by
+ * shift_fsb blocks, for collapsing a range.  [start_fsb - shift_fsb,
+ * start_fsb) must be a hole already.  At most num_exts records are
+ * moved; *next_fsb is set to where the caller should carry on, or
+ * NULLFSBLOCK once the last extent has moved.
+ */
+int						/* error */
+xfs_bmap_shift_extents(
+	xfs_trans_t		*tp,		/* transaction pointer */
+	xfs_inode_t		*ip,		/* incore inode */
+	xfs_fileoff_t		start_fsb,	/* first block to move */
+	xfs_fileoff_t		shift_fsb,	/* blocks to move down by */
+	xfs_fileoff_t		*next_fsb,	/* o: where to carry on */
+	xfs_fsblock_t		*firstblock,	/* first allocated block */
+	xfs_bmap_free_t		*flist,		/* i/o: list extents to free */
+	int			num_exts)	/* max number of extents */
+{
+	xfs_btree_cur_t		*cur = NULL;	/* btree cursor */
+	xfs_bmbt_rec_host_t	*ep;		/* extent record pointer */
+	xfs_bmbt_irec_t		got;		/* current extent */
+	xfs_extnum_t		idx;		/* extent record index */
+	xfs_extnum_t		nexts;		/* number of extents */
+	xfs_ifork_t		*ifp;		/* inode fork pointer */
+	xfs_mount_t		*mp;		/* mount structure */
+	int			error = 0;	/* error return value */
+	int			i;		/* btree lookup status */
+	int			logflags;	/* inode logging flags */
+
+	mp = ip->i_mount;
+	if (XFS_IFORK_FORMAT(ip, XFS_DATA_FORK) != XFS_DINODE_FMT_EXTENTS &&
+	    XFS_IFORK_FORMAT(ip, XFS_DATA_FORK) != XFS_DINODE_FMT_BTREE) {
+		XFS_ERROR_REPORT("xfs_bmap_shift_extents",
+				 XFS_ERRLEVEL_LOW, mp);
+		return XFS_ERROR(EFSCORRUPTED);
+	}
+	if (XFS_FORCED_SHUTDOWN(mp))
+		return XFS_ERROR(EIO);
+
+	ifp = XFS_IFORK_PTR(ip, XFS_DATA_FORK);
+	if (!(ifp->if_flags & XFS_IFEXTENTS) &&
+	    (error = xfs_iread_extents(tp, ip, XFS_DATA_FORK)))
+		return error;
+
+	*next_fsb = NULLFSBLOCK;
+	ep = xfs_iext_bno_to_ext(ifp, start_fsb, &idx);
+	if (!ep)
+		return 0;
+	nexts = ifp->if_bytes / (uint)sizeof(xfs_bmbt_rec_t);
+
+	if (ifp->if_flags & XFS_IFBROOT) {
+		cur = xfs_bmbt_init_cursor(mp, tp, ip, XFS_DATA_FORK);
+		cur->bc_private.b.firstblock = *firstblock;
+		cur->bc_private.b.flist = flist;
+		cur->bc_private.b.flags = 0;
+		logflags = XFS_ILOG_CORE;
+	} else
+		logflags = XFS_ILOG_CORE | XFS_ILOG_DEXT;
+
+	/*
+	 * Moving the extents in ascending order keeps the records sorted
+	 * all along, the hole below start_fsb being at least shift_fsb long.
+	 */
+	for (; idx < nexts && num_exts > 0; idx++, num_exts--) {
+		ep = xfs_iext_get_ext(ifp, idx);
+		xfs_bmbt_get_all(ep, &got);
+
+		/* delayed allocations must have been flushed out */
+		if (isnullstartblock(got.br_startblock) ||
+		    got.br_startoff < start_fsb) {
+			XFS_ERROR_REPORT("xfs_bmap_shift_extents",
+					 XFS_ERRLEVEL_LOW, mp);
+			error = XFS_ERROR(EFSCORRUPTED);
+			goto del_cursor;
+		}
+
+		if (cur) {
+			error = xfs_bmbt_lookup_eq(cur, got.br_startoff,
+						   got.br_startblock,
+						   got.br_blockcount, &i);
+			if (error)
+				goto del_cursor;
+			XFS_WANT_CORRUPTED_GOTO(i == 1, del_cursor);
+			error = xfs_bmbt_update(cur,
+						got.br_startoff - shift_fsb,
+						got.br_startblock,
+						got.br_blockcount,
+						got.br_state);
+			if (error)
+				goto del_cursor;
+		}
+		xfs_bmbt_set_startoff(ep, got.br_startoff - shift_fsb);
+		start_fsb = got.br_startoff + got.br_blockcount;
+	}
+	if (idx < nexts)
+		*next_fsb = start_fsb;
+
+del_cursor:
+	if (cur)
+		xfs_btree_del_cursor(cur,
+			error ? XFS_BTREE_ERROR : XFS_BTREE_NOERROR);
+	xfs_trans_log_inode(tp, ip, logflags);
+	return error;
+}
+
 /*
  * Returns whether the selected fork of the inode has exactly one
  * block or not.  For the data fork we check this matches di_size,
@@ -328,6 +328,22 @@ xfs_bunmapi(
 						   extents */
 	int			*done);		/* set if not done yet */
 
+/*
+ * Shift extents from start_fsb on down by shift_fsb blocks, moving at
+ * most num_exts of them.  *next_fsb is where to carry on, NULLFSBLOCK
+ * once done.
+ */
+int						/* error */
+xfs_bmap_shift_extents(
+	struct xfs_trans	*tp,		/* transaction pointer */
+	struct xfs_inode	*ip,		/* incore inode */
+	xfs_fileoff_t		start_fsb,	/* first block to move */
+	xfs_fileoff_t		shift_fsb,	/* blocks to move down by */
+	xfs_fileoff_t		*next_fsb,	/* o: where to carry on */
+	xfs_fsblock_t		*firstblock,	/* first allocated block */
+	xfs_bmap_free_t		*flist,		/* i/o: list extents to free */
+	int			num_exts);	/* max number of extents */
+
 /*
  * Check an extent list, which has just been read, for
  * any bit in the extent flag field.
@@ -99,13 +99,6 @@ STATIC void xlog_ungrant_log_space(xlog_t	 *log,
 				   xlog_ticket_t *ticket);
 
 
-/* local ticket functions */
-STATIC xlog_ticket_t	*xlog_ticket_alloc(xlog_t *log,
-					 int	unit_bytes,
-					 int	count,
-					 char	clientid,
-					 uint	flags);
-
 #if defined(DEBUG)
 STATIC void	xlog_verify_dest_ptr(xlog_t *log, __psint_t ptr);
 STATIC void	xlog_verify_grant_head(xlog_t *log, int equals);
@@ -404,6 +397,18 @@ _xfs_log_force(
 
 	XFS_STATS_INC(xs_log_force);
 
+	/*
+	 * With delayed logging the items to force out may still be in the
+	 * CIL, and their lsn is the sequence number of the checkpoint they
+	 * were committed to rather than a position in the log.  Push the
+	 * CIL, which also aborts it on a shut down log, then force out
+	 * everything.
+	 */
+	if (log->l_cilp) {
+		xlog_cil_push(log);
+		lsn = 0;
+	}
+
 	if (log->l_flags & XLOG_IO_ERROR)
 		return XFS_ERROR(EIO);
 	if (lsn == 0)
@@ -514,7 +519,7 @@ xfs_log_reserve(xfs_mount_t	 *mp,
 	} else {
 		/* may sleep if need to allocate more tickets */
 		internal_ticket = xlog_ticket_alloc(log, unit_bytes, cnt,
-						  client, flags);
+						client, flags, KM_SLEEP|KM_MAYFAIL);
 		if (!internal_ticket)
 			return XFS_ERROR(ENOMEM);
 		internal_ticket->t_trans_type = t_type;
@@ -567,6 +572,12 @@ xfs_log_mount(
 		goto out;
 	}
 
+	if (mp->m_flags & XFS_MOUNT_DELAYLOG) {
+		error = xlog_cil_init(mp->m_log);
+		if (error)
+			goto out_free_log;
+	}
+
 	/*
 	 * Initialize the AIL now we have a log.
 	 */
@@ -899,6 +910,10 @@ xfs_log_need_covered(xfs_mount_t *mp)
 	if (!xfs_fs_writable(mp))
 		return 0;
 
+	/* items in the CIL will go out with the next push */
+	if (log->l_cilp && !xlog_cil_empty(log))
+		return 0;
+
 	spin_lock(&log->l_icloglock);
 	if (((log->l_covered_state == XLOG_STATE_COVER_NEED) ||
 		(log->l_covered_state == XLOG_STATE_COVER_NEED2))
@@ -1602,6 +1617,9 @@ xlog_dealloc_log(xlog_t *log)
 	xlog_in_core_t	*iclog, *next_iclog;
 	int		i;
 
+	if (log->l_cilp)
+		xlog_cil_destroy(log);
+
 	iclog = log->l_iclog;
 	for (i=0; i<log->l_iclog_bufs; i++) {
 		sv_destroy(&iclog->ic_force_wait);
@@ -1714,7 +1732,9 @@ xlog_print_tic_res(xfs_mount_t *mp, xlog_ticket_t *ticket)
 	    "GROWFSRT_ALLOC",
 	    "GROWFSRT_ZERO",
 	    "GROWFSRT_FREE",
-	    "SWAPEXT"
+	    "SWAPEXT",
+	    "SB_COUNT",
+	    "CHECKPOINT"
 	};
 
 	xfs_fs_cmn_err(CE_WARN, mp,
@@ -3224,17 +3244,18 @@ xfs_log_ticket_get(
 /*
  * Allocate and initialise a new log ticket.
  */
-STATIC xlog_ticket_t *
+xlog_ticket_t *
 xlog_ticket_alloc(xlog_t		*log,
 		int		unit_bytes,
 		int		cnt,
 		char		client,
-		uint		xflags)
+		uint		xflags,
+		int		alloc_flags)
 {
 	xlog_ticket_t	*tic;
 	uint		num_headers;
 
-	tic = kmem_zone_zalloc(xfs_log_ticket_zone, KM_SLEEP|KM_MAYFAIL);
+	tic = kmem_zone_zalloc(xfs_log_ticket_zone, alloc_flags);
 	if (!tic)
 		return NULL;
 
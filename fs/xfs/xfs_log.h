@@ -135,6 +135,7 @@ typedef struct xfs_log_callback {
 /* Log manager interfaces */
 struct xfs_mount;
 struct xlog_ticket;
+struct xfs_trans;
 xfs_lsn_t xfs_log_done(struct xfs_mount *mp,
 		       xfs_log_ticket_t ticket,
 		       void		**iclog,
@@ -174,6 +175,9 @@ int	  xfs_log_unmount_write(struct xfs_mount *mp);
 void      xfs_log_unmount(struct xfs_mount *mp);
 int	  xfs_log_force_umount(struct xfs_mount *mp, int logerror);
 int	  xfs_log_need_covered(struct xfs_mount *mp);
+int	  xfs_log_commit_cil(struct xfs_mount *mp, struct xfs_trans *tp,
+			     uint flags);
+void	  xfs_log_cil_add_busy(struct xfs_mount *mp, struct xfs_trans *tp);
 
 void	  xlog_iodone(struct xfs_buf *);
 
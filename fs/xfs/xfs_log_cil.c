@@ -0,0 +1,474 @@
+/*
+ * Copyright (c) 2009 Silicon Graphics, Inc.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it would be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write the Free Software Foundation,
+ * Inc.,  51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include "xfs.h"
+#include "xfs_fs.h"
+#include "xfs_types.h"
+#include "xfs_bit.h"
+#include "xfs_log.h"
+#include "xfs_inum.h"
+#include "xfs_trans.h"
+#include "xfs_sb.h"
+#include "xfs_ag.h"
+#include "xfs_dir2.h"
+#include "xfs_dmapi.h"
+#include "xfs_mount.h"
+#include "xfs_error.h"
+#include "xfs_log_priv.h"
+#include "xfs_trans_priv.h"
+
+/*
+ * Delayed logging: the Committed Item List (CIL).  See xfs_log_priv.h for
+ * an overview.
+ */
+
+/*
+ * Allocate the ticket of a checkpoint.  It gets no log space of its own:
+ * the space is moved over from the tickets of the transactions committed
+ * into the checkpoint, starting with the overhead of the checkpoint
+ * transaction itself, which the first of them pays for.
+ */
+STATIC xlog_ticket_t *
+xlog_cil_ticket_alloc(
+	xlog_t			*log)
+{
+	xlog_ticket_t		*tic;
+
+	tic = xlog_ticket_alloc(log, 0, 1, XFS_TRANSACTION, 0,
+				KM_SLEEP|KM_NOFS);
+	tic->t_trans_type = XFS_TRANS_CHECKPOINT;
+	tic->t_curr_res = 0;
+	return tic;
+}
+
+STATIC struct xfs_cil_ctx *
+xlog_cil_ctx_alloc(
+	struct xfs_cil		*cil,
+	xfs_lsn_t		sequence)
+{
+	struct xfs_cil_ctx	*ctx;
+
+	ctx = kmem_zalloc(sizeof(*ctx), KM_SLEEP|KM_NOFS);
+	INIT_LIST_HEAD(&ctx->lv_chain);
+	INIT_LIST_HEAD(&ctx->busy_trans);
+	ctx->cil = cil;
+	ctx->sequence = sequence;
+	ctx->ticket = xlog_cil_ticket_alloc(cil->xc_log);
+	return ctx;
+}
+
+int
+xlog_cil_init(
+	xlog_t			*log)
+{
+	struct xfs_cil		*cil;
+
+	cil = kmem_zalloc(sizeof(*cil), KM_SLEEP|KM_MAYFAIL);
+	if (!cil)
+		return ENOMEM;
+
+	spin_lock_init(&cil->xc_cil_lock);
+	init_rwsem(&cil->xc_ctx_lock);
+	mutex_init(&cil->xc_push_lock);
+	cil->xc_log = log;
+	cil->xc_ctx = xlog_cil_ctx_alloc(cil, 1);
+	log->l_cilp = cil;
+	return 0;
+}
+
+/*
+ * The log has been forced out on unmount, so the current checkpoint
+ * context can only be empty.
+ */
+void
+xlog_cil_destroy(
+	xlog_t			*log)
+{
+	struct xfs_cil		*cil = log->l_cilp;
+
+	ASSERT(list_empty(&cil->xc_ctx->lv_chain));
+	ASSERT(list_empty(&cil->xc_ctx->busy_trans));
+
+	xfs_log_ticket_put(cil->xc_ctx->ticket);
+	kmem_free(cil->xc_ctx);
+	kmem_free(cil);
+	log->l_cilp = NULL;
+}
+
+/*
+ * A checkpoint needs writing if items were logged into it, or if
+ * transactions whose items went into an earlier checkpoint wait for it to
+ * release their busy extents.
+ */
+STATIC int
+xlog_cil_ctx_empty(
+	struct xfs_cil_ctx	*ctx)
+{
+	return list_empty(&ctx->lv_chain) && list_empty(&ctx->busy_trans);
+}
+
+int
+xlog_cil_empty(
+	xlog_t			*log)
+{
+	struct xfs_cil		*cil = log->l_cilp;
+	int			empty;
+
+	spin_lock(&cil->xc_cil_lock);
+	empty = xlog_cil_ctx_empty(cil->xc_ctx);
+	spin_unlock(&cil->xc_cil_lock);
+	return empty;
+}
+
+/*
+ * Log space a log vector takes up in the checkpoint, with the operation
+ * header each of its regions gets.
+ */
+static inline int
+xlog_cil_lv_space(
+	struct xfs_log_vec	*lv)
+{
+	return lv->lv_buf_len + lv->lv_niovecs * sizeof(xlog_op_header_t);
+}
+
+STATIC void
+xlog_cil_free_lv(
+	struct xfs_log_vec	*lv)
+{
+	kmem_free(lv->lv_buf);
+	kmem_free(lv->lv_iovecp);
+	kmem_free(lv);
+}
+
+/*
+ * Format a dirty item of a committing transaction into a new log vector.
+ * The regions of an item point into the item itself, so they are copied
+ * into a buffer of the log vector, which stays unchanged when the item is
+ * modified again by later transactions.
+ */
+STATIC struct xfs_log_vec *
+xlog_cil_format_item(
+	xfs_log_item_desc_t	*lidp)
+{
+	struct xfs_log_vec	*lv;
+	xfs_log_iovec_t		*vecp;
+	char			*ptr;
+	int			index;
+
+	lv = kmem_zalloc(sizeof(*lv), KM_SLEEP|KM_NOFS);
+	INIT_LIST_HEAD(&lv->lv_list);
+	lv->lv_item = lidp->lid_item;
+	lv->lv_stale = lidp->lid_flags & XFS_LID_BUF_STALE;
+
+	/*
+	 * The item may be marked dirty but not log anything.  It still
+	 * goes through the CIL, to get called when the checkpoint commits.
+	 */
+	lv->lv_niovecs = IOP_SIZE(lv->lv_item);
+	if (!lv->lv_niovecs)
+		return lv;
+
+	lv->lv_iovecp = kmem_alloc(lv->lv_niovecs * sizeof(xfs_log_iovec_t),
+				   KM_SLEEP|KM_NOFS);
+	IOP_FORMAT(lv->lv_item, lv->lv_iovecp);
+
+	for (index = 0, vecp = lv->lv_iovecp; index < lv->lv_niovecs;
+	     index++, vecp++)
+		lv->lv_buf_len += vecp->i_len;
+
+	ptr = lv->lv_buf = kmem_alloc(lv->lv_buf_len,
+				      KM_SLEEP|KM_NOFS|KM_LARGE);
+	for (index = 0, vecp = lv->lv_iovecp; index < lv->lv_niovecs;
+	     index++, vecp++) {
+		memcpy(ptr, vecp->i_addr, vecp->i_len);
+		vecp->i_addr = ptr;
+		ptr += vecp->i_len;
+	}
+	return lv;
+}
+
+/*
+ * Commit a transaction into the CIL.
+ *
+ * The dirty items are formatted first, then added to the current
+ * checkpoint, each replacing the log vector the item already had there.
+ * The replaced vector is kept, though, if it cancels a stale buffer that
+ * is now logged again, so that recovery still sees the cancellation.
+ * Items are kept in the order they first entered the checkpoint, since
+ * recovery replays them in that order and e.g. an inode buffer must be
+ * initialised before the inodes in it.
+ *
+ * The log space the checkpoint grows by is moved from the transaction's
+ * ticket to the checkpoint's, and the rest of the transaction reservation
+ * released.  The sequence number of the checkpoint is returned in
+ * tp->t_commit_lsn, forcing the log on it pushes the CIL.  The items
+ * stay locked, the caller unlocks them.
+ */
+int
+xfs_log_commit_cil(
+	struct xfs_mount	*mp,
+	struct xfs_trans	*tp,
+	uint			flags)
+{
+	xlog_t			*log = mp->m_log;
+	struct xfs_cil		*cil = log->l_cilp;
+	struct xfs_cil_ctx	*ctx;
+	xlog_ticket_t		*ticket = tp->t_ticket;
+	xfs_log_item_desc_t	*lidp;
+	struct xfs_log_vec	*lv, *old, *next;
+	LIST_HEAD		(new_lvs);
+	LIST_HEAD		(old_lvs);
+	int			len = 0;
+	int			nvecs = 0;
+	int			iclog_space;
+	int			push;
+	xfs_lsn_t		lsn;
+
+	for (lidp = xfs_trans_first_item(tp);
+	     lidp != NULL;
+	     lidp = xfs_trans_next_item(tp, lidp)) {
+		if (!(lidp->lid_flags & XFS_LID_DIRTY))
+			continue;
+		lv = xlog_cil_format_item(lidp);
+		list_add_tail(&lv->lv_list, &new_lvs);
+	}
+
+	down_read(&cil->xc_ctx_lock);
+	ctx = cil->xc_ctx;
+
+	/*
+	 * The items are locked by the transaction, and the push needs
+	 * xc_ctx_lock exclusively to detach them, so their li_lv is stable.
+	 */
+	list_for_each_entry(lv, &new_lvs, lv_list) {
+		old = lv->lv_item->li_lv;
+		if (old && old->lv_stale && !lv->lv_stale)
+			old = NULL;
+		if (!old)
+			IOP_PIN(lv->lv_item);
+		len += xlog_cil_lv_space(lv);
+		nvecs += lv->lv_niovecs;
+		if (old) {
+			len -= xlog_cil_lv_space(old);
+			nvecs -= old->lv_niovecs;
+		}
+	}
+
+	spin_lock(&cil->xc_cil_lock);
+	list_for_each_entry_safe(lv, next, &new_lvs, lv_list) {
+		old = lv->lv_item->li_lv;
+		if (old && old->lv_stale && !lv->lv_stale)
+			old = NULL;
+		if (old) {
+			list_replace(&old->lv_list, &lv->lv_list);
+			list_add(&old->lv_list, &old_lvs);
+		} else {
+			list_move_tail(&lv->lv_list, &ctx->lv_chain);
+		}
+		lv->lv_item->li_lv = lv;
+	}
+
+	/* the first commit into a checkpoint pays for its overhead */
+	if (ctx->ticket->t_curr_res == 0) {
+		ctx->ticket->t_curr_res = ctx->ticket->t_unit_res;
+		ticket->t_curr_res -= ctx->ticket->t_unit_res;
+	}
+
+	/* and for the headers of the log records the checkpoint grows into */
+	iclog_space = log->l_iclog_size - log->l_iclog_hsize;
+	if (len > 0 && (ctx->space_used / iclog_space !=
+			(ctx->space_used + len) / iclog_space)) {
+		int	hdrs;
+
+		hdrs = (len + iclog_space - 1) / iclog_space;
+		hdrs *= log->l_iclog_hsize + sizeof(xlog_op_header_t);
+		ctx->ticket->t_unit_res += hdrs;
+		ctx->ticket->t_curr_res += hdrs;
+		ticket->t_curr_res -= hdrs;
+	}
+	ticket->t_curr_res -= len;
+	ctx->ticket->t_curr_res += len;
+	ctx->ticket->t_unit_res += len;
+	ASSERT(ticket->t_curr_res >= 0);
+
+	ctx->space_used += len;
+	ctx->nvecs += nvecs;
+	push = ctx->space_used > XLOG_CIL_SPACE_LIMIT(log);
+	tp->t_commit_lsn = ctx->sequence;
+	spin_unlock(&cil->xc_cil_lock);
+	up_read(&cil->xc_ctx_lock);
+
+	list_for_each_entry_safe(lv, next, &old_lvs, lv_list)
+		xlog_cil_free_lv(lv);
+
+	/*
+	 * The ticket was never written with, so this doesn't write a commit
+	 * record, it only releases what's left of the reservation.
+	 */
+	lsn = xfs_log_done(mp, ticket, NULL, flags);
+
+	if (push)
+		xlog_cil_push(log);
+
+	if (lsn == -1)
+		return XFS_ERROR(EIO);
+	return 0;
+}
+
+/*
+ * Keep a committed transaction which freed extents until the current
+ * checkpoint has been committed to disk, which is no earlier than the
+ * checkpoint its items went into.
+ */
+void
+xfs_log_cil_add_busy(
+	struct xfs_mount	*mp,
+	struct xfs_trans	*tp)
+{
+	struct xfs_cil		*cil = mp->m_log->l_cilp;
+
+	spin_lock(&cil->xc_cil_lock);
+	list_add_tail(&tp->t_cil_busy, &cil->xc_ctx->busy_trans);
+	spin_unlock(&cil->xc_cil_lock);
+}
+
+/*
+ * Called when the commit record of a checkpoint is on disk, or when the
+ * checkpoint has been aborted.  All its items go through the commit
+ * processing a transaction's items do in xfs_trans_committed(), with the
+ * lsn of the start of the checkpoint.
+ */
+STATIC void
+xlog_cil_committed(
+	void			*args,
+	int			abort)
+{
+	struct xfs_cil_ctx	*ctx = args;
+	struct xfs_log_vec	*lv, *next;
+	struct xfs_trans	*tp, *tp_next;
+
+	list_for_each_entry_safe(lv, next, &ctx->lv_chain, lv_list) {
+		xfs_trans_item_committed(lv->lv_item, ctx->start_lsn, abort,
+					 lv->lv_stale);
+		xlog_cil_free_lv(lv);
+	}
+
+	list_for_each_entry_safe(tp, tp_next, &ctx->busy_trans, t_cil_busy) {
+		list_del(&tp->t_cil_busy);
+		xfs_trans_cil_committed(tp);
+	}
+
+	kmem_free(ctx);
+}
+
+/*
+ * Push the CIL: install a new checkpoint context for further commits, and
+ * write the items of the current one to the log as a single transaction.
+ *
+ * Pushes are serialised, so that checkpoints are written in sequence
+ * order, and so that a log force after a push finds the checkpoint in the
+ * iclogs even if the push was done by someone else.
+ */
+int
+xlog_cil_push(
+	xlog_t			*log)
+{
+	struct xfs_cil		*cil = log->l_cilp;
+	struct xfs_mount	*mp = log->l_mp;
+	struct xfs_cil_ctx	*ctx, *new_ctx;
+	struct xfs_log_vec	*lv;
+	xlog_in_core_t		*commit_iclog;
+	xfs_log_iovec_t		hdr;
+	xfs_lsn_t		commit_lsn;
+	xfs_lsn_t		lsn;
+	int			num_items = 0;
+	int			error;
+
+	mutex_lock(&cil->xc_push_lock);
+	if (xlog_cil_empty(log)) {
+		mutex_unlock(&cil->xc_push_lock);
+		return 0;
+	}
+
+	new_ctx = xlog_cil_ctx_alloc(cil, 0);
+
+	/*
+	 * Lock out commits while the items are detached from the checkpoint
+	 * and the new context installed.  The items can be logged again
+	 * into the new one as soon as we let go.
+	 */
+	down_write(&cil->xc_ctx_lock);
+	ctx = cil->xc_ctx;
+	list_for_each_entry(lv, &ctx->lv_chain, lv_list) {
+		lv->lv_item->li_lv = NULL;
+		if (lv->lv_niovecs)
+			num_items++;
+	}
+	new_ctx->sequence = ctx->sequence + 1;
+	spin_lock(&cil->xc_cil_lock);
+	cil->xc_ctx = new_ctx;
+	spin_unlock(&cil->xc_cil_lock);
+	up_write(&cil->xc_ctx_lock);
+
+	if (XLOG_FORCED_SHUTDOWN(log)) {
+		xfs_log_ticket_put(ctx->ticket);
+		goto out_abort;
+	}
+
+	ctx->header.th_magic = XFS_TRANS_HEADER_MAGIC;
+	ctx->header.th_type = XFS_TRANS_CHECKPOINT;
+	ctx->header.th_num_items = num_items;
+	hdr.i_addr = (xfs_caddr_t)&ctx->header;
+	hdr.i_len = sizeof(xfs_trans_header_t);
+	XLOG_VEC_SET_TYPE(&hdr, XLOG_REG_TYPE_TRANSHDR);
+
+	error = xfs_log_write(mp, &hdr, 1, ctx->ticket, &ctx->start_lsn);
+	list_for_each_entry(lv, &ctx->lv_chain, lv_list) {
+		if (error)
+			break;
+		if (!lv->lv_niovecs)
+			continue;
+		error = xfs_log_write(mp, lv->lv_iovecp, lv->lv_niovecs,
+				      ctx->ticket, &lsn);
+	}
+
+	/*
+	 * On a write error the log has been shut down, so this only
+	 * releases the ticket.
+	 */
+	commit_lsn = xfs_log_done(mp, ctx->ticket, (void **)&commit_iclog, 0);
+	if (error || commit_lsn == -1)
+		goto out_abort;
+
+	/*
+	 * Hang the completion of the checkpoint off the iclog of its commit
+	 * record, and let the iclog go to disk.
+	 */
+	ctx->log_cb.cb_func = xlog_cil_committed;
+	ctx->log_cb.cb_arg = ctx;
+	if (xfs_log_notify(mp, commit_iclog, &ctx->log_cb))
+		xlog_cil_committed(ctx, XFS_LI_ABORTED);
+
+	error = xfs_log_release_iclog(mp, commit_iclog);
+	mutex_unlock(&cil->xc_push_lock);
+	return error;
+
+out_abort:
+	xlog_cil_committed(ctx, XFS_LI_ABORTED);
+	mutex_unlock(&cil->xc_push_lock);
+	return XFS_ERROR(EIO);
+}
@@ -24,6 +24,7 @@ struct log;
 struct xlog_ticket;
 struct xfs_buf_cancel;
 struct xfs_mount;
+struct xfs_cil;
 
 /*
  * Macros, structures, prototypes for internal log manager use.
@@ -438,10 +439,72 @@ typedef struct log {
 	char			*l_iclog_bak[XLOG_MAX_ICLOGS];
 #endif
 
+	struct xfs_cil		*l_cilp;	/* committed item list, if
+						 * delayed logging */
 } xlog_t;
 
 #define XLOG_FORCED_SHUTDOWN(log)	((log)->l_flags & XLOG_IO_ERROR)
 
+/*
+ * Delayed logging.
+ *
+ * With delayed logging, transactions don't write their changes into the
+ * iclogs at commit time.  Instead, each dirty log item is formatted into
+ * a private log vector which is added to the Committed Item List (CIL),
+ * replacing the vector the item had there if it was already logged since
+ * the last checkpoint.  Items are pinned when they first enter the CIL,
+ * and the log space needed for their vectors is moved from the committing
+ * transaction's ticket to the ticket of the current checkpoint context.
+ *
+ * When the CIL grows too large, or the log is forced, the CIL is pushed:
+ * a new context is installed for further commits, and the items of the
+ * old one are written to the log as a single checkpoint transaction.
+ * Once its commit record is on disk, the items are inserted into the AIL
+ * and unpinned, exactly as if they had been committed by one regular
+ * transaction.
+ *
+ * The lock order is xc_push_lock -> xc_ctx_lock -> xc_cil_lock.
+ * Commits hold xc_ctx_lock shared while adding items to the current
+ * context, so the push only needs it exclusively to switch contexts.
+ */
+struct xfs_log_vec {
+	struct list_head	lv_list;	/* CIL context chain */
+	struct xfs_log_item	*lv_item;	/* owner */
+	int			lv_niovecs;	/* number of iovecs in lv */
+	struct xfs_log_iovec	*lv_iovecp;	/* iovec array */
+	char			*lv_buf;	/* formatted buffer */
+	int			lv_buf_len;	/* size of formatted buffer */
+	int			lv_stale;	/* buffer was staled */
+};
+
+struct xfs_cil_ctx {
+	struct xfs_cil		*cil;
+	xfs_lsn_t		sequence;	/* checkpoint sequence # */
+	xfs_lsn_t		start_lsn;	/* first LSN of checkpoint */
+	struct xlog_ticket	*ticket;	/* checkpoint ticket */
+	int			nvecs;		/* number of regions */
+	int			space_used;	/* aggregate size of regions */
+	struct list_head	lv_chain;	/* logged items */
+	struct list_head	busy_trans;	/* trans with busy extents */
+	struct xfs_trans_header	header;		/* checkpoint trans header */
+	xfs_log_callback_t	log_cb;		/* completion callback */
+};
+
+struct xfs_cil {
+	struct log		*xc_log;
+	spinlock_t		xc_cil_lock;	/* protects the lists */
+	struct xfs_cil_ctx	*xc_ctx;	/* current context */
+	struct rw_semaphore	xc_ctx_lock;	/* switching contexts */
+	struct mutex		xc_push_lock;	/* serialises checkpoints */
+};
+
+/*
+ * Push the CIL once the current checkpoint takes up an eighth of the log,
+ * which keeps checkpoints well clear of the space the log needs for
+ * ordinary transactions.
+ */
+#define XLOG_CIL_SPACE_LIMIT(log)	((log)->l_logsize >> 3)
+
 
 /* common routines */
 extern xfs_lsn_t xlog_assign_tail_lsn(struct xfs_mount *mp);
@@ -456,6 +519,15 @@ extern void	 xlog_recover_process_iunlinks(xlog_t *log);
 extern struct xfs_buf *xlog_get_bp(xlog_t *, int);
 extern void	 xlog_put_bp(struct xfs_buf *);
 
+extern xlog_ticket_t *xlog_ticket_alloc(xlog_t *log, int unit_bytes, int count,
+				char client, uint xflags, int alloc_flags);
+
+/* delayed logging */
+extern int	 xlog_cil_init(xlog_t *log);
+extern void	 xlog_cil_destroy(xlog_t *log);
+extern int	 xlog_cil_push(xlog_t *log);
+extern int	 xlog_cil_empty(xlog_t *log);
+
 extern kmem_zone_t	*xfs_log_ticket_zone;
 
 /* iclog tracing */
@@ -52,7 +52,9 @@ STATIC void	xfs_trans_fill_vecs(xfs_trans_t *, xfs_log_iovec_t *);
 STATIC void	xfs_trans_uncommit(xfs_trans_t *, uint);
 STATIC void	xfs_trans_committed(xfs_trans_t *, int);
 STATIC void	xfs_trans_chunk_committed(xfs_log_item_chunk_t *, xfs_lsn_t, int);
+STATIC void	xfs_trans_clear_busy(xfs_trans_t *);
 STATIC void	xfs_trans_free(xfs_trans_t *);
+STATIC int	xfs_trans_commit_cil(xfs_mount_t *, xfs_trans_t *, uint, int *);
 
 kmem_zone_t	*xfs_trans_zone;
 
@@ -839,7 +841,8 @@ shut_us_down:
 				shutdown = XFS_ERROR(EIO);
 		}
 		current_restore_flags_nested(&tp->t_pflags, PF_FSTRANS);
-		xfs_trans_free_items(tp, shutdown? XFS_TRANS_ABORT : 0);
+		xfs_trans_free_items(tp, NULLCOMMITLSN,
+				     shutdown? XFS_TRANS_ABORT : 0);
 		xfs_trans_free_busy(tp);
 		xfs_trans_free(tp);
 		XFS_STATS_INC(xs_trans_empty);
@@ -855,6 +858,9 @@ shut_us_down:
 	}
 	XFS_TRANS_APPLY_DQUOT_DELTAS(mp, tp);
 
+	if (mp->m_flags & XFS_MOUNT_DELAYLOG)
+		return xfs_trans_commit_cil(mp, tp, flags, log_flushed);
+
 	/*
 	 * Ask each log item how many log_vector entries it will
 	 * need so we can figure out how many to allocate.
@@ -996,6 +1002,70 @@ shut_us_down:
 }
 
 
+/*
+ * Commit the transaction with delayed logging.  Its dirty items are
+ * formatted into the CIL, and only get written to the log with the next
+ * checkpoint, so all that's left to do here is what's done after the log
+ * write in the normal commit path.
+ *
+ * If the transaction freed extents, they must stay busy until the
+ * checkpoint has been committed to disk, so the transaction is handed over
+ * to the CIL instead of being freed.  It doesn't count as active anymore,
+ * though.
+ */
+STATIC int
+xfs_trans_commit_cil(
+	xfs_mount_t		*mp,
+	xfs_trans_t		*tp,
+	uint			flags,
+	int			*log_flushed)
+{
+	xfs_lsn_t		commit_lsn;
+	int			log_flags;
+	int			sync;
+	int			error;
+
+	if (flags & XFS_TRANS_RELEASE_LOG_RES)
+		log_flags = XFS_LOG_REL_PERM_RESERV;
+	else
+		log_flags = 0;
+
+	error = xfs_log_commit_cil(mp, tp, log_flags);
+	commit_lsn = tp->t_commit_lsn;
+
+	xfs_trans_unreserve_and_mod_sb(tp);
+	current_restore_flags_nested(&tp->t_pflags, PF_FSTRANS);
+
+	/*
+	 * The items are in the CIL now, unlock them.  On error they have
+	 * been inserted all the same, and get aborted with the checkpoint.
+	 */
+	xfs_trans_free_items(tp, commit_lsn, 0);
+
+	sync = tp->t_flags & XFS_TRANS_SYNC;
+	if (tp->t_busy.lbc_unused) {
+		atomic_dec(&mp->m_active_trans);
+		XFS_TRANS_FREE_DQINFO(mp, tp);
+		xfs_log_cil_add_busy(mp, tp);
+	} else {
+		xfs_trans_free(tp);
+	}
+
+	if (error)
+		return error;
+
+	if (sync) {
+		error = _xfs_log_force(mp, commit_lsn,
+				       XFS_LOG_FORCE | XFS_LOG_SYNC,
+				       log_flushed);
+		XFS_STATS_INC(xs_trans_sync);
+	} else {
+		XFS_STATS_INC(xs_trans_async);
+	}
+
+	return error;
+}
+
 /*
  * Total up the number of log iovecs needed to commit this
  * transaction.  The transaction itself needs one for the
@@ -1060,7 +1130,7 @@ xfs_trans_uncommit(
 	xfs_trans_unreserve_and_mod_sb(tp);
 	XFS_TRANS_UNRESERVE_AND_MOD_DQUOTS(tp->t_mountp, tp);
 
-	xfs_trans_free_items(tp, flags);
+	xfs_trans_free_items(tp, NULLCOMMITLSN, flags);
 	xfs_trans_free_busy(tp);
 	xfs_trans_free(tp);
 }
@@ -1198,7 +1268,7 @@ xfs_trans_cancel(
 	/* mark this thread as no longer being in a transaction */
 	current_restore_flags_nested(&tp->t_pflags, PF_FSTRANS);
 
-	xfs_trans_free_items(tp, flags);
+	xfs_trans_free_items(tp, NULLCOMMITLSN, flags);
 	xfs_trans_free_busy(tp);
 	xfs_trans_free(tp);
 }
@@ -1307,9 +1377,6 @@ xfs_trans_committed(
 {
 	xfs_log_item_chunk_t	*licp;
 	xfs_log_item_chunk_t	*next_licp;
-	xfs_log_busy_chunk_t	*lbcp;
-	xfs_log_busy_slot_t	*lbsp;
-	int			i;
 
 	/*
 	 * Call the transaction's completion callback if there
@@ -1339,9 +1406,25 @@ xfs_trans_committed(
 		licp = next_licp;
 	}
 
+	xfs_trans_clear_busy(tp);
+
 	/*
-	 * Clear all the per-AG busy list items listed in this transaction
+	 * That's it for the transaction structure.  Free it.
 	 */
+	xfs_trans_free(tp);
+}
+
+/*
+ * Clear all the per-AG busy list items listed in this transaction
+ */
+STATIC void
+xfs_trans_clear_busy(
+	xfs_trans_t	*tp)
+{
+	xfs_log_busy_chunk_t	*lbcp;
+	xfs_log_busy_slot_t	*lbsp;
+	int			i;
+
 	lbcp = &tp->t_busy;
 	while (lbcp != NULL) {
 		for (i = 0, lbsp = lbcp->lbc_busy; i < lbcp->lbc_unused; i++, lbsp++) {
@@ -1353,23 +1436,29 @@ xfs_trans_committed(
 		lbcp = lbcp->lbc_next;
 	}
 	xfs_trans_free_busy(tp);
+}
 
-	/*
-	 * That's it for the transaction structure.  Free it.
-	 */
-	xfs_trans_free(tp);
+/*
+ * Called for a transaction committed with delayed logging which freed
+ * extents, once the checkpoint it went into has been committed to disk.
+ * xfs_trans_commit_cil() already did the rest of xfs_trans_free().
+ */
+void
+xfs_trans_cil_committed(
+	xfs_trans_t	*tp)
+{
+	xfs_trans_clear_busy(tp);
+	kmem_zone_free(xfs_trans_zone, tp);
 }
 
 /*
- * This is called to perform the commit processing for each
- * item described by the given chunk.
+ * Do the commit processing for a single logged item: call its committed
+ * routine, move it in the AIL if needed and unpin it.  Both the items of
+ * a transaction and the items of a delayed logging checkpoint go through
+ * here.
  *
- * The commit processing consists of unlocking items which were
- * held locked with the SYNC_UNLOCK attribute, calling the committed
- * routine of each logged item, updating the item's position in the AIL
- * if necessary, and unpinning each item.  If the committed routine
- * returns -1, then do nothing further with the item because it
- * may have been freed.
+ * If the committed routine returns -1, then do nothing further with the
+ * item because it may have been freed.
  *
  * Since items are unlocked when they are copied to the incore
  * log, it is possible for two transactions to be completing
@@ -1381,6 +1470,76 @@ xfs_trans_committed(
  * otherwise they could be immediately flushed and we'd have to race
  * with the flusher trying to pull the item from the AIL as we add it.
  */
+void
+xfs_trans_item_committed(
+	xfs_log_item_t		*lip,
+	xfs_lsn_t		lsn,
+	int			aborted,
+	int			stale)
+{
+	struct xfs_ail		*ailp;
+	xfs_lsn_t		item_lsn;
+
+	if (aborted)
+		lip->li_flags |= XFS_LI_ABORTED;
+
+	/*
+	 * Send in the ABORTED flag to the COMMITTED routine
+	 * so that it knows whether the transaction was aborted
+	 * or not.
+	 */
+	item_lsn = IOP_COMMITTED(lip, lsn);
+
+	/*
+	 * If the committed routine returns -1, make
+	 * no more references to the item.
+	 */
+	if (XFS_LSN_CMP(item_lsn, (xfs_lsn_t)-1) == 0)
+		return;
+
+	/*
+	 * If the returned lsn is greater than what it
+	 * contained before, update the location of the
+	 * item in the AIL.  If it is not, then do nothing.
+	 * Items can never move backwards in the AIL.
+	 *
+	 * While the new lsn should usually be greater, it
+	 * is possible that a later transaction completing
+	 * simultaneously with an earlier one using the
+	 * same item could complete first with a higher lsn.
+	 * This would cause the earlier transaction to fail
+	 * the test below.
+	 */
+	ailp = lip->li_ailp;
+	spin_lock(&ailp->xa_lock);
+	if (XFS_LSN_CMP(item_lsn, lip->li_lsn) > 0) {
+		/*
+		 * This will set the item's lsn to item_lsn
+		 * and update the position of the item in
+		 * the AIL.
+		 *
+		 * xfs_trans_ail_update() drops the AIL lock.
+		 */
+		xfs_trans_ail_update(ailp, lip, item_lsn);
+	} else {
+		spin_unlock(&ailp->xa_lock);
+	}
+
+	/*
+	 * Now that we've repositioned the item in the AIL,
+	 * unpin it so it can be flushed.
+	 */
+	IOP_UNPIN(lip, stale);
+}
+
+/*
+ * This is called to perform the commit processing for each
+ * item described by the given chunk.
+ *
+ * The commit processing consists of calling the committed routine
+ * of each logged item, updating the item's position in the AIL
+ * if necessary, and unpinning each item, see xfs_trans_item_committed().
+ */
 STATIC void
 xfs_trans_chunk_committed(
 	xfs_log_item_chunk_t	*licp,
@@ -1388,72 +1547,20 @@ xfs_trans_chunk_committed(
 	int			aborted)
 {
 	xfs_log_item_desc_t	*lidp;
-	xfs_log_item_t		*lip;
-	xfs_lsn_t		item_lsn;
 	int			i;
 
 	lidp = licp->lic_descs;
 	for (i = 0; i < licp->lic_unused; i++, lidp++) {
-		struct xfs_ail		*ailp;
-
 		if (xfs_lic_isfree(licp, i)) {
 			continue;
 		}
 
-		lip = lidp->lid_item;
-		if (aborted)
-			lip->li_flags |= XFS_LI_ABORTED;
-
-		/*
-		 * Send in the ABORTED flag to the COMMITTED routine
-		 * so that it knows whether the transaction was aborted
-		 * or not.
-		 */
-		item_lsn = IOP_COMMITTED(lip, lsn);
-
-		/*
-		 * If the committed routine returns -1, make
-		 * no more references to the item.
-		 */
-		if (XFS_LSN_CMP(item_lsn, (xfs_lsn_t)-1) == 0) {
-			continue;
-		}
-
-		/*
-		 * If the returned lsn is greater than what it
-		 * contained before, update the location of the
-		 * item in the AIL.  If it is not, then do nothing.
-		 * Items can never move backwards in the AIL.
-		 *
-		 * While the new lsn should usually be greater, it
-		 * is possible that a later transaction completing
-		 * simultaneously with an earlier one using the
-		 * same item could complete first with a higher lsn.
-		 * This would cause the earlier transaction to fail
-		 * the test below.
-		 */
-		ailp = lip->li_ailp;
-		spin_lock(&ailp->xa_lock);
-		if (XFS_LSN_CMP(item_lsn, lip->li_lsn) > 0) {
-			/*
-			 * This will set the item's lsn to item_lsn
-			 * and update the position of the item in
-			 * the AIL.
-			 *
-			 * xfs_trans_ail_update() drops the AIL lock.
-			 */
-			xfs_trans_ail_update(ailp, lip, item_lsn);
-		} else {
-			spin_unlock(&ailp->xa_lock);
-		}
-
 		/*
-		 * Now that we've repositioned the item in the AIL,
-		 * unpin it so it can be flushed. Pass information
-		 * about buffer stale state down from the log item
-		 * flags, if anyone else stales the buffer we do not
-		 * want to pay any attention to it.
+		 * Pass information about buffer stale state down from
+		 * the log item flags, if anyone else stales the buffer
+		 * we do not want to pay any attention to it.
 		 */
-		IOP_UNPIN(lip, lidp->lid_flags & XFS_LID_BUF_STALE);
+		xfs_trans_item_committed(lidp->lid_item, lsn, aborted,
+					 lidp->lid_flags & XFS_LID_BUF_STALE);
 	}
 }
@@ -97,7 +97,8 @@ typedef struct xfs_trans_header {
 #define	XFS_TRANS_GROWFSRT_FREE		39
 #define	XFS_TRANS_SWAPEXT		40
 #define	XFS_TRANS_SB_COUNT		41
-#define	XFS_TRANS_TYPE_MAX		41
+#define	XFS_TRANS_CHECKPOINT		42
+#define	XFS_TRANS_TYPE_MAX		42
 /* new transaction types need to be reflected in xfs_logprint(8) */
 
 /*
@@ -777,6 +778,7 @@ typedef struct xfs_log_item {
 							/* buffer item iodone */
 							/* callback func */
 	struct xfs_item_ops		*li_ops;	/* function list */
+	struct xfs_log_vec		*li_lv;		/* vector in the CIL */
 } xfs_log_item_t;
 
 #define	XFS_LI_IN_AIL	0x1
@@ -899,6 +901,7 @@ typedef struct xfs_trans {
 	unsigned int		t_busy_free;	/* busy descs free */
 	xfs_log_busy_chunk_t	t_busy;		/* busy/async free blocks */
 	unsigned long		t_pflags;	/* saved process flags state */
+	struct list_head	t_cil_busy;	/* CIL context busy list */
 } xfs_trans_t;
 
 /*
@@ -35,7 +35,8 @@ struct xfs_log_item_desc	*xfs_trans_find_item(struct xfs_trans *,
 struct xfs_log_item_desc	*xfs_trans_first_item(struct xfs_trans *);
 struct xfs_log_item_desc	*xfs_trans_next_item(struct xfs_trans *,
 					     struct xfs_log_item_desc *);
-void				xfs_trans_free_items(struct xfs_trans *, int);
+void				xfs_trans_free_items(struct xfs_trans *,
+							xfs_lsn_t, int);
 void				xfs_trans_unlock_items(struct xfs_trans *,
 							xfs_lsn_t);
 void				xfs_trans_free_busy(xfs_trans_t *tp);
@@ -43,6 +44,13 @@ xfs_log_busy_slot_t		*xfs_trans_add_busy(xfs_trans_t *tp,
 						    xfs_agnumber_t ag,
 						    xfs_extlen_t idx);
 
+/*
+ * From xfs_trans.c, for the delayed logging checkpoint completion
+ */
+void				xfs_trans_item_committed(struct xfs_log_item *,
+						xfs_lsn_t, int, int);
+void				xfs_trans_cil_committed(struct xfs_trans *);
+
 /*
  * AIL traversal cursor.
  *
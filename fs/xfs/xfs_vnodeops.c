@@ -2789,8 +2789,8 @@ xfs_zero_remaining_bytes(
  * xfs_free_file_space()
  *      This routine frees disk space for the given file.
  *
- *	This routine is only called by xfs_change_file_space
- *	for an UNRESVSP type call.
+ *	This routine is called by xfs_change_file_space for an
+ *	UNRESVSP type call, and by xfs_collapse_file_space.
  *
  * RETURNS:
  *       0 on success
@@ -2999,6 +2999,116 @@ xfs_free_file_space(
 	return error;
 }
 
+/*
+ * xfs_collapse_file_space()
+ *	This routine removes [offset, offset + len) from the file and
+ *	shifts everything above it down, shrinking the file by len.
+ *	Both offset and len must be filesystem block aligned.
+ *
+ *	The caller holds the iolock exclusively.
+ *
+ * RETURNS:
+ *       0 on success
+ *      errno on error
+ *
+ */
+int
+xfs_collapse_file_space(
+	xfs_inode_t		*ip,
+	xfs_off_t		offset,
+	xfs_off_t		len)
+{
+	xfs_mount_t		*mp = ip->i_mount;
+	xfs_trans_t		*tp;
+	xfs_bmap_free_t		free_list;
+	xfs_fsblock_t		firstfsb;
+	xfs_fileoff_t		start_fsb;
+	xfs_fileoff_t		shift_fsb;
+	struct iattr		iattr;
+	int			committed;
+	int			error;
+
+	ASSERT(xfs_isilocked(ip, XFS_IOLOCK_EXCL));
+	xfs_itrace_entry(ip);
+
+	if ((offset | len) & mp->m_blockmask)
+		return XFS_ERROR(EINVAL);
+
+	/*
+	 * The VFS checked this without the iolock, so a truncate may have
+	 * moved EOF since.
+	 */
+	if (offset + len >= ip->i_size)
+		return XFS_ERROR(EINVAL);
+
+	start_fsb = XFS_B_TO_FSB(mp, offset + len);
+	shift_fsb = XFS_B_TO_FSB(mp, len);
+
+	error = xfs_free_file_space(ip, offset, len, XFS_ATTR_NOLOCK);
+	if (error)
+		return error;
+
+	/*
+	 * Everything above the hole is about to move: write it back so no
+	 * delayed allocation is left, and drop the cached pages, which
+	 * would otherwise be found at their old offsets.  Preallocation
+	 * past EOF would end up inside the file once shifted, so trim it.
+	 */
+	xfs_inval_cached_trace(ip, offset, -1, offset, -1);
+	error = xfs_flushinval_pages(ip, offset, -1, FI_REMAPF_LOCKED);
+	if (error)
+		return error;
+	error = xfs_free_eofblocks(mp, ip, 0);
+	if (error)
+		return error;
+
+	while (start_fsb != NULLFSBLOCK) {
+		tp = xfs_trans_alloc(mp, XFS_TRANS_DIOSTRAT);
+		error = xfs_trans_reserve(tp, 0, XFS_WRITE_LOG_RES(mp), 0,
+					  XFS_TRANS_PERM_LOG_RES,
+					  XFS_WRITE_LOG_COUNT);
+		if (error) {
+			ASSERT(error == ENOSPC || XFS_FORCED_SHUTDOWN(mp));
+			xfs_trans_cancel(tp, 0);
+			return error;
+		}
+
+		xfs_ilock(ip, XFS_ILOCK_EXCL);
+		xfs_trans_ijoin(tp, ip, XFS_ILOCK_EXCL);
+		xfs_trans_ihold(tp, ip);
+
+		/*
+		 * Shift a couple of extents at a time so that a large file
+		 * does not overrun the log reservation.
+		 */
+		xfs_bmap_init(&free_list, &firstfsb);
+		error = xfs_bmap_shift_extents(tp, ip, start_fsb, shift_fsb,
+					       &start_fsb, &firstfsb,
+					       &free_list, 2);
+		if (error)
+			goto error0;
+
+		error = xfs_bmap_finish(&tp, &free_list, &committed);
+		if (error)
+			goto error0;
+
+		error = xfs_trans_commit(tp, XFS_TRANS_RELEASE_LOG_RES);
+		xfs_iunlock(ip, XFS_ILOCK_EXCL);
+		if (error)
+			return error;
+	}
+
+	iattr.ia_valid = ATTR_SIZE;
+	iattr.ia_size = ip->i_size - len;
+	return xfs_setattr(ip, &iattr, XFS_ATTR_NOLOCK);
+
+ error0:
+	xfs_bmap_cancel(&free_list);
+	xfs_trans_cancel(tp, XFS_TRANS_RELEASE_LOG_RES | XFS_TRANS_ABORT);
+	xfs_iunlock(ip, XFS_ILOCK_EXCL);
+	return error;
+}
+
 /*
  * xfs_change_file_space()
  *      This routine allocates or frees disk space for the given file.
@@ -83,6 +83,11 @@ struct kioctx;
  * discouraged.  In either case, kick_iocb() must be called once and only
  * once.  ki_retry must ensure forward progress, the AIO core will wait
  * indefinitely for kick_iocb() to be called.
+ *
+ * The generic helpers (lock_page_async(), congestion_wait_async()) record
+ * what they queued ki_wait on in ki_wait.key; a non-NULL ki_wait.key.flags
+ * after ki_retry returns means a kick is pending and the retry must not be
+ * completed yet.
  */
 struct kiocb {
 	struct list_head	ki_run_list;
@@ -102,7 +107,7 @@ struct kiocb {
 	} ki_obj;
 
 	__u64			ki_user_data;	/* user's data for completion */
-	wait_queue_t		ki_wait;
+	struct wait_bit_queue	ki_wait;
 	loff_t			ki_pos;
 
 	void			*private;
@@ -127,6 +132,7 @@ struct kiocb {
 };
 
 #define is_sync_kiocb(iocb)	((iocb)->ki_key == KIOCB_SYNC_KEY)
+#define kiocbIsWaiting(iocb)	((iocb)->ki_wait.key.flags != NULL)
 #define init_sync_kiocb(x, filp)			\
 	do {						\
 		struct task_struct *tsk = current;	\
@@ -140,7 +146,8 @@ struct kiocb {
 		(x)->ki_dtor = NULL;			\
 		(x)->ki_obj.tsk = tsk;			\
 		(x)->ki_user_data = 0;                  \
-		init_wait((&(x)->ki_wait));             \
+		init_wait((&(x)->ki_wait.wait));        \
+		(x)->ki_wait.key.flags = NULL;          \
 	} while (0)
 
 #define AIO_RING_MAGIC			0xa10a10a1
@@ -223,7 +230,7 @@ struct mm_struct;
 static inline void exit_aio(struct mm_struct *mm) { }
 #endif /* CONFIG_AIO */
 
-#define io_wait_to_kiocb(wait) container_of(wait, struct kiocb, ki_wait)
+#define io_wait_to_kiocb(wait) container_of(wait, struct kiocb, ki_wait.wait)
 
 #include <linux/aio_abi.h>
 
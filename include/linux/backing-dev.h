@@ -34,6 +34,11 @@ typedef int (congested_fn)(void *, int);
 enum bdi_stat_item {
 	BDI_RECLAIMABLE,
 	BDI_WRITEBACK,
+	BDI_RA_HIT,		/* reads which reached a readahead marker */
+	BDI_RA_MISS,		/* reads which missed the page cache */
+	BDI_RA_LATE,		/* readahead still in flight at the marker */
+	BDI_RA_THRASH,		/* readahead pages evicted before use */
+	BDI_RA_PAGES,		/* pages read by readahead */
 	NR_BDI_STAT_ITEMS
 };
 
@@ -41,6 +46,7 @@ enum bdi_stat_item {
 
 struct backing_dev_info {
 	unsigned long ra_pages;	/* max readahead in PAGE_CACHE_SIZE units */
+	unsigned long ra_max_pages; /* limit for adaptive readahead windows */
 	unsigned long state;	/* Always use atomic bitops on this */
 	unsigned int capabilities; /* Device capabilities */
 	congested_fn *congested_fn; /* Function pointer if device is md/dm */
@@ -232,6 +238,9 @@ static inline int bdi_rw_congested(struct backing_dev_info *bdi)
 void clear_bdi_congested(struct backing_dev_info *bdi, int rw);
 void set_bdi_congested(struct backing_dev_info *bdi, int rw);
 long congestion_wait(int rw, long timeout);
+struct wait_bit_queue;
+int congestion_wait_async(struct backing_dev_info *bdi,
+			  struct wait_bit_queue *wait);
 
 
 static inline bool bdi_cap_writeback_dirty(struct backing_dev_info *bdi)
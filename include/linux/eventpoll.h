@@ -49,6 +49,21 @@ struct epoll_event {
 	__u64 data;
 } EPOLL_PACKED;
 
+/*
+ * Layout of the event ring that can be mmap()ed on an epoll file descriptor,
+ * and that is filled by sys_epoll_wait_ring(). The kernel stores events at
+ * "tail" and then advances it, userspace consumes events at "head" and then
+ * advances it. Both indexes are free running, and are masked with
+ * "nr_events" - 1 (a power of two) to obtain a slot.
+ */
+struct epoll_ring {
+	__u32 head;
+	__u32 tail;
+	__u32 nr_events;
+	__u32 flags;
+	struct epoll_event events[0];
+};
+
 #ifdef __KERNEL__
 
 /* Forward declarations to avoid compiler errors */
@@ -2,5 +2,21 @@
 #define _FALLOC_H_
 
 #define FALLOC_FL_KEEP_SIZE	0x01 /* default is extend size */
+#define FALLOC_FL_PUNCH_HOLE	0x02 /* de-allocates range */
+
+/*
+ * FALLOC_FL_COLLAPSE_RANGE removes the range from the file and shifts
+ * the data after it down, the file shrinking by len.  Offset and len
+ * must be multiples of the filesystem block size, and the range must
+ * end before EOF.  It cannot be combined with other flags.
+ */
+#define FALLOC_FL_COLLAPSE_RANGE	0x08
+
+/*
+ * FALLOC_FL_ZERO_RANGE makes the range read back as zeroes, with blocks
+ * preallocated for it.  The file size grows to offset + len unless
+ * FALLOC_FL_KEEP_SIZE is given too.
+ */
+#define FALLOC_FL_ZERO_RANGE	0x10
 
 #endif /* _FALLOC_H_ */
@@ -0,0 +1,74 @@
+#ifndef _LINUX_FANOTIFY_H
+#define _LINUX_FANOTIFY_H
+
+/*
+ * fanotify - filesystem wide access notification
+ *
+ * Unlike inotify, fanotify reports events with an open file descriptor for
+ * the object instead of a watch descriptor and a name, and a single mark
+ * can watch every file on a mount.
+ */
+
+#include <linux/types.h>
+
+/* For O_CLOEXEC and O_NONBLOCK */
+#include <linux/fcntl.h>
+
+/* the following are legal, implemented events that user-space can watch for */
+#define FAN_ACCESS		0x00000001	/* File was accessed */
+#define FAN_MODIFY		0x00000002	/* File was modified */
+#define FAN_CLOSE_WRITE		0x00000008	/* Writtable file closed */
+#define FAN_CLOSE_NOWRITE	0x00000010	/* Unwrittable file closed */
+#define FAN_OPEN		0x00000020	/* File was opened */
+
+/* the following are legal events.  they are sent as needed to any watch */
+#define FAN_Q_OVERFLOW		0x00004000	/* Event queued overflowed */
+
+/* helper events */
+#define FAN_CLOSE		(FAN_CLOSE_WRITE | FAN_CLOSE_NOWRITE) /* close */
+
+#define FAN_ALL_EVENTS		(FAN_ACCESS | FAN_MODIFY | FAN_CLOSE | \
+				 FAN_OPEN)
+
+/* flags for fanotify_init() */
+#define FAN_CLOEXEC		O_CLOEXEC
+#define FAN_NONBLOCK		O_NONBLOCK
+
+/* flags for fanotify_mark() */
+#define FAN_MARK_ADD		0x00000001	/* add events to a mark */
+#define FAN_MARK_REMOVE		0x00000002	/* remove events from a mark */
+#define FAN_MARK_DONT_FOLLOW	0x00000004	/* don't follow a sym link */
+#define FAN_MARK_ONLYDIR	0x00000008	/* only watch the path if it is a directory */
+#define FAN_MARK_MOUNT		0x00000010	/* mark the whole mount of the path */
+#define FAN_MARK_FLUSH		0x00000080	/* remove all marks of the group */
+
+/*
+ * struct fanotify_event_metadata - what read() returns for every event
+ *
+ * fd is a file descriptor for the object, opened with the event_f_flags
+ * given to fanotify_init(), or FAN_NOFD for FAN_Q_OVERFLOW.  The reader is
+ * responsible for closing it.  Identical events on a file are coalesced
+ * while queued, so mask can have more than one event set.
+ */
+struct fanotify_event_metadata {
+	__u32	event_len;	/* length of this record, including metadata */
+	__u32	vers;		/* FANOTIFY_METADATA_VERSION */
+	__u32	mask;		/* the events */
+	__s32	fd;		/* open file descriptor for the object */
+	__s32	pid;		/* process which caused the event */
+};
+
+#define FANOTIFY_METADATA_VERSION	1
+#define FAN_EVENT_METADATA_LEN		(sizeof(struct fanotify_event_metadata))
+#define FAN_NOFD			-1
+
+#ifdef __KERNEL__
+
+#define FAN_ALL_INIT_FLAGS	(FAN_CLOEXEC | FAN_NONBLOCK)
+#define FAN_ALL_MARK_FLAGS	(FAN_MARK_ADD | FAN_MARK_REMOVE | \
+				 FAN_MARK_DONT_FOLLOW | FAN_MARK_ONLYDIR | \
+				 FAN_MARK_MOUNT | FAN_MARK_FLUSH)
+
+#endif /* __KERNEL__ */
+
+#endif /* _LINUX_FANOTIFY_H */
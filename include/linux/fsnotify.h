@@ -3,7 +3,8 @@
 
 /*
  * include/linux/fsnotify.h - generic hooks for filesystem notification, to
- * reduce in-source duplication from both dnotify and inotify.
+ * reduce in-source duplication from dnotify, inotify and the fsnotify
+ * backend.
  *
  * We don't compile any of this away in some complicated menagerie of ifdefs.
  * Instead, we rely on the code inside to optimize away as needed.
@@ -13,6 +14,7 @@
 
 #include <linux/dnotify.h>
 #include <linux/inotify.h>
+#include <linux/fsnotify_backend.h>
 #include <linux/audit.h>
 
 /*
@@ -57,14 +59,19 @@ static inline void fsnotify_move(struct inode *old_dir, struct inode *new_dir,
 				  source);
 	inotify_inode_queue_event(new_dir, IN_MOVED_TO|isdir, cookie, new_name,
 				  source);
+	fsnotify(old_dir, FS_MOVED_FROM, old_dir, FSNOTIFY_EVENT_INODE);
+	fsnotify(new_dir, FS_MOVED_TO, new_dir, FSNOTIFY_EVENT_INODE);
 
 	if (target) {
 		inotify_inode_queue_event(target, IN_DELETE_SELF, 0, NULL, NULL);
 		inotify_inode_is_dead(target);
+		fsnotify(target, FS_DELETE_SELF, target, FSNOTIFY_EVENT_INODE);
+		__fsnotify_inode_delete(target);
 	}
 
 	if (source) {
 		inotify_inode_queue_event(source, IN_MOVE_SELF, 0, NULL, NULL);
+		fsnotify(source, FS_MOVE_SELF, source, FSNOTIFY_EVENT_INODE);
 	}
 	audit_inode_child(new_name, moved, new_dir);
 }
@@ -78,6 +85,8 @@ static inline void fsnotify_nameremove(struct dentry *dentry, int isdir)
 		isdir = IN_ISDIR;
 	dnotify_parent(dentry, DN_DELETE);
 	inotify_dentry_parent_queue_event(dentry, IN_DELETE|isdir, 0, dentry->d_name.name);
+	fsnotify(dentry->d_parent->d_inode, FS_DELETE,
+		 dentry->d_parent->d_inode, FSNOTIFY_EVENT_INODE);
 }
 
 /*
@@ -87,6 +96,8 @@ static inline void fsnotify_inoderemove(struct inode *inode)
 {
 	inotify_inode_queue_event(inode, IN_DELETE_SELF, 0, NULL, NULL);
 	inotify_inode_is_dead(inode);
+	fsnotify(inode, FS_DELETE_SELF, inode, FSNOTIFY_EVENT_INODE);
+	__fsnotify_inode_delete(inode);
 }
 
 /*
@@ -95,6 +106,7 @@ static inline void fsnotify_inoderemove(struct inode *inode)
 static inline void fsnotify_link_count(struct inode *inode)
 {
 	inotify_inode_queue_event(inode, IN_ATTRIB, 0, NULL, NULL);
+	fsnotify(inode, FS_ATTRIB, inode, FSNOTIFY_EVENT_INODE);
 }
 
 /*
@@ -105,6 +117,7 @@ static inline void fsnotify_create(struct inode *inode, struct dentry *dentry)
 	inode_dir_notify(inode, DN_CREATE);
 	inotify_inode_queue_event(inode, IN_CREATE, 0, dentry->d_name.name,
 				  dentry->d_inode);
+	fsnotify(inode, FS_CREATE, inode, FSNOTIFY_EVENT_INODE);
 	audit_inode_child(dentry->d_name.name, dentry, inode);
 }
 
@@ -118,6 +131,7 @@ static inline void fsnotify_link(struct inode *dir, struct inode *inode, struct
 	inode_dir_notify(dir, DN_CREATE);
 	inotify_inode_queue_event(dir, IN_CREATE, 0, new_dentry->d_name.name,
 				  inode);
+	fsnotify(dir, FS_CREATE, dir, FSNOTIFY_EVENT_INODE);
 	fsnotify_link_count(inode);
 	audit_inode_child(new_dentry->d_name.name, new_dentry, dir);
 }
@@ -130,14 +144,16 @@ static inline void fsnotify_mkdir(struct inode *inode, struct dentry *dentry)
 	inode_dir_notify(inode, DN_CREATE);
 	inotify_inode_queue_event(inode, IN_CREATE | IN_ISDIR, 0, 
 				  dentry->d_name.name, dentry->d_inode);
+	fsnotify(inode, FS_CREATE, inode, FSNOTIFY_EVENT_INODE);
 	audit_inode_child(dentry->d_name.name, dentry, inode);
 }
 
 /*
  * fsnotify_access - file was read
  */
-static inline void fsnotify_access(struct dentry *dentry)
+static inline void fsnotify_access(struct file *file)
 {
+	struct dentry *dentry = file->f_path.dentry;
 	struct inode *inode = dentry->d_inode;
 	u32 mask = IN_ACCESS;
 
@@ -147,13 +163,16 @@ static inline void fsnotify_access(struct dentry *dentry)
 	dnotify_parent(dentry, DN_ACCESS);
 	inotify_dentry_parent_queue_event(dentry, mask, 0, dentry->d_name.name);
 	inotify_inode_queue_event(inode, mask, 0, NULL, NULL);
+	if (!(file->f_mode & FMODE_NONOTIFY))
+		fsnotify(inode, FS_ACCESS, &file->f_path, FSNOTIFY_EVENT_PATH);
 }
 
 /*
  * fsnotify_modify - file was modified
  */
-static inline void fsnotify_modify(struct dentry *dentry)
+static inline void fsnotify_modify(struct file *file)
 {
+	struct dentry *dentry = file->f_path.dentry;
 	struct inode *inode = dentry->d_inode;
 	u32 mask = IN_MODIFY;
 
@@ -163,13 +182,16 @@ static inline void fsnotify_modify(struct dentry *dentry)
 	dnotify_parent(dentry, DN_MODIFY);
 	inotify_dentry_parent_queue_event(dentry, mask, 0, dentry->d_name.name);
 	inotify_inode_queue_event(inode, mask, 0, NULL, NULL);
+	if (!(file->f_mode & FMODE_NONOTIFY))
+		fsnotify(inode, FS_MODIFY, &file->f_path, FSNOTIFY_EVENT_PATH);
 }
 
 /*
  * fsnotify_open - file was opened
  */
-static inline void fsnotify_open(struct dentry *dentry)
+static inline void fsnotify_open(struct file *file)
 {
+	struct dentry *dentry = file->f_path.dentry;
 	struct inode *inode = dentry->d_inode;
 	u32 mask = IN_OPEN;
 
@@ -178,6 +200,8 @@ static inline void fsnotify_open(struct dentry *dentry)
 
 	inotify_dentry_parent_queue_event(dentry, mask, 0, dentry->d_name.name);
 	inotify_inode_queue_event(inode, mask, 0, NULL, NULL);
+	if (!(file->f_mode & FMODE_NONOTIFY))
+		fsnotify(inode, FS_OPEN, &file->f_path, FSNOTIFY_EVENT_PATH);
 }
 
 /*
@@ -196,6 +220,9 @@ static inline void fsnotify_close(struct file *file)
 
 	inotify_dentry_parent_queue_event(dentry, mask, 0, name);
 	inotify_inode_queue_event(inode, mask, 0, NULL, NULL);
+	if (!(mode & FMODE_NONOTIFY))
+		fsnotify(inode, mask & FS_CLOSE, &file->f_path,
+			 FSNOTIFY_EVENT_PATH);
 }
 
 /*
@@ -211,6 +238,7 @@ static inline void fsnotify_xattr(struct dentry *dentry)
 
 	inotify_dentry_parent_queue_event(dentry, mask, 0, dentry->d_name.name);
 	inotify_inode_queue_event(inode, mask, 0, NULL, NULL);
+	fsnotify(inode, FS_ATTRIB, inode, FSNOTIFY_EVENT_INODE);
 }
 
 /*
@@ -255,6 +283,7 @@ static inline void fsnotify_change(struct dentry *dentry, unsigned int ia_valid)
 	if (dn_mask)
 		dnotify_parent(dentry, dn_mask);
 	if (in_mask) {
+		fsnotify(inode, in_mask, inode, FSNOTIFY_EVENT_INODE);
 		if (S_ISDIR(inode->i_mode))
 			in_mask |= IN_ISDIR;
 		inotify_inode_queue_event(inode, in_mask, 0, NULL, NULL);
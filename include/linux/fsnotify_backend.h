@@ -0,0 +1,186 @@
+/*
+ * Filesystem access notification backend for Linux
+ *
+ * A notification group (fsnotify_group) is the kernel side of a listener.
+ * A group attaches marks (fsnotify_mark) to the objects it is interested
+ * in, either a single inode or a whole vfsmount, and the hooks in
+ * <linux/fsnotify.h> deliver events to the groups whose marks match.
+ * Every group has its own queue of events, in which identical events are
+ * coalesced.
+ */
+
+#ifndef __LINUX_FSNOTIFY_BACKEND_H
+#define __LINUX_FSNOTIFY_BACKEND_H
+
+#ifdef __KERNEL__
+
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/path.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+#include <linux/wait.h>
+
+/*
+ * Events a mark can be interested in.  The values are shared with inotify,
+ * so that the hooks can hand the same mask to both.
+ */
+#define FS_ACCESS		0x00000001	/* File was accessed */
+#define FS_MODIFY		0x00000002	/* File was modified */
+#define FS_ATTRIB		0x00000004	/* Metadata changed */
+#define FS_CLOSE_WRITE		0x00000008	/* Writtable file was closed */
+#define FS_CLOSE_NOWRITE	0x00000010	/* Unwrittable file closed */
+#define FS_OPEN			0x00000020	/* File was opened */
+#define FS_MOVED_FROM		0x00000040	/* File was moved from X */
+#define FS_MOVED_TO		0x00000080	/* File was moved to Y */
+#define FS_CREATE		0x00000100	/* Subfile was created */
+#define FS_DELETE		0x00000200	/* Subfile was deleted */
+#define FS_DELETE_SELF		0x00000400	/* Self was deleted */
+#define FS_MOVE_SELF		0x00000800	/* Self was moved */
+
+#define FS_Q_OVERFLOW		0x00004000	/* Event queued overflowed */
+
+#define FS_CLOSE		(FS_CLOSE_WRITE | FS_CLOSE_NOWRITE)
+
+/* what the data argument of fsnotify() points to */
+#define FSNOTIFY_EVENT_NONE	0
+#define FSNOTIFY_EVENT_PATH	1
+#define FSNOTIFY_EVENT_INODE	2
+
+/* at most this many queued events are looked at for coalescing */
+#define FSNOTIFY_MERGE_DEPTH	128
+
+struct fsnotify_group;
+struct fsnotify_event;
+struct fsnotify_mark;
+
+/*
+ * struct fsnotify_ops - what a listener implements
+ *
+ * should_send_event: decide whether an event seen through one of the
+ *	group's marks should be queued at all.  Must not sleep.
+ * merge: try to fold a new event into an already queued one, returning
+ *	1 if it did.  Called with the group's notification_mutex held.
+ * free_group_priv: release listener private data of a group being freed.
+ */
+struct fsnotify_ops {
+	int (*should_send_event)(struct fsnotify_group *group,
+				 struct fsnotify_mark *mark, __u32 mask,
+				 void *data, int data_is);
+	int (*merge)(struct fsnotify_event *old, struct fsnotify_event *new);
+	void (*free_group_priv)(struct fsnotify_group *group);
+};
+
+/*
+ * struct fsnotify_group - a listener, and the queue of events for it
+ *
+ * Groups are only reachable from the hooks through their marks, so a group
+ * can be freed once all of its marks are gone.
+ */
+struct fsnotify_group {
+	const struct fsnotify_ops *ops;
+
+	struct mutex notification_mutex;	/* protects the list below */
+	struct list_head notification_list;	/* events waiting for the reader */
+	wait_queue_head_t notification_waitq;	/* the reader sleeps here */
+	unsigned int q_len;			/* events on the list */
+	unsigned int max_events;		/* maximum events allowed */
+
+	struct list_head marks_list;		/* all marks of this group */
+	unsigned int nr_marks;			/* protected by fsnotify_mark_lock */
+
+	void *private;				/* listener private data */
+};
+
+/*
+ * struct fsnotify_mark - a group's interest in an inode or a vfsmount
+ *
+ * An inode mark pins its inode until it is destroyed.  A vfsmount mark does
+ * not pin the vfsmount; it is destroyed when the vfsmount is released, and
+ * inode marks are destroyed when their superblock is unmounted.  Marks are
+ * found by the hooks under SRCU, and only freed after a grace period.
+ */
+struct fsnotify_mark {
+	__u32 mask;			/* events this mark is interested in */
+	struct fsnotify_group *group;
+	struct inode *inode;		/* NULL for a vfsmount mark */
+	struct vfsmount *mnt;		/* NULL for an inode mark */
+	struct list_head obj_list;	/* on the inode's or vfsmount's list */
+	struct list_head g_list;	/* on group->marks_list */
+};
+
+/*
+ * struct fsnotify_event - an event queued to one group
+ *
+ * For FSNOTIFY_EVENT_PATH events, path is held so the listener can open
+ * the object.  inode identifies the object for coalescing, and is pinned
+ * either through path or by its own reference.
+ */
+struct fsnotify_event {
+	struct list_head list;
+	struct inode *inode;
+	struct path path;
+	__u32 mask;
+	struct pid *tgid;		/* thread group which caused the event */
+};
+
+/* called from the hooks in linux/fsnotify.h */
+#ifdef CONFIG_FSNOTIFY
+
+extern void fsnotify(struct inode *to_tell, __u32 mask, void *data,
+		     int data_is);
+extern void __fsnotify_inode_delete(struct inode *inode);
+extern void __fsnotify_vfsmount_delete(struct vfsmount *mnt);
+extern void fsnotify_unmount_inodes(struct list_head *list);
+
+#else
+
+static inline void fsnotify(struct inode *to_tell, __u32 mask, void *data,
+			    int data_is)
+{}
+
+static inline void __fsnotify_inode_delete(struct inode *inode)
+{}
+
+static inline void __fsnotify_vfsmount_delete(struct vfsmount *mnt)
+{}
+
+static inline void fsnotify_unmount_inodes(struct list_head *list)
+{}
+
+#endif /* CONFIG_FSNOTIFY */
+
+#ifdef CONFIG_FSNOTIFY
+
+/* group.c */
+extern struct fsnotify_group *fsnotify_alloc_group(
+				const struct fsnotify_ops *ops,
+				unsigned int max_events);
+extern void fsnotify_destroy_group(struct fsnotify_group *group);
+
+/* mark.c */
+extern int fsnotify_add_mark(struct fsnotify_group *group, __u32 mask,
+				struct inode *inode, struct vfsmount *mnt,
+				unsigned int max_marks);
+extern int fsnotify_remove_mark(struct fsnotify_group *group, __u32 mask,
+				struct inode *inode, struct vfsmount *mnt);
+extern void fsnotify_clear_marks_by_group(struct fsnotify_group *group);
+
+/* notification.c */
+extern struct fsnotify_event *fsnotify_create_event(__u32 mask, void *data,
+				int data_is);
+extern void fsnotify_destroy_event(struct fsnotify_event *event);
+extern void fsnotify_add_notify_event(struct fsnotify_group *group,
+				struct fsnotify_event *event);
+extern int fsnotify_notify_queue_is_empty(struct fsnotify_group *group);
+extern struct fsnotify_event *fsnotify_peek_notify_event(
+				struct fsnotify_group *group);
+extern struct fsnotify_event *fsnotify_remove_notify_event(
+				struct fsnotify_group *group);
+extern void fsnotify_flush_notify(struct fsnotify_group *group);
+
+#endif /* CONFIG_FSNOTIFY */
+
+#endif /* __KERNEL__ */
+
+#endif /* __LINUX_FSNOTIFY_BACKEND_H */
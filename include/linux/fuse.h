@@ -112,6 +112,9 @@ struct fuse_file_lock {
  * INIT request/reply flags
  *
  * FUSE_EXPORT_SUPPORT: filesystem handles lookups of "." and ".."
+ * FUSE_WRITEBACK_CACHE: use writeback cache for buffered writes.  The
+ * kernel then keeps the file size and mtime of regular files, and
+ * sends them to the filesystem with the writes and SETATTR.
  */
 #define FUSE_ASYNC_READ		(1 << 0)
 #define FUSE_POSIX_LOCKS	(1 << 1)
@@ -119,6 +122,7 @@ struct fuse_file_lock {
 #define FUSE_ATOMIC_O_TRUNC	(1 << 3)
 #define FUSE_EXPORT_SUPPORT	(1 << 4)
 #define FUSE_BIG_WRITES		(1 << 5)
+#define FUSE_WRITEBACK_CACHE	(1 << 16)
 
 /**
  * Release flags
@@ -0,0 +1,134 @@
+/*
+ * include/linux/io_ring.h
+ *
+ * Shared submission/completion ring interface for asynchronous I/O.
+ *
+ * Distribute under the terms of the GPLv2 (see ../../COPYING).
+ */
+#ifndef _LINUX_IO_RING_H
+#define _LINUX_IO_RING_H
+
+#include <linux/types.h>
+
+/*
+ * I/O submission queue entry, filled by the application inside the array
+ * mapped at IORING_OFF_SQES, and referenced by index from the SQ ring.
+ */
+struct io_ring_sqe {
+	__u8	opcode;		/* type of operation for this sqe */
+	__u8	flags;		/* IOSQE_ flags */
+	__u16	buf_index;	/* index into fixed buffers, if used */
+	__s32	fd;		/* file descriptor, or fixed file index */
+	__u64	off;		/* offset into file */
+	__u64	addr;		/* buffer, or accept: peer address */
+	__u32	len;		/* buffer size */
+	union {
+		__u32	fsync_flags;
+		__u32	poll_events;
+		__u32	accept_flags;
+	};
+	__u64	user_data;	/* data to be passed back at completion time */
+	__u64	addr2;		/* accept: peer address length */
+	__u64	__pad[2];
+};
+
+/*
+ * sqe->flags
+ */
+#define IOSQE_FIXED_FILE	(1U << 0)	/* use fixed fileset */
+
+/*
+ * io_ring_setup() flags
+ */
+#define IORING_SETUP_SQPOLL	(1U << 0)	/* kernel side polling */
+
+enum {
+	IORING_OP_NOP,
+	IORING_OP_READ,
+	IORING_OP_WRITE,
+	IORING_OP_READ_FIXED,
+	IORING_OP_WRITE_FIXED,
+	IORING_OP_FSYNC,
+	IORING_OP_POLL_ADD,
+	IORING_OP_ACCEPT,
+};
+
+/*
+ * sqe->fsync_flags
+ */
+#define IORING_FSYNC_DATASYNC	(1U << 0)
+
+/*
+ * IO completion data structure (Completion Queue Entry)
+ */
+struct io_ring_cqe {
+	__u64	user_data;	/* sqe->user_data submission passed back */
+	__s32	res;		/* result code for this event */
+	__u32	flags;
+};
+
+/*
+ * Magic offsets for the application to mmap the data it needs
+ */
+#define IORING_OFF_SQ_RING	0ULL
+#define IORING_OFF_CQ_RING	0x8000000ULL
+#define IORING_OFF_SQES		0x10000000ULL
+
+/*
+ * Filled with the offset for mmap(2)
+ */
+struct io_sqring_offsets {
+	__u32	head;
+	__u32	tail;
+	__u32	ring_mask;
+	__u32	ring_entries;
+	__u32	flags;
+	__u32	dropped;
+	__u32	array;
+	__u32	resv1;
+	__u64	resv2;
+};
+
+/*
+ * sq_ring->flags
+ */
+#define IORING_SQ_NEED_WAKEUP	(1U << 0)	/* needs io_ring_enter wakeup */
+
+struct io_cqring_offsets {
+	__u32	head;
+	__u32	tail;
+	__u32	ring_mask;
+	__u32	ring_entries;
+	__u32	overflow;
+	__u32	cqes;
+	__u64	resv[2];
+};
+
+/*
+ * io_ring_enter(2) flags
+ */
+#define IORING_ENTER_GETEVENTS	(1U << 0)
+#define IORING_ENTER_SQ_WAKEUP	(1U << 1)
+
+/*
+ * Passed in for io_ring_setup(2). Copied back with updated info on success
+ */
+struct io_ring_params {
+	__u32	sq_entries;
+	__u32	cq_entries;
+	__u32	flags;
+	__u32	sq_thread_idle;		/* msecs, for IORING_SETUP_SQPOLL */
+	__u32	resv[4];
+	struct io_sqring_offsets sq_off;
+	struct io_cqring_offsets cq_off;
+};
+
+/*
+ * io_ring_register(2) opcodes and arguments
+ */
+#define IORING_REGISTER_BUFFERS		0	/* arg: struct iovec array */
+#define IORING_UNREGISTER_BUFFERS	1
+#define IORING_REGISTER_FILES		2	/* arg: __s32 fd array */
+#define IORING_UNREGISTER_FILES		3
+
+#endif /* _LINUX_IO_RING_H */
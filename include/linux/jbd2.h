@@ -757,6 +757,9 @@ jbd2_time_diff(unsigned long start, unsigned long end)
  * @j_wbufsize: maximum number of buffer_heads allowed in j_wbuf, the
  *	number that will fit in j_blocksize
  * @j_last_sync_writer: most recent pid which did a synchronous write
+ * @j_batch_waits: Number of times a syncer waited for others to join
+ * @j_sync_commits: Number of transaction completions waited for by syncers
+ * @j_sync_skipped: Number of syncers whose transaction had already committed
  * @j_history: Buffer storing the transactions statistics history
  * @j_history_max: Maximum number of transactions in the statistics history
  * @j_history_cur: Current number of transactions in the statistics history
@@ -981,6 +984,13 @@ struct journal_s
 	u32			j_min_batch_time;
 	u32			j_max_batch_time;
 
+	/*
+	 * Group commit statistics, exported in /proc/fs/jbd2 [j_state_lock]
+	 */
+	unsigned long		j_batch_waits;
+	unsigned long		j_sync_commits;
+	unsigned long		j_sync_skipped;
+
 	/* This function is called when a transaction is closed */
 	void			(*j_commit_callback)(journal_t *,
 						     transaction_t *);
@@ -1215,6 +1225,8 @@ int __jbd2_log_start_commit(journal_t *journal, tid_t tid);
 int jbd2_journal_start_commit(journal_t *journal, tid_t *tid);
 int jbd2_journal_force_commit_nested(journal_t *journal);
 int jbd2_log_wait_commit(journal_t *journal, tid_t tid);
+int jbd2_complete_transaction(journal_t *journal, tid_t tid);
+void jbd2_log_batch_wait(journal_t *journal, ktime_t start_time);
 int jbd2_log_do_checkpoint(journal_t *journal);
 
 void __jbd2_log_wait_for_space(journal_t *journal);
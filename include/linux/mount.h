@@ -65,6 +65,10 @@ struct vfsmount {
 	int mnt_expiry_mark;		/* true if marked for expiry */
 	int mnt_pinned;
 	int mnt_ghosts;
+#ifdef CONFIG_FSNOTIFY
+	__u32 mnt_fsnotify_mask;	/* all events marks on this mount care about */
+	struct list_head mnt_fsnotify_marks;	/* fsnotify marks on this mount */
+#endif
 	/*
 	 * This value is not stable unless all of the mnt_writers[] spinlocks
 	 * are held, and all mnt_writer[]s on this mount have 0 as their ->count
@@ -342,6 +342,9 @@ static inline int lock_page_killable(struct page *page)
 	return 0;
 }
 
+struct wait_bit_queue;
+extern int lock_page_async(struct page *page, struct wait_bit_queue *wait);
+
 /*
  * lock_page_nosync should only be used if we can't pin the page's inode.
  * Doesn't play quite so well with block device plugging.
@@ -253,7 +253,8 @@ struct mdp_superblock_1 {
 	__le64	resync_offset;	/* data before this offset (from data_offset) known to be in sync */
 	__le32	sb_csum;	/* checksum upto devs[max_dev] */
 	__le32	max_dev;	/* size of devs[] array to consider */
-	__u8	pad3[64-32];	/* set to 0 when writing */
+	__le32	journal_dev;	/* raid4/5/6 journal, only valid with feature bit '8' */
+	__u8	pad3[64-36];	/* set to 0 when writing */
 
 	/* device state information. Indexed by dev_number.
 	 * 2 bytes per device
@@ -270,8 +271,51 @@ struct mdp_superblock_1 {
 					   * must be honoured
 					   */
 #define	MD_FEATURE_RESHAPE_ACTIVE	4
+#define	MD_FEATURE_JOURNAL		8 /* journal_dev must be attached
+					   * before the array is used
+					   */
+
+#define	MD_FEATURE_ALL			(1|2|4|8)
+
+/*
+ * The raid4/5/6 journal.
+ *
+ * The journal device starts with a super block, followed by a ring of
+ * records.  A record is a meta block followed by one data block for
+ * every payload it describes.  All blocks are 'block_size' bytes, and
+ * all checksums are crc32 over a whole block with the checksum field
+ * set to 0, except for payloads which only cover their sectors.
+ */
+#define R5L_MAGIC	0x6433c509
+#define R5L_VERSION	1
+
+struct r5l_super_block {
+	__le32	magic;
+	__le32	checksum;
+	__le32	version;
+	__le32	block_size;
+	__u8	uuid[16];	/* of the array the journal belongs to */
+	__le64	log_start;	/* first sector of the ring */
+	__le64	log_end;	/* first sector after the ring */
+	__le64	checkpoint;	/* sector of the oldest record to replay */
+	__le64	seq;		/* sequence number of that record */
+};
 
-#define	MD_FEATURE_ALL			(1|2|4)
+struct r5l_payload {
+	__le64	location;	/* array sector the data belongs at */
+	__le32	sectors;	/* at the start of the data block */
+	__le32	checksum;
+};
+
+struct r5l_meta_block {
+	__le32	magic;
+	__le32	checksum;
+	__le64	seq;		/* one more than the previous record */
+	__le64	position;	/* sector of this block on the journal */
+	__le32	nr_payloads;
+	__le32	pad;
+	struct r5l_payload payloads[0];
+};
 
 #endif 
 
@@ -1352,6 +1352,8 @@ struct task_struct {
 	struct backing_dev_info *backing_dev_info;
 
 	struct io_context *io_context;
+/* aio retry wait entry, set while running a kiocb retry */
+	struct wait_bit_queue *io_wait;
 
 	unsigned long ptrace_message;
 	siginfo_t *last_siginfo; /* For ptrace use.  */
@@ -308,6 +308,8 @@ struct ucred {
 #define IPX_TYPE	1
 
 #ifdef __KERNEL__
+struct file;
+
 extern int memcpy_fromiovec(unsigned char *kdata, struct iovec *iov, int len);
 extern int memcpy_fromiovecend(unsigned char *kdata, struct iovec *iov, 
 				int offset, int len);
@@ -320,6 +322,9 @@ extern int verify_iovec(struct msghdr *m, struct iovec *iov, struct sockaddr *ad
 extern int memcpy_toiovec(struct iovec *v, unsigned char *kdata, int len);
 extern int move_addr_to_user(struct sockaddr *kaddr, int klen, void __user *uaddr, int __user *ulen);
 extern int move_addr_to_kernel(void __user *uaddr, int ulen, struct sockaddr *kaddr);
+extern int __sys_accept4_file(struct file *file, unsigned file_flags,
+			      struct sockaddr __user *upeer_sockaddr,
+			      int __user *upeer_addrlen, int flags);
 extern int put_cmsg(struct msghdr*, int level, int type, int len, void *data);
 
 #endif
@@ -12,6 +12,7 @@
 #define _LINUX_SYSCALLS_H
 
 struct epoll_event;
+struct io_ring_params;
 struct iattr;
 struct inode;
 struct iocb;
@@ -573,6 +574,18 @@ asmlinkage long sys_epoll_pwait(int epfd, struct epoll_event __user *events,
 				int maxevents, int timeout,
 				const sigset_t __user *sigmask,
 				size_t sigsetsize);
+asmlinkage long sys_epoll_wait_ring(int epfd, int maxevents, int timeout);
+asmlinkage long sys_io_ring_setup(u32 entries,
+				struct io_ring_params __user *p);
+asmlinkage long sys_io_ring_enter(unsigned int fd, u32 to_submit,
+				u32 min_complete, u32 flags);
+asmlinkage long sys_io_ring_register(unsigned int fd, unsigned int op,
+				void __user *arg, unsigned int nr_args);
+asmlinkage long sys_fanotify_init(unsigned int flags,
+				unsigned int event_f_flags);
+asmlinkage long sys_fanotify_mark(int fanotify_fd, unsigned int flags,
+				__u32 mask, int dfd,
+				const char __user *pathname);
 asmlinkage long sys_gethostname(char __user *name, int len);
 asmlinkage long sys_sethostname(char __user *name, int len);
 asmlinkage long sys_setdomainname(char __user *name, int len);
@@ -141,6 +141,7 @@ void get_dirty_limits(unsigned long *pbackground, unsigned long *pdirty,
 void page_writeback_init(void);
 void balance_dirty_pages_ratelimited_nr(struct address_space *mapping,
 					unsigned long nr_pages_dirtied);
+int balance_dirty_pages_ratelimited_async(struct address_space *mapping);
 
 static inline void
 balance_dirty_pages_ratelimited(struct address_space *mapping)
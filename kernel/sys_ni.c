@@ -62,6 +62,10 @@ cond_syscall(sys_epoll_ctl);
 cond_syscall(sys_epoll_wait);
 cond_syscall(sys_epoll_pwait);
 cond_syscall(compat_sys_epoll_pwait);
+cond_syscall(sys_epoll_wait_ring);
+cond_syscall(sys_io_ring_setup);
+cond_syscall(sys_io_ring_enter);
+cond_syscall(sys_io_ring_register);
 cond_syscall(sys_semget);
 cond_syscall(sys_semop);
 cond_syscall(sys_semtimedop);
@@ -100,6 +104,8 @@ cond_syscall(sys_inotify_init);
 cond_syscall(sys_inotify_init1);
 cond_syscall(sys_inotify_add_watch);
 cond_syscall(sys_inotify_rm_watch);
+cond_syscall(sys_fanotify_init);
+cond_syscall(sys_fanotify_mark);
 cond_syscall(sys_migrate_pages);
 cond_syscall(sys_move_pages);
 cond_syscall(sys_chown16);
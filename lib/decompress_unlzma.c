@@ -31,11 +31,21 @@
 
 #ifndef STATIC
 #include <linux/decompress/unlzma.h>
+#ifdef CONFIG_SQUASHFS_LZMA
+#define UNLZMA_RUNTIME
+#endif
 #endif /* STATIC */
 
 #include <linux/decompress/mm.h>
 #include <linux/slab.h>
 
+#ifdef UNLZMA_RUNTIME
+/* squashfs decompresses with it long after boot */
+#include <linux/module.h>
+#undef INIT
+#define INIT
+#endif
+
 #define	MIN(a, b) (((a) < (b)) ? (a) : (b))
 
 static long long INIT read_int(unsigned char *ptr, int size)
@@ -296,6 +306,11 @@ static inline uint8_t INIT peek_old_byte(struct writer *wr,
 {
 	if (!wr->flush) {
 		int32_t pos;
+		/* all the output is in the buffer, don't reach before it */
+		if (offs > wr->buffer_pos) {
+			error("distance beyond start of output");
+			return 0;
+		}
 		while (offs > wr->header->dict_size)
 			offs -= wr->header->dict_size;
 		pos = wr->buffer_pos - offs;
@@ -645,4 +660,8 @@ exit_0:
 	return ret;
 }
 
+#ifdef UNLZMA_RUNTIME
+EXPORT_SYMBOL(unlzma);
+#endif
+
 #define decompress unlzma
@@ -6,6 +6,7 @@
 #include <linux/sched.h>
 #include <linux/module.h>
 #include <linux/writeback.h>
+#include <linux/blkdev.h>
 #include <linux/device.h>
 
 void default_unplug_io_fn(struct backing_dev_info *bdi, struct page *page)
@@ -127,6 +128,30 @@ static ssize_t name##_show(struct device *dev,				\
 
 BDI_SHOW(read_ahead_kb, K(bdi->ra_pages))
 
+static ssize_t read_ahead_max_kb_store(struct device *dev,
+				      struct device_attribute *attr,
+				      const char *buf, size_t count)
+{
+	struct backing_dev_info *bdi = dev_get_drvdata(dev);
+	char *end;
+	unsigned long read_ahead_max_kb;
+	ssize_t ret = -EINVAL;
+
+	read_ahead_max_kb = simple_strtoul(buf, &end, 10);
+	if (*buf && (end[0] == '\0' || (end[0] == '\n' && end[1] == '\0'))) {
+		bdi->ra_max_pages = read_ahead_max_kb >> (PAGE_SHIFT - 10);
+		ret = count;
+	}
+	return ret;
+}
+BDI_SHOW(read_ahead_max_kb, K(bdi->ra_max_pages))
+
+BDI_SHOW(readahead_hits, bdi_stat_sum(bdi, BDI_RA_HIT))
+BDI_SHOW(readahead_misses, bdi_stat_sum(bdi, BDI_RA_MISS))
+BDI_SHOW(readahead_late, bdi_stat_sum(bdi, BDI_RA_LATE))
+BDI_SHOW(readahead_thrashed, bdi_stat_sum(bdi, BDI_RA_THRASH))
+BDI_SHOW(readahead_kb, K(bdi_stat_sum(bdi, BDI_RA_PAGES)))
+
 static ssize_t min_ratio_store(struct device *dev,
 		struct device_attribute *attr, const char *buf, size_t count)
 {
@@ -167,8 +192,14 @@ BDI_SHOW(max_ratio, bdi->max_ratio)
 
 static struct device_attribute bdi_dev_attrs[] = {
 	__ATTR_RW(read_ahead_kb),
+	__ATTR_RW(read_ahead_max_kb),
 	__ATTR_RW(min_ratio),
 	__ATTR_RW(max_ratio),
+	__ATTR_RO(readahead_hits),
+	__ATTR_RO(readahead_misses),
+	__ATTR_RO(readahead_late),
+	__ATTR_RO(readahead_thrashed),
+	__ATTR_RO(readahead_kb),
 	__ATTR_NULL,
 };
 
@@ -242,6 +273,7 @@ int bdi_init(struct backing_dev_info *bdi)
 
 	bdi->dev = NULL;
 
+	bdi->ra_max_pages = VM_MAX_ADAPTIVE_READAHEAD * 1024 / PAGE_CACHE_SIZE;
 	bdi->min_ratio = 0;
 	bdi->max_ratio = 100;
 	bdi->max_prop_frac = PROP_FRAC_BASE;
@@ -328,3 +360,47 @@ long congestion_wait(int rw, long timeout)
 }
 EXPORT_SYMBOL(congestion_wait);
 
+/**
+ * congestion_wait_async - queue an aio retry until a backing_dev uncongests
+ * @bdi: the backing_dev being written to
+ * @wait: the wait entry of the kiocb being retried
+ *
+ * The aio flavour of congestion_wait().  If @bdi is write congested, @wait
+ * is queued and -EIOCBRETRY returned; the iocb is kicked when a backing_dev
+ * exits write congestion.  Returns 0 if @bdi is not congested, there being
+ * nothing to wait for then.
+ */
+int congestion_wait_async(struct backing_dev_info *bdi,
+			  struct wait_bit_queue *wait)
+{
+	wait_queue_head_t *wqh = &congestion_wqh[BLK_RW_ASYNC];
+	unsigned long flags;
+
+	if (wait->key.flags)
+		return -EIOCBRETRY;
+	if (!bdi_write_congested(bdi))
+		return 0;
+
+	wait->key.flags = &bdi->state;
+	wait->key.bit_nr = BDI_async_congested;
+	spin_lock_irqsave(&wqh->lock, flags);
+	__add_wait_queue(wqh, &wait->wait);
+	spin_unlock_irqrestore(&wqh->lock, flags);
+
+	/* pairs with smp_mb__after_clear_bit() in clear_bdi_congested() */
+	smp_mb();
+	if (bdi_write_congested(bdi))
+		return -EIOCBRETRY;
+
+	spin_lock_irqsave(&wqh->lock, flags);
+	if (list_empty(&wait->wait.task_list)) {
+		spin_unlock_irqrestore(&wqh->lock, flags);
+		return -EIOCBRETRY;
+	}
+	list_del_init(&wait->wait.task_list);
+	spin_unlock_irqrestore(&wqh->lock, flags);
+	wait->key.flags = NULL;
+	return 0;
+}
+EXPORT_SYMBOL(congestion_wait_async);
+
@@ -649,6 +649,74 @@ int __lock_page_killable(struct page *page)
 }
 EXPORT_SYMBOL_GPL(__lock_page_killable);
 
+/*
+ * Queue an aio retry on @bit_nr of @page instead of sleeping on it.  Returns
+ * -EIOCBRETRY if @wait is queued (or was already queued by an earlier
+ * blocking point of this retry), 0 if the bit was found clear.
+ */
+static int __wait_on_page_bit_async(struct page *page, int bit_nr,
+				    struct wait_bit_queue *wait)
+{
+	wait_queue_head_t *wq = page_waitqueue(page);
+	struct address_space *mapping;
+	unsigned long flags;
+
+	if (wait->key.flags)
+		return -EIOCBRETRY;
+
+	wait->key.flags = &page->flags;
+	wait->key.bit_nr = bit_nr;
+	spin_lock_irqsave(&wq->lock, flags);
+	__add_wait_queue(wq, &wait->wait);
+	spin_unlock_irqrestore(&wq->lock, flags);
+
+	/* pairs with smp_mb__after_clear_bit() before wake_up_page() */
+	smp_mb();
+	if (test_bit(bit_nr, &page->flags)) {
+		/* unplug, as sync_page() would before sleeping */
+		mapping = page_mapping(page);
+		if (mapping && mapping->a_ops && mapping->a_ops->sync_page)
+			mapping->a_ops->sync_page(page);
+		return -EIOCBRETRY;
+	}
+
+	/* The bit went away before we were queued, unless we got kicked */
+	spin_lock_irqsave(&wq->lock, flags);
+	if (list_empty(&wait->wait.task_list)) {
+		spin_unlock_irqrestore(&wq->lock, flags);
+		return -EIOCBRETRY;
+	}
+	list_del_init(&wait->wait.task_list);
+	spin_unlock_irqrestore(&wq->lock, flags);
+	wait->key.flags = NULL;
+	return 0;
+}
+
+/**
+ * lock_page_async - lock a page, or queue an aio retry
+ * @page: the page to lock
+ * @wait: the wait entry of the kiocb being retried, or NULL
+ *
+ * Like lock_page_killable(), except that when @wait is given and the page
+ * is locked, @wait is queued on the page instead of sleeping and
+ * -EIOCBRETRY is returned.  The iocb is kicked once the page is unlocked.
+ */
+int lock_page_async(struct page *page, struct wait_bit_queue *wait)
+{
+	int ret;
+
+	if (!wait)
+		return lock_page_killable(page);
+
+	while (!trylock_page(page)) {
+		ret = __wait_on_page_bit_async(page, PG_locked, wait);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+EXPORT_SYMBOL(lock_page_async);
+
 /**
  * __lock_page_nosync - get a lock on the page, without calling sync_page()
  * @page: the page to lock
@@ -1141,7 +1209,7 @@ page_ok:
 
 page_not_up_to_date:
 		/* Get exclusive access to the page ... */
-		error = lock_page_killable(page);
+		error = lock_page_async(page, current->io_wait);
 		if (unlikely(error))
 			goto readpage_error;
 
@@ -1172,7 +1240,12 @@ readpage:
 		}
 
 		if (!PageUptodate(page)) {
-			error = lock_page_killable(page);
+			/*
+			 * Wait for the read to complete.  An aio retry gets
+			 * queued on the page instead, and finds it uptodate
+			 * in the page cache next time around.
+			 */
+			error = lock_page_async(page, current->io_wait);
 			if (unlikely(error))
 				goto readpage_error;
 			if (!PageUptodate(page)) {
@@ -1195,7 +1268,11 @@ readpage:
 		goto page_ok;
 
 readpage_error:
-		/* UHHUH! A synchronous read error occurred. Report it */
+		/*
+		 * UHHUH! A synchronous read error occurred. Report it.
+		 * -EIOCBRETRY ends up here too, what has been copied so
+		 * far is returned and the aio retry carries on from there.
+		 */
 		desc->error = error;
 		page_cache_release(page);
 		goto out;
@@ -2275,7 +2352,10 @@ again:
 		pos += copied;
 		written += copied;
 
-		balance_dirty_pages_ratelimited(mapping);
+		/* an aio writer stops here until writeback catches up */
+		status = balance_dirty_pages_ratelimited_async(mapping);
+		if (unlikely(status))
+			break;
 
 	} while (iov_iter_count(i));
 
@@ -489,7 +489,7 @@ get_dirty_limits(unsigned long *pbackground, unsigned long *pdirty,
  * If we're over `background_thresh' then pdflush is woken to perform some
  * writeout.
  */
-static void balance_dirty_pages(struct address_space *mapping)
+static int balance_dirty_pages(struct address_space *mapping, int async)
 {
 	long nr_reclaimable, bdi_nr_reclaimable;
 	long nr_writeback, bdi_nr_writeback;
@@ -498,6 +498,7 @@ static void balance_dirty_pages(struct address_space *mapping)
 	unsigned long bdi_thresh;
 	unsigned long pages_written = 0;
 	unsigned long write_chunk = sync_writeback_pages();
+	int ret = 0;
 
 	struct backing_dev_info *bdi = mapping->backing_dev_info;
 
@@ -571,6 +572,17 @@ static void balance_dirty_pages(struct address_space *mapping)
 		if (pages_written >= write_chunk)
 			break;		/* We've done our duty */
 
+		/*
+		 * An aio writer is not put to sleep while the queue is
+		 * congested: it gets kicked once the queue uncongests.  With
+		 * nothing to wait for it is throttled like everybody else.
+		 */
+		if (async && current->io_wait) {
+			ret = congestion_wait_async(bdi, current->io_wait);
+			if (ret)
+				break;
+		}
+
 		congestion_wait(WRITE, HZ/10);
 	}
 
@@ -579,7 +591,7 @@ static void balance_dirty_pages(struct address_space *mapping)
 		bdi->dirty_exceeded = 0;
 
 	if (writeback_in_progress(bdi))
-		return;		/* pdflush is already working this queue */
+		return ret;	/* pdflush is already working this queue */
 
 	/*
 	 * In laptop mode, we wait until hitting the higher threshold before
@@ -594,6 +606,7 @@ static void balance_dirty_pages(struct address_space *mapping)
 					  + global_page_state(NR_UNSTABLE_NFS)
 					  > background_thresh)))
 		pdflush_operation(background_writeout, 0);
+	return ret;
 }
 
 void set_page_dirty_balance(struct page *page, int page_mkwrite)
@@ -606,22 +619,9 @@ void set_page_dirty_balance(struct page *page, int page_mkwrite)
 	}
 }
 
-/**
- * balance_dirty_pages_ratelimited_nr - balance dirty memory state
- * @mapping: address_space which was dirtied
- * @nr_pages_dirtied: number of pages which the caller has just dirtied
- *
- * Processes which are dirtying memory should call in here once for each page
- * which was newly dirtied.  The function will periodically check the system's
- * dirty state and will initiate writeback if needed.
- *
- * On really big machines, get_writeback_state is expensive, so try to avoid
- * calling it too often (ratelimiting).  But once we're over the dirty memory
- * limit we decrease the ratelimiting by a lot, to prevent individual processes
- * from overshooting the limit by (ratelimit_pages) each.
- */
-void balance_dirty_pages_ratelimited_nr(struct address_space *mapping,
-					unsigned long nr_pages_dirtied)
+static int __balance_dirty_pages_ratelimited(struct address_space *mapping,
+					    unsigned long nr_pages_dirtied,
+					    int async)
 {
 	static DEFINE_PER_CPU(unsigned long, ratelimits) = 0;
 	unsigned long ratelimit;
@@ -641,13 +641,50 @@ void balance_dirty_pages_ratelimited_nr(struct address_space *mapping,
 	if (unlikely(*p >= ratelimit)) {
 		*p = 0;
 		preempt_enable();
-		balance_dirty_pages(mapping);
-		return;
+		return balance_dirty_pages(mapping, async);
 	}
 	preempt_enable();
+	return 0;
+}
+
+/**
+ * balance_dirty_pages_ratelimited_nr - balance dirty memory state
+ * @mapping: address_space which was dirtied
+ * @nr_pages_dirtied: number of pages which the caller has just dirtied
+ *
+ * Processes which are dirtying memory should call in here once for each page
+ * which was newly dirtied.  The function will periodically check the system's
+ * dirty state and will initiate writeback if needed.
+ *
+ * On really big machines, get_writeback_state is expensive, so try to avoid
+ * calling it too often (ratelimiting).  But once we're over the dirty memory
+ * limit we decrease the ratelimiting by a lot, to prevent individual processes
+ * from overshooting the limit by (ratelimit_pages) each.
+ */
+void balance_dirty_pages_ratelimited_nr(struct address_space *mapping,
+					unsigned long nr_pages_dirtied)
+{
+	__balance_dirty_pages_ratelimited(mapping, nr_pages_dirtied, 0);
 }
 EXPORT_SYMBOL(balance_dirty_pages_ratelimited_nr);
 
+/**
+ * balance_dirty_pages_ratelimited_async - balance dirty memory state for aio
+ * @mapping: address_space which was dirtied
+ *
+ * Like balance_dirty_pages_ratelimited(), but an aio writer is queued to be
+ * retried instead of sleeping while the backing device is congested.  The
+ * caller must stop and return -EIOCBRETRY when that happens.
+ *
+ * Returns -EIOCBRETRY when an aio writer has been queued to be retried
+ * once writeback catches up, 0 otherwise.
+ */
+int balance_dirty_pages_ratelimited_async(struct address_space *mapping)
+{
+	return __balance_dirty_pages_ratelimited(mapping, 1, 1);
+}
+EXPORT_SYMBOL(balance_dirty_pages_ratelimited_async);
+
 void throttle_vm_writeout(gfp_t gfp_mask)
 {
 	unsigned long background_thresh;
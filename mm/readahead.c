@@ -308,6 +308,87 @@ static unsigned long get_next_ra_size(struct file_ra_state *ra,
 	return min(newsize, max);
 }
 
+/*
+ * Count contiguously cached pages from @offset-1 to @offset-@max.  This is
+ * a conservative estimate of the length of a sequential stream which led
+ * up to @offset.
+ */
+static pgoff_t count_history_pages(struct address_space *mapping,
+				   pgoff_t offset, unsigned long max)
+{
+	pgoff_t head;
+
+	rcu_read_lock();
+	head = radix_tree_prev_hole(&mapping->page_tree, offset - 1, max);
+	rcu_read_unlock();
+
+	return offset - 1 - head;
+}
+
+/*
+ * Page cache context based readahead, for streams whose readahead state
+ * was overwritten by other streams interleaved in the same file.
+ */
+static int try_context_readahead(struct address_space *mapping,
+				 struct file_ra_state *ra, pgoff_t offset,
+				 unsigned long req_size, unsigned long max)
+{
+	pgoff_t size;
+
+	size = count_history_pages(mapping, offset, max);
+
+	/*
+	 * No history pages: it could be a random read.
+	 */
+	if (!size)
+		return 0;
+
+	/*
+	 * Starts from the beginning of the file: a strong indication of a
+	 * long running stream, or of a whole-file read.
+	 */
+	if (size >= offset)
+		size *= 2;
+
+	ra->start = offset;
+	ra->size = get_init_ra_size(size + req_size, max);
+	ra->async_size = ra->size;
+
+	return 1;
+}
+
+/*
+ * Adaptive readahead window.
+ *
+ * ra->ra_pages starts out as the bdi's read_ahead_kb and is then adjusted
+ * per stream, from what readahead observes:
+ *
+ * - The reader got to the PG_readahead marker while the I/O for it was still
+ *   in flight.  The window doesn't cover the device's latency at the rate
+ *   this stream is consumed, so double it, up to read_ahead_max_kb.  A
+ *   stream thus settles at about the device's throughput-latency product,
+ *   which on striped arrays is well above the static default.
+ *
+ * - A page of the current window was gone when the reader got to it.
+ *   Readahead pages are being evicted before use, typically because too
+ *   many streams compete for memory, so halve the window.
+ */
+static void ra_grow(struct file_ra_state *ra, struct backing_dev_info *bdi)
+{
+	unsigned long limit = max(bdi->ra_max_pages, bdi->ra_pages);
+
+	if (ra->ra_pages < limit)
+		ra->ra_pages = min(2UL * ra->ra_pages, limit);
+}
+
+static void ra_shrink(struct file_ra_state *ra)
+{
+	unsigned int floor = VM_MIN_READAHEAD * 1024 / PAGE_CACHE_SIZE;
+
+	if (ra->ra_pages > floor)
+		ra->ra_pages = max(ra->ra_pages / 2, floor);
+}
+
 /*
  * On-demand readahead design.
  *
@@ -336,7 +417,10 @@ static unsigned long get_next_ra_size(struct file_ra_state *ra,
  * It should be maintained by the caller, and will be used for detecting
  * small random reads. Note that the readahead algorithm checks loosely
  * for sequential patterns. Hence interleaved reads might be served as
- * sequential ones.
+ * sequential ones.  A read which looks random is checked against the
+ * page cache: if the pages right before it are cached, it most likely
+ * continues a stream interleaved with others, and gets readahead sized
+ * after the length of that history.
  *
  * There is a special-case: if the first page which the application tries to
  * read happens to be the first page of the file, it is assumed that a linear
@@ -376,10 +460,14 @@ ondemand_readahead(struct address_space *mapping,
 	sequential = offset - prev_offset <= 1UL || req_size > max;
 
 	/*
-	 * Standalone, small read.
-	 * Read as is, and do not pollute the readahead state.
+	 * Not sequential with the last read of this file.  Look for the
+	 * traces a sequential stream leading up to offset would have left
+	 * in the page cache, or else treat it as a standalone, small read:
+	 * read as is, and do not pollute the readahead state.
 	 */
 	if (!hit_readahead_marker && !sequential) {
+		if (try_context_readahead(mapping, ra, offset, req_size, max))
+			goto readit;
 		return __do_page_cache_readahead(mapping, filp,
 						offset, req_size, 0);
 	}
@@ -440,12 +528,24 @@ void page_cache_sync_readahead(struct address_space *mapping,
 			       struct file_ra_state *ra, struct file *filp,
 			       pgoff_t offset, unsigned long req_size)
 {
+	struct backing_dev_info *bdi = mapping->backing_dev_info;
+	unsigned long actual;
+
 	/* no read-ahead */
 	if (!ra->ra_pages)
 		return;
 
+	__inc_bdi_stat(bdi, BDI_RA_MISS);
+
+	/* the page was read ahead, and got evicted before it was used */
+	if (ra_has_index(ra, offset)) {
+		__inc_bdi_stat(bdi, BDI_RA_THRASH);
+		ra_shrink(ra);
+	}
+
 	/* do read-ahead */
-	ondemand_readahead(mapping, ra, filp, false, offset, req_size);
+	actual = ondemand_readahead(mapping, ra, filp, false, offset, req_size);
+	__add_bdi_stat(bdi, BDI_RA_PAGES, actual);
 }
 EXPORT_SYMBOL_GPL(page_cache_sync_readahead);
 
@@ -470,6 +570,9 @@ page_cache_async_readahead(struct address_space *mapping,
 			   struct page *page, pgoff_t offset,
 			   unsigned long req_size)
 {
+	struct backing_dev_info *bdi = mapping->backing_dev_info;
+	unsigned long actual;
+
 	/* no read-ahead */
 	if (!ra->ra_pages)
 		return;
@@ -482,13 +585,22 @@ page_cache_async_readahead(struct address_space *mapping,
 
 	ClearPageReadahead(page);
 
+	__inc_bdi_stat(bdi, BDI_RA_HIT);
+
+	/* the reader caught up with readahead I/O still in flight */
+	if (!PageUptodate(page)) {
+		__inc_bdi_stat(bdi, BDI_RA_LATE);
+		ra_grow(ra, bdi);
+	}
+
 	/*
 	 * Defer asynchronous read-ahead on IO congestion.
 	 */
-	if (bdi_read_congested(mapping->backing_dev_info))
+	if (bdi_read_congested(bdi))
 		return;
 
 	/* do read-ahead */
-	ondemand_readahead(mapping, ra, filp, true, offset, req_size);
+	actual = ondemand_readahead(mapping, ra, filp, true, offset, req_size);
+	__add_bdi_stat(bdi, BDI_RA_PAGES, actual);
 }
 EXPORT_SYMBOL_GPL(page_cache_async_readahead);
@@ -60,6 +60,7 @@ static struct vfsmount *shm_mnt;
 #include <linux/highmem.h>
 #include <linux/seq_file.h>
 #include <linux/magic.h>
+#include <linux/falloc.h>
 
 #include <asm/uaccess.h>
 #include <asm/div64.h>
@@ -768,6 +769,69 @@ static void shmem_truncate(struct inode *inode)
 	shmem_truncate_range(inode, inode->i_size, (loff_t)-1);
 }
 
+/*
+ * tmpfs allocates pages on demand, so fallocate only knows how to drop
+ * them: FALLOC_FL_PUNCH_HOLE, and FALLOC_FL_ZERO_RANGE which is a punched
+ * hole (reading back as zeroes) that may also extend the file.
+ */
+static long shmem_fallocate(struct inode *inode, int mode, loff_t offset,
+			    loff_t len)
+{
+	struct address_space *mapping = inode->i_mapping;
+	struct page *head = NULL, *tail = NULL;
+	loff_t end = offset + len;
+	loff_t hole_end;
+
+	if (!(mode & (FALLOC_FL_PUNCH_HOLE | FALLOC_FL_ZERO_RANGE)))
+		return -EOPNOTSUPP;
+
+	mutex_lock(&inode->i_mutex);
+	if (offset >= inode->i_size)
+		goto extend;
+	hole_end = min_t(loff_t, end, inode->i_size);
+
+	/*
+	 * Bring partially punched pages in from swap, as for truncation,
+	 * so truncate_partial_page() zeroes them; they are dirtied below
+	 * so that the zeroes make it back to swap.
+	 */
+	if (offset & (PAGE_CACHE_SIZE - 1)) {
+		(void) shmem_getpage(inode, offset >> PAGE_CACHE_SHIFT,
+						&head, SGP_READ, NULL);
+		if (head)
+			unlock_page(head);
+	}
+	if (hole_end & (PAGE_CACHE_SIZE - 1)) {
+		(void) shmem_getpage(inode, hole_end >> PAGE_CACHE_SHIFT,
+						&tail, SGP_READ, NULL);
+		if (tail)
+			unlock_page(tail);
+	}
+
+	down_write(&inode->i_alloc_sem);
+	unmap_mapping_range(mapping, offset, hole_end - offset, 1);
+	truncate_inode_pages_range(mapping, offset, hole_end - 1);
+	unmap_mapping_range(mapping, offset, hole_end - offset, 1);
+	shmem_truncate_range(inode, offset, hole_end - 1);
+	up_write(&inode->i_alloc_sem);
+
+	if (head) {
+		set_page_dirty(head);
+		page_cache_release(head);
+	}
+	if (tail) {
+		set_page_dirty(tail);
+		page_cache_release(tail);
+	}
+extend:
+	if ((mode & FALLOC_FL_ZERO_RANGE) && !(mode & FALLOC_FL_KEEP_SIZE) &&
+	    end > inode->i_size)
+		i_size_write(inode, end);
+	inode->i_ctime = inode->i_mtime = CURRENT_TIME;
+	mutex_unlock(&inode->i_mutex);
+	return 0;
+}
+
 static int shmem_notify_change(struct dentry *dentry, struct iattr *attr)
 {
 	struct inode *inode = dentry->d_inode;
@@ -2445,6 +2509,7 @@ static const struct inode_operations shmem_inode_operations = {
 	.truncate	= shmem_truncate,
 	.setattr	= shmem_notify_change,
 	.truncate_range	= shmem_truncate_range,
+	.fallocate	= shmem_fallocate,
 #ifdef CONFIG_TMPFS_POSIX_ACL
 	.setxattr	= generic_setxattr,
 	.getxattr	= generic_getxattr,
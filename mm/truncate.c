@@ -47,11 +47,16 @@ void do_invalidatepage(struct page *page, unsigned long offset)
 		(*invalidatepage)(page, offset);
 }
 
-static inline void truncate_partial_page(struct page *page, unsigned partial)
+/*
+ * Zero bytes [from, to) of a page straddling a truncation boundary.  The
+ * fs-private data can only be invalidated when the tail of the page goes.
+ */
+static inline void truncate_partial_page(struct page *page, unsigned from,
+					 unsigned to)
 {
-	zero_user_segment(page, partial, PAGE_CACHE_SIZE);
-	if (page_has_private(page))
-		do_invalidatepage(page, partial);
+	zero_user_segment(page, from, to);
+	if (to == PAGE_CACHE_SIZE && page_has_private(page))
+		do_invalidatepage(page, from);
 }
 
 /*
@@ -142,8 +147,12 @@ invalidate_complete_page(struct address_space *mapping, struct page *page)
  * @lend: offset to which to truncate
  *
  * Truncate the page cache, removing the pages that are between
- * specified offsets (and zeroing out partial page
- * (if lstart is not page aligned)).
+ * specified offsets (and zeroing out partial pages
+ * (if lstart or lend + 1 is not page aligned)).
+ *
+ * Pages only partially covered by the range stay in the page cache with
+ * the covered part zeroed; it is up to the filesystem to zero the blocks
+ * backing them on disk, as it does for the block at a new i_size.
  *
  * Truncate takes two passes - the first pass is nonblocking.  It will not
  * block on page locks and it will not block on writeback.  The second pass
@@ -162,8 +171,9 @@ void truncate_inode_pages_range(struct address_space *mapping,
 				loff_t lstart, loff_t lend)
 {
 	const pgoff_t start = (lstart + PAGE_CACHE_SIZE-1) >> PAGE_CACHE_SHIFT;
-	pgoff_t end;
+	pgoff_t end;		/* exclusive */
 	const unsigned partial = lstart & (PAGE_CACHE_SIZE - 1);
+	unsigned partial_end;
 	struct pagevec pvec;
 	pgoff_t next;
 	int i;
@@ -171,18 +181,21 @@ void truncate_inode_pages_range(struct address_space *mapping,
 	if (mapping->nrpages == 0)
 		return;
 
-	BUG_ON((lend & (PAGE_CACHE_SIZE - 1)) != (PAGE_CACHE_SIZE - 1));
-	end = (lend >> PAGE_CACHE_SHIFT);
+	partial_end = (lend + 1) & (PAGE_CACHE_SIZE - 1);
+	if (lend == -1)
+		end = -1;
+	else
+		end = (lend + 1) >> PAGE_CACHE_SHIFT;
 
 	pagevec_init(&pvec, 0);
 	next = start;
-	while (next <= end &&
+	while (next < end &&
 	       pagevec_lookup(&pvec, mapping, next, PAGEVEC_SIZE)) {
 		for (i = 0; i < pagevec_count(&pvec); i++) {
 			struct page *page = pvec.pages[i];
 			pgoff_t page_index = page->index;
 
-			if (page_index > end) {
+			if (page_index >= end) {
 				next = page_index;
 				break;
 			}
@@ -211,12 +224,32 @@ void truncate_inode_pages_range(struct address_space *mapping,
 	if (partial) {
 		struct page *page = find_lock_page(mapping, start - 1);
 		if (page) {
+			unsigned top = PAGE_CACHE_SIZE;
+
+			if (start > end) {
+				/* the range is inside this one page */
+				top = partial_end;
+				partial_end = 0;
+			}
 			wait_on_page_writeback(page);
-			truncate_partial_page(page, partial);
+			truncate_partial_page(page, partial, top);
 			unlock_page(page);
 			page_cache_release(page);
 		}
+		if (start > end)
+			return;
 	}
+	if (partial_end) {
+		struct page *page = find_lock_page(mapping, end);
+		if (page) {
+			wait_on_page_writeback(page);
+			truncate_partial_page(page, 0, partial_end);
+			unlock_page(page);
+			page_cache_release(page);
+		}
+	}
+	if (start >= end)
+		return;
 
 	next = start;
 	for ( ; ; ) {
@@ -227,14 +260,14 @@ void truncate_inode_pages_range(struct address_space *mapping,
 			next = start;
 			continue;
 		}
-		if (pvec.pages[0]->index > end) {
+		if (pvec.pages[0]->index >= end) {
 			pagevec_release(&pvec);
 			break;
 		}
 		for (i = 0; i < pagevec_count(&pvec); i++) {
 			struct page *page = pvec.pages[i];
 
-			if (page->index > end)
+			if (page->index >= end)
 				break;
 			lock_page(page);
 			wait_on_page_writeback(page);
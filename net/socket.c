@@ -1467,12 +1467,20 @@ SYSCALL_DEFINE2(listen, int, fd, int, backlog)
  *	clean when we restucture accept also.
  */
 
-SYSCALL_DEFINE4(accept4, int, fd, struct sockaddr __user *, upeer_sockaddr,
-		int __user *, upeer_addrlen, int, flags)
+/*
+ *	Accept on a listening socket the caller already holds a reference
+ *	on. @file_flags are or-ed to the socket file flags for this accept
+ *	only, so that an asynchronous caller can ask for O_NONBLOCK without
+ *	changing the flags of a file it shares with userspace.
+ */
+
+int __sys_accept4_file(struct file *file, unsigned file_flags,
+		       struct sockaddr __user *upeer_sockaddr,
+		       int __user *upeer_addrlen, int flags)
 {
 	struct socket *sock, *newsock;
 	struct file *newfile;
-	int err, len, newfd, fput_needed;
+	int err, len, newfd;
 	struct sockaddr_storage address;
 
 	if (flags & ~(SOCK_CLOEXEC | SOCK_NONBLOCK))
@@ -1481,13 +1489,13 @@ SYSCALL_DEFINE4(accept4, int, fd, struct sockaddr __user *, upeer_sockaddr,
 	if (SOCK_NONBLOCK != O_NONBLOCK && (flags & SOCK_NONBLOCK))
 		flags = (flags & ~SOCK_NONBLOCK) | O_NONBLOCK;
 
-	sock = sockfd_lookup_light(fd, &err, &fput_needed);
+	sock = sock_from_file(file, &err);
 	if (!sock)
 		goto out;
 
 	err = -ENFILE;
 	if (!(newsock = sock_alloc()))
-		goto out_put;
+		goto out;
 
 	newsock->type = sock->type;
 	newsock->ops = sock->ops;
@@ -1502,7 +1510,7 @@ SYSCALL_DEFINE4(accept4, int, fd, struct sockaddr __user *, upeer_sockaddr,
 	if (unlikely(newfd < 0)) {
 		err = newfd;
 		sock_release(newsock);
-		goto out_put;
+		goto out;
 	}
 
 	err = sock_attach_fd(newsock, newfile, flags & O_NONBLOCK);
@@ -1513,7 +1521,7 @@ SYSCALL_DEFINE4(accept4, int, fd, struct sockaddr __user *, upeer_sockaddr,
 	if (err)
 		goto out_fd;
 
-	err = sock->ops->accept(sock, newsock, sock->file->f_flags);
+	err = sock->ops->accept(sock, newsock, sock->file->f_flags | file_flags);
 	if (err < 0)
 		goto out_fd;
 
@@ -1534,19 +1542,33 @@ SYSCALL_DEFINE4(accept4, int, fd, struct sockaddr __user *, upeer_sockaddr,
 	fd_install(newfd, newfile);
 	err = newfd;
 
-out_put:
-	fput_light(sock->file, fput_needed);
 out:
 	return err;
 out_fd_simple:
 	sock_release(newsock);
 	put_filp(newfile);
 	put_unused_fd(newfd);
-	goto out_put;
+	goto out;
 out_fd:
 	fput(newfile);
 	put_unused_fd(newfd);
-	goto out_put;
+	goto out;
+}
+
+SYSCALL_DEFINE4(accept4, int, fd, struct sockaddr __user *, upeer_sockaddr,
+		int __user *, upeer_addrlen, int, flags)
+{
+	struct file *file;
+	int err, fput_needed;
+
+	err = -EBADF;
+	file = fget_light(fd, &fput_needed);
+	if (file) {
+		err = __sys_accept4_file(file, 0, upeer_sockaddr,
+					 upeer_addrlen, flags);
+		fput_light(file, fput_needed);
+	}
+	return err;
 }
 
 SYSCALL_DEFINE3(accept, int, fd, struct sockaddr __user *, upeer_sockaddr,